@@ -108,9 +108,10 @@
 #define VREFINTCAL_MIN	(1570) // Approximately 1.15V. Spec sheet minimum is 1.182V
 #define VREFINTCAL_MAX	(1734) // Approximately 1.27V. Spec sheet maximum is 1.232V
 #define ADC_FACTORY_CAL_VOLTAGE (3.0f) // Calibration is done at 3.0V
-#define ADC_VREG_STARTUP_DELAY  (1)  // Only needs 20us
+#define ADC_VREG_STARTUP_US     (20) // Regulator settling before calibration
 #define ADC_STARTUP_DELAY_MS    (50) // Wait this long for any startup spikes in analog values to die down
-#define ADC_NUM_INTEG_SAMPLES (128) // Number of samples to integrate when measuring at startup
+#define ADC_VREF_OVSR           (6)  // Vrefint is averaged in hardware over 128 samples at startup
+#define ADC_VREF_OVSS           (7)  // and shifted back down to 12 bits
 
 typedef struct _config_adc {
     float Shunt_Resistance;
@@ -138,6 +139,7 @@ typedef enum {
 
 void ADC_InjSeqComplete(void);
 void ADC_RegSeqComplete(void);
+void ADC_PowerUp(void);
 void ADC_Init(void);
 float ADC_GetCurrent(uint8_t which_cur);
 uint16_t ADC_Raw(uint8_t which_cur);
@@ -147,6 +149,7 @@ float ADC_GetVbus(void);
 float ADC_GetVref(void);
 void ADC_SetNull(uint8_t which_cur, uint16_t nullVal);
 float ADC_GetFetTempDegC(void);
+float ADC_GetMotorTempDegC(void);
 
 uint8_t ADC_SetRShunt(float new_rshunt);
 float ADC_GetRShunt(void);
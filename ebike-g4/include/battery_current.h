@@ -0,0 +1,65 @@
+/******************************************************************************
+ * Filename: battery_current.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _BATTERY_CURRENT_H_
+#define _BATTERY_CURRENT_H_
+
+#include "main_data_types.h"
+
+// Called every PWM cycle
+#define IBATT_SAMPLING_RATE         ((float)DFLT_FOC_PWM_FREQ)
+// Filtered value for display and the derating engine
+#define IBATT_FILT                  (50.0f) // Hz
+
+// Loss compensation
+// Dead time makes the real phase voltage smaller than commanded, in the
+// direction of the current. Fraction of the bus voltage lost:
+#define IBATT_DEADTIME_FRACTION     ((float)DFLT_FOC_PWM_DEADTIME * 1.0e-9f * (float)DFLT_FOC_PWM_FREQ)
+// Switching losses, battery amps per phase amp
+#define IBATT_SWITCHING_LOSS        (0.005f)
+// Controller supply current, with the motor idle
+#define IBATT_IDLE_CURRENT          (0.05f) // Amps
+
+// Below this much q-axis voltage (fraction of SVM output), the battery
+// current is too small to need a limit, and solving for Iq isn't stable.
+#define IBATT_MIN_TQ                (0.02f)
+
+typedef struct _ibatt_type {
+    float Raw; // Estimate from the latest PWM cycle (A)
+    float Filtered; // Low pass filtered estimate (A)
+    float FiltCoef; // Filter coefficient
+    float IqMax; // Most Iq allowed by the battery limits (A)
+    float IqMin; // Least Iq allowed by the battery limits (A)
+    uint8_t Limiting; // Non-zero when the last Iq request was clipped
+} IBatt_Type;
+
+void IBATT_Init(void);
+float IBATT_Estimate(float td, float tq, float id, float iq);
+float IBATT_LimitIq(Config_Main* cfg, float iq_ref, float td, float tq, float id, float iq);
+float IBATT_GetCurrent(void);
+float IBATT_GetFilteredCurrent(void);
+uint8_t IBATT_IsLimiting(void);
+
+#endif //_BATTERY_CURRENT_H_
@@ -0,0 +1,54 @@
+/******************************************************************************
+ * Filename: bldc.h
+ ******************************************************************************
+
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _BLDC_H_
+#define _BLDC_H_
+
+#include "main_data_types.h"
+
+#define BLDC_SECTOR_NONE            (0xFFu) // All phases floating
+#define BLDC_MAX_DUTY               (0.95f) // Leaves time for the bootstrap and current sampling
+
+typedef struct _bldc_type {
+    uint8_t Enabled; // Non-zero when six-step starts are requested
+    uint8_t Forced; // Non-zero while the outputs are in six-step states
+    uint8_t Sector; // Active voltage vector, 0-5 (30 + 60*n degrees)
+    uint32_t AboveSpeedCount; // PWM cycles spent above SpeedToFOC
+    float AngleError; // Between the six-step vector and the FOC vector, +/-1/12
+    uint32_t Handovers; // Six-step to FOC transitions
+    uint32_t Fallbacks; // FOC to six-step transitions
+} BLDC_Type;
+
+void BLDC_Init(void);
+uint8_t BLDC_Enable(void);
+uint8_t BLDC_Disable(void);
+uint8_t BLDC_IsEnabled(void);
+void BLDC_Commutate(uint8_t hall_state, Angle_Type angle, float vq, Motor_PWMDuties* pwm);
+void BLDC_Release(void);
+uint8_t BLDC_CheckHandover(Config_Main* cfg, float speed, uint8_t angle_valid);
+void BLDC_Fallback(void);
+
+#endif //_BLDC_H_
@@ -0,0 +1,46 @@
+/******************************************************************************
+ * Filename: boot_profile.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _BOOT_PROFILE_H_
+#define _BOOT_PROFILE_H_
+
+#include "main_data_types.h"
+
+// Init steps, in the order main() finishes them
+typedef enum {
+    Boot_Eeprom = 0, // EEPROM emulation started and settings loaded
+    Boot_Adc, // ADCs calibrated, Vref measured
+    Boot_Drv, // DRV8353 configured
+    Boot_Peripherals, // PWM, UART, USB, throttle, PAS, Hall sensors
+    Boot_Control, // Control modules and main loop tasks
+    Boot_Ready, // Watchdog started, main loop about to run
+    Boot_NumSteps
+} Boot_Step;
+
+void BOOT_Start(void);
+void BOOT_Mark(Boot_Step step);
+uint32_t BOOT_GetStatistic(uint16_t value_ID);
+
+#endif //_BOOT_PROFILE_H_
@@ -0,0 +1,91 @@
+/******************************************************************************
+ * Filename: cogging.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _COGGING_H_
+#define _COGGING_H_
+
+#include "main_data_types.h"
+
+// Table resolution, bins per electrical revolution
+#define COG_BINS                    (256)
+// Angle_Type bits below the bin index, 32 - log2(COG_BINS)
+#define COG_BIN_SHIFT               (24)
+// Largest compensation current that can be learned or stored (A)
+#define COG_MAX_CURRENT             (5.0f)
+
+// Learning window (electrical Hz). Below this the Hall edges are too far
+// apart to measure the ripple, above it the rotor inertia filters it out.
+#define COG_LEARN_MIN_SPEED         (3.0f)
+#define COG_LEARN_MAX_SPEED         (40.0f)
+// Iq offset change per unit of relative speed error, per Hall edge (A)
+#define COG_LEARN_GAIN              (0.5f)
+// Filter for the mean speed, per Hall edge. About 8 revolutions.
+#define COG_MEAN_SPEED_FILT         (0.02f)
+
+// Dedicated flash page for the table, just below the event log
+#define COG_PAGE_NUM                (121)
+#define COG_START_ADDRESS_DUAL      ((uint32_t)BANK2_START_ADDRESS + COG_PAGE_NUM*PAGE_SIZE_DUAL)
+#define COG_START_ADDRESS_SINGLE    ((uint32_t)FLASH_START_ADDRESS + COG_PAGE_NUM*PAGE_SIZE_SINGLE)
+#define COG_MAGIC                   (0x474F4343u) // "CCOG"
+// Same pacing as the event log, one double word per run
+#define COG_SAVE_PERIOD_US          (2000)
+
+// Saved table in flash. Entries are stored as signed bytes, scaled by
+// the largest entry. The CRC is written last.
+typedef struct _cog_flash {
+    uint32_t Magic;
+    float Scale; // Amps per LSB
+    int8_t Table[COG_BINS];
+    uint32_t Crc; // CRC32 of everything above
+    uint32_t Reserved; // Pads to a whole double word
+} Cog_Flash_Type;
+
+typedef struct _cog_type {
+    float Table[COG_BINS + 1]; // Iq offset (A). Last entry repeats the first, for interpolation.
+    uint8_t Enabled; // Offsets are added to the current command
+    uint8_t Learning; // Table adapts from the speed ripple
+    uint8_t PreviousState; // Hall state at the last edge
+    uint8_t Edges; // Edges in a row so far, up to two
+    Angle_Type EdgeAngle[2]; // Rotor angle at the last two edges, latest first
+    float SectorSpeed[2]; // Speed over the sectors before them (electrical Hz)
+    float MeanSpeed; // Filtered speed (electrical Hz)
+    uint32_t Updates; // Hall edges learned from since startup
+} Cog_Type;
+
+void COG_Init(void);
+void COG_Enable(void);
+void COG_Disable(void);
+uint8_t COG_IsEnabled(void);
+void COG_StartLearning(void);
+void COG_StopLearning(void);
+uint8_t COG_IsLearning(void);
+float COG_GetOffset(Angle_Type angle);
+void COG_Learn(Angle_Type angle, uint8_t hall_state, float speed, uint8_t direction, uint8_t angle_valid);
+void COG_Clear(void);
+uint8_t COG_Save(void);
+void COG_SaveTask(void);
+uint32_t COG_GetStatistic(uint16_t value_ID);
+
+#endif //_COGGING_H_
@@ -27,8 +27,8 @@
 #define _CORDIC_SIN_COS_H
 
 void CORDIC_Init(void);
-void CORDIC_CalcSinCos(float theta, float* sin, float* cos) ;
-void CORDIC_CalcSinCosDeferred(float theta);
+void CORDIC_CalcSinCos(Angle_Type theta, float* sin, float* cos) ;
+void CORDIC_CalcSinCosDeferred(Angle_Type theta);
 void CORDIC_GetResults(float* sin, float* cos);
 
 #endif
@@ -27,7 +27,16 @@
 #ifndef _CRC32_H_
 #define _CRC32_H_
 
+// The hardware CRC unit belongs to the packet interface, which uses it from
+// both the main loop and the motor interrupt. Anything else that needs a
+// CRC-32 (flash records, firmware images) uses the software version, which
+// gives the same result and can't be corrupted by an interrupt.
+#define CRC_SOFT_INIT       ((uint32_t)0xFFFFFFFFu)
+
 void CRC_Init(void);
-uint32_t CRC_Generate_CRC32(uint8_t *buf, uint16_t len);
+uint32_t CRC_Generate_CRC32(uint8_t *buf, uint32_t len);
+uint32_t CRC_Software_Update(uint32_t crc, const uint8_t* buf, uint32_t len);
+uint32_t CRC_Software_Finish(uint32_t crc, uint32_t total_len);
+uint32_t CRC_Software_CRC32(const uint8_t* buf, uint32_t len);
 
 #endif // _CRC32_H_
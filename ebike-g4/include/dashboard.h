@@ -0,0 +1,48 @@
+/******************************************************************************
+ * Filename: dashboard.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _DASHBOARD_H_
+#define _DASHBOARD_H_
+
+#include "main_data_types.h"
+
+#define DASH_FILT                   (0.1f) // Display low pass, about 1.7Hz at 100Hz
+
+typedef struct _dash_type {
+    // Phase current samples since the last update, from the speed loop
+    float SumSquares;
+    uint32_t Samples;
+    // Filtered values
+    float PhaseCurrent; // RMS (A)
+    float BatteryCurrent; // A
+    float BatteryVolts; // V
+} Dash_Type;
+
+void DASH_Init(void);
+void DASH_AddCurrentSample(float current);
+void DASH_Update(Config_Main* cfg, Main_Snapshot* snap, float battery_current, uint32_t faults);
+void DASH_GetData(uint8_t* data);
+
+#endif //_DASHBOARD_H_
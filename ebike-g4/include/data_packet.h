@@ -65,8 +65,8 @@ typedef struct _data_packet {
 #define DATA_PACKET_FAIL        (0)
 #define DATA_PACKET_SUCCESS     (1)
 
-#define PACKET_MAX_LENGTH       (256)
-#define PACKET_MAX_DATA_LENGTH  (64)
+#define PACKET_MAX_LENGTH       (512) // Event log download sends big packets
+#define PACKET_MAX_DATA_LENGTH  (4 + FWUP_CHUNK_BYTES) // Firmware update chunks are the biggest
 
 #define PACKET_OVERHEAD_BYTES       (10)
 #define PACKET_CRC_BYTES            (4)
@@ -88,6 +88,10 @@ typedef struct _data_packet {
 #define HOST_ACK                (0x11)
 #define HOST_NACK               (0x12)
 #define REQUEST_DASHBOARD_DATA  (0x27)
+#define REQUEST_EVENT_LOG       (0x28)
+#define REQUEST_TRACE           (0x29)
+#define REQUEST_LOG             (0x2A)
+#define FIRMWARE_CHUNK          (0x2B)
 // Packet type defines, Controller to Host
 #define GET_RAM_RESULT          (0x81)
 #define GET_EEPROM_RESULT       (0x83)
@@ -96,6 +100,9 @@ typedef struct _data_packet {
 #define CONTROLLER_ACK          (0x91)
 #define CONTROLLER_NACK         (0x92)
 #define DASHBOARD_DATA_RESULT   (0xA7)
+#define EVENT_LOG_RESULT        (0xA8)
+#define TRACE_RESULT            (0xA9)
+#define LOG_RESULT              (0xAA)
 
 // Fault codes
 #define NO_FAULT                (0x00)
@@ -0,0 +1,91 @@
+/******************************************************************************
+ * Filename: debug_trace.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _DEBUG_TRACE_H_
+#define _DEBUG_TRACE_H_
+
+#include "main_data_types.h"
+
+// The trace rings are compiled into debug builds only. Define DTRACE_ENABLE
+// as 0 or 1 to override that. With it off, DTRACE_RECORD() is empty, so a
+// release build has no trace code, RAM, or interrupt time at all.
+#if !defined(DTRACE_ENABLE)
+#if defined(DEBUG)
+#define DTRACE_ENABLE               (1)
+#else
+#define DTRACE_ENABLE               (0)
+#endif
+#endif
+
+// Channels, one ring each. A channel must only be written from one
+// interrupt priority, the rings have no locking.
+#define DTRACE_CH_HALL              (0) // Hall timer interrupt
+#define DTRACE_CH_CONTROL           (1) // Motor interrupt
+#define DTRACE_NUM_CHANNELS         (2)
+#define DTRACE_DFLT_MASK            ((1u << DTRACE_NUM_CHANNELS) - 1u)
+
+// Events on the Hall channel
+#define DTRACE_HALL_EDGE            (1) // Arg16 is the capture value, Arg32 is the state + (direction << 8)
+#define DTRACE_HALL_STOPPED         (2) // Arg16 is the overflow count
+// Events on the control channel
+#define DTRACE_CTRL_TO_FOC          (1) // Arg16 is the Hall state, Arg32 is the PWM cycle count
+#define DTRACE_CTRL_TO_BLDC         (2) // Same as above
+
+// Records kept per channel, a power of two
+#define DTRACE_RING_RECORDS         (64)
+
+// Bulk download, same layout as the event log. Each response holds the
+// next index and end index, then as many records as fit in one packet.
+#define DTRACE_DOWNLOAD_HEADER_BYTES (8)
+#define DTRACE_DOWNLOAD_RECORD_BYTES (12)
+#define DTRACE_RECORDS_PER_PACKET   ((PACKET_MAX_LENGTH - PACKET_OVERHEAD_BYTES - DTRACE_DOWNLOAD_HEADER_BYTES) \
+                                    / DTRACE_DOWNLOAD_RECORD_BYTES)
+#define DTRACE_DOWNLOAD_BYTES       (DTRACE_DOWNLOAD_HEADER_BYTES + DTRACE_RECORDS_PER_PACKET*DTRACE_DOWNLOAD_RECORD_BYTES)
+
+typedef struct _dtrace_record {
+    uint32_t Cycles; // DWT cycle counter
+    uint8_t Channel;
+    uint8_t Event; // DTRACE_xxx event of the channel
+    uint16_t Arg16; // Depends on the event
+    uint32_t Arg32;
+} DTrace_Record_Type;
+
+#if DTRACE_ENABLE
+extern volatile uint32_t DTrace_Mask;
+#define DTRACE_RECORD(ch, event, arg16, arg32) do { \
+        if((DTrace_Mask & (1u << (ch))) != 0) { \
+            DTRACE_Write((ch), (event), (arg16), (arg32)); \
+        } \
+    } while(0)
+#else
+#define DTRACE_RECORD(ch, event, arg16, arg32) do { } while(0)
+#endif
+
+void DTRACE_Write(uint8_t channel, uint8_t event, uint16_t arg16, uint32_t arg32);
+uint16_t DTRACE_Download(uint8_t channel, uint32_t index, uint8_t* data);
+uint8_t DTRACE_SetMask(uint32_t mask);
+uint32_t DTRACE_GetMask(void);
+
+#endif //_DEBUG_TRACE_H_
@@ -0,0 +1,77 @@
+/******************************************************************************
+ * Filename: deferred_log.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _DEFERRED_LOG_H_
+#define _DEFERRED_LOG_H_
+
+#include "main_data_types.h"
+
+// Ring of 32-bit words, a power of two
+#define DLOG_RING_WORDS             (512)
+#define DLOG_MAX_ARGS               (4)
+
+// Each record is a header word, the DWT cycle count, then the arguments.
+// Header bits 31:8 are the string ID, its offset in the .dlog_fmt section
+// of the ELF file. Bit 7 is always set. Bits 3:0 are the number of
+// arguments.
+#define DLOG_HEADER_VALID           (0x80u)
+#define DLOG_HEADER_NARGS_MASK      (0x0Fu)
+#define DLOG_HEADER_ID_SHIFT        (8)
+
+// Download packets start with the number of records dropped since the
+// last download, then as many whole records as fit
+#define DLOG_DOWNLOAD_HEADER_BYTES  (4)
+#define DLOG_DOWNLOAD_WORDS         ((PACKET_MAX_LENGTH - PACKET_OVERHEAD_BYTES - DLOG_DOWNLOAD_HEADER_BYTES) / 4)
+#define DLOG_DOWNLOAD_BYTES         (DLOG_DOWNLOAD_HEADER_BYTES + DLOG_DOWNLOAD_WORDS*4)
+
+// The format string never leaves the ELF file, the host formats the
+// message. Arguments are sent as raw 32-bit words: integers as they are,
+// floats through DLOG_Float() so the host gets the bits of a 32-bit float
+// for each %f. Up to DLOG_MAX_ARGS arguments, and strings (%s) can't be
+// sent. Safe from any interrupt.
+#define DLOG(fmt, ...) do { \
+        static const char dlog_fmt[] __attribute__((section(".dlog_fmt"), used)) = fmt; \
+        const uint32_t dlog_args[] = { 0, ##__VA_ARGS__ }; \
+        _Static_assert(DLOG_NARGS(__VA_ARGS__) <= DLOG_MAX_ARGS, "Too many arguments to DLOG"); \
+        DLOG_Write((uint32_t)dlog_fmt, &(dlog_args[1]), DLOG_NARGS(__VA_ARGS__)); \
+    } while(0)
+
+// Counts past DLOG_MAX_ARGS, so too many is caught when it compiles
+#define DLOG_NARGS(...)             DLOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) (n)
+
+static inline uint32_t DLOG_Float(float value) {
+    union {
+        float f;
+        uint32_t u;
+    } bits;
+    bits.f = value;
+    return bits.u;
+}
+
+void DLOG_Write(uint32_t id, const uint32_t* args, uint8_t nargs);
+uint16_t DLOG_Download(uint8_t* data);
+
+#endif //_DEFERRED_LOG_H_
@@ -0,0 +1,57 @@
+/******************************************************************************
+ * Filename: derating.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _DERATING_H_
+#define _DERATING_H_
+
+#include "main_data_types.h"
+
+// Called from the speed loop
+#define DERATE_SAMPLING_RATE        ((float)DFLT_FOC_PWM_FREQ / (float)SCHED_SPEED_DIVIDER)
+// The scale can drop instantly, but only recovers at this rate (full scale per second)
+#define DERATE_RECOVERY_RATE        (0.5f) // 0->100% in 2 seconds
+// Bus voltage filter, to keep the limit from chasing PWM ripple
+#define DERATE_VBUS_FILT            (20.0f) // Hz
+#define DERATE_VBUS_FILT_Q          (0.707f)
+// Temperature filter, to keep ADC noise from tripping the hard caps
+#define DERATE_TEMP_FILT            (5.0f) // Hz
+#define DERATE_TEMP_FILT_Q          (0.707f)
+// Channels of the derating filter bank
+#define DERATE_FILT_VBUS            (0)
+#define DERATE_FILT_FET_TEMP        (1)
+#define DERATE_FILT_MOTOR_TEMP      (2)
+#define DERATE_FILT_CHANNELS        (3)
+// Battery current is held by the fast limiter in the current loop. This is a
+// backup for when it can't, with no current allowed this far over the limit.
+#define DERATE_BATT_OVERSHOOT       (1.25f)
+
+void DERATE_Init(void);
+float DERATE_Process(Config_Main* cfg, float vbus, float fet_temp,
+        float motor_temp, float phase_current, float batt_current);
+float DERATE_GetScale(void);
+float DERATE_GetRegenScale(void);
+Main_Limit_Type DERATE_GetReason(void);
+
+#endif //_DERATING_H_
@@ -40,8 +40,38 @@
 
 // Sit and spin in a loop waiting for SPI completion
 // If it takes longer than about 3us, quit
+// Only during initialization, after that transfers run from the interrupt
 #define SPI_MAX_WAIT_CYCLES     500
 
+// SPI job queue
+#define DRV_MAX_JOBS            (16)
+#define DRV_NUM_REGS            (8)
+#define DRV_CS_HIGH_NS          (400) // Minimum chip select high time between frames
+#define DRV_WAKE_DELAY_MS       (5) // From enable high to the first frame
+#define DRV_WRITE_RETRIES       (2) // Times to try a write again if the read back doesn't match
+// Background poll of the fault status registers
+#define DRV_POLL_PERIOD_US      (10000)
+#define DRV_POLL_CTRL_DIVIDER   (10) // Control register is checked every 10th poll
+
+// Job types
+#define DRV_JOB_READ            (0) // Read into the shadow
+#define DRV_JOB_WRITE           (1) // Write, always followed by a verify
+#define DRV_JOB_VERIFY          (2) // Read back and compare with what was written
+
+typedef struct _drv_job {
+    uint16_t Frame; // SPI frame to send
+    uint16_t Expect; // For verify jobs, the value that was written
+    uint8_t Type; // DRV_JOB_xxx
+    uint8_t Retries; // Times this write has been tried again
+} DRV_Job_Type;
+
+typedef struct _drv_status {
+    uint32_t Transfers; // Completed SPI frames
+    uint32_t VerifyFailures; // Writes that didn't read back correctly
+    uint32_t QueueFull; // Jobs turned away because the queue was full
+    uint32_t Polls; // Fault register polls
+} DRV_Status_Type;
+
 // Settings for shunt amplifier gain
 typedef enum _DRV_Gain {
     DRV_Gain_5 = 0,
@@ -198,10 +228,13 @@ typedef enum _DRV_VDS_Limit {
 
 #define DRVBIT_CAL_MODE         0x001 // set to use internal auto-calibration routine
 
+void DRV8353_PowerUp(void);
 void DRV8353_Init(void);
-uint16_t DRV8353_Transaction(uint16_t DataOut);
-uint16_t DRV8353_Read(uint8_t reg_addr);
-uint16_t DRV8353_Write(uint8_t reg_addr, uint16_t reg_value);
+uint16_t DRV8353_GetRegister(uint8_t reg_addr);
+uint8_t DRV8353_QueueRead(uint8_t reg_addr);
+uint8_t DRV8353_QueueWrite(uint8_t reg_addr, uint16_t reg_value);
+void DRV8353_Poll(void);
+void DRV8353_IRQ(void);
 uint8_t DRV8353_SetGain(DRV_Gain gain);
 DRV_Gain DRV8353_GetGain(void);
 uint8_t DRV8353_SetVDSLimit(DRV_VDS_Limit lmt);
@@ -54,6 +54,10 @@ typedef enum {
 #define BANK1_START_ADDRESS     (uint32_t)0x08000000 // same as start of Flash
 #define BANK2_START_ADDRESS     (uint32_t)0x08040000 // 256K past the start
 
+// Unlock sequence for FLASH->CR
+#define FLASH_KEY1               ((uint32_t)0x45670123)
+#define FLASH_KEY2               ((uint32_t)0xCDEF89AB)
+
 #define PAGE0_PAGE_NUM          126 // Second-to-last page
 #define PAGE1_PAGE_NUM          127 // Last page
 
@@ -110,6 +114,11 @@ int16_t EE_ReadInt16WithDefault(uint16_t VirtAddress, int16_t defalt);
 int32_t EE_ReadInt32WithDefault(uint16_t VirtAddress, int32_t defalt);
 float EE_ReadFloatWithDefault(uint16_t VirtAddress, float defalt);
 
+// Low level Flash access, also used by the event log
+FLASH_Status FLASH_ProgramDoubleWord(uint32_t Address, uint32_t Data1, uint32_t Data2);
+FLASH_Status FLASH_StartErasePage(uint32_t FLASH_Page, uint8_t FLASH_Bank);
+FLASH_Status FLASH_FinishErase(void);
+
 #endif /* EEPROM_EMULATION_H_ */
 
 /******************* (C) COPYRIGHT 2011 STMicroelectronics *****END OF FILE****/
@@ -0,0 +1,96 @@
+/******************************************************************************
+ * Filename: event_log.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _EVENT_LOG_H_
+#define _EVENT_LOG_H_
+
+#include "main_data_types.h"
+
+// Event types
+#define ELOG_EVENT_RESET            (1) // Code is the reset flags (RCC->CSR bits 31:25)
+#define ELOG_EVENT_FAULT            (2) // Code is the newly tripped FAULT_xxx bits
+#define ELOG_EVENT_FAULT_CLEAR      (3) // Code is the faults that were latched
+#define ELOG_EVENT_LOG_CLEARED      (4)
+#define ELOG_EVENT_DRV_FAULT        (5) // Code is the DRV8353 fault status 1 register
+#define ELOG_EVENT_WATCHDOG         (6) // Code is what held back the watchdog before the reset (WDT_MISS_xxx)
+#define ELOG_EVENT_FW_UPDATE        (7) // Code is how a firmware update ended (FWUP_RESULT_xxx)
+#define ELOG_EVENT_TASKS_LOST       (8) // Code is how many main loop tasks didn't fit in the task table
+
+// Dedicated flash pages for the log, just below the EEPROM emulation pages.
+// In dual bank mode they are in bank 2, so programming and erasing never
+// stall the code running from bank 1.
+#define ELOG_FIRST_PAGE_NUM         (122)
+#define ELOG_NUM_PAGES              (4)
+#define ELOG_START_ADDRESS_DUAL     ((uint32_t)BANK2_START_ADDRESS + ELOG_FIRST_PAGE_NUM*PAGE_SIZE_DUAL)
+#define ELOG_START_ADDRESS_SINGLE   ((uint32_t)FLASH_START_ADDRESS + ELOG_FIRST_PAGE_NUM*PAGE_SIZE_SINGLE)
+
+// Records waiting in RAM to be written to flash
+#define ELOG_RAM_RECORDS            (16)
+// The drain task writes one double word per run, so it never holds up
+// the main loop for more than one flash program time (about 85us)
+#define ELOG_DRAIN_PERIOD_US        (2000)
+#define ELOG_RECORD_DOUBLE_WORDS    (sizeof(ELog_Record_Type) / 8)
+#define ELOG_ERASED                 (0xFFFFFFFFu)
+
+// Bulk download. Each response holds the next index and end index, then
+// as many records as fit in one packet.
+#define ELOG_DOWNLOAD_HEADER_BYTES  (8)
+#define ELOG_DOWNLOAD_RECORD_BYTES  (28) // Everything but the CRC
+#define ELOG_RECORDS_PER_PACKET     ((PACKET_MAX_LENGTH - PACKET_OVERHEAD_BYTES - ELOG_DOWNLOAD_HEADER_BYTES) \
+                                    / ELOG_DOWNLOAD_RECORD_BYTES)
+#define ELOG_DOWNLOAD_BYTES         (ELOG_DOWNLOAD_HEADER_BYTES + ELOG_RECORDS_PER_PACKET*ELOG_DOWNLOAD_RECORD_BYTES)
+
+// One log record, four double words in flash. The CRC is written last,
+// so a record cut short by a power loss is never mistaken for a good one.
+typedef struct _elog_record {
+    uint32_t Sequence; // Increases by one every record, never reused
+    uint32_t Timestamp; // PWM cycle count
+    uint32_t Code; // Depends on the event type
+    uint16_t DrvFault1; // DRV8353 fault status registers, for fault events
+    uint16_t DrvFault2;
+    float Vbus; // Bus voltage (V)
+    float Current; // Magnitude of the phase current vector (A)
+    int16_t Speed; // Rotor speed (electrical Hz)
+    uint8_t Type; // ELOG_EVENT_xxx
+    int8_t FetTemp; // degC
+    uint32_t Crc; // CRC32 of everything above
+} ELog_Record_Type;
+
+typedef struct _elog_stats {
+    uint32_t Written; // Records written to flash since startup
+    uint32_t Dropped; // Records lost because the RAM buffer was full
+    uint32_t FlashErrors; // Failed program or erase operations
+    uint32_t Sequence; // Sequence number of the newest record
+} ELog_Stats_Type;
+
+void ELOG_Init(void);
+void ELOG_UpdateSignals(uint32_t timestamp, float vbus, float current, float speed_eHz, float fet_temp);
+void ELOG_Record(uint8_t type, uint32_t code);
+void ELOG_Drain(void);
+uint8_t ELOG_Clear(void);
+uint16_t ELOG_Download(uint32_t index, uint8_t* data);
+uint32_t ELOG_GetStatistic(uint16_t value_ID);
+
+#endif //_EVENT_LOG_H_
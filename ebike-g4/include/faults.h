@@ -0,0 +1,58 @@
+/******************************************************************************
+ * Filename: faults.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _FAULTS_H_
+#define _FAULTS_H_
+
+#include "main_data_types.h"
+
+// Fault codes. Bitmapped, more than one can be latched at a time.
+#define FAULT_OVERCURRENT           (0x00000001u) // Any phase above CurrentFault
+#define FAULT_OVERVOLTAGE           (0x00000002u) // Bus above MaxVoltFault
+#define FAULT_UNDERVOLTAGE          (0x00000004u) // Bus below MinVoltFault. Not latched.
+#define FAULT_FET_OVERTEMP          (0x00000008u) // FETs well past their hard cap
+#define FAULT_MOTOR_OVERTEMP        (0x00000010u) // Motor well past its hard cap
+#define FAULT_HW_BREAK              (0x00000020u) // Gate driver pulled the TIM1 break input
+
+// Derating brings the current to zero at the hard temperature caps.
+// Still getting hotter past this point means something is wrong.
+#define FAULT_OVERTEMP_MARGIN       (10.0f) // degC
+
+typedef struct _fault_type {
+    uint32_t Active; // Latched faults
+    uint32_t First; // The fault(s) that tripped first since the last clear
+    uint32_t Count; // Number of times a fault has tripped
+    uint32_t Timestamp; // PWM cycle count when the first fault tripped
+} Fault_Type;
+
+void FAULT_Init(void);
+uint32_t FAULT_Check(Config_Main* cfg, Motor_Observations* obv, float vbus, uint32_t timestamp);
+void FAULT_Set(uint32_t faults);
+uint8_t FAULT_Clear(void);
+uint8_t FAULT_MotorON(void);
+uint32_t FAULT_GetActive(void);
+uint32_t FAULT_GetStatistic(uint16_t value_ID);
+
+#endif //_FAULTS_H_
@@ -43,6 +43,22 @@
 #define INV_SQRT3           0.57735026918963f
 #endif
 
+// Angles are unsigned 32 bit phase accumulators, one full electrical
+// revolution is 2^32. Wraparound is free with integer overflow, and the
+// same bits reinterpreted as signed are the Q31 angle the CORDIC expects.
+typedef uint32_t Angle_Type;
+
+#define ANGLE_SCALE                 (4294967296.0f)
+// Angle in [0,1) of a revolution to Angle_Type. One or more overflows the
+// conversion, which is undefined, so wrap angles from outside first.
+#define ANGLE_FROM_FLOAT(x)         ((Angle_Type)((x) * ANGLE_SCALE))
+// Signed difference in (-0.5,0.5) of a revolution to Angle_Type
+#define ANGLE_DELTA_FROM_FLOAT(x)   ((Angle_Type)(int32_t)((x) * ANGLE_SCALE))
+// Angle_Type to [0,1) of a revolution
+#define ANGLE_TO_FLOAT(a)           ((float)(a) * (1.0f / ANGLE_SCALE))
+// Angle_Type difference to [-0.5,0.5) of a revolution
+#define ANGLE_DELTA_TO_FLOAT(a)     ((float)(int32_t)(a) * (1.0f / ANGLE_SCALE))
+
 typedef struct _PID_Type {
     float Err; // Input: Error term (Reference - feedback)
     float Ui;  // Output: Integral output
@@ -69,6 +85,30 @@ typedef struct _Biquad_Type {
     float Y;  // Output: filtered result
 } Biquad_Type;
 
+typedef enum _Biquad_Shape {
+    Biquad_LowPass,
+    Biquad_HighPass,
+    Biquad_Notch,
+    Biquad_BandPass // 0dB gain at the center frequency
+} Biquad_Shape;
+
+#define BIQUAD_BANK_MAX_CHANNELS    (8)
+
+// Several biquads run by one call. Structure of arrays, each term is
+// contiguous across channels so the loop streams through memory.
+typedef struct _Biquad_Bank_Type {
+    uint8_t Channels; // Param: Number of channels in use
+    float A1[BIQUAD_BANK_MAX_CHANNELS]; // Param: A1 gain (output at one delay)
+    float A2[BIQUAD_BANK_MAX_CHANNELS]; // Param: A2 gain (output at two delays)
+    float B0[BIQUAD_BANK_MAX_CHANNELS]; // Param: B0 gain (input, no delay)
+    float B1[BIQUAD_BANK_MAX_CHANNELS]; // Param: B1 gain (input, one delay)
+    float B2[BIQUAD_BANK_MAX_CHANNELS]; // Param: B2 gain (input, two delays)
+    float U1[BIQUAD_BANK_MAX_CHANNELS]; // State: First delay register
+    float U2[BIQUAD_BANK_MAX_CHANNELS]; // State: Second delay register
+    float X[BIQUAD_BANK_MAX_CHANNELS];  // Input: variables to be filtered
+    float Y[BIQUAD_BANK_MAX_CHANNELS];  // Output: filtered results
+} Biquad_Bank_Type;
+
 void FOC_SVM(float alpha, float beta, float* tA, float* tB, float* tC);
 
 void FOC_Ipark(float D, float Q, float sin, float cos, float* alpha, float* beta);
@@ -76,14 +116,21 @@ void FOC_Clarke(float A, float B, float* Alpha, float* Beta);
 void FOC_Park(float alpha, float beta, float sin, float cos, float* D, float* Q);
 
 void FOC_BiquadCalc(Biquad_Type* biq);
+void FOC_BiquadDesign(Biquad_Type* biq, Biquad_Shape shape, float Fs, float f0, float Q);
 void FOC_BiquadLPF(Biquad_Type* biq, float Fs, float f0, float Q);
+void FOC_BiquadBankInit(Biquad_Bank_Type* bank, uint8_t channels);
+void FOC_BiquadBankDesign(Biquad_Bank_Type* bank, uint8_t ch, Biquad_Shape shape,
+        float Fs, float f0, float Q);
+void FOC_BiquadBankPrime(Biquad_Bank_Type* bank, uint8_t ch, float x);
+void FOC_BiquadBankCalc(Biquad_Bank_Type* bank);
 
+void FOC_PIsynth(PID_Type* pid, float r, float l, float full_scale, float fs, float bandwidth);
 void FOC_PIDdefaults(PID_Type* pid);
 void FOC_PIDreset(PID_Type* pid);
 void FOC_PIDcalc(PID_Type* pid);
 void FOC_PIcalc(PID_Type* pid);
 
-void FOC_RampGen(float* rampAngle, float rampInc);
-float FOC_RampCtrl(float callingFreq, float rampFreq);
+void FOC_RampGen(Angle_Type* rampAngle, Angle_Type rampInc);
+Angle_Type FOC_RampCtrl(float callingFreq, float rampFreq);
 
 #endif
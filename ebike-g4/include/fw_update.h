@@ -0,0 +1,102 @@
+/******************************************************************************
+ * Filename: fw_update.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _FW_UPDATE_H_
+#define _FW_UPDATE_H_
+
+#include "main_data_types.h"
+
+// Flash layout for in-application updates. The boot stage has the first
+// sector to itself, so an interrupted swap always has something to start.
+// The running image and the staging slot are the same size and are swapped
+// a sector at a time. Staging starts at bank 2, so with dual bank on it can
+// be written while the motor runs. The top 28K is still the cogging table,
+// event log, and EEPROM emulation, see mem.ld.
+#define FWUP_SECTOR_SIZE        ((uint32_t)0x1000) // One single bank page, or two dual bank pages
+#define FWUP_SLOT_SECTORS       (57)
+#define FWUP_SLOT_SIZE          ((uint32_t)(FWUP_SLOT_SECTORS * FWUP_SECTOR_SIZE)) // 228K
+#define FWUP_BOOT_ADDRESS       ((uint32_t)FLASH_START_ADDRESS)
+#define FWUP_APP_ADDRESS        ((uint32_t)(FLASH_START_ADDRESS + FWUP_SECTOR_SIZE))
+#define FWUP_SCRATCH_ADDRESS    ((uint32_t)(FWUP_APP_ADDRESS + FWUP_SLOT_SIZE))
+#define FWUP_RECORD_ADDRESS     ((uint32_t)(FWUP_SCRATCH_ADDRESS + FWUP_SECTOR_SIZE))
+#define FWUP_STAGING_ADDRESS    ((uint32_t)BANK2_START_ADDRESS)
+
+#define FWUP_MAGIC              (0x50555746u) // "FWUP"
+// Image bytes per FIRMWARE_CHUNK packet, after the 4 byte offset
+#define FWUP_CHUNK_BYTES        (512)
+// Same pacing as the event log, one flash operation per run
+#define FWUP_TASK_PERIOD_US     (2000)
+// A new image that runs this long without a reset keeps itself
+#define FWUP_CONFIRM_MS         (3000)
+
+// Swap steps for each sector, in order. Each one is journaled, so the boot
+// stage can pick up where it left off after a power loss.
+#define FWUP_STEP_SAVE          (0) // Running image sector to scratch
+#define FWUP_STEP_LOAD          (1) // Staged sector over the running one
+#define FWUP_STEP_STASH         (2) // Scratch (the old sector) to staging
+#define FWUP_SWAP_STEPS         (3)
+
+// Results logged with ELOG_EVENT_FW_UPDATE
+#define FWUP_RESULT_CONFIRMED   (1)
+#define FWUP_RESULT_ROLLED_BACK (2)
+
+// Update record, in its own sector. Flash only goes from erased to
+// programmed, so every flag is a double word that gets zeroed. The header
+// is written by the application once the staged image checks out, Magic
+// last. Everything after that is written by the boot stage, except for
+// Confirmed and Reported.
+typedef struct _fwup_record {
+    uint32_t Size; // Image length (bytes)
+    uint32_t Crc; // CRC-32 of the image
+    uint32_t Magic;
+    uint32_t Reserved;
+    uint64_t Trial; // Swapped in, the new image is on its first run
+    uint64_t Confirmed; // The new image ran long enough to keep
+    uint64_t Reverted; // The new image didn't confirm, the old one is back
+    uint64_t Reported; // The rollback has been logged
+    uint64_t Swap[FWUP_SLOT_SECTORS][FWUP_SWAP_STEPS];
+    uint64_t Revert[FWUP_SLOT_SECTORS][FWUP_SWAP_STEPS];
+} Fwup_Record_Type;
+
+typedef enum {
+    Fwup_Idle = 0,
+    Fwup_Receiving, // Taking chunks and writing them to staging
+    Fwup_Committing, // Staged image is good, writing the record
+    Fwup_Ready, // Swaps in on the next reset
+    Fwup_Trial, // Running a new image that hasn't confirmed yet
+    Fwup_Confirmed, // Running a new image that has confirmed
+    Fwup_RolledBack, // The last update didn't start, running the old image
+    Fwup_Failed // Staged image didn't match the CRC, or flash failed
+} Fwup_State;
+
+void FWUP_Init(void);
+uint8_t FWUP_Begin(uint32_t size, uint32_t crc);
+uint8_t FWUP_Chunk(uint32_t offset, uint8_t* data, uint16_t length);
+uint8_t FWUP_Commit(void);
+uint8_t FWUP_Abort(void);
+void FWUP_Task(void);
+uint32_t FWUP_GetStatistic(uint16_t value_ID);
+
+#endif //_FW_UPDATE_H_
@@ -48,9 +48,10 @@
 typedef struct _hallsensor{
     float Speed;
     float PreviousSpeed;
+    float SectorSpeed; // Over the last Hall state alone
     uint32_t CallingFrequency;
-    float AngleIncrement;
-    float Angle;
+    Angle_Type AngleIncrement;
+    Angle_Type Angle;
     uint32_t CaptureValue;
     uint32_t CaptureForState[8];
     uint16_t Prescaler;
@@ -71,7 +72,7 @@ typedef struct _hallsensorpll{
     float Beta; // Gain for frequency (fixed at alpha^2/2)
     float dt; // Timestep
     float Frequency; // Output frequency
-    float Phase; // Output angle
+    Angle_Type Phase; // Output angle
     uint8_t Valid; // Is phase locked?
     uint16_t ValidCounter; // Increments to saturation while locked
 
@@ -87,8 +88,8 @@ typedef struct _hallsensorpll{
 #define ANGLE_VALID                 (1)
 
 void HALL_Init(uint32_t callingFrequency);
-uint8_t HALL_GenFwdOrder(float* angleTab, uint8_t* fwdOrderTab);
-uint8_t HALL_GenRevOrder(float* angleTab, uint8_t* revOrderTab);
+uint8_t HALL_GenFwdOrder(Angle_Type* angleTab, uint8_t* fwdOrderTab);
+uint8_t HALL_GenRevOrder(Angle_Type* angleTab, uint8_t* revOrderTab);
 uint8_t HALL_GenFwdTable(uint8_t* orderTab, uint8_t* fwdTab);
 uint8_t HALL_GenFwdInvTable(uint8_t* fwdTab, uint8_t* fwdInvTab);
 uint8_t HALL_GenRevTable(uint8_t* revOrderTab, uint8_t* revTab);
@@ -96,28 +97,27 @@ uint8_t HALL_GenRevInvTable(uint8_t* revTab, uint8_t* revInvTab);
 
 uint8_t HALL_GetState(void);
 void HALL_IncAngle(void);
-uint16_t HALL_GetAngle(void);
-float HALL_GetAngleF(void);
+Angle_Type HALL_GetAngle(void);
 
 uint32_t HALL_GetSpeed(void);
 float HALL_GetSpeedF(void);
+float HALL_GetSectorSpeedF(void);
 uint8_t HALL_GetDirection(void);
 uint8_t HALL_IsValid(void);
 
 void HALL_PLLUpdate(void);
-uint16_t HALL_GetPLLAngle(void);
-float HALL_GetPLLAngleF(void);
+Angle_Type HALL_GetPLLAngle(void);
 uint32_t HALL_GetPLLSpeed(void);
 float HALL_GetPLLSpeedF(void);
 uint8_t HALL_PLLIsValid(void);
 
 uint8_t HALL_SetAngle(uint8_t state, float newAngle);
 uint8_t HALL_SetAngleTable(float* angleTab);
-float* HALL_GetAngleTable(void);
-float HALL_GetAngleFromTable(uint8_t state);
-float HALL_GetStateMidpoint(uint8_t state);
+Angle_Type* HALL_GetAngleTable(void);
+Angle_Type HALL_GetAngleFromTable(uint8_t state);
+Angle_Type HALL_GetStateMidpoint(uint8_t state);
 void HALL_ChangeFrequency(uint32_t newfreq);
-void HALL_EnableHallDetection(float* angleTable, uint8_t tableLength);
+void HALL_EnableHallDetection(Angle_Type* angleTable, uint8_t tableLength);
 void HALL_DisableHallDetection(void);
 void HALL_UpdateCallback(void);
 void HALL_CaptureCallback(void);
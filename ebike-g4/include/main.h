@@ -31,21 +31,39 @@
 #include "stm32g4xx.h"
 #include "main_data_types.h"
 #include "adc.h"
+#include "battery_current.h"
+#include "bldc.h"
+#include "boot_profile.h"
+#include "cogging.h"
 #include "cordic_sin_cos.h"
 #include "crc.h"
+#include "dashboard.h"
 #include "data_commands.h"
 #include "data_packet.h"
+#include "debug_trace.h"
+#include "deferred_log.h"
 #include "delay.h"
+#include "derating.h"
 #include "drv8353.h"
 #include "eeprom_emulation.h"
+#include "event_log.h"
+#include "faults.h"
 #include "foc_lib.h"
+#include "fw_update.h"
 #include "gpio.h"
 #include "hall_sensor.h"
 #include "live_data.h"
+#include "motor_id.h"
+#include "pas.h"
 #include "periphconfig.h"
 #include "pinconfig.h"
 #include "project_parameters.h"
 #include "pwm.h"
+#include "regen.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "speed_control.h"
+#include "tasks.h"
 #include "throttle.h"
 #include "uart.h"
 #include "usb_cdc.h"
@@ -57,6 +75,13 @@
 #define RETVAL_OK           (1)
 #define RETVAL_FAIL         (0)
 
+// Core coupled memory. Code runs from CCM SRAM with no Flash wait states,
+// so the motor interrupt path lives there. DMA can't reach it, so DMA
+// buffers have to stay in SRAM. _start() copies and clears these regions.
+#define CCMRAM_FUNC         __attribute__((section(".ramfunc.CCMRAM")))
+#define CCMRAM_DATA         __attribute__((section(".data.CCMRAM")))
+#define CCMRAM_BSS          __attribute__((section(".bss.CCMRAM")))
+
 // Bootloader locations
 #define BOOTLOADER_REMAPPED_TOP_OF_STACK        ((uint32_t)0x00000000)
 #define BOOTLOADER_REMAPPED_RESET_VECTOR        ((uint32_t)0x00000004)
@@ -65,16 +90,50 @@
 #define BOOTLOADER_RESET_FLAG       ((uint32_t)0x7441634F) // "tAcO"
 
 // Various settings
-#define APP_TIM_RATE        (1000) // 1kHz update rate
+#define MAIN_THROTTLE_DIVIDER   (2) // Throttle is processed at 1kHz, every other speed loop
+#define MAIN_USB_POLL_US        (1000) // Check the USB port at least this often
+#define MAIN_CURRENT_BW_DFLT    (500.0f) // Current loop bandwidth when tuning (Hz)
+// With 1.5 PWM cycles of delay, this keeps over 60 degrees of phase margin
+#define MAIN_CURRENT_BW_MAX     ((float)DFLT_FOC_PWM_FREQ / 20.0f)
 
 // Exported functions
 
 uint8_t MAIN_GetDashboardData(uint8_t* data); // Returns live values
+uint8_t MAIN_SetLimit(Main_Limit_Type limit, float value); // Change one of the limit settings
+float MAIN_GetLimit(Main_Limit_Type limit);
+uint8_t MAIN_SetPolePairs(uint16_t pole_pairs);
+uint16_t MAIN_GetPolePairs(void);
+uint8_t MAIN_SetGearRatio(float ratio);
+float MAIN_GetGearRatio(void);
+uint8_t MAIN_SetWheelSize(float wheel_mm);
+float MAIN_GetWheelSize(void);
+uint8_t MAIN_SetKv(float kv);
+float MAIN_GetKv(void);
+uint8_t MAIN_SetMotorModel(uint16_t value_ID, float value);
+float MAIN_GetMotorModel(uint16_t value_ID);
+uint8_t MAIN_SetCurrentGain(uint16_t value_ID, float value);
+float MAIN_GetCurrentGain(uint16_t value_ID);
+uint8_t MAIN_CommitCurrentGains(void); // Applies the staged gains as one set
+uint8_t MAIN_TuneCurrentLoop(float bandwidth); // Current loop gains from the motor model
+uint8_t MAIN_SetCountsToFOC(int32_t counts);
+int32_t MAIN_GetCountsToFOC(void);
+uint8_t MAIN_SetSpeedToFOC(float speed);
+float MAIN_GetSpeedToFOC(void);
+uint8_t MAIN_SetSwitchEpsilon(float eps);
+float MAIN_GetSwitchEpsilon(void);
+void MAIN_SaveVariables(void);
+void MAIN_LoadVariables(void);
 uint8_t MAIN_EnableDebugPWM(void); // Turn on PWM outputs
 uint8_t MAIN_DisableDebugPWM(void); // Turn off PWM outputs
+uint8_t MAIN_EnableFOC(void); // Run the current loop instead of debug waves
+uint8_t MAIN_DisableFOC(void); // Back to debug waves
+uint8_t MAIN_RequestBLDC(void); // Six-step at low speed, FOC above SpeedToFOC
+uint8_t MAIN_RequestFOC(void); // No more six-step after the next handover
+uint8_t MAIN_IdentifyMotor(float test_current); // Measure R, Ld, Lq, and flux linkage
 void MAIN_Reboot(void); // Restart processor
 void MAIN_GoToBootloader(void); // Restart and go to bootloader at startup
-void MAIN_AppTimerISR(void); // Called periodically to do housekeeping functions
-void MAIN_MotorISR(void); // Called periodically to perform motor control functions
+void MAIN_HousekeepingISR(void); // Called at 100Hz to do housekeeping functions
+void MAIN_SpeedISR(void); // Called at 2kHz to perform speed and limit functions
+void MAIN_MotorISR(void); // Called every PWM cycle to perform motor control functions
 
 #endif //__MAIN_H
@@ -32,6 +32,7 @@
 // Variable type definitions
 
 typedef enum _main_limit_type {
+    Main_Limit_None, // Not limited
     Main_Limit_PhaseCurrent,
     Main_Limit_PhaseRegenCurrent,
     Main_Limit_BattCurrent,
@@ -64,6 +65,10 @@ typedef struct _main_config {
     float WheelSizeMM;
     float GearRatio;
     float MotorKv;
+    float MotorResistance; // Identified motor model, zero if unknown
+    float MotorLd;
+    float MotorLq;
+    float MotorFluxLinkage;
     int32_t PWMFrequency;
     int32_t PWMDeadTime;
     float MaxPhaseCurrent;
@@ -79,6 +84,10 @@ typedef struct _main_config {
     float MinVoltFault;
     float MaxVoltFault;
     float CurrentFault;
+    float CurrentKp; // Current loop gains, both axes
+    float CurrentKi;
+    float CurrentKd;
+    float CurrentKc;
     Main_Control_Methods ControlMethod;
     // ----- Generated constants -----
     float inv_max_phase_current;
@@ -86,6 +95,7 @@ typedef struct _main_config {
     float kv_volts_per_ehz;
     // ----- Local variables -----
     float throttle_limit_scale;
+    float regen_limit_scale; // Thermal part of the derating only
 } Config_Main;
 
 typedef struct _Motor_Controls {
@@ -98,9 +108,12 @@ typedef struct _Motor_Observations {
     float iA;
     float iB;
     float iC;
-    float RotorAngle;
+    Angle_Type RotorAngle;
     float RotorSpeed_eHz;
     uint8_t HallState;
+    float FetTempDegC;
+    float MotorTempDegC;
+    uint32_t FaultCode;
 } Motor_Observations;
 
 typedef struct _Motor_PWMDuties {
@@ -114,6 +127,8 @@ typedef struct _FOC_StateVariables {
     float Clarke_Beta;
     float Park_D;
     float Park_Q;
+    float Vd; // Applied voltages, PI output plus feedforward
+    float Vq;
     PID_Type* Id_PID;
     PID_Type* Iq_PID;
 } FOC_StateVariables;
@@ -126,6 +141,19 @@ typedef struct _main_variables_type {
     FOC_StateVariables* Foc;
 } Main_Variables;
 
+// Copy of the motor control state from a single PWM cycle, for readers
+// outside the motor interrupt. See SNAP_Get.
+typedef struct _main_snapshot_type {
+    uint32_t Timestamp;
+    Motor_Controls Ctrl;
+    Motor_Observations Obv;
+    Motor_PWMDuties Pwm;
+    float Park_D;
+    float Park_Q;
+    float Vd;
+    float Vq;
+} Main_Snapshot;
+
 
 
 #endif
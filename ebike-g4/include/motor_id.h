@@ -0,0 +1,103 @@
+/******************************************************************************
+ * Filename: motor_id.h
+ ******************************************************************************
+
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _MOTOR_ID_H_
+#define _MOTOR_ID_H_
+
+#include "main_data_types.h"
+
+// Runs every PWM cycle
+#define MOTID_SAMPLING_RATE         ((float)DFLT_FOC_PWM_FREQ)
+#define MOTID_DEFAULT_CURRENT       (10.0f) // Test current when none is given (A)
+#define MOTID_MAX_VOLTAGE           (0.5f) // Largest voltage command, fraction of Vbus/sqrt(3)
+// Resistance: DC current at half and full test current
+#define MOTID_ALIGN_CYCLES          (DFLT_FOC_PWM_FREQ) // Current ramps up over 1s, rotor lines up with phase A
+#define MOTID_SETTLE_CYCLES         (DFLT_FOC_PWM_FREQ / 4) // Let the current loop settle before averaging
+#define MOTID_AVERAGE_CYCLES        (DFLT_FOC_PWM_FREQ / 4)
+#define MOTID_MIN_CURRENT_RATIO     (0.9f) // Fail if the current doesn't get this close to the test current
+// Inductance: square wave on top of the DC bias, along the d axis then the q axis
+#define MOTID_HF_VOLTS              (2.0f) // Square wave amplitude (V)
+#define MOTID_HF_HALF_PERIOD        (4) // PWM cycles, 2.5kHz at 20kHz PWM
+#define MOTID_HF_PERIODS            (2000) // Number of ripple measurements to average
+// Flux linkage: spin up with a small q axis current, only if the wheel is free
+#define MOTID_SPIN_FRACTION         (0.25f) // Fraction of the test current
+#define MOTID_FLUX_SPEED            (20.0f) // Measure above this speed (eHz)
+#define MOTID_FLUX_CYCLES           (DFLT_FOC_PWM_FREQ / 10)
+#define MOTID_SPIN_TIMEOUT_CYCLES   (DFLT_FOC_PWM_FREQ * 5) // Wheel is blocked if it isn't up to speed by then
+
+// Error codes
+#define MOTID_ERR_NONE              (0)
+#define MOTID_ERR_ABORTED           (1) // Outputs were turned off, usually by a fault
+#define MOTID_ERR_NO_CURRENT        (2) // Ran out of voltage before reaching the test current
+#define MOTID_ERR_BAD_RESULT        (3) // Resistance or inductance came out negative or zero
+
+typedef enum _motid_state {
+    MotId_Idle,
+    MotId_Align,
+    MotId_Resistance1,
+    MotId_Resistance2,
+    MotId_InductanceD,
+    MotId_InductanceQ,
+    MotId_Spin,
+    MotId_Done,
+    MotId_Failed
+} MotId_State;
+
+typedef struct _motid_type {
+    MotId_State State;
+    uint32_t Error;
+    uint32_t Counter; // PWM cycles in the present state
+    uint32_t ElapsedCycles; // PWM cycles since the start
+    float TestCurrent; // (A)
+    float BiasAlpha; // DC voltage held during injection, fraction of Vbus/sqrt(3)
+    float BiasBeta;
+    float Injection; // Square wave amplitude, same units
+    uint8_t AlignHallState; // Hall state when aligning started
+    uint8_t Aligned; // Non-zero if the rotor turned to line up with phase A
+    float AxisSin; // d axis for the injection
+    float AxisCos;
+    float SumVolts; // Averaging
+    float SumAmps;
+    float SumSpeed;
+    uint32_t Samples;
+    float R1Volts; // First resistance point
+    float R1Amps;
+    float IMin; // Current extremes over one injection period
+    float IMax;
+    float Resistance; // Phase resistance (Ohm)
+    float Ld; // d axis inductance (H)
+    float Lq; // q axis inductance (H)
+    float FluxLinkage; // Peak phase flux linkage (V*s)
+    uint8_t FluxValid; // Zero if the wheel didn't turn
+} MotId_Type;
+
+void MOTID_Init(void);
+uint8_t MOTID_Start(float test_current);
+uint8_t MOTID_IsRunning(void);
+void MOTID_Process(Main_Variables* mvar, Config_Main* cfg, uint8_t outputs_on);
+uint32_t MOTID_GetStatistic(uint16_t value_ID);
+
+#endif //_MOTOR_ID_H_
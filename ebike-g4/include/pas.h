@@ -0,0 +1,110 @@
+/******************************************************************************
+ * Filename: pas.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _PAS_H_
+#define _PAS_H_
+
+#include "main_data_types.h"
+
+// What's connected to the throttle input
+#define PAS_INPUT_THROTTLE          (0) // Plain analog throttle, no pedal sensor
+#define PAS_INPUT_CADENCE           (1) // Cadence sensor pulses, captured by the PAS timer
+#define PAS_INPUT_TORQUE            (2) // Analog torque sensor
+#define PAS_INPUT_MAX               (PAS_INPUT_TORQUE)
+
+// How to tell which way the cranks turn, from the duty cycle of the
+// cadence pulses. Dual Hall sensors give a different duty each way.
+#define PAS_DIR_NONE                (0) // Single signal sensor, always forward
+#define PAS_DIR_HIGH_FORWARD        (1) // Duty above 50% is forward
+#define PAS_DIR_LOW_FORWARD         (2) // Duty below 50% is forward
+#define PAS_DIR_MAX                 (PAS_DIR_LOW_FORWARD)
+
+// Pedaling state
+#define PAS_PEDAL_STOPPED           (0)
+#define PAS_PEDAL_FORWARD           (1)
+#define PAS_PEDAL_BACKWARD          (2)
+
+#define PAS_NUM_LEVELS              (5) // Level 0 is no assist
+#define PAS_TICK_HZ                 (100000u) // Capture timer resolution
+#define PAS_START_PULSES            (2) // Forward pulses in a row before assist starts
+#define PAS_RISE                    (0.002f) // Assist ramps up to full in half a second, drops at once
+#define PAS_TORQUE_FILT             (0.05f) // Torque low pass, about 8Hz at 1kHz
+#define PAS_TORQUE_DEADBAND         (2.0f) // Nm. Feet resting on the pedals isn't pedaling.
+#define PAS_TORQUE_MIN_VOLTS        (0.2f) // Outside this range the torque sensor is
+#define PAS_TORQUE_MAX_VOLTS        (4.8f) // disconnected or shorted
+#define PAS_PULSES_MIN              (1)
+#define PAS_PULSES_MAX              (64)
+#define PAS_TIMEOUT_MIN             (0.05f) // Seconds
+#define PAS_TIMEOUT_MAX             (2.0f)
+#define PAS_OUTPUT_MAX              (0.99f) // Same as the throttle
+
+typedef struct _config_pas {
+    uint16_t InputMode; // PAS_INPUT_xxx
+    uint16_t PulsesPerRev; // Cadence pulses per crank revolution
+    uint16_t Direction; // PAS_DIR_xxx
+    uint16_t Level; // Present assist level, 0 to PAS_NUM_LEVELS
+    float Timeout; // Pedaling has stopped when there's no pulse for this long (s)
+    float CadenceFull; // Cadence that gets the full assist for the level (rpm)
+    float TorqueZero; // Torque sensor output with no load (V)
+    float TorqueScale; // Torque sensor gain (Nm/V)
+    float TorqueFull; // Rider torque that gets the full assist for the level (Nm)
+    float LevelAssist[PAS_NUM_LEVELS]; // Largest command at each level, fraction of full torque
+} Config_PAS;
+
+typedef struct _pas_type {
+    volatile uint32_t Period; // Latest cadence period (timer ticks)
+    volatile uint8_t Pulses; // Pulses in a row in the same direction
+    volatile uint8_t Pedaling; // PAS_PEDAL_xxx
+    volatile uint8_t Stopped; // No pulse within the timeout, next period is meaningless
+    float Cadence; // rpm
+    float Torque; // Rider torque, filtered (Nm)
+    float Command; // Assist request, fraction of full torque
+} PAS_Type;
+
+void PAS_Init(void);
+void PAS_CaptureCallback(void);
+void PAS_TimeoutCallback(void);
+void PAS_Process(void);
+uint8_t PAS_IsEnabled(void);
+float PAS_GetCommand(void);
+float PAS_GetCadence(void);
+float PAS_GetTorque(void);
+uint16_t PAS_GetPedaling(void);
+
+uint8_t PAS_SetInputMode(uint16_t mode);
+uint16_t PAS_GetInputMode(void);
+uint8_t PAS_SetPulsesPerRev(uint16_t pulses);
+uint16_t PAS_GetPulsesPerRev(void);
+uint8_t PAS_SetDirection(uint16_t direction);
+uint16_t PAS_GetDirection(void);
+uint8_t PAS_SetLevel(uint16_t level);
+uint16_t PAS_GetLevel(void);
+uint8_t PAS_SetCurve(uint16_t value_ID, float value);
+float PAS_GetCurve(uint16_t value_ID);
+
+void PAS_SaveVariables(void);
+void PAS_LoadVariables(void);
+
+#endif //_PAS_H_
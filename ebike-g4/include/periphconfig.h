@@ -36,7 +36,7 @@
  * TIM20 -
  * --- General purpose, 32bit ---
  * TIM2 -
- * TIM5 - Pedal Assist (PAS) timer for Thr
+ * TIM5 - Pedal Assist (PAS) cadence capture, on the throttle input
  * --- General purpose, 16bit ---
  * TIM3 -
  * TIM4 - Hall sensors
@@ -44,8 +44,8 @@
  * TIM16 -
  * TIM17 -
  * --- Basic ---
- * TIM6 - Basic timer for application scheduling
- * TIM7 -
+ * TIM6 - Not running. Interrupt vector used for the 100Hz housekeeping rate group
+ * TIM7 - Not running. Interrupt vector used for the 2kHz speed rate group
  * --- Other ---
  * LPTIM1 -
  * IDWG - Safety reset
@@ -86,7 +86,9 @@
  * HASH -
  * CRYP -
  * CORDIC - sin/cos calculations in FOC
- * FMAC - biquad filter calculations
+ * FMAC - Not used. In Q1.15 the throttle filter loses its DC gain and the
+ *        derating filters stick, and all the filters together only take
+ *        about 0.2% of the CPU on the FPU (test_fmac).
  */
 
 // Clocks and timing
@@ -121,6 +123,7 @@
 #define PWM_CLK                 APB2_CLK
 #define PWM_TIM_CLK_ENABLE()    RCC->APB2ENR |= RCC_APB2ENR_TIM1EN
 #define PWM_IRQn                TIM1_UP_TIM16_IRQn
+#define PWM_BRK_IRQn            TIM1_BRK_TIM15_IRQn
 
 // Hall Sensors
 #define HALL_TIM                TIM4
@@ -134,11 +137,10 @@
 #define PAS_TIM_CLK_ENABLE()    RCC->APB1ENR1 |= RCC_APB1ENR1_TIM5EN
 #define PAS_IRQn                TIM5_IRQn
 
-// Application timer
-#define APP_TIM                 TIM6
-#define APP_CLK                 APB1_CLK
-#define APP_TIMER_CLK_ENABLE()  RCC->APB1ENR1 |= RCC_APB1ENR1_TIM6EN
-#define APP_IRQn                TIM6_DAC_IRQn
+// Scheduler rate groups
+// These are triggered in software at the end of the motor control interrupt.
+#define SCHED_SPEED_IRQn        TIM7_DAC_IRQn
+#define SCHED_HOUSEKEEPING_IRQn TIM6_DAC_IRQn
 
 // HBD
 #define HBD_UART                USART2
@@ -164,15 +166,18 @@
 // Multiple interrupt sources can use the same priority level,
 // but only a lower number interrupt will override a currently
 // responding IRQ function.
-#define PRIO_PWM        (0)
-#define PRIO_HALL       (1)
-#define PRIO_ADC        (2)
-#define PRIO_PAS        (3)
-#define PRIO_APPTIMER   (3)
-#define PRIO_SYSTICK    (3)
-#define PRIO_HBD_UART   (4)
-#define PRIO_BMS_UART   (4)
-#define PRIO_DRV_SPI    (4)
-#define PRIO_USB        (5)
+#define PRIO_PWM                (0)
+#define PRIO_PWM_BRK            (0)
+#define PRIO_HALL               (1)
+#define PRIO_ADC                (2)
+#define PRIO_PAS                (3)
+#define PRIO_SCHED_SPEED        (3)
+#define PRIO_SYSTICK            (3)
+#define PRIO_HBD_UART           (4)
+#define PRIO_BMS_UART           (4)
+#define PRIO_DRV_SPI            (4)
+#define PRIO_USB                (5)
+#define PRIO_FLASH              (5)
+#define PRIO_SCHED_HOUSEKEEPING (6)
 
 #endif //__PERIPHCONFIG_H
@@ -105,6 +105,11 @@
 #define ADC_VBUS_PORT       GPIOB
 #define ADC_VBUS_PIN        12
 
+// Pedal assist sensor. Shares the throttle input, there are no spare pins.
+#define PAS_PORT            ADC_THR_PORT
+#define PAS_PIN             ADC_THR_PIN
+#define PAS_AF              (2U) // TIM5_CH1
+
 // DAC
 #define DAC_PORT            GPIOA
 #define DAC1_PIN            4
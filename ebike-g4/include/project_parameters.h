@@ -135,7 +135,7 @@ typedef enum _data_type {
 #define CONFIG_LMT_MOTOR_TEMP_SOFTCAP   (0x040C) //F32: Soften current when motor temp here
 #define CONFIG_LMT_MOTOR_TEMP_HARDCAP   (0x040D) //F32: No more current when motor temp here
 /*** Limit Default Values ***/
-#define DFLT_LMT_VOLT_FAULT_MIN         (44.8f) // 2.8 x 16 cells
+#define DFLT_LMT_VOLT_FAULT_MIN         (7.0f) // For testing, below VOLT_HARDCAP. 2.8 x 16 cells = 44.8V
 #define DFLT_LMT_VOLT_FAULT_MAX         (70.4f) // 4.4 x 16 cells
 #define DFLT_LMT_CUR_FAULT_MAX          (74.0f) // Just below max sensing level
 #define DFLT_LMT_VOLT_SOFTCAP           (10.0f) // For testing, just apply 12V or more
@@ -151,7 +151,7 @@ typedef enum _data_type {
 
 /*** Motor Configuration Variable IDs ***/
 #define CONFIG_MOTOR_PREFIX         (0x0500)
-#define CONFIG_MOTOR_NUMVARS        (10)
+#define CONFIG_MOTOR_NUMVARS        (14)
 #define CONFIG_MOTOR_HALL1          (0x0501) //F32: Angle of motor when switching into state 1, forward rotation
 #define CONFIG_MOTOR_HALL2          (0x0502) //F32: Angle when switching into state 2
 #define CONFIG_MOTOR_HALL3          (0x0503) //F32: Angle when switching into state 3
@@ -162,6 +162,10 @@ typedef enum _data_type {
 #define CONFIG_MOTOR_GEAR_RATIO     (0x0508) //F32: Turns of mechanical motor / turns of wheel
 #define CONFIG_MOTOR_WHEEL_SIZE     (0x0509) //F32: Diameter in mm
 #define CONFIG_MOTOR_KV             (0x050A) //F32: Motor voltage constant (RPM / Volt)
+#define CONFIG_MOTOR_RESISTANCE     (0x050B) //F32: Phase resistance (Ohm), from motor identification
+#define CONFIG_MOTOR_LD             (0x050C) //F32: d axis inductance (H)
+#define CONFIG_MOTOR_LQ             (0x050D) //F32: q axis inductance (H)
+#define CONFIG_MOTOR_FLUX           (0x050E) //F32: Peak phase flux linkage (V*s)
 /*** Motor Default Values ***/
 // For Ebikeling 700C front 1200W motor
 #define DFLT_MOTOR_HALL1            (0.743786f)
@@ -176,6 +180,10 @@ typedef enum _data_type {
                                                 // https://www.cateye.com/data/resources/Tire_size_chart_ENG_151106.pdf
                                                 // 2200 mm / pi = 700.28mm
 #define DFLT_MOTOR_KV               (7.5f) // When zero, PI loop feedforward is disabled
+#define DFLT_MOTOR_RESISTANCE       (0.0f) // Unknown until identified
+#define DFLT_MOTOR_LD               (0.0f)
+#define DFLT_MOTOR_LQ               (0.0f)
+#define DFLT_MOTOR_FLUX             (0.0f)
 
 
 /*** Three Phase Driver Variable IDs ***/
@@ -192,6 +200,39 @@ typedef enum _data_type {
 #define DFLT_DRV_VDS_LIMIT          (0x05)   // Set to 0.6V (about 100A if the FET has its worst-case Rdson of 6mOhm)
 #define DFLT_DRV_CSA_GAIN           (0x01)   // x10 gain
 
+/*** Pedal Assist Variable IDs ***/
+#define CONFIG_PAS_PREFIX           (0x0700)
+#define CONFIG_PAS_NUMVARS          (14)
+#define CONFIG_PAS_INPUT_MODE       (0x0701) //I16: Sensor on the throttle input. 0 = throttle, 1 = cadence, 2 = torque
+#define CONFIG_PAS_PULSES           (0x0702) //I16: Cadence pulses per crank revolution
+#define CONFIG_PAS_DIRECTION        (0x0703) //I16: 0 = no direction sensing, 1 = high duty is forward, 2 = low duty is forward
+#define CONFIG_PAS_LEVEL            (0x0704) //I16: Assist level, 0 (off) to 5
+#define CONFIG_PAS_TIMEOUT          (0x0705) //F32: Pedaling stops after no cadence pulse for this long (s)
+#define CONFIG_PAS_CADENCE_FULL     (0x0706) //F32: Cadence for full assist at the level (rpm)
+#define CONFIG_PAS_TORQUE_ZERO      (0x0707) //F32: Torque sensor output with no load (V)
+#define CONFIG_PAS_TORQUE_SCALE     (0x0708) //F32: Torque sensor gain (Nm/V)
+#define CONFIG_PAS_TORQUE_FULL      (0x0709) //F32: Rider torque for full assist at the level (Nm)
+#define CONFIG_PAS_LEVEL1           (0x070A) //F32: Largest assist at level 1, fraction of full torque
+#define CONFIG_PAS_LEVEL2           (0x070B) //F32: Largest assist at level 2
+#define CONFIG_PAS_LEVEL3           (0x070C) //F32: Largest assist at level 3
+#define CONFIG_PAS_LEVEL4           (0x070D) //F32: Largest assist at level 4
+#define CONFIG_PAS_LEVEL5           (0x070E) //F32: Largest assist at level 5
+/*** Pedal Assist Default Values ***/
+#define DFLT_PAS_INPUT_MODE         (0) // Throttle only until a sensor is set up
+#define DFLT_PAS_PULSES             (12)
+#define DFLT_PAS_DIRECTION          (0)
+#define DFLT_PAS_LEVEL              (2)
+#define DFLT_PAS_TIMEOUT            (0.5f) // About 10 rpm with 12 pulses
+#define DFLT_PAS_CADENCE_FULL       (60.0f)
+#define DFLT_PAS_TORQUE_ZERO        (0.75f)
+#define DFLT_PAS_TORQUE_SCALE       (40.0f)
+#define DFLT_PAS_TORQUE_FULL        (60.0f)
+#define DFLT_PAS_LEVEL1             (0.2f)
+#define DFLT_PAS_LEVEL2             (0.35f)
+#define DFLT_PAS_LEVEL3             (0.5f)
+#define DFLT_PAS_LEVEL4             (0.7f)
+#define DFLT_PAS_LEVEL5             (0.9f)
+
 /*** BMS Interactions ***/
 #define CONFIG_BMS_PREFIX           (0x1A00)
 #define CONFIG_BMS_ISCONNECTED      (0x1A01) //I8: Zero for not connected, one for connected
@@ -199,28 +240,140 @@ typedef enum _data_type {
 #define CONFIG_BMS_GETBAT_N         (0x1A03) //F32: Voltage of a particular cell (requires 2-byte cell number, zero indexed)
 #define CONFIG_BMS_GETSTATUS_N      (0x1A04) //I32: Status of a particular cell (requires 2-byte cell number, zero indexed)
 
+/*** Scheduler Statistics (read only, not saved in EEPROM) ***/
+#define CONFIG_SCHED_PREFIX         (0x1B00)
+#define CONFIG_SCHED_GROUP_OFFSET   (0x0010) // Add (rate group number * offset) to read a different group
+                                             // 0 = current loop, 1 = speed loop, 2 = housekeeping, 3 = main loop
+#define CONFIG_SCHED_RUNS           (0x1B01) //I32: Number of times the rate group has run
+#define CONFIG_SCHED_OVERRUNS       (0x1B02) //I32: Number of missed deadlines
+#define CONFIG_SCHED_BUDGET_OVERRUNS (0x1B03) //I32: Number of runs that exceeded the execution budget
+#define CONFIG_SCHED_LAST_CYCLES    (0x1B04) //I32: Execution time of the latest run (CPU cycles)
+#define CONFIG_SCHED_MAX_CYCLES     (0x1B05) //I32: Worst case execution time (CPU cycles)
+#define CONFIG_SCHED_BUDGET_CYCLES  (0x1B06) //I32: Execution budget (CPU cycles)
+
+/*** Main Loop Task Statistics (read only, not saved in EEPROM) ***/
+#define CONFIG_TASK_PREFIX          (0x1C00)
+#define CONFIG_TASK_OFFSET          (0x0010) // Add (task number * offset) to read a different task
+                                             // Task 0 is the watchdog supervisor, the rest in order of registration
+#define CONFIG_TASK_RUNS            (0x1C01) //I32: Number of times the task has run
+#define CONFIG_TASK_LAST_LATENCY    (0x1C02) //I32: Time from ready to running, latest run (CPU cycles)
+#define CONFIG_TASK_MAX_LATENCY     (0x1C03) //I32: Worst case time from ready to running (CPU cycles)
+#define CONFIG_TASK_MAX_RUN_CYCLES  (0x1C04) //I32: Worst case execution time (CPU cycles)
+#define CONFIG_TASK_MISSED_CHECKINS (0x1C05) //I32: Number of watchdog feeds held back by this task
+
+/*** Limit Status (read only, not saved in EEPROM) ***/
+#define CONFIG_LMT_STATUS_PREFIX    (0x1D00)
+#define CONFIG_LMT_STATUS_SCALE     (0x1D01) //F32: Present current limit scale, 0 to 1
+#define CONFIG_LMT_STATUS_REASON    (0x1D02) //I16: Limit holding the scale down (Main_Limit_Type, zero for none)
+#define CONFIG_LMT_STATUS_REGEN_SCALE (0x1D03) //F32: Present regen limit scale, from the temperatures only
+
+/*** Regen Status (read only, not saved in EEPROM) ***/
+#define CONFIG_REGEN_STATUS_PREFIX  (0x1E00)
+#define CONFIG_REGEN_STATUS_COMMAND (0x1E01) //F32: Present regen command, fraction of maximum regen current
+#define CONFIG_REGEN_STATUS_ENERGY  (0x1E02) //F32: Energy returned to the battery since startup (Wh)
+
+/*** Fault Status (read only, not saved in EEPROM) ***/
+#define CONFIG_FAULT_STATUS_PREFIX  (0x1F00)
+#define CONFIG_FAULT_STATUS_ACTIVE  (0x1F01) //I32: Latched fault codes (FAULT_xxx bits)
+#define CONFIG_FAULT_STATUS_FIRST   (0x1F02) //I32: Fault code(s) that tripped first since the last clear
+#define CONFIG_FAULT_STATUS_COUNT   (0x1F03) //I32: Number of faults since startup
+#define CONFIG_FAULT_STATUS_TIMESTAMP (0x1F04) //I32: PWM cycle count when the first fault tripped
+
+/*** Event Log Status (read only, not saved in EEPROM) ***/
+#define CONFIG_ELOG_STATUS_PREFIX   (0x2000)
+#define CONFIG_ELOG_STATUS_WRITTEN  (0x2001) //I32: Records written to flash since startup
+#define CONFIG_ELOG_STATUS_PENDING  (0x2002) //I32: Records waiting in RAM to be written
+#define CONFIG_ELOG_STATUS_DROPPED  (0x2003) //I32: Records lost because the RAM buffer was full
+#define CONFIG_ELOG_STATUS_ERRORS   (0x2004) //I32: Failed flash program or erase operations
+#define CONFIG_ELOG_STATUS_SEQUENCE (0x2005) //I32: Sequence number of the newest record in flash
+
+/*** Motor Identification Status (read only, not saved in EEPROM) ***/
+#define CONFIG_MOTID_STATUS_PREFIX  (0x2100)
+#define CONFIG_MOTID_STATUS_STATE   (0x2101) //I32: Identification step (MotId_State), 7 when done, 8 when failed
+#define CONFIG_MOTID_STATUS_ERROR   (0x2102) //I32: Reason for failure (MOTID_ERR_xxx)
+#define CONFIG_MOTID_STATUS_TIME    (0x2103) //I32: Time taken by the identification (ms)
+#define CONFIG_MOTID_STATUS_FLUX_VALID (0x2104) //I32: Non-zero if the flux linkage was measured (wheel free)
+
+/*** Cogging Compensation Status (read only, not saved in EEPROM) ***/
+#define CONFIG_COG_STATUS_PREFIX    (0x2200)
+#define CONFIG_COG_STATUS_UPDATES   (0x2201) //I32: Hall edges the table has learned from since startup
+#define CONFIG_COG_STATUS_PEAK      (0x2202) //I32: Largest table entry (mA)
+#define CONFIG_COG_STATUS_SAVING    (0x2203) //I32: Non-zero while the table is being written to flash
+#define CONFIG_COG_STATUS_SAVES     (0x2204) //I32: Tables saved since startup
+#define CONFIG_COG_STATUS_ERRORS    (0x2205) //I32: Flash erase or program failures
+
+/*** Pedal Assist Status (read only, not saved in EEPROM) ***/
+#define CONFIG_PAS_STATUS_PREFIX    (0x2300)
+#define CONFIG_PAS_STATUS_CADENCE   (0x2301) //F32: Crank cadence (rpm)
+#define CONFIG_PAS_STATUS_TORQUE    (0x2302) //F32: Rider torque (Nm)
+#define CONFIG_PAS_STATUS_COMMAND   (0x2303) //F32: Assist request, fraction of full torque
+#define CONFIG_PAS_STATUS_PEDALING  (0x2304) //I16: 0 = stopped, 1 = forward, 2 = backward
+
+/*** Debug Trace (not saved in EEPROM, only in builds with DTRACE_ENABLE) ***/
+#define CONFIG_DTRACE_PREFIX        (0x2400)
+#define CONFIG_DTRACE_MASK          (0x2401) //I32: Channels being recorded, bit N is DTRACE channel N
+
+/*** Boot Profile (read only, not saved in EEPROM) ***/
+#define CONFIG_BOOT_STATUS_PREFIX   (0x2500)
+#define CONFIG_BOOT_STATUS_STEP     (0x2501) //I32: Time from clock setup to the end of an init step (us)
+                                             // Add the step number (Boot_Step) to read a different step
+
+/*** Watchdog Status (read only, not saved in EEPROM) ***/
+#define CONFIG_WDT_STATUS_PREFIX    (0x2600)
+#define CONFIG_WDT_STATUS_MISSES    (0x2601) //I32: Supervisor passes that held back the watchdog since startup
+#define CONFIG_WDT_STATUS_LAST_RESET (0x2602) //I32: What held back the watchdog before the last reset (WDT_MISS_xxx)
+                                              // 0x01xx is an interrupt (Wdt_Source), 0x02xx is a main loop task
+
+/*** Firmware Update Status (read only, not saved in EEPROM) ***/
+#define CONFIG_FWUP_STATUS_PREFIX   (0x2700)
+#define CONFIG_FWUP_STATUS_STATE    (0x2701) //I32: Update progress (Fwup_State)
+#define CONFIG_FWUP_STATUS_RECEIVED (0x2702) //I32: Image bytes taken so far
+#define CONFIG_FWUP_STATUS_PROGRAMMED (0x2703) //I32: Image bytes written to the staging slot
+#define CONFIG_FWUP_STATUS_ERRORS   (0x2704) //I32: Updates stopped by a bad CRC or a flash failure
+
 /*** For EEPROM settings ***/
 #define TOTAL_EE_VARS   (CONFIG_ADC_NUMVARS + CONFIG_FOC_NUMVARS \
                         + CONFIG_MAIN_NUMVARS + CONFIG_THRT_NUMVARS \
                         + CONFIG_LMT_NUMVARS + CONFIG_MOTOR_NUMVARS \
-                        + CONFIG_DRV_NUMVARS)
+                        + CONFIG_DRV_NUMVARS + CONFIG_PAS_NUMVARS)
 
 /*** Routines - set to start ***/
 #define ROUTINE_SAVE_ALL_EEPROM     (0x0101)
 #define ROUTINE_LOAD_ALL_EEPROM     (0x0102)
 
 #define ROUTINE_HALL_DETECT         (0x0201)
+#define ROUTINE_MOTOR_IDENTIFY      (0x0202)
+#define ROUTINE_CURRENT_LOOP_TUNE   (0x0203)
+#define ROUTINE_COGGING_SAVE        (0x0204)
+#define ROUTINE_COGGING_CLEAR       (0x0205)
+#define ROUTINE_CURRENT_GAINS_COMMIT (0x0206)
 
 #define ROUTINE_SOFT_RESET          (0x0301)
 #define ROUTINE_BOOTLOADER_RESET    (0x0302)
 
+#define ROUTINE_SCHED_RESET_STATS   (0x0401)
+#define ROUTINE_TASK_RESET_STATS    (0x0402)
+
+#define ROUTINE_CLEAR_FAULTS        (0x0501)
+#define ROUTINE_CLEAR_EVENT_LOG     (0x0502)
+
+#define ROUTINE_FWUP_BEGIN          (0x0601)
+#define ROUTINE_FWUP_COMMIT         (0x0602)
+#define ROUTINE_FWUP_ABORT          (0x0603)
+
 /*** Features - toggle on or off ***/
 #define FEATURE_SERIAL_DATA         (0x0001)
 #define FEATURE_BLDC_MODE           (0x0002)
 #define FEATURE_DEBUG_PWM           (0x0003)
+#define FEATURE_FOC_CONTROL         (0x0004)
+#define FEATURE_CRUISE              (0x0005)
+#define FEATURE_WALK_ASSIST         (0x0006) // Has to be enabled again every half second to keep going
+#define FEATURE_REGEN_BRAKE         (0x0007) // Enabled while the brake lever is pulled
+#define FEATURE_COGGING_COMP        (0x0008)
+#define FEATURE_COGGING_LEARN       (0x0009) // Also turns on the compensation
 
 /*** Dashboard Data Format ***/
-#define DASHBOARD_DATA_LENGTH       (8*4)
+#define DASHBOARD_DATA_LENGTH       (9*4)
 // Param1: F32: Throttle position (%)
 // Param2: F32: Speed (rpm)
 // Param3: F32: Phase Amps
@@ -229,6 +382,7 @@ typedef enum _data_type {
 // Param6: F32: Controller FET Temperature (degC)
 // Param7: F32: Motor Temperature (degC)
 // Param8: I32: Fault Code
+// Param9: F32: Speed (km/h)
 
 // For the Hall sensor detection routine
 #define HALL_DETECT_RAMP_SPEED          (5.0f) // 5 Hz = 300 eRPM = 13 RPM
@@ -252,6 +406,22 @@ typedef enum _data_type {
 #define U16_300_DEG     ((uint16_t)54613)
 #define U16_330_DEG     ((uint16_t)60075)
 
+// Angle definitions - phase accumulator
+// This set of defines are the values of angles
+// as defined for Angle_Type, a 32 bit unsigned integer.
+#define U32_0_DEG       ((uint32_t)0u)
+#define U32_30_DEG      ((uint32_t)357913941u)
+#define U32_60_DEG      ((uint32_t)715827883u)
+#define U32_90_DEG      ((uint32_t)1073741824u)
+#define U32_120_DEG     ((uint32_t)1431655765u)
+#define U32_150_DEG     ((uint32_t)1789569707u)
+#define U32_180_DEG     ((uint32_t)2147483648u)
+#define U32_210_DEG     ((uint32_t)2505397589u)
+#define U32_240_DEG     ((uint32_t)2863311531u)
+#define U32_270_DEG     ((uint32_t)3221225472u)
+#define U32_300_DEG     ((uint32_t)3579139413u)
+#define U32_330_DEG     ((uint32_t)3937053355u)
+
 // Angle definitions - floating point
 // This set of defines are the integer values of angles
 // as defined for a single-precision float.
@@ -0,0 +1,58 @@
+/******************************************************************************
+ * Filename: regen.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _REGEN_H_
+#define _REGEN_H_
+
+#include "main_data_types.h"
+
+// Called from the speed loop
+#define REGEN_SAMPLING_RATE         ((float)DFLT_FOC_PWM_FREQ / (float)SCHED_SPEED_DIVIDER)
+// Regen torque ramps, in full scale per second
+#define REGEN_RISE_RATE             (2.0f) // 0->100% in half a second
+#define REGEN_FALL_RATE             (10.0f) // Let go quickly when the brake is released
+// Regen fades out over this range of bus voltage, ending this far below
+// MaxVoltFault so the bus doesn't ride right at the fault threshold
+#define REGEN_VBUS_FADE             (2.0f) // Volts
+#define REGEN_VBUS_MARGIN           (1.0f) // Volts
+// And at low speed, where there's little energy to recover
+#define REGEN_FADE_LOW_KMH          (3.0f) // None below this
+#define REGEN_FADE_HIGH_KMH         (8.0f) // Full above this
+
+typedef struct _regen_type {
+    uint8_t Brake; // Non-zero while the brake is applied
+    float Level; // Ramped regen request, 0 to 1
+    float Command; // After voltage and speed limits, 0 to 1
+    float RecoveredWh; // Energy returned to the battery
+} Regen_Type;
+
+void REGEN_Init(void);
+float REGEN_Process(Config_Main* cfg, float vbus, float speed_kmh, float batt_current, uint8_t direction);
+uint8_t REGEN_SetBrake(uint8_t brake);
+uint8_t REGEN_IsBraking(void);
+float REGEN_GetCommand(void);
+float REGEN_GetRecoveredWh(void);
+
+#endif //_REGEN_H_
@@ -0,0 +1,71 @@
+/******************************************************************************
+ * Filename: scheduler.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+// Used resources:
+// DWT cycle counter
+// TIM6_DAC and TIM7_DAC interrupt vectors (software triggered)
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+// Rate groups, highest priority first
+typedef enum _sched_group_type {
+    Sched_Current = 0, // Every PWM cycle (20kHz), from the ADC injected conversion interrupt
+    Sched_Speed = 1, // Speed and limit loops (2kHz)
+    Sched_Housekeeping = 2, // Thermal and housekeeping (100Hz)
+    Sched_Background = 3, // Main loop, runs with whatever time is left
+    Sched_NumGroups = 4
+} Sched_Group;
+
+typedef struct _sched_stats_type {
+    uint32_t Runs; // Number of times the group has run
+    uint32_t Overruns; // Deadline misses (skipped or late releases)
+    uint32_t BudgetOverruns; // Runs that took longer than the budget
+    uint32_t LastCycles; // Execution time of the latest run (CPU cycles)
+    uint32_t MaxCycles; // Worst case execution time (CPU cycles)
+    uint32_t BudgetCycles; // Allowed execution time (CPU cycles)
+} Sched_Stats_Type;
+
+// Slower rate groups are released every N ticks of the current loop
+#define SCHED_SPEED_DIVIDER             (10) // 20kHz / 10 = 2kHz
+#define SCHED_HOUSEKEEPING_DIVIDER      (200) // 20kHz / 200 = 100Hz
+
+// Execution time budgets.
+// Preemption by higher priority groups is not counted against a group's budget.
+#define SCHED_CURRENT_BUDGET_PCT        (50) // Percent of one PWM period
+#define SCHED_SPEED_BUDGET_PCT          (20) // Percent of one speed loop period
+#define SCHED_HOUSEKEEPING_BUDGET_PCT   (10) // Percent of one housekeeping period
+#define SCHED_BACKGROUND_BUDGET_US      (10000) // One pass of the main loop, well inside the watchdog timeout
+
+// Current loop releases that arrive later than this are counted as overruns
+#define SCHED_LATE_TICK_PCT             (150) // Percent of one PWM period
+
+void SCHED_Init(uint32_t tick_freq);
+void SCHED_Tick(void);
+void SCHED_Begin(Sched_Group group);
+void SCHED_End(Sched_Group group);
+void SCHED_ResetStats(void);
+uint32_t SCHED_GetStatistic(uint16_t value_ID);
+
+#endif //_SCHEDULER_H_
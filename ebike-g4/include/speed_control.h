@@ -0,0 +1,70 @@
+/******************************************************************************
+ * Filename: speed_control.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _SPEED_CONTROL_H_
+#define _SPEED_CONTROL_H_
+
+#include "main_data_types.h"
+
+// Called from the speed loop
+#define SPEED_SAMPLING_RATE         ((float)DFLT_FOC_PWM_FREQ / (float)SCHED_SPEED_DIVIDER)
+
+// Speed PI gains. Error is in km/h, output is a fraction of full torque.
+#define SPEED_KP                    (0.1f) // 10% torque per km/h
+#define SPEED_KI                    (0.0005f) // Integral time of 1 second
+#define SPEED_KC                    (0.0005f) // Back calculation anti-windup
+
+// Cruise control can't be engaged below this speed
+#define SPEED_CRUISE_MIN_KMH        (8.0f)
+// Walk assist
+#define SPEED_WALK_KMH              (6.0f) // Legal limit in most places
+#define SPEED_WALK_MAX_TORQUE       (0.3f) // Fraction of full torque
+#define SPEED_WALK_TIMEOUT          (0.5f) // Seconds. Has to be requested again within this time.
+
+typedef enum _speed_mode {
+    Speed_Off, // Torque follows the throttle
+    Speed_Cruise, // Hold the speed when cruise was engaged
+    Speed_Walk // Push the bike along at walking speed
+} Speed_Mode;
+
+typedef struct _speed_control_type {
+    Speed_Mode Mode;
+    float SetpointKmh; // Target speed
+    float SpeedKmh; // Latest measured speed
+    float KmhPerEHz; // Conversion from electrical frequency to road speed
+    uint16_t WalkTimeout; // Speed loop cycles until walk assist stops
+    PID_Type Loop;
+} Speed_Control_Type;
+
+void SPEED_Init(void);
+float SPEED_Process(Config_Main* cfg, float throttle, float speed_eHz, uint8_t batt_limiting);
+uint8_t SPEED_EngageCruise(void);
+uint8_t SPEED_EngageWalk(void);
+uint8_t SPEED_Disengage(void);
+Speed_Mode SPEED_GetMode(void);
+float SPEED_GetSpeedKmh(void);
+float SPEED_KmhPerEHz(Config_Main* cfg);
+
+#endif //_SPEED_CONTROL_H_
@@ -0,0 +1,67 @@
+/******************************************************************************
+ * Filename: tasks.h
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _TASKS_H_
+#define _TASKS_H_
+
+// Event flags, posted from interrupts with TASK_PostEvent
+#define TASK_EVENT_USB_RX           (0x00000001u) // USB serial data received
+#define TASK_EVENT_FLASH_DONE       (0x00000002u) // Flash program or erase finished
+#define TASK_EVENT_LIVE_READY       (0x00000004u) // Live data packet ready to send
+#define TASK_EVENT_MOTOR_ID         (0x00000008u) // Motor identification finished, results to save
+#define TASK_EVENT_CURRENT_GAINS    (0x00000010u) // Current loop retuned, gains to save
+#define TASK_NUM_EVENTS             (5)
+
+#define TASK_MAX_TASKS              (10)
+#define TASK_INVALID                (0xFF)
+
+// The watchdog supervisor runs this often. Must be well inside the IWDG timeout.
+#define TASK_SUPERVISOR_PERIOD_US   (10000)
+// Event driven tasks are late if they wait longer than this.
+// Periodic tasks are late if they wait longer than one period.
+#define TASK_EVENT_DEADLINE_US      (20000)
+
+typedef struct _task_type {
+    void (*Function)(void);
+    uint32_t Events; // Event flags that make this task ready
+    uint32_t PeriodCycles; // Run at this interval (CPU cycles), zero for event driven only
+    uint32_t NextRelease; // Cycle count when the next periodic run is due
+    uint32_t Runs; // Number of times the task has run
+    uint32_t LastLatency; // From ready to start of run (CPU cycles)
+    uint32_t MaxLatency; // Worst case latency (CPU cycles)
+    uint32_t MaxRunCycles; // Worst case execution time (CPU cycles)
+    uint32_t MissedCheckins; // Watchdog feeds held back by this task
+    uint32_t Echo; // Watchdog token, copied back each pass the task is kept up with
+    uint32_t LateToken; // Watchdog token when the task last ran late
+} Task_Type;
+
+void TASK_Init(void);
+uint8_t TASK_Register(void (*function)(void), uint32_t events, uint32_t period_us);
+void TASK_PostEvent(uint32_t events);
+void TASK_Run(void);
+void TASK_ResetStats(void);
+uint32_t TASK_GetStatistic(uint16_t value_ID);
+
+#endif //_TASKS_H_
@@ -35,7 +35,93 @@
 #define IWDG_PSC        ((uint32_t)0x00000000u) // For about 125usec granularity (32kHz/4)
 #define IWDG_REL_VAL    ((uint32_t)400) // 125usec * 400 = 50msec
 
+// Window watchdog, clocked from PCLK1 / 4096 / 128, about 3.1ms per count.
+// It's refreshed every time the housekeeping interrupt runs, which is
+// released by counting PWM cycles, so the period only moves by as long as
+// the faster interrupts hold it off. The window opens 3-6ms after a refresh
+// (the prescaler isn't reset), so a refresh that comes more than about 4ms
+// early resets the MCU. It also resets when the counter drops below 0x40,
+// about 195ms after a refresh, which rides out a blocking flash page erase.
+#define WWDG_TIMEBASE   (WWDG_CFR_WDGTB_2 | WWDG_CFR_WDGTB_1 | WWDG_CFR_WDGTB_0)
+#define WWDG_RELOAD     (0x7Fu)
+#define WWDG_WINDOW     (0x7Du)
+#define WWDG_COUNT_US   (3084) // 4096 * 128 / 170MHz
+#define WWDG_REFRESH_US (10000) // Housekeeping interrupt period
+
+// Interrupt code that has to keep running for the watchdog to be fed.
+// Main loop tasks are checked by the task supervisor.
+typedef enum {
+    Wdt_MotorISR = 0,
+    Wdt_SpeedISR,
+    Wdt_HousekeepingISR,
+    Wdt_NumSources
+} Wdt_Source;
+
+// Supervisor passes a source can go without checking in
+#define WDT_DEADLINE_MOTOR          (1)
+#define WDT_DEADLINE_SPEED          (1)
+#define WDT_DEADLINE_HOUSEKEEPING   (3) // Runs at 100Hz, about the supervisor rate
+
+// What held back the watchdog. The source or task number is added.
+#define WDT_MISS_NONE       (0x0000u)
+#define WDT_MISS_SOURCE     (0x0100u) // Plus the Wdt_Source
+#define WDT_MISS_TASK       (0x0200u) // Plus the task number
+#define WDT_MISS_MAGIC      (0x57445400u) // "WDT", kept through a reset
+
+// After a watchdog reset that the supervisor didn't get to record, the
+// breadcrumbs are used to find what was stuck. Counted in motor interrupts.
+#define WDT_NOT_RUNNING     (0xFFFFFFFFu)
+#define WDT_STUCK_SPEED     (SCHED_SPEED_DIVIDER * 2) // Two speed loop periods
+#define WDT_STUCK_HOUSEKEEPING (SCHED_HOUSEKEEPING_DIVIDER) // One housekeeping period
+#define WDT_STUCK_TASK      (500) // 25ms at 20kHz, half the IWDG timeout
+
+// Kept through a reset. Written as things start and finish, so whatever
+// was running when the watchdog went off is still here afterwards.
+typedef struct _wdt_breadcrumbs {
+    uint32_t Magic; // WDT_MISS_MAGIC once set up
+    uint32_t Miss; // What held back the last supervisor pass
+    uint32_t Tick; // Motor interrupt count
+    uint32_t Task; // WDT_MISS_TASK plus the task being run, WDT_MISS_NONE between tasks
+    uint32_t TaskStart; // Tick when the task started
+    uint32_t Entered[Wdt_NumSources]; // Tick when each interrupt started, WDT_NOT_RUNNING once it's done
+} Wdt_Breadcrumbs;
+
+// Each pass, the supervisor hands out a new token. A source checks in by
+// copying it back, which is cheap enough for the motor interrupt.
+extern volatile uint32_t Wdt_Token;
+extern volatile uint32_t Wdt_Echo[Wdt_NumSources];
+extern volatile Wdt_Breadcrumbs Wdt_Crumbs;
+
+// Call first thing in each interrupt
+static inline void WDT_CheckIn(Wdt_Source source) {
+    Wdt_Echo[source] = Wdt_Token;
+    if(source == Wdt_MotorISR) {
+        Wdt_Crumbs.Tick++;
+    }
+    Wdt_Crumbs.Entered[source] = Wdt_Crumbs.Tick;
+}
+
+// Call last thing in each interrupt
+static inline void WDT_CheckOut(Wdt_Source source) {
+    Wdt_Crumbs.Entered[source] = WDT_NOT_RUNNING;
+}
+
+// Around each main loop task
+static inline void WDT_TaskStart(uint8_t task) {
+    Wdt_Crumbs.TaskStart = Wdt_Crumbs.Tick;
+    Wdt_Crumbs.Task = WDT_MISS_TASK + task;
+}
+
+static inline void WDT_TaskEnd(void) {
+    Wdt_Crumbs.Task = WDT_MISS_NONE;
+}
+
+void WDT_CheckLastReset(void);
 void WDT_Init(void);
 void WDT_Feed(void);
+void WDT_RefreshWindow(void);
+uint32_t WDT_CheckSources(void);
+void WDT_RecordMiss(uint32_t miss);
+uint32_t WDT_GetStatistic(uint16_t value_ID);
 
 #endif //WDT_H_
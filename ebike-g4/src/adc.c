@@ -33,48 +33,24 @@ uint16_t adc2_raw_regular_results[8];
 uint16_t adc3_raw_regular_results[8];
 uint16_t adc4_raw_regular_results[8];
 
-uint16_t adc_conv[NUM_ADC_CH];
-uint16_t adc_current_null[NUM_CUR_CH];
+uint16_t adc_conv[NUM_ADC_CH] CCMRAM_BSS;
+uint16_t adc_current_null[NUM_CUR_CH] CCMRAM_BSS;
 float adc_vref;
 
 Config_ADC config_adc;
 
 static void ADC_Enable(ADC_TypeDef* adc);
+static void ADC_StartVref(void);
 static void ADC_CalcVref(void);
+static float ADC_ThermistorDegC(uint16_t counts);
 /**
- * @brief Initialize the ADC peripherals
- *
- * Initializes two or four ADC units for regular and injected conversion modes.
- * All ADCs are triggered by TIM1 TRGO (should be set to CCR4)
- * In two channel mode:
- * ADC1 converts IA, IC, VC, VBUS, and Motor Temp
- * ADC2 converts IB, VA, VB, Throttle, and FET Temp
- * In four channel mode:
- * ADC1 converts IC and Motor Temp
- * ADC2 converts IB, VA, VB, Throttle, and FET Temp
- * ADC3 converts IA and VC
- * ADC4 converts VBUS
- *
- * Currents are converted in injected mode. All others are done
- * in regular sequence.
- *
- * According to the errata, we should always perform two conversions
- * and throw out the second one due to instability when switching
- * inputs. The sampling switch changes to the next input in the
- * middle of a conversion, but if the next conversion is the same
- * as the current conversion, no switching will take place. Therefore,
- * we should use the first conversion of two of the same channel as the
- * best conversion.
- *
- * ADCs are all triggered together, which should help solve some of the
- * sampling switching issues. All the sampling times should be the same
- * for either injected or regular mode.
+ * @brief Powers up the ADCs: analog pins, clocks, and the internal
+ *        voltage regulators, then starts the calibration and the Vrefint
+ *        measurement. Those take about a millisecond, so this is called
+ *        early in startup and they run while the EEPROM loads. ADC_Init
+ *        finishes the job.
  */
-void ADC_Init(void) {
-
-    // Load from eeprom
-    ADC_LoadVariables();
-
+void ADC_PowerUp(void) {
     // Enable all the GPIO clocks
     GPIO_Clk(ADC_MTEMP_PORT); GPIO_Clk(ADC_FTEMP_PORT);
     GPIO_Clk(ADC_IA_PORT); GPIO_Clk(ADC_IB_PORT); GPIO_Clk(ADC_IC_PORT);
@@ -117,28 +93,61 @@ void ADC_Init(void) {
     ADC2->CR |= ADC_CR_ADVREGEN;
     ADC3->CR |= ADC_CR_ADVREGEN;
     ADC4->CR |= ADC_CR_ADVREGEN;
-    // Wait for it to stabilize
-    Delay(ADC_VREG_STARTUP_DELAY);
-
-    // Perform calibrations
-    ADC1->CR |= ADC_CR_ADCAL;
-    while((ADC1->CR & ADC_CR_ADCAL) != 0) {
+    // Calibration needs them settled, which is quick
+    uint32_t start = DWT->CYCCNT;
+    while((DWT->CYCCNT - start) < ((SystemCoreClock / 1000000u) * ADC_VREG_STARTUP_US)) {
         // pass
     }
+
+    // Calibrate all four at once. ADC_Init waits for them to finish.
+    ADC1->CR |= ADC_CR_ADCAL;
     ADC2->CR |= ADC_CR_ADCAL;
-    while((ADC2->CR & ADC_CR_ADCAL) != 0) {
-        // pass
-    }
     ADC3->CR |= ADC_CR_ADCAL;
-    while((ADC3->CR & ADC_CR_ADCAL) != 0) {
-        // pass
-    }
     ADC4->CR |= ADC_CR_ADCAL;
-    while((ADC4->CR & ADC_CR_ADCAL) != 0) {
+    // Then measure Vrefint on ADC1 as soon as it's calibrated
+    ADC_StartVref();
+}
+
+/**
+ * @brief Initialize the ADC peripherals, once ADC_PowerUp has been called
+ *
+ * Initializes two or four ADC units for regular and injected conversion modes.
+ * All ADCs are triggered by TIM1 TRGO (should be set to CCR4)
+ * In two channel mode:
+ * ADC1 converts IA, IC, VC, VBUS, and Motor Temp
+ * ADC2 converts IB, VA, VB, Throttle, and FET Temp
+ * In four channel mode:
+ * ADC1 converts IC and Motor Temp
+ * ADC2 converts IB, VA, VB, Throttle, and FET Temp
+ * ADC3 converts IA and VC
+ * ADC4 converts VBUS
+ *
+ * Currents are converted in injected mode. So is VBUS, on ADC4, so the
+ * fault check sees a fresh bus voltage every PWM cycle. All others are
+ * done in regular sequence.
+ *
+ * According to the errata, we should always perform two conversions
+ * and throw out the second one due to instability when switching
+ * inputs. The sampling switch changes to the next input in the
+ * middle of a conversion, but if the next conversion is the same
+ * as the current conversion, no switching will take place. Therefore,
+ * we should use the first conversion of two of the same channel as the
+ * best conversion.
+ *
+ * ADCs are all triggered together, which should help solve some of the
+ * sampling switching issues. All the sampling times should be the same
+ * for either injected or regular mode.
+ */
+void ADC_Init(void) {
+
+    // Load from eeprom
+    ADC_LoadVariables();
+
+    // Calibration and the Vrefint conversion were started by ADC_PowerUp,
+    // and have usually finished while the EEPROM was loading
+    while(((ADC1->CR | ADC2->CR | ADC3->CR | ADC4->CR) & ADC_CR_ADCAL) != 0) {
         // pass
     }
-
-    // Measure and store VREF by converting Vrefint
     ADC_CalcVref();
 
 
@@ -194,11 +203,14 @@ void ADC_Init(void) {
 
     // Injected sequences
     // ADC1, 2, and 3 convert the current sensor 2 times each
-    // ADC4 doesn't have an injected sequence
+    // ADC4 converts VBUS 2 times. With the longer sampling time it finishes
+    // after the currents, so the motor interrupt reads the previous cycle's
+    // result, which is never more than one PWM cycle old.
     // External trigger is TIM1_TRGO, rising edge (set to oc4ref in TIM1)
     ADC1->JSQR = 1 | ADC_JSQR_JEXTEN_0 | (ADC_IC_CH << 9U) | (ADC_IC_CH << 15U);
     ADC2->JSQR = 1 | ADC_JSQR_JEXTEN_0 | (ADC_IB_CH << 9U) | (ADC_IB_CH << 15U);
     ADC3->JSQR = 1 | ADC_JSQR_JEXTEN_0 | (ADC_IA_CH << 9U) | (ADC_IA_CH << 15U);
+    ADC4->JSQR = 1 | ADC_JSQR_JEXTEN_0 | (ADC_VBUS_CH << 9U) | (ADC_VBUS_CH << 15U);
 
     // External trigger selection (regular sequence): hardware trigger on rising edge
     // of TIM1_TRGO2 (set to oc5ref in TIM1)
@@ -286,27 +298,40 @@ void ADC_Init(void) {
     ADC1->CR |= ADC_CR_ADSTART | ADC_CR_JADSTART;
     ADC2->CR |= ADC_CR_ADSTART | ADC_CR_JADSTART;
     ADC3->CR |= ADC_CR_ADSTART | ADC_CR_JADSTART;
-    ADC4->CR |= ADC_CR_ADSTART;
+    ADC4->CR |= ADC_CR_ADSTART | ADC_CR_JADSTART;
 }
 
 /**
- * @brief  Converts Vrefint to determine value of VDDA/VREF+
+ * @brief  Starts converting Vrefint on ADC1, to find VDDA/VREF+. The
+ *         hardware oversampler averages the samples, so it runs by itself
+ *         while the EEPROM loads. ADC_CalcVref picks up the result.
  */
-static void ADC_CalcVref(void) {
-    // Save current values of things we're gonna change.
-    uint32_t temp_smpr2 = ADC1->SMPR2;
-    uint32_t temp_sqr1 = ADC1->SQR1;
-    uint32_t temp_cfgr = ADC1->CFGR;
-    uint32_t temp_cfgr2 = ADC1->CFGR2;
-    uint32_t temp_ier = ADC1->IER;
-
-    // Clear 'em.
+static void ADC_StartVref(void) {
+    // ADC1 has to be calibrated before it's enabled
+    while((ADC1->CR & ADC_CR_ADCAL) != 0) {
+        // pass
+    }
+    // One software started conversion, oversampled
     ADC1->CFGR = 0;
-    ADC1->CFGR2 = 0;
-    ADC1->SQR1 = 0;
-    ADC1->SMPR2 = 0;
+    ADC1->CFGR2 = ADC_CFGR2_ROVSE | (ADC_VREF_OVSR << ADC_CFGR2_OVSR_Pos)
+                | (ADC_VREF_OVSS << ADC_CFGR2_OVSS_Pos);
     ADC1->IER = 0;
 
+    // Sampling time for Vrefint has to be at least 4us
+    // 247.5 cycles at 42.5MHz = 5.82us, 128 of them is about 0.8ms
+    ADC1->SMPR2 = (0x06) << ((ADC_VREFINT_CH-10U) * 3U);
+    ADC1->SQR1 = ((ADC_VREFINT_CH) << 6U);
+
+    ADC_Enable(ADC1);
+    ADC1->CR |= ADC_CR_ADSTART;
+}
+
+/**
+ * @brief  Waits for the conversion from ADC_StartVref, and works out
+ *         VDDA/VREF+ from it. Leaves ADC1 disabled, ready to be set up
+ *         for dual mode.
+ */
+static void ADC_CalcVref(void) {
     float vrefint = 0.0f;
     uint16_t* vrefcal = ((uint16_t*) 0x1FFF75AA); // From STM32G4 datasheet
 
@@ -317,54 +342,29 @@ static void ADC_CalcVref(void) {
         vrefint = VREFINTDEFAULT;
     }
 
-    // Check if we need to power up
-    if(((ADC1->CR & ADC_CR_DEEPPWD) != 0) || ((ADC1->CR & ADC_CR_ADVREGEN) == 0)) {
-        ADC1->CR &= (~ADC_CR_DEEPPWD);
-        ADC1->CR |= ADC_CR_ADVREGEN;
-        Delay(ADC_VREG_STARTUP_DELAY);
+    while ((ADC1->ISR & ADC_ISR_EOC) == 0) {
+        // pass
     }
+    adc_vref = vrefint / ((float) ADC1->DR / MAXCOUNTF);
 
-    // Turn on ADC1, it will be used alone for this
-    ADC_Enable(ADC1);
-
-    // Sampling time for Vrefint has to be at least 4us
-    // 247.5 cycles at 42.5MHz = 5.82us
-    ADC1->SMPR2 = (0x06) << ((ADC_VREFINT_CH-10U) * 3U);
-
-    // Perform single conversions of the Vrefint channel
-    ADC1->SQR1 = ((ADC_VREFINT_CH) << 6U);
-
-    uint32_t vref_sum = 0;
-    for (uint8_t i = 0; i < ADC_NUM_INTEG_SAMPLES; i++) {
-        ADC1->CR |= ADC_CR_ADSTART;
-        while ((ADC1->ISR & ADC_ISR_EOC) == 0) {
-            // pass
-        }
-        ADC1->ISR &= ~(ADC_ISR_EOC);
-        vref_sum += ADC1->DR;
+    // Dual mode can only be selected with the ADCs disabled
+    ADC1->CR |= ADC_CR_ADDIS;
+    while((ADC1->CR & ADC_CR_ADEN) != 0) {
+        // pass
     }
-
-    adc_vref = vrefint
-            / ((float) (vref_sum / ADC_NUM_INTEG_SAMPLES) / MAXCOUNTF);
-
-    // Reset all the stuff that was changed
-    ADC1->SMPR2 = temp_smpr2;
-    ADC1->SQR1 = temp_sqr1;
-    ADC1->CFGR = temp_cfgr;
-    ADC1->CFGR2 = temp_cfgr2;
-    ADC1->IER = temp_ier;
-
+    ADC1->CFGR2 = 0;
 }
 
-void ADC_InjSeqComplete(void) {
+void CCMRAM_FUNC ADC_InjSeqComplete(void) {
     adc_conv[ADC_IA] = ADC3->JDR1;
     adc_conv[ADC_IB] = ADC2->JDR1;
     adc_conv[ADC_IC] = ADC1->JDR1;
-
+    adc_conv[ADC_VBUS] = ADC4->JDR1;
 }
 
 void ADC_RegSeqComplete(void) {
-    adc_conv[ADC_VBUS] = adc4_raw_regular_results[0];
+    // VBUS comes from the injected sequence. The regular sequence on ADC4
+    // is kept so it stays in step with ADC3 in dual mode.
     adc_conv[ADC_THR] = adc2_raw_regular_results[4];
     adc_conv[ADC_FTEMP] = adc2_raw_regular_results[6];
     adc_conv[ADC_MTEMP] = adc1_raw_regular_results[0];
@@ -391,7 +391,7 @@ void ADC_AverageInitialValue(void) {
     // TODO: do I need this? Can I do it after already initializing the ADC?
 }
 
-float ADC_ConvertToAmps(int32_t rawCurrentReading) {
+float CCMRAM_FUNC ADC_ConvertToAmps(int32_t rawCurrentReading) {
     // Assume null point has already been subtracted.
     // The raw reading is a 12-bit number
     float temp_current = ((float) rawCurrentReading) / MAXCOUNTF;
@@ -403,7 +403,7 @@ float ADC_ConvertToAmps(int32_t rawCurrentReading) {
     return temp_current;
 }
 
-float ADC_GetCurrent(uint8_t which_cur) {
+float CCMRAM_FUNC ADC_GetCurrent(uint8_t which_cur) {
     return ADC_ConvertToAmps(
             (int32_t) (adc_conv[which_cur])
                     - (int32_t) (adc_current_null[which_cur]));
@@ -422,7 +422,7 @@ float ADC_GetThrottle(void) {
     return temp_throttle;
 }
 
-float ADC_GetVbus(void) {
+float CCMRAM_FUNC ADC_GetVbus(void) {
     // Convert 12-bit to float
     float temp_vbus = ((float) adc_conv[ADC_VBUS]) / MAXCOUNTF;
     // Convert to volts from reference
@@ -442,7 +442,20 @@ void ADC_SetNull(uint8_t which_cur, uint16_t nullVal) {
 }
 
 float ADC_GetFetTempDegC(void) {
-    
+    return ADC_ThermistorDegC(adc_conv[ADC_FTEMP]);
+}
+
+float ADC_GetMotorTempDegC(void) {
+    return ADC_ThermistorDegC(adc_conv[ADC_MTEMP]);
+}
+
+/**
+ * @brief  Converts a thermistor divider reading to temperature.
+ *         The motor and FET thermistors share the same settings.
+ * @param  counts - Raw 12-bit ADC reading
+ * @retval Temperature in degC
+ */
+static float ADC_ThermistorDegC(uint16_t counts) {
     // Step 1: Calculate thermistor resistance right now
     // Fixed resistor is at the bottom of the voltage divider,
     // thermistor is on top.
@@ -455,7 +468,7 @@ float ADC_GetFetTempDegC(void) {
     // Rt = Rf*(1-adc)/adc, which simplifies to Rf*(1/adc - 1)
     
     // Convert 12-bit to float
-    float temp = ((float) adc_conv[ADC_FTEMP]) / MAXCOUNTF;
+    float temp = ((float) counts) / MAXCOUNTF;
     // Calculate resistance
 //    temp = TEMP_FIXED_RESISTOR * (1.0f/temp - 1.0f);
     temp = config_adc.Thermistor_Fixed_R * (1.0f/temp - 1.0f);
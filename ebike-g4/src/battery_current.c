@@ -0,0 +1,140 @@
+/******************************************************************************
+ * Filename: battery_current.c
+ * Description: Battery current estimation and limiting. There is no sensor
+ *              for the battery current, so it is calculated from the power
+ *              going into the motor. With the amplitude invariant Clarke
+ *              transform, power is 3/2 * (Vd*Id + Vq*Iq). The SVM output
+ *              (Td, Tq) gives phase voltage amplitude Vbus/sqrt(3) at 1.0,
+ *              so dividing the power by Vbus:
+ *
+ *                  Ibatt = sqrt(3)/2 * (Td*Id + Tq*Iq) + losses
+ *
+ *              Bus voltage cancels out completely. Losses cover dead time
+ *              (the real voltage is smaller than commanded), switching, and
+ *              the controller's own supply current.
+ *
+ *              The same equation is solved for Iq every cycle, giving the
+ *              range of Iq that keeps both the battery draw and the regen
+ *              charge current inside their limits.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+#include <math.h>
+
+IBatt_Type IBatt;
+
+static float IBATT_Losses(float id, float iq);
+
+void IBATT_Init(void) {
+    IBatt.Raw = 0.0f;
+    IBatt.Filtered = 0.0f;
+    // Single pole low pass
+    IBatt.FiltCoef = 2.0f * PI * IBATT_FILT / IBATT_SAMPLING_RATE;
+    IBatt.IqMax = 0.0f;
+    IBatt.IqMin = 0.0f;
+    IBatt.Limiting = 0;
+}
+
+/**
+ * @brief  Estimates the battery current. Call once per PWM cycle.
+ * @param  td - d-axis voltage command, as a fraction of SVM output
+ * @param  tq - q-axis voltage command, as a fraction of SVM output
+ * @param  id - Measured d-axis current (A)
+ * @param  iq - Measured q-axis current (A)
+ * @retval Battery current (A), positive when drawing from the battery
+ */
+float CCMRAM_FUNC IBATT_Estimate(float td, float tq, float id, float iq) {
+    IBatt.Raw = SQRT3_OVER_2 * (td * id + tq * iq) + IBATT_Losses(id, iq);
+    IBatt.Filtered += (IBatt.Raw - IBatt.Filtered) * IBatt.FiltCoef;
+    return IBatt.Raw;
+}
+
+/**
+ * @brief  Clips the Iq request to the battery current limits. Uses the
+ *         voltages and currents from the latest cycle, so the limit is
+ *         one cycle behind, but the current loop is much slower than that.
+ * @param  cfg - Main configuration, for the battery limits
+ * @param  iq_ref - Requested q-axis current (A)
+ * @param  td - d-axis voltage command, as a fraction of SVM output
+ * @param  tq - q-axis voltage command, as a fraction of SVM output
+ * @param  id - Measured d-axis current (A)
+ * @param  iq - Measured q-axis current (A)
+ * @retval The allowed q-axis current (A)
+ */
+float CCMRAM_FUNC IBATT_LimitIq(Config_Main* cfg, float iq_ref, float td, float tq, float id, float iq) {
+    // Battery current that doesn't depend on Iq
+    float base = SQRT3_OVER_2 * td * id + IBATT_Losses(id, iq);
+    float k = SQRT3_OVER_2 * tq;
+
+    if(tq > IBATT_MIN_TQ) {
+        IBatt.IqMax = (cfg->MaxBatteryCurrent - base) / k;
+        IBatt.IqMin = (-cfg->MaxBatteryRegenCurrent - base) / k;
+    } else if(tq < -IBATT_MIN_TQ) {
+        // Spinning backwards, the sign of power flips
+        IBatt.IqMax = (-cfg->MaxBatteryRegenCurrent - base) / k;
+        IBatt.IqMin = (cfg->MaxBatteryCurrent - base) / k;
+    } else {
+        // Not enough back EMF to draw or return much battery current
+        IBatt.IqMax = cfg->MaxPhaseCurrent;
+        IBatt.IqMin = -cfg->MaxPhaseCurrent;
+    }
+
+    IBatt.Limiting = 0;
+    if(iq_ref > IBatt.IqMax) {
+        iq_ref = IBatt.IqMax;
+        IBatt.Limiting = 1;
+    }
+    if(iq_ref < IBatt.IqMin) {
+        iq_ref = IBatt.IqMin;
+        IBatt.Limiting = 1;
+    }
+    return iq_ref;
+}
+
+float IBATT_GetCurrent(void) {
+    return IBatt.Raw;
+}
+
+float IBATT_GetFilteredCurrent(void) {
+    return IBatt.Filtered;
+}
+
+uint8_t IBATT_IsLimiting(void) {
+    return IBatt.Limiting;
+}
+
+/**
+ * @brief  Battery current that isn't in the commanded power.
+ * @param  id - Measured d-axis current (A)
+ * @param  iq - Measured q-axis current (A)
+ * @retval Loss current (A)
+ */
+static float CCMRAM_FUNC IBATT_Losses(float id, float iq) {
+    float imag = sqrtf(id * id + iq * iq);
+    // Dead time error is a square wave in phase with the current, with
+    // the fundamental at 4/pi of its height. Times 3/2 for power, and
+    // divided by Vbus, that's 6/pi * dead time fraction per amp.
+    float deadtime = (6.0f / PI) * IBATT_DEADTIME_FRACTION * imag;
+    return (IBATT_SWITCHING_LOSS * imag) - deadtime + IBATT_IDLE_CURRENT;
+}
@@ -0,0 +1,213 @@
+/******************************************************************************
+ * Filename: bldc.c
+ * Description: Six-step (trapezoidal) commutation from the Hall sensors.
+ *              At standstill and low speed the interpolated Hall angle
+ *              isn't good enough for FOC, so two phases are driven and
+ *              the third floats. The voltage vector is the one closest
+ *              to 90 degrees ahead of the rotor, and its length comes
+ *              from the same q axis current PI that FOC uses. That way
+ *              the handover is bumpless: once the speed has been above
+ *              SpeedToFOC for CountsToFOC PWM cycles, FOC takes over at
+ *              the moment its voltage vector lines up with the six-step
+ *              vector to within SwitchEpsilon. If the Hall angle becomes
+ *              invalid, six-step takes over again.
+ ******************************************************************************
+
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+#include <math.h>
+
+BLDC_Type Bldc;
+
+void BLDC_Init(void) {
+    Bldc.Enabled = 0;
+    Bldc.Forced = 0;
+    Bldc.Sector = BLDC_SECTOR_NONE;
+    Bldc.AboveSpeedCount = 0;
+    Bldc.AngleError = 0.0f;
+    Bldc.Handovers = 0;
+    Bldc.Fallbacks = 0;
+}
+
+uint8_t BLDC_Enable(void) {
+    Bldc.AboveSpeedCount = 0;
+    Bldc.Enabled = 1;
+    return RETVAL_OK;
+}
+
+uint8_t BLDC_Disable(void) {
+    Bldc.Enabled = 0;
+    return RETVAL_OK;
+}
+
+uint8_t CCMRAM_FUNC BLDC_IsEnabled(void) {
+    return Bldc.Enabled;
+}
+
+/**
+ * @brief  Sets up the outputs for six-step. Call every PWM cycle while
+ *         in six-step mode.
+ * @param  hall_state - Hall state, 1 to 6. Anything else floats all phases.
+ * @param  angle - Rotor angle, a full revolution is 2^32
+ * @param  vq - Voltage command from the q axis PI, -1 to 1
+ * @param  pwm - Duty cycles, written for the PWM phase and zero otherwise
+ * @retval None
+ */
+void CCMRAM_FUNC BLDC_Commutate(uint8_t hall_state, Angle_Type angle, float vq, Motor_PWMDuties* pwm) {
+    Angle_Type vector;
+    uint8_t sector;
+
+    // Voltage 90 degrees ahead of the rotor for positive torque, behind for negative
+    if(vq >= 0.0f) {
+        vector = angle + U32_90_DEG;
+    } else {
+        vector = angle + U32_270_DEG;
+        vq = -vq;
+    }
+    if(vq > BLDC_MAX_DUTY) {
+        vq = BLDC_MAX_DUTY;
+    }
+    // Six vectors, centered at 30 + 60*n degrees. The top 32 bits of
+    // vector * 6 are the sector, 0 to 5.
+    sector = (uint8_t)(((uint64_t)vector * 6u) >> 32);
+    Bldc.AngleError = ANGLE_DELTA_TO_FLOAT(vector - (U32_30_DEG + sector * U32_60_DEG));
+
+    if((hall_state < 1) || (hall_state > 6)) {
+        // Broken Hall sensor wiring, nothing sensible to do
+        sector = BLDC_SECTOR_NONE;
+    }
+
+    pwm->tA = 0.0f;
+    pwm->tB = 0.0f;
+    pwm->tC = 0.0f;
+    // Output modes only change on a new sector
+    if((sector != Bldc.Sector) || (Bldc.Forced == 0)) {
+        switch(sector) {
+        case 0: // A+ C-
+            PHASE_B_OFF();
+            PHASE_C_LOW();
+            PHASE_A_PWM();
+            break;
+        case 1: // B+ C-
+            PHASE_A_OFF();
+            PHASE_C_LOW();
+            PHASE_B_PWM();
+            break;
+        case 2: // B+ A-
+            PHASE_C_OFF();
+            PHASE_A_LOW();
+            PHASE_B_PWM();
+            break;
+        case 3: // C+ A-
+            PHASE_B_OFF();
+            PHASE_A_LOW();
+            PHASE_C_PWM();
+            break;
+        case 4: // C+ B-
+            PHASE_A_OFF();
+            PHASE_B_LOW();
+            PHASE_C_PWM();
+            break;
+        case 5: // A+ B-
+            PHASE_C_OFF();
+            PHASE_B_LOW();
+            PHASE_A_PWM();
+            break;
+        default:
+            PHASE_A_OFF();
+            PHASE_B_OFF();
+            PHASE_C_OFF();
+            break;
+        }
+        Bldc.Sector = sector;
+        Bldc.Forced = 1;
+    }
+    switch(sector) {
+    case 0:
+    case 5:
+        pwm->tA = vq;
+        break;
+    case 1:
+    case 2:
+        pwm->tB = vq;
+        break;
+    case 3:
+    case 4:
+        pwm->tC = vq;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief  Puts all three phases back to normal complementary PWM.
+ *         Does nothing if they already are.
+ * @retval None
+ */
+void CCMRAM_FUNC BLDC_Release(void) {
+    if(Bldc.Forced != 0) {
+        PHASE_A_PWM();
+        PHASE_B_PWM();
+        PHASE_C_PWM();
+        Bldc.Forced = 0;
+        Bldc.Sector = BLDC_SECTOR_NONE;
+    }
+}
+
+/**
+ * @brief  Decides if it's time to hand over to FOC. Call every PWM cycle
+ *         in six-step mode. Uses the angle error from the last commutation.
+ * @param  cfg - Main configuration, for the handover settings
+ * @param  speed - Rotor speed, electrical Hz
+ * @param  angle_valid - ANGLE_VALID if the interpolated Hall angle can be used
+ * @retval Non-zero if FOC should take over on this cycle
+ */
+uint8_t CCMRAM_FUNC BLDC_CheckHandover(Config_Main* cfg, float speed, uint8_t angle_valid) {
+    if((angle_valid == ANGLE_VALID) && (fabsf(speed) > cfg->SpeedToFOC)) {
+        if(Bldc.AboveSpeedCount < cfg->CountsToFOC) {
+            Bldc.AboveSpeedCount++;
+            return 0;
+        }
+    } else {
+        Bldc.AboveSpeedCount = 0;
+        return 0;
+    }
+    // Fast enough for long enough. Wait for the vectors to line up.
+    if(fabsf(Bldc.AngleError) < cfg->SwitchEpsilon) {
+        Bldc.AboveSpeedCount = 0;
+        Bldc.Handovers++;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief  Records a transition from FOC back to six-step.
+ * @retval None
+ */
+void CCMRAM_FUNC BLDC_Fallback(void) {
+    Bldc.AboveSpeedCount = 0;
+    Bldc.Fallbacks++;
+}
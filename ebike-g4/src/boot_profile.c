@@ -0,0 +1,69 @@
+/******************************************************************************
+ * Filename: boot_profile.c
+ * Description: Boot time profile. Each init step in main() is timestamped
+ *              with the DWT cycle counter, counting from the end of the
+ *              clock setup. The times can be read over the data interface
+ *              to see where startup is spending its time.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+
+static uint32_t boot_start_cycles;
+static uint32_t boot_step_cycles[Boot_NumSteps];
+
+/**
+ * @brief  Starts the cycle counter and the boot profile. Call as soon as
+ *         the clocks are running at full speed.
+ * @retval None
+ */
+void BOOT_Start(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    boot_start_cycles = DWT->CYCCNT;
+}
+
+/**
+ * @brief  Records the end of an init step.
+ * @param  step - The step that just finished
+ * @retval None
+ */
+void BOOT_Mark(Boot_Step step) {
+    if(step < Boot_NumSteps) {
+        boot_step_cycles[step] = DWT->CYCCNT - boot_start_cycles;
+    }
+}
+
+/**
+ * @brief  Gets the boot profile for the data interface.
+ * @param  value_ID - CONFIG_BOOT_STATUS_STEP plus the step number
+ * @retval Time from BOOT_Start to the end of the step (us), or zero if
+ *         the ID is invalid
+ */
+uint32_t BOOT_GetStatistic(uint16_t value_ID) {
+    uint16_t step = value_ID - CONFIG_BOOT_STATUS_STEP;
+    if((value_ID < CONFIG_BOOT_STATUS_STEP) || (step >= Boot_NumSteps)) {
+        return 0;
+    }
+    return boot_step_cycles[step] / (SystemCoreClock / 1000000u);
+}
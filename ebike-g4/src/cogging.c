@@ -0,0 +1,379 @@
+/******************************************************************************
+ * Filename: cogging.c
+ * Description: Cogging and torque ripple compensation. A table of q axis
+ *              current offsets, indexed by electrical angle, is added to
+ *              the current command every PWM cycle. The lookup is one
+ *              table read and a linear interpolation.
+ *
+ *              The table learns itself at low speed, from the speed over
+ *              each Hall sector. The rotor speeds up across a sector where
+ *              the motor makes too much torque, so the offsets for that
+ *              sector are nudged down by how much faster the next sector
+ *              was than the one before it, and up where it slows down.
+ *              The speed itself lags the torque by a quarter of a cycle,
+ *              so it can't be used directly. Six sectors a revolution see
+ *              the first and second harmonics of the ripple, with some of
+ *              the fourth and fifth folded onto them. The sixth, and slot
+ *              cogging above it, averages out over every sector and isn't
+ *              learned (test_cogging).
+ *
+ *              The table can be saved to a dedicated flash page, stored as
+ *              one signed byte per bin, and is loaded again on startup.
+ ******************************************************************************
+
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include "main.h"
+#include <math.h>
+
+#define COG_SAVE_IDLE           (0xFFFFu)
+#define COG_SAVE_ERASE          (0xFFFEu)
+#define COG_FLASH_DOUBLE_WORDS  (sizeof(Cog_Flash_Type) / 8)
+
+static Cog_Type Cog;
+// Image of the flash page contents while a save is in progress
+static Cog_Flash_Type cog_image;
+static uint16_t cog_save_dw;
+static uint8_t cog_erasing;
+static uint8_t cog_bank;
+static uint32_t cog_address;
+static uint32_t cog_saves;
+static uint32_t cog_flash_errors;
+
+static void COG_Load(void);
+static uint32_t COG_CalcCRC(Cog_Flash_Type* image);
+static uint16_t COG_Bin(Angle_Type angle);
+
+/**
+ * @brief  Sets up the compensation table, and loads the saved one from
+ *         flash if there is a good one. Compensation and learning both
+ *         start off. Call after CRC_Init.
+ * @retval None
+ */
+void COG_Init(void) {
+    Cog.Enabled = 0;
+    Cog.Learning = 0;
+    Cog.PreviousState = 0;
+    Cog.Edges = 0;
+    Cog.MeanSpeed = 0.0f;
+    Cog.Updates = 0;
+    cog_save_dw = COG_SAVE_IDLE;
+    cog_erasing = 0;
+    cog_saves = 0;
+    cog_flash_errors = 0;
+
+    // Same bank mode check as the EEPROM emulation
+    if((FLASH->OPTR & FLASH_OPTR_DBANK) == 0) {
+        cog_address = COG_START_ADDRESS_SINGLE;
+        cog_bank = 0;
+    } else {
+        cog_address = COG_START_ADDRESS_DUAL;
+        cog_bank = 1;
+    }
+    COG_Load();
+}
+
+void COG_Enable(void) {
+    Cog.Enabled = 1;
+}
+
+void COG_Disable(void) {
+    Cog.Enabled = 0;
+}
+
+uint8_t COG_IsEnabled(void) {
+    return Cog.Enabled;
+}
+
+/**
+ * @brief  Starts adapting the table. Compensation is turned on as well,
+ *         since the table only learns what's left after it's applied.
+ * @retval None
+ */
+void COG_StartLearning(void) {
+    Cog.PreviousState = 0;
+    Cog.MeanSpeed = 0.0f;
+    Cog.Learning = 1;
+    Cog.Enabled = 1;
+}
+
+void COG_StopLearning(void) {
+    Cog.Learning = 0;
+}
+
+uint8_t COG_IsLearning(void) {
+    return Cog.Learning;
+}
+
+/**
+ * @brief  Compensation current for a rotor angle. Called every PWM cycle.
+ * @param  angle - Electrical angle of the rotor, a full revolution is 2^32
+ * @retval Offset to add to the q axis current command (A)
+ */
+float CCMRAM_FUNC COG_GetOffset(Angle_Type angle) {
+    float fraction;
+    uint16_t bin;
+
+    if(Cog.Enabled == 0) {
+        return 0.0f;
+    }
+    bin = COG_Bin(angle);
+    // Bits below the bin are the position within it
+    fraction = (float)(angle & ((1u << COG_BIN_SHIFT) - 1u)) * (1.0f / (float)(1u << COG_BIN_SHIFT));
+    return Cog.Table[bin] + fraction * (Cog.Table[bin + 1] - Cog.Table[bin]);
+}
+
+/**
+ * @brief  Adapts the table from the speed ripple. Called every PWM cycle,
+ *         but only does anything on a Hall edge while learning.
+ * @param  angle - Electrical angle of the rotor, a full revolution is 2^32
+ * @param  hall_state - Present Hall state
+ * @param  speed - Hall speed over the sector just finished, HALL_GetSectorSpeedF (electrical Hz)
+ * @param  direction - HALL_ROT_xxx
+ * @param  angle_valid - ANGLE_VALID if the Hall angle is being interpolated
+ * @retval None
+ */
+void CCMRAM_FUNC COG_Learn(Angle_Type angle, uint8_t hall_state, float speed, uint8_t direction, uint8_t angle_valid) {
+    float error, step, amount;
+    uint32_t bin, half;
+
+    if(Cog.Learning == 0) {
+        return;
+    }
+    if((angle_valid != ANGLE_VALID) || (direction != HALL_ROT_FORWARD)
+            || (speed < COG_LEARN_MIN_SPEED) || (speed > COG_LEARN_MAX_SPEED)) {
+        // Start again from the next edge
+        Cog.PreviousState = 0;
+        return;
+    }
+    if(hall_state == Cog.PreviousState) {
+        return;
+    }
+    if(Cog.PreviousState == 0) {
+        // First edge, nothing to compare with yet
+        Cog.Edges = 0;
+        if(Cog.MeanSpeed == 0.0f) {
+            Cog.MeanSpeed = speed;
+        }
+    }
+
+    if(Cog.Edges >= 2) {
+        Cog.MeanSpeed += COG_MEAN_SPEED_FILT * (speed - Cog.MeanSpeed);
+        // Speed gained across the sector before this one, from the
+        // sectors either side of it
+        error = COG_LEARN_GAIN * (speed - Cog.SectorSpeed[1]) / (2.0f * Cog.MeanSpeed);
+
+        // Spread the correction as a triangle from the middle of one
+        // neighbouring sector to the middle of the other, so the table
+        // joins up the sectors in straight lines instead of steps
+        half = (Cog.EdgeAngle[0] - Cog.EdgeAngle[1]) >> COG_BIN_SHIFT;
+        if(half != 0) {
+            step = error / (float)half;
+            amount = 0.0f;
+            bin = (COG_Bin(Cog.EdgeAngle[1]) - (half >> 1)) & (COG_BINS - 1);
+            for(uint32_t i = 0; i <= (2 * half); i++) {
+                Cog.Table[bin] -= amount;
+                if(Cog.Table[bin] > COG_MAX_CURRENT) {
+                    Cog.Table[bin] = COG_MAX_CURRENT;
+                } else if(Cog.Table[bin] < -COG_MAX_CURRENT) {
+                    Cog.Table[bin] = -COG_MAX_CURRENT;
+                }
+                amount += (i < half) ? step : -step;
+                bin = (bin + 1) & (COG_BINS - 1);
+            }
+        }
+        Cog.Table[COG_BINS] = Cog.Table[0];
+        Cog.Updates++;
+    } else {
+        Cog.Edges++;
+    }
+
+    Cog.EdgeAngle[1] = Cog.EdgeAngle[0];
+    Cog.EdgeAngle[0] = angle;
+    Cog.SectorSpeed[1] = Cog.SectorSpeed[0];
+    Cog.SectorSpeed[0] = speed;
+    Cog.PreviousState = hall_state;
+}
+
+/**
+ * @brief  Throws away everything learned. The saved table is kept until
+ *         the next save.
+ * @retval None
+ */
+void COG_Clear(void) {
+    for(uint16_t i = 0; i <= COG_BINS; i++) {
+        Cog.Table[i] = 0.0f;
+    }
+    Cog.PreviousState = 0;
+    Cog.MeanSpeed = 0.0f;
+}
+
+/**
+ * @brief  Packs the table and starts writing it to flash. The write is
+ *         done by COG_SaveTask, a bit at a time.
+ * @retval RETVAL_OK if the save was started, RETVAL_FAIL if one is
+ *         already in progress
+ */
+uint8_t COG_Save(void) {
+    float peak = 0.0f;
+
+    if(cog_save_dw != COG_SAVE_IDLE) {
+        return RETVAL_FAIL;
+    }
+    for(uint16_t i = 0; i < COG_BINS; i++) {
+        if(fabsf(Cog.Table[i]) > peak) {
+            peak = fabsf(Cog.Table[i]);
+        }
+    }
+    cog_image.Magic = COG_MAGIC;
+    cog_image.Scale = (peak > 0.0f) ? (peak / 127.0f) : (COG_MAX_CURRENT / 127.0f);
+    for(uint16_t i = 0; i < COG_BINS; i++) {
+        cog_image.Table[i] = (int8_t)lroundf(Cog.Table[i] / cog_image.Scale);
+    }
+    cog_image.Crc = COG_CalcCRC(&cog_image);
+    cog_image.Reserved = 0xFFFFFFFFu;
+    cog_save_dw = COG_SAVE_ERASE;
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Main loop task that writes a saved table into flash. Does at
+ *         most one flash operation per run, the page erase or one double
+ *         word, the same as the event log.
+ * @retval None
+ */
+void COG_SaveTask(void) {
+    FLASH_Status status;
+    uint32_t* words;
+
+    if(cog_save_dw == COG_SAVE_IDLE) {
+        return;
+    }
+    if((cog_bank == 0) && ((PWM_TIM->BDTR & TIM_BDTR_MOE) != 0)) {
+        // Single bank, the motor interrupts can't wait on the flash
+        return;
+    }
+
+    if(cog_erasing) {
+        status = FLASH_FinishErase();
+        if(status == FLASH_BUSY) {
+            return;
+        }
+        cog_erasing = 0;
+        if(status != FLASH_COMPLETE) {
+            cog_flash_errors++;
+            cog_save_dw = COG_SAVE_IDLE;
+            return;
+        }
+    }
+    if((FLASH->SR & FLASH_SR_BSY) != 0) {
+        // The event log or updater is using the flash. Programming now
+        // would hold up the main loop until it's done, so try again later.
+        return;
+    }
+
+    if(cog_save_dw == COG_SAVE_ERASE) {
+        status = FLASH_StartErasePage(COG_PAGE_NUM, cog_bank);
+        if(status == FLASH_BUSY) {
+            // Someone else got in first, try again next time
+            return;
+        }
+        if(status == FLASH_COMPLETE) {
+            cog_erasing = 1;
+            cog_save_dw = 0;
+        } else {
+            cog_flash_errors++;
+            cog_save_dw = COG_SAVE_IDLE;
+        }
+        return;
+    }
+
+    // The CRC is in the last double word, so it's written last
+    words = ((uint32_t*)(&cog_image)) + (cog_save_dw * 2u);
+    status = FLASH_ProgramDoubleWord(cog_address + (cog_save_dw * 8u), words[0], words[1]);
+    if(status == FLASH_BUSY) {
+        return;
+    }
+    if(status != FLASH_COMPLETE) {
+        cog_flash_errors++;
+        cog_save_dw = COG_SAVE_IDLE;
+        return;
+    }
+    cog_save_dw++;
+    if(cog_save_dw >= COG_FLASH_DOUBLE_WORDS) {
+        cog_saves++;
+        cog_save_dw = COG_SAVE_IDLE;
+    }
+}
+
+uint32_t COG_GetStatistic(uint16_t value_ID) {
+    float peak = 0.0f;
+
+    switch(value_ID) {
+    case CONFIG_COG_STATUS_UPDATES:
+        return Cog.Updates;
+    case CONFIG_COG_STATUS_PEAK:
+        for(uint16_t i = 0; i < COG_BINS; i++) {
+            if(fabsf(Cog.Table[i]) > peak) {
+                peak = fabsf(Cog.Table[i]);
+            }
+        }
+        return (uint32_t)(peak * 1000.0f);
+    case CONFIG_COG_STATUS_SAVING:
+        return (cog_save_dw != COG_SAVE_IDLE) ? 1 : 0;
+    case CONFIG_COG_STATUS_SAVES:
+        return cog_saves;
+    case CONFIG_COG_STATUS_ERRORS:
+        return cog_flash_errors;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief  Loads the saved table from flash, or clears the table if
+ *         there isn't a good one.
+ * @retval None
+ */
+static void COG_Load(void) {
+    Cog_Flash_Type* saved = (Cog_Flash_Type*)cog_address;
+
+    if((saved->Magic != COG_MAGIC) || (saved->Crc != COG_CalcCRC(saved))) {
+        COG_Clear();
+        return;
+    }
+    for(uint16_t i = 0; i < COG_BINS; i++) {
+        Cog.Table[i] = ((float)saved->Table[i]) * saved->Scale;
+    }
+    Cog.Table[COG_BINS] = Cog.Table[0];
+}
+
+static uint32_t COG_CalcCRC(Cog_Flash_Type* image) {
+    // Software CRC, the CRC unit belongs to the packet interface
+    return CRC_Software_CRC32((uint8_t*)image, sizeof(Cog_Flash_Type) - 2*sizeof(uint32_t));
+}
+
+static uint16_t CCMRAM_FUNC COG_Bin(Angle_Type angle) {
+    return (uint16_t)(angle >> COG_BIN_SHIFT);
+}
@@ -57,17 +57,7 @@ void CORDIC_Init(void) {
 
 }
 
-int32_t float_to_q31(float input) {
-    int32_t retval;
-    asm(    "VCVT.S32.F32 %1, %1, #31\n\t"
-            "VMOV %0, %1"
-            :"=r" (retval)
-            :"t" (input)
-            :);
-    return retval;
-}
-
-float q31_to_float(int32_t input) {
+float CCMRAM_FUNC q31_to_float(int32_t input) {
     float retval;
     asm(    "VMOV %0, %1\n\t"
             "VCVT.F32.S32 %0, %0, #31"
@@ -79,17 +69,16 @@ float q31_to_float(int32_t input) {
 
 /**
  * @brief  Calculates sin(theta) and cos(theta) using the CORDIC peripheral.
- * @param  theta: input angle in range [-1,1), which is scaled to [-pi, pi)
+ * @param  theta: input angle, a full revolution is 2^32. Read as signed this
+ *         is already the Q31 [-1,1) input the CORDIC scales to [-pi, pi).
  * @param  sin: pointer to sin(theta) result
  * @param  cos: pointer to cos(theta) result
  * @retval None
  */
-void CORDIC_CalcSinCos(float theta, float* sin, float* cos) {
-    int32_t fxd_input, fxd_sin, fxd_cos;
-//    fxd_input = (int32_t) (theta * 2147483648.0f); // Multiply by 0x80000000 = 2147483648
-    fxd_input = float_to_q31(theta);
+void CCMRAM_FUNC CORDIC_CalcSinCos(Angle_Type theta, float* sin, float* cos) {
+    int32_t fxd_sin, fxd_cos;
 
-    CORDIC->WDATA = fxd_input;
+    CORDIC->WDATA = theta;
 
     // Get the results
     fxd_sin = CORDIC->RDATA; // Inserts wait states until result is ready
@@ -103,14 +92,11 @@ void CORDIC_CalcSinCos(float theta, float* sin, float* cos) {
 
 /**
  * @brief  Launches sin(theta) and cos(theta) calculation, result read later with CORDIC_GetResult.
- * @param  theta: input angle in range [-1,1), which is scaled to [-pi, pi)
+ * @param  theta: input angle, a full revolution is 2^32
  * @retval None
  */
-void CORDIC_CalcSinCosDeferred(float theta) {
-    int32_t fxd_input;
-    fxd_input = float_to_q31(theta);
-//    fxd_input = (int32_t) (theta * 1073741824.0f); // Multiply by 0x80000000
-    CORDIC->WDATA = fxd_input;
+void CORDIC_CalcSinCosDeferred(Angle_Type theta) {
+    CORDIC->WDATA = theta;
 }
 
 /**
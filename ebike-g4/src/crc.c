@@ -36,6 +36,14 @@
 
 #include "main.h"
 
+// CRC-32 of each 4 bit value, reflected polynomial 0xEDB88320
+static const uint32_t crc_nibble_table[16] = {
+    0x00000000u, 0x1DB71064u, 0x3B6E20C8u, 0x26D930ACu,
+    0x76DC4190u, 0x6B6B51F4u, 0x4DB26158u, 0x5005713Cu,
+    0xEDB88320u, 0xF00F9344u, 0xD6D6A3E8u, 0xCB61B38Cu,
+    0x9B64C2B0u, 0x86D3D2D4u, 0xA00AE278u, 0xBDBDF21Cu
+};
+
 void CRC_Init(void) {
     // Turns on the hardware
     RCC->AHB1ENR |= RCC_AHB1ENR_CRCEN;
@@ -51,7 +59,7 @@ void CRC_Init(void) {
  * @param  len: Length of input buffer (number of bytes)
  * @retval The generated CRC-32 value.
  */
-uint32_t CRC_Generate_CRC32(uint8_t *buf, uint16_t len) {
+uint32_t CCMRAM_FUNC CRC_Generate_CRC32(uint8_t *buf, uint32_t len) {
     uint32_t crc_input;
 
     // Enable the bit reversals for CRC-32
@@ -96,3 +104,46 @@ uint32_t CRC_Generate_CRC32(uint8_t *buf, uint16_t len) {
     }
 
 }
+
+/**
+ * @brief  Adds bytes to a software CRC-32. Start from CRC_SOFT_INIT, and
+ *         the data can be fed in any number of pieces.
+ * @param  crc - Running value
+ * @param  buf - Next bytes
+ * @param  len - Number of bytes
+ * @retval The new running value
+ */
+uint32_t CRC_Software_Update(uint32_t crc, const uint8_t* buf, uint32_t len) {
+    while(len > 0) {
+        crc ^= *buf;
+        crc = (crc >> 4) ^ crc_nibble_table[crc & 0x0Fu];
+        crc = (crc >> 4) ^ crc_nibble_table[crc & 0x0Fu];
+        buf++;
+        len--;
+    }
+    return crc;
+}
+
+/**
+ * @brief  Finishes a software CRC-32 the same way CRC_Generate_CRC32 does,
+ *         with the data padded out to a multiple of 4 bytes with 0's.
+ * @param  crc - Running value from CRC_Software_Update
+ * @param  total_len - Number of bytes fed in altogether
+ * @retval The CRC-32
+ */
+uint32_t CRC_Software_Finish(uint32_t crc, uint32_t total_len) {
+    static const uint8_t zeros[3] = {0, 0, 0};
+    crc = CRC_Software_Update(crc, zeros, (4u - (total_len & 0x03u)) & 0x03u);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/**
+ * @brief  Software version of CRC_Generate_CRC32, same result. Safe to
+ *         use anywhere, but several times slower.
+ * @param  buf: The input buffer of unsigned bytes
+ * @param  len: Length of input buffer (number of bytes)
+ * @retval The generated CRC-32 value.
+ */
+uint32_t CRC_Software_CRC32(const uint8_t* buf, uint32_t len) {
+    return CRC_Software_Finish(CRC_Software_Update(CRC_SOFT_INIT, buf, len), len);
+}
@@ -0,0 +1,138 @@
+/******************************************************************************
+ * Filename: dashboard.c
+ * Description: Keeps the dashboard data ready to send. The values are
+ *              worked out at 100Hz in the housekeeping loop and packed into
+ *              a buffer, so a dashboard request is answered with a copy.
+ *              The phase current is an RMS value, from the current vector
+ *              magnitude sampled every speed loop.
+ ******************************************************************************
+
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include "main.h"
+#include <math.h>
+
+static Dash_Type Dash;
+// Packed dashboard data. Odd sequence means it's being written.
+static uint8_t dash_buffer[DASHBOARD_DATA_LENGTH];
+static volatile uint32_t dash_sequence;
+
+void DASH_Init(void) {
+    Dash.SumSquares = 0.0f;
+    Dash.Samples = 0;
+    Dash.PhaseCurrent = 0.0f;
+    Dash.BatteryCurrent = 0.0f;
+    Dash.BatteryVolts = 0.0f;
+    dash_sequence = 0;
+    for(uint16_t i = 0; i < DASHBOARD_DATA_LENGTH; i++) {
+        dash_buffer[i] = 0;
+    }
+}
+
+/**
+ * @brief  Adds a sample of the phase current vector magnitude. Called
+ *         from the speed loop.
+ * @param  current - Magnitude of the alpha/beta current vector (A)
+ * @retval None
+ */
+void DASH_AddCurrentSample(float current) {
+    Dash.SumSquares += current * current;
+    Dash.Samples++;
+}
+
+/**
+ * @brief  Works out the dashboard values and packs them, ready to send.
+ *         Called from the housekeeping loop.
+ * @param  cfg - Motor and wheel settings
+ * @param  snap - Motor state from the latest PWM cycle
+ * @param  battery_current - Estimated battery current (A)
+ * @param  faults - Latched fault codes
+ * @retval None
+ */
+void DASH_Update(Config_Main* cfg, Main_Snapshot* snap, float battery_current, uint32_t faults) {
+    float sum, mean_square, motor_rpm, kmh;
+    uint32_t samples;
+    uint8_t* data = dash_buffer;
+
+    // Take the samples, the speed loop can add more at any time
+    __disable_irq();
+    sum = Dash.SumSquares;
+    samples = Dash.Samples;
+    Dash.SumSquares = 0.0f;
+    Dash.Samples = 0;
+    __enable_irq();
+    if(samples > 0) {
+        // A balanced set of phase currents with peak I has a vector
+        // magnitude of I, and an RMS value of I / sqrt(2)
+        mean_square = 0.5f * sum / ((float)samples);
+        Dash.PhaseCurrent += DASH_FILT * (sqrtf(mean_square) - Dash.PhaseCurrent);
+    }
+    Dash.BatteryCurrent += DASH_FILT * (battery_current - Dash.BatteryCurrent);
+    Dash.BatteryVolts += DASH_FILT * (snap->Ctrl.BusVoltage - Dash.BatteryVolts);
+
+    motor_rpm = snap->Obv.RotorSpeed_eHz * 60.0f * cfg->inv_pole_pairs;
+    // Same conversion as the speed loop, from the same PWM cycle as the rest
+    kmh = snap->Obv.RotorSpeed_eHz * SPEED_KmhPerEHz(cfg);
+
+    dash_sequence++;
+    __DMB();
+    data_packet_pack_float(data, snap->Ctrl.ThrottleCommand * 100.0f);
+    data+=4;
+    data_packet_pack_float(data, motor_rpm);
+    data+=4;
+    data_packet_pack_float(data, Dash.PhaseCurrent);
+    data+=4;
+    data_packet_pack_float(data, Dash.BatteryCurrent);
+    data+=4;
+    data_packet_pack_float(data, Dash.BatteryVolts);
+    data+=4;
+    data_packet_pack_float(data, snap->Obv.FetTempDegC);
+    data+=4;
+    data_packet_pack_float(data, snap->Obv.MotorTempDegC);
+    data+=4;
+    data_packet_pack_32b(data, faults);
+    data+=4;
+    data_packet_pack_float(data, kmh);
+    __DMB();
+    dash_sequence++;
+}
+
+/**
+ * @brief  Copies out the latest dashboard data. If the housekeeping loop
+ *         updates it partway through, the copy is done again.
+ * @param  data - Buffer of at least DASHBOARD_DATA_LENGTH bytes
+ * @retval None
+ */
+void DASH_GetData(uint8_t* data) {
+    uint32_t sequence;
+
+    do {
+        sequence = dash_sequence;
+        __DMB();
+        for(uint16_t i = 0; i < DASHBOARD_DATA_LENGTH; i++) {
+            data[i] = dash_buffer[i];
+        }
+        __DMB();
+    } while(((sequence & 1u) != 0) || (sequence != dash_sequence));
+}
@@ -28,6 +28,12 @@
 
 #include "main.h"
 
+// Event log, trace, and log download packets are too big to build in the
+// receive buffer. Only one is built at a time, so they share.
+#define DOWNLOAD_MAX(a, b)  (((a) > (b)) ? (a) : (b))
+static uint8_t download_buffer[DOWNLOAD_MAX(DOWNLOAD_MAX(ELOG_DOWNLOAD_BYTES, DTRACE_DOWNLOAD_BYTES),
+                               DLOG_DOWNLOAD_BYTES)];
+
 static Data_Type command_get_datatype(uint16_t data_ID);
 
 /**
@@ -132,6 +138,39 @@ uint16_t data_process_command(Data_Packet_Type* pkt) {
             errCode = data_packet_create(pkt, DASHBOARD_DATA_RESULT, pkt->Data, DASHBOARD_DATA_LENGTH);
         }
         break;
+    case REQUEST_EVENT_LOG:
+        // Data is the index to start from. The host keeps asking until it has everything.
+        if (pkt->DataLength >= 4) {
+            uint16_t loglen = ELOG_Download(data_packet_extract_32b(pkt->Data), download_buffer);
+            errCode = data_packet_create(pkt, EVENT_LOG_RESULT, download_buffer, loglen);
+        } else {
+            errCode = data_packet_create(pkt, CONTROLLER_NACK, 0, 0);
+        }
+        break;
+    case REQUEST_TRACE:
+        // Data is the channel, then the index to start from
+        if (pkt->DataLength >= 5) {
+            uint16_t tracelen = DTRACE_Download(data_packet_extract_8b(pkt->Data),
+                    data_packet_extract_32b(&(pkt->Data[1])), download_buffer);
+            errCode = data_packet_create(pkt, TRACE_RESULT, download_buffer, tracelen);
+        } else {
+            errCode = data_packet_create(pkt, CONTROLLER_NACK, 0, 0);
+        }
+        break;
+    case REQUEST_LOG:
+        // Records are taken out of the ring as they're sent
+        errCode = data_packet_create(pkt, LOG_RESULT, download_buffer, DLOG_Download(download_buffer));
+        break;
+    case FIRMWARE_CHUNK:
+        // Data is the offset in the image, then the image bytes. A chunk that
+        // can't be taken yet is NACKed, and the host sends it again.
+        if ((pkt->DataLength > 4) && (FWUP_Chunk(data_packet_extract_32b(pkt->Data),
+                &(pkt->Data[4]), pkt->DataLength - 4) == RETVAL_OK)) {
+            errCode = data_packet_create(pkt, CONTROLLER_ACK, 0, 0);
+        } else {
+            errCode = data_packet_create(pkt, CONTROLLER_NACK, 0, 0);
+        }
+        break;
 
         // Responses from a lower-level controller (e.g. BMS):
     case GET_RAM_RESULT:
@@ -179,6 +218,36 @@ uint16_t command_get_ram(uint8_t* pktdata, uint8_t* retval) {
     uint32_t retval32b = 0;
     uint16_t errCode = RETVAL_FAIL;
 
+    // Scheduler statistics are repeated for each rate group
+    if((value_ID & 0xFF00) == CONFIG_SCHED_PREFIX) {
+        retval32b = SCHED_GetStatistic(value_ID);
+    }
+    // And task statistics for each main loop task
+    if((value_ID & 0xFF00) == CONFIG_TASK_PREFIX) {
+        retval32b = TASK_GetStatistic(value_ID);
+    }
+    if((value_ID & 0xFF00) == CONFIG_FAULT_STATUS_PREFIX) {
+        retval32b = FAULT_GetStatistic(value_ID);
+    }
+    if((value_ID & 0xFF00) == CONFIG_ELOG_STATUS_PREFIX) {
+        retval32b = ELOG_GetStatistic(value_ID);
+    }
+    if((value_ID & 0xFF00) == CONFIG_MOTID_STATUS_PREFIX) {
+        retval32b = MOTID_GetStatistic(value_ID);
+    }
+    if((value_ID & 0xFF00) == CONFIG_COG_STATUS_PREFIX) {
+        retval32b = COG_GetStatistic(value_ID);
+    }
+    if((value_ID & 0xFF00) == CONFIG_BOOT_STATUS_PREFIX) {
+        retval32b = BOOT_GetStatistic(value_ID);
+    }
+    if((value_ID & 0xFF00) == CONFIG_WDT_STATUS_PREFIX) {
+        retval32b = WDT_GetStatistic(value_ID);
+    }
+    if((value_ID & 0xFF00) == CONFIG_FWUP_STATUS_PREFIX) {
+        retval32b = FWUP_GetStatistic(value_ID);
+    }
+
     switch (value_ID) {
 
     // 8-bit integer values
@@ -212,7 +281,27 @@ uint16_t command_get_ram(uint8_t* pktdata, uint8_t* retval) {
     case CONFIG_MAIN_USB_CHOICE_10:
         retval16b = LIVE_GetOutput(value_ID-CONFIG_MAIN_USB_CHOICE_1);
         break;
+    case CONFIG_LMT_STATUS_REASON:
+        retval16b = (uint16_t)DERATE_GetReason();
+        break;
     case CONFIG_MOTOR_POLEPAIRS:
+        retval16b = MAIN_GetPolePairs();
+        break;
+    case CONFIG_PAS_INPUT_MODE:
+        retval16b = PAS_GetInputMode();
+        break;
+    case CONFIG_PAS_PULSES:
+        retval16b = PAS_GetPulsesPerRev();
+        break;
+    case CONFIG_PAS_DIRECTION:
+        retval16b = PAS_GetDirection();
+        break;
+    case CONFIG_PAS_LEVEL:
+        retval16b = PAS_GetLevel();
+        break;
+    case CONFIG_PAS_STATUS_PEDALING:
+        retval16b = PAS_GetPedaling();
+        break;
     case CONFIG_BMS_NUMBATTS:
         retval16b = 0xAAAAu;
         break;
@@ -221,10 +310,15 @@ uint16_t command_get_ram(uint8_t* pktdata, uint8_t* retval) {
     case CONFIG_DRV_GATE_STRENGTH:
         retval32b = DRV8353_GetGateStrength();
         break;
+    case CONFIG_MAIN_COUNTS_TO_FOC:
+        retval32b = MAIN_GetCountsToFOC();
+        break;
+    case CONFIG_DTRACE_MASK:
+        retval32b = DTRACE_GetMask();
+        break;
     // Not yet implemented
     case CONFIG_FOC_PWM_FREQ:
     case CONFIG_FOC_PWM_DEADTIME:
-    case CONFIG_MAIN_COUNTS_TO_FOC:
     case CONFIG_BMS_GETSTATUS_N:
         retval32b = 0xAAAAAAAAu;
         break;
@@ -263,35 +357,112 @@ uint16_t command_get_ram(uint8_t* pktdata, uint8_t* retval) {
     case CONFIG_THRT_RATIO:
         retvalf = THROTTLE_GetRatio();
         break;
-    // Not yet implemented
-    case CONFIG_FOC_KP:
-    case CONFIG_FOC_KI:
-    case CONFIG_FOC_KD:
-    case CONFIG_FOC_KC:
-    case CONFIG_MAIN_SPEED_TO_FOC:
-    case CONFIG_MAIN_SWITCH_EPS:
     case CONFIG_LMT_VOLT_FAULT_MIN:
+        retvalf = MAIN_GetLimit(Main_Limit_MinVoltFault);
+        break;
     case CONFIG_LMT_VOLT_FAULT_MAX:
+        retvalf = MAIN_GetLimit(Main_Limit_MaxVoltFault);
+        break;
     case CONFIG_LMT_CUR_FAULT_MAX:
+        retvalf = MAIN_GetLimit(Main_Limit_CurrentFault);
+        break;
     case CONFIG_LMT_VOLT_SOFTCAP:
+        retvalf = MAIN_GetLimit(Main_Limit_SoftVoltage);
+        break;
     case CONFIG_LMT_VOLT_HARDCAP:
+        retvalf = MAIN_GetLimit(Main_Limit_HardVoltage);
+        break;
     case CONFIG_LMT_PHASE_CUR_MAX:
+        retvalf = MAIN_GetLimit(Main_Limit_PhaseCurrent);
+        break;
     case CONFIG_LMT_PHASE_REGEN_MAX:
+        retvalf = MAIN_GetLimit(Main_Limit_PhaseRegenCurrent);
+        break;
     case CONFIG_LMT_BATT_CUR_MAX:
+        retvalf = MAIN_GetLimit(Main_Limit_BattCurrent);
+        break;
     case CONFIG_LMT_BATT_REGEN_MAX:
+        retvalf = MAIN_GetLimit(Main_Limit_BattRegenCurrent);
+        break;
     case CONFIG_LMT_FET_TEMP_SOFTCAP:
+        retvalf = MAIN_GetLimit(Main_Limit_SoftFetTemp);
+        break;
     case CONFIG_LMT_FET_TEMP_HARDCAP:
+        retvalf = MAIN_GetLimit(Main_Limit_HardFetTemp);
+        break;
     case CONFIG_LMT_MOTOR_TEMP_SOFTCAP:
+        retvalf = MAIN_GetLimit(Main_Limit_SoftMotorTemp);
+        break;
     case CONFIG_LMT_MOTOR_TEMP_HARDCAP:
+        retvalf = MAIN_GetLimit(Main_Limit_HardMotorTemp);
+        break;
+    case CONFIG_LMT_STATUS_SCALE:
+        retvalf = DERATE_GetScale();
+        break;
+    case CONFIG_LMT_STATUS_REGEN_SCALE:
+        retvalf = DERATE_GetRegenScale();
+        break;
+    case CONFIG_REGEN_STATUS_COMMAND:
+        retvalf = REGEN_GetCommand();
+        break;
+    case CONFIG_REGEN_STATUS_ENERGY:
+        retvalf = REGEN_GetRecoveredWh();
+        break;
+    case CONFIG_MOTOR_GEAR_RATIO:
+        retvalf = MAIN_GetGearRatio();
+        break;
+    case CONFIG_MOTOR_WHEEL_SIZE:
+        retvalf = MAIN_GetWheelSize();
+        break;
+    case CONFIG_MOTOR_KV:
+        retvalf = MAIN_GetKv();
+        break;
+    case CONFIG_MOTOR_RESISTANCE:
+    case CONFIG_MOTOR_LD:
+    case CONFIG_MOTOR_LQ:
+    case CONFIG_MOTOR_FLUX:
+        retvalf = MAIN_GetMotorModel(value_ID);
+        break;
+    case CONFIG_MAIN_SPEED_TO_FOC:
+        retvalf = MAIN_GetSpeedToFOC();
+        break;
+    case CONFIG_MAIN_SWITCH_EPS:
+        retvalf = MAIN_GetSwitchEpsilon();
+        break;
+    case CONFIG_FOC_KP:
+    case CONFIG_FOC_KI:
+    case CONFIG_FOC_KD:
+    case CONFIG_FOC_KC:
+        retvalf = MAIN_GetCurrentGain(value_ID);
+        break;
+    case CONFIG_PAS_TIMEOUT:
+    case CONFIG_PAS_CADENCE_FULL:
+    case CONFIG_PAS_TORQUE_ZERO:
+    case CONFIG_PAS_TORQUE_SCALE:
+    case CONFIG_PAS_TORQUE_FULL:
+    case CONFIG_PAS_LEVEL1:
+    case CONFIG_PAS_LEVEL2:
+    case CONFIG_PAS_LEVEL3:
+    case CONFIG_PAS_LEVEL4:
+    case CONFIG_PAS_LEVEL5:
+        retvalf = PAS_GetCurve(value_ID);
+        break;
+    case CONFIG_PAS_STATUS_CADENCE:
+        retvalf = PAS_GetCadence();
+        break;
+    case CONFIG_PAS_STATUS_TORQUE:
+        retvalf = PAS_GetTorque();
+        break;
+    case CONFIG_PAS_STATUS_COMMAND:
+        retvalf = PAS_GetCommand();
+        break;
+    // Not yet implemented
     case CONFIG_MOTOR_HALL1:
     case CONFIG_MOTOR_HALL2:
     case CONFIG_MOTOR_HALL3:
     case CONFIG_MOTOR_HALL4:
     case CONFIG_MOTOR_HALL5:
     case CONFIG_MOTOR_HALL6:
-    case CONFIG_MOTOR_GEAR_RATIO:
-    case CONFIG_MOTOR_WHEEL_SIZE:
-    case CONFIG_MOTOR_KV:
     case CONFIG_BMS_GETBAT_N:
         retvalf = 5.555f;
         break;
@@ -378,17 +549,34 @@ uint16_t command_set_ram(uint8_t* pktdata) {
         errCode = LIVE_SetOutput(value_ID-CONFIG_MAIN_USB_CHOICE_1,value16b);
         break;
     case CONFIG_MOTOR_POLEPAIRS:
-        errCode = RETVAL_OK;
+        errCode = MAIN_SetPolePairs(value16b);
+        break;
+    case CONFIG_PAS_INPUT_MODE:
+        errCode = PAS_SetInputMode(value16b);
+        break;
+    case CONFIG_PAS_PULSES:
+        errCode = PAS_SetPulsesPerRev(value16b);
+        break;
+    case CONFIG_PAS_DIRECTION:
+        errCode = PAS_SetDirection(value16b);
+        break;
+    case CONFIG_PAS_LEVEL:
+        errCode = PAS_SetLevel(value16b);
         break;
 
     // 32 bit integer values
     case CONFIG_DRV_GATE_STRENGTH:
         errCode = DRV8353_SetGateStrength(value32b);
         break;
+    case CONFIG_MAIN_COUNTS_TO_FOC:
+        errCode = MAIN_SetCountsToFOC(value32b);
+        break;
+    case CONFIG_DTRACE_MASK:
+        errCode = DTRACE_SetMask(value32b);
+        break;
     // Not yet implemented
     case CONFIG_FOC_PWM_FREQ:
     case CONFIG_FOC_PWM_DEADTIME:
-    case CONFIG_MAIN_COUNTS_TO_FOC:
         errCode = RETVAL_OK;
         break;
 
@@ -426,35 +614,91 @@ uint16_t command_set_ram(uint8_t* pktdata) {
     case CONFIG_THRT_RATIO:
         errCode = THROTTLE_SetRatio(valuef);
         break;
-    // Not yet implemented
-    case CONFIG_FOC_KP:
-    case CONFIG_FOC_KI:
-    case CONFIG_FOC_KD:
-    case CONFIG_FOC_KC:
-    case CONFIG_MAIN_SPEED_TO_FOC:
-    case CONFIG_MAIN_SWITCH_EPS:
     case CONFIG_LMT_VOLT_FAULT_MIN:
+        errCode = MAIN_SetLimit(Main_Limit_MinVoltFault, valuef);
+        break;
     case CONFIG_LMT_VOLT_FAULT_MAX:
+        errCode = MAIN_SetLimit(Main_Limit_MaxVoltFault, valuef);
+        break;
     case CONFIG_LMT_CUR_FAULT_MAX:
+        errCode = MAIN_SetLimit(Main_Limit_CurrentFault, valuef);
+        break;
     case CONFIG_LMT_VOLT_SOFTCAP:
+        errCode = MAIN_SetLimit(Main_Limit_SoftVoltage, valuef);
+        break;
     case CONFIG_LMT_VOLT_HARDCAP:
+        errCode = MAIN_SetLimit(Main_Limit_HardVoltage, valuef);
+        break;
     case CONFIG_LMT_PHASE_CUR_MAX:
+        errCode = MAIN_SetLimit(Main_Limit_PhaseCurrent, valuef);
+        break;
     case CONFIG_LMT_PHASE_REGEN_MAX:
+        errCode = MAIN_SetLimit(Main_Limit_PhaseRegenCurrent, valuef);
+        break;
     case CONFIG_LMT_BATT_CUR_MAX:
+        errCode = MAIN_SetLimit(Main_Limit_BattCurrent, valuef);
+        break;
     case CONFIG_LMT_BATT_REGEN_MAX:
+        errCode = MAIN_SetLimit(Main_Limit_BattRegenCurrent, valuef);
+        break;
     case CONFIG_LMT_FET_TEMP_SOFTCAP:
+        errCode = MAIN_SetLimit(Main_Limit_SoftFetTemp, valuef);
+        break;
     case CONFIG_LMT_FET_TEMP_HARDCAP:
+        errCode = MAIN_SetLimit(Main_Limit_HardFetTemp, valuef);
+        break;
     case CONFIG_LMT_MOTOR_TEMP_SOFTCAP:
+        errCode = MAIN_SetLimit(Main_Limit_SoftMotorTemp, valuef);
+        break;
     case CONFIG_LMT_MOTOR_TEMP_HARDCAP:
+        errCode = MAIN_SetLimit(Main_Limit_HardMotorTemp, valuef);
+        break;
+    case CONFIG_MOTOR_GEAR_RATIO:
+        errCode = MAIN_SetGearRatio(valuef);
+        break;
+    case CONFIG_MOTOR_WHEEL_SIZE:
+        errCode = MAIN_SetWheelSize(valuef);
+        break;
+    case CONFIG_MOTOR_KV:
+        errCode = MAIN_SetKv(valuef);
+        break;
+    case CONFIG_MOTOR_RESISTANCE:
+    case CONFIG_MOTOR_LD:
+    case CONFIG_MOTOR_LQ:
+    case CONFIG_MOTOR_FLUX:
+        errCode = MAIN_SetMotorModel(value_ID, valuef);
+        break;
+    case CONFIG_MAIN_SPEED_TO_FOC:
+        errCode = MAIN_SetSpeedToFOC(valuef);
+        break;
+    case CONFIG_MAIN_SWITCH_EPS:
+        errCode = MAIN_SetSwitchEpsilon(valuef);
+        break;
+    case CONFIG_FOC_KP:
+    case CONFIG_FOC_KI:
+    case CONFIG_FOC_KD:
+    case CONFIG_FOC_KC:
+        errCode = MAIN_SetCurrentGain(value_ID, valuef);
+        break;
+    case CONFIG_PAS_TIMEOUT:
+    case CONFIG_PAS_CADENCE_FULL:
+    case CONFIG_PAS_TORQUE_ZERO:
+    case CONFIG_PAS_TORQUE_SCALE:
+    case CONFIG_PAS_TORQUE_FULL:
+    case CONFIG_PAS_LEVEL1:
+    case CONFIG_PAS_LEVEL2:
+    case CONFIG_PAS_LEVEL3:
+    case CONFIG_PAS_LEVEL4:
+    case CONFIG_PAS_LEVEL5:
+        errCode = PAS_SetCurve(value_ID, valuef);
+        break;
+    // Not yet implemented
     case CONFIG_MOTOR_HALL1:
     case CONFIG_MOTOR_HALL2:
     case CONFIG_MOTOR_HALL3:
     case CONFIG_MOTOR_HALL4:
     case CONFIG_MOTOR_HALL5:
     case CONFIG_MOTOR_HALL6:
-    case CONFIG_MOTOR_GEAR_RATIO:
-    case CONFIG_MOTOR_WHEEL_SIZE:
-    case CONFIG_MOTOR_KV:
         errCode = RETVAL_OK;
         break;
 
@@ -538,12 +782,31 @@ uint16_t command_enable_feature(uint8_t* pktdata) {
         errCode = LIVE_TurnOnData();
         break;
     case FEATURE_BLDC_MODE:
-//        errCode = MAIN_RequestBLDC();
-        errCode = RETVAL_OK;
+        errCode = MAIN_RequestBLDC();
         break;
     case FEATURE_DEBUG_PWM:
         errCode = MAIN_EnableDebugPWM();
         break;
+    case FEATURE_FOC_CONTROL:
+        errCode = MAIN_EnableFOC();
+        break;
+    case FEATURE_CRUISE:
+        errCode = SPEED_EngageCruise();
+        break;
+    case FEATURE_WALK_ASSIST:
+        errCode = SPEED_EngageWalk();
+        break;
+    case FEATURE_REGEN_BRAKE:
+        errCode = REGEN_SetBrake(1);
+        break;
+    case FEATURE_COGGING_COMP:
+        COG_Enable();
+        errCode = RETVAL_OK;
+        break;
+    case FEATURE_COGGING_LEARN:
+        COG_StartLearning();
+        errCode = RETVAL_OK;
+        break;
     default:
         errCode = RETVAL_FAIL;
         break;
@@ -561,12 +824,30 @@ uint16_t command_disable_feature(uint8_t* pktdata) {
         errCode = LIVE_TurnOffData();
         break;
     case FEATURE_BLDC_MODE:
-//        errCode = MAIN_RequestFOC();
-        errCode = RETVAL_OK;
+        errCode = MAIN_RequestFOC();
         break;
     case FEATURE_DEBUG_PWM:
         errCode = MAIN_DisableDebugPWM();
         break;
+    case FEATURE_FOC_CONTROL:
+        errCode = MAIN_DisableFOC();
+        break;
+    case FEATURE_CRUISE:
+    case FEATURE_WALK_ASSIST:
+        errCode = SPEED_Disengage();
+        break;
+    case FEATURE_REGEN_BRAKE:
+        errCode = REGEN_SetBrake(0);
+        break;
+    case FEATURE_COGGING_COMP:
+        COG_StopLearning();
+        COG_Disable();
+        errCode = RETVAL_OK;
+        break;
+    case FEATURE_COGGING_LEARN:
+        COG_StopLearning();
+        errCode = RETVAL_OK;
+        break;
     default:
         errCode = RETVAL_FAIL;
         break;
@@ -580,24 +861,26 @@ uint16_t command_run_routine(uint8_t* pktdata) {
     pktdata += 2;
     uint16_t errCode = RETVAL_FAIL;
 
-//    float valuef;
+    float valuef;
 
     switch(routine_ID) {
 
     case ROUTINE_LOAD_ALL_EEPROM:
         // Run the various loading functions
-//        MAIN_LoadVariables();
-//        HallSensor_Load_Variables();
-//        adcLoadVariables();
-//        throttle_load_variables();
+        MAIN_LoadVariables();
+        HALL_LoadVariables();
+        ADC_LoadVariables();
+        THROTTLE_LoadVariables();
+        PAS_LoadVariables();
         errCode = RETVAL_OK;
         break;
     case ROUTINE_SAVE_ALL_EEPROM:
         // Run all the saving functions
-//        MAIN_SaveVariables();
-//        HallSensor_Save_Variables();
-//        adcSaveVariables();
-//        throttle_save_variables();
+        MAIN_SaveVariables();
+        HALL_SaveVariables();
+        ADC_SaveVariables();
+        THROTTLE_SaveVariables();
+        PAS_SaveVariables();
         errCode = RETVAL_OK;
         break;
     case ROUTINE_HALL_DETECT:
@@ -606,6 +889,27 @@ uint16_t command_run_routine(uint8_t* pktdata) {
 //        MAIN_DetectHallPositions(valuef);
         errCode = RETVAL_OK;
         break;
+    case ROUTINE_MOTOR_IDENTIFY:
+        // Single variable float is the test current, zero for the default
+        valuef = data_packet_extract_float(pktdata);
+        errCode = MAIN_IdentifyMotor(valuef);
+        break;
+    case ROUTINE_CURRENT_LOOP_TUNE:
+        // Single variable float is the bandwidth (Hz), zero for the default
+        valuef = data_packet_extract_float(pktdata);
+        errCode = MAIN_TuneCurrentLoop(valuef);
+        break;
+    case ROUTINE_COGGING_SAVE:
+        errCode = COG_Save();
+        break;
+    case ROUTINE_COGGING_CLEAR:
+        COG_Clear();
+        errCode = RETVAL_OK;
+        break;
+    case ROUTINE_CURRENT_GAINS_COMMIT:
+        // Gains written with CONFIG_FOC_KP..KC only take effect here
+        errCode = MAIN_CommitCurrentGains();
+        break;
     case ROUTINE_SOFT_RESET:
         // Run the reset command
         // Shouldn't return from this function
@@ -616,6 +920,30 @@ uint16_t command_run_routine(uint8_t* pktdata) {
         // Shouldn't return from this function
         MAIN_GoToBootloader();
         break;
+    case ROUTINE_SCHED_RESET_STATS:
+        SCHED_ResetStats();
+        errCode = RETVAL_OK;
+        break;
+    case ROUTINE_TASK_RESET_STATS:
+        TASK_ResetStats();
+        errCode = RETVAL_OK;
+        break;
+    case ROUTINE_CLEAR_FAULTS:
+        errCode = FAULT_Clear();
+        break;
+    case ROUTINE_CLEAR_EVENT_LOG:
+        errCode = ELOG_Clear();
+        break;
+    case ROUTINE_FWUP_BEGIN:
+        // Image size, then the CRC-32 of the whole image
+        errCode = FWUP_Begin(data_packet_extract_32b(pktdata), data_packet_extract_32b(&(pktdata[4])));
+        break;
+    case ROUTINE_FWUP_COMMIT:
+        errCode = FWUP_Commit();
+        break;
+    case ROUTINE_FWUP_ABORT:
+        errCode = FWUP_Abort();
+        break;
     }
 
     return errCode;
@@ -645,6 +973,12 @@ static Data_Type command_get_datatype(uint16_t data_ID) {
     case CONFIG_MAIN_USB_CHOICE_10:
     case CONFIG_MOTOR_POLEPAIRS:
     case CONFIG_BMS_NUMBATTS:
+    case CONFIG_LMT_STATUS_REASON:
+    case CONFIG_PAS_INPUT_MODE:
+    case CONFIG_PAS_PULSES:
+    case CONFIG_PAS_DIRECTION:
+    case CONFIG_PAS_LEVEL:
+    case CONFIG_PAS_STATUS_PEDALING:
         type = Data_Type_Int16;
         break;
     // 32 bit integer values
@@ -653,6 +987,7 @@ static Data_Type command_get_datatype(uint16_t data_ID) {
     case CONFIG_MAIN_COUNTS_TO_FOC:
     case CONFIG_DRV_GATE_STRENGTH:
     case CONFIG_BMS_GETSTATUS_N:
+    case CONFIG_DTRACE_MASK:
         type = Data_Type_Int32;
         break;
     // 32 bit float values
@@ -673,6 +1008,19 @@ static Data_Type command_get_datatype(uint16_t data_ID) {
     case CONFIG_THRT_FILT:
     case CONFIG_THRT_RISE:
     case CONFIG_THRT_RATIO:
+    case CONFIG_PAS_TIMEOUT:
+    case CONFIG_PAS_CADENCE_FULL:
+    case CONFIG_PAS_TORQUE_ZERO:
+    case CONFIG_PAS_TORQUE_SCALE:
+    case CONFIG_PAS_TORQUE_FULL:
+    case CONFIG_PAS_LEVEL1:
+    case CONFIG_PAS_LEVEL2:
+    case CONFIG_PAS_LEVEL3:
+    case CONFIG_PAS_LEVEL4:
+    case CONFIG_PAS_LEVEL5:
+    case CONFIG_PAS_STATUS_CADENCE:
+    case CONFIG_PAS_STATUS_TORQUE:
+    case CONFIG_PAS_STATUS_COMMAND:
     case CONFIG_LMT_VOLT_FAULT_MIN:
     case CONFIG_LMT_VOLT_FAULT_MAX:
     case CONFIG_LMT_CUR_FAULT_MAX:
@@ -695,9 +1043,30 @@ static Data_Type command_get_datatype(uint16_t data_ID) {
     case CONFIG_MOTOR_GEAR_RATIO:
     case CONFIG_MOTOR_WHEEL_SIZE:
     case CONFIG_MOTOR_KV:
+    case CONFIG_MOTOR_RESISTANCE:
+    case CONFIG_MOTOR_LD:
+    case CONFIG_MOTOR_LQ:
+    case CONFIG_MOTOR_FLUX:
     case CONFIG_BMS_GETBAT_N:
+    case CONFIG_LMT_STATUS_SCALE:
+    case CONFIG_LMT_STATUS_REGEN_SCALE:
+    case CONFIG_REGEN_STATUS_COMMAND:
+    case CONFIG_REGEN_STATUS_ENERGY:
         type = Data_Type_Float;
         break;
+    default:
+        if(((data_ID & 0xFF00) == CONFIG_SCHED_PREFIX)
+                || ((data_ID & 0xFF00) == CONFIG_TASK_PREFIX)
+                || ((data_ID & 0xFF00) == CONFIG_FAULT_STATUS_PREFIX)
+                || ((data_ID & 0xFF00) == CONFIG_ELOG_STATUS_PREFIX)
+                || ((data_ID & 0xFF00) == CONFIG_MOTID_STATUS_PREFIX)
+                || ((data_ID & 0xFF00) == CONFIG_COG_STATUS_PREFIX)
+                || ((data_ID & 0xFF00) == CONFIG_BOOT_STATUS_PREFIX)
+                || ((data_ID & 0xFF00) == CONFIG_WDT_STATUS_PREFIX)
+                || ((data_ID & 0xFF00) == CONFIG_FWUP_STATUS_PREFIX)) {
+            type = Data_Type_Int32;
+        }
+        break;
     }
     return type;
 }
@@ -98,7 +98,7 @@ uint32_t data_packet_recreate_crc(uint8_t PacketType, uint8_t* DataBuffer, uint1
  * @retval DATA_PACKET_FAIL - the packet couldn't be created
  *            DATA_PACKET_SUCCESS - packet was created, it can now be sent
  */
-uint8_t data_packet_create(Data_Packet_Type* pkt, uint8_t type, uint8_t* data,
+uint8_t CCMRAM_FUNC data_packet_create(Data_Packet_Type* pkt, uint8_t type, uint8_t* data,
         uint16_t datalen) {
     uint16_t place = 0;
     uint32_t crc;
@@ -201,7 +201,13 @@ uint8_t data_packet_extract_one_byte(Data_Packet_Type *pkt, uint8_t new_byte) {
         // And the second byte
         pkt->DataLength += new_byte;
         pkt->DataBytesRead = 0;
-        pkt->State = DATA_COMM_DATALEN_1;
+        if (pkt->DataLength > PACKET_MAX_DATA_LENGTH) {
+            // Won't fit in the data buffer
+            pkt->State = DATA_COMM_IDLE;
+            pkt->FaultCode = INVALID_PACKET_LENGTH;
+        } else {
+            pkt->State = DATA_COMM_DATALEN_1;
+        }
         break;
     case DATA_COMM_DATALEN_1:
         // Now we got to keep track of how much data has been collected
@@ -0,0 +1,150 @@
+/******************************************************************************
+ * Filename: debug_trace.c
+ * Description: Debug trace rings. Interrupt code records small typed and
+ *              timestamped events into a RAM ring per channel, and the host
+ *              downloads them over the data interface. Each channel can be
+ *              turned on and off at runtime with a mask.
+ *
+ *              Everything here is compiled out unless DTRACE_ENABLE is set,
+ *              which it is by default in debug builds only. Then the trace
+ *              points are empty macros and the download returns no records.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+
+#if DTRACE_ENABLE
+
+volatile uint32_t DTrace_Mask = DTRACE_DFLT_MASK;
+
+static DTrace_Record_Type dtrace_ring[DTRACE_NUM_CHANNELS][DTRACE_RING_RECORDS];
+static volatile uint32_t dtrace_head[DTRACE_NUM_CHANNELS]; // Records ever written to the channel
+
+/**
+ * @brief  Adds a record to a channel's ring, overwriting the oldest one.
+ *         Use DTRACE_RECORD() instead, which checks the mask first and
+ *         compiles out when tracing is off.
+ * @param  channel - DTRACE_CH_xxx
+ * @param  event - DTRACE_xxx event of the channel
+ * @param  arg16 - Depends on the event
+ * @param  arg32 - Depends on the event
+ * @retval None
+ */
+void CCMRAM_FUNC DTRACE_Write(uint8_t channel, uint8_t event, uint16_t arg16, uint32_t arg32) {
+    if(channel >= DTRACE_NUM_CHANNELS) {
+        return;
+    }
+    uint32_t head = dtrace_head[channel];
+    DTrace_Record_Type* rec = &(dtrace_ring[channel][head & (DTRACE_RING_RECORDS - 1)]);
+    rec->Cycles = DWT->CYCCNT;
+    rec->Channel = channel;
+    rec->Event = event;
+    rec->Arg16 = arg16;
+    rec->Arg32 = arg32;
+    // Record is complete before it's counted
+    __DMB();
+    dtrace_head[channel] = head + 1;
+}
+
+/**
+ * @brief  Fills a download response with records from one channel.
+ *         Indexes count every record written since startup. Ones that
+ *         have already been overwritten are skipped. A very busy channel
+ *         can overwrite a record while it's copied out, which shows up as
+ *         a jump in the cycle count.
+ * @param  channel - DTRACE_CH_xxx
+ * @param  index - Index of the first record the host wants
+ * @param  data - Response buffer, DTRACE_DOWNLOAD_BYTES long
+ * @retval Number of bytes in the response
+ */
+uint16_t DTRACE_Download(uint8_t channel, uint32_t index, uint8_t* data) {
+    uint32_t end = 0;
+    uint16_t place = DTRACE_DOWNLOAD_HEADER_BYTES;
+    uint8_t num_records = 0;
+
+    if(channel < DTRACE_NUM_CHANNELS) {
+        end = dtrace_head[channel];
+        if((end > DTRACE_RING_RECORDS) && (index < (end - DTRACE_RING_RECORDS))) {
+            index = end - DTRACE_RING_RECORDS;
+        }
+        while((index < end) && (num_records < DTRACE_RECORDS_PER_PACKET)) {
+            DTrace_Record_Type* rec = &(dtrace_ring[channel][index & (DTRACE_RING_RECORDS - 1)]);
+            data_packet_pack_32b(&(data[place]), rec->Cycles);
+            data_packet_pack_8b(&(data[place + 4]), rec->Channel);
+            data_packet_pack_8b(&(data[place + 5]), rec->Event);
+            data_packet_pack_16b(&(data[place + 6]), rec->Arg16);
+            data_packet_pack_32b(&(data[place + 8]), rec->Arg32);
+            place += DTRACE_DOWNLOAD_RECORD_BYTES;
+            num_records++;
+            index++;
+        }
+    }
+    if(index > end) {
+        index = end;
+    }
+    data_packet_pack_32b(&(data[0]), index);
+    data_packet_pack_32b(&(data[4]), end);
+    return place;
+}
+
+uint8_t DTRACE_SetMask(uint32_t mask) {
+    if((mask & ~DTRACE_DFLT_MASK) != 0) {
+        return RETVAL_FAIL;
+    }
+    DTrace_Mask = mask;
+    return RETVAL_OK;
+}
+
+uint32_t DTRACE_GetMask(void) {
+    return DTrace_Mask;
+}
+
+#else
+
+// Tracing is compiled out. The host still gets valid, empty responses.
+
+void DTRACE_Write(uint8_t channel, uint8_t event, uint16_t arg16, uint32_t arg32) {
+    (void)channel;
+    (void)event;
+    (void)arg16;
+    (void)arg32;
+}
+
+uint16_t DTRACE_Download(uint8_t channel, uint32_t index, uint8_t* data) {
+    (void)channel;
+    (void)index;
+    data_packet_pack_32b(&(data[0]), 0);
+    data_packet_pack_32b(&(data[4]), 0);
+    return DTRACE_DOWNLOAD_HEADER_BYTES;
+}
+
+uint8_t DTRACE_SetMask(uint32_t mask) {
+    (void)mask;
+    return RETVAL_FAIL;
+}
+
+uint32_t DTRACE_GetMask(void) {
+    return 0;
+}
+
+#endif
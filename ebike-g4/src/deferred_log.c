@@ -0,0 +1,137 @@
+/******************************************************************************
+ * Filename: deferred_log.c
+ * Description: Deferred binary logger. A log call stores the ID of its
+ *              format string and the raw arguments in a RAM ring, which
+ *              takes a few dozen cycles and is safe from any interrupt.
+ *              No formatting is done on the target. The host downloads
+ *              the ring and formats each message with the string it reads
+ *              from the .dlog_fmt section of the ELF file, which is never
+ *              loaded into Flash.
+ *
+ *              Writers reserve space by moving the head with LDREX/STREX,
+ *              so an interrupt can log in the middle of another log call.
+ *              The header word goes in last. The reader stops at a header
+ *              that is still zero, and zeroes the words it takes out.
+ *              The dropped record count is updated the same way.
+ *
+ *              tools/dlog_format.py reads the strings out of the ELF file
+ *              and formats the downloaded records.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+
+static uint32_t dlog_ring[DLOG_RING_WORDS];
+static volatile uint32_t dlog_head; // Words reserved since startup
+static volatile uint32_t dlog_tail; // Words read out since startup
+static volatile uint32_t dlog_dropped; // Records lost since the last download
+
+static void DLOG_CountDropped(void);
+
+/**
+ * @brief  Stores one log record. Use DLOG() instead, which sets up the
+ *         string ID and the arguments.
+ * @param  id - Address of the format string in the .dlog_fmt section
+ * @param  args - Arguments as raw 32-bit words
+ * @param  nargs - Number of arguments, up to DLOG_MAX_ARGS
+ * @retval None
+ */
+void DLOG_Write(uint32_t id, const uint32_t* args, uint8_t nargs) {
+    uint32_t head, words, i;
+    if(nargs > DLOG_MAX_ARGS) {
+        nargs = DLOG_MAX_ARGS;
+    }
+    words = 2 + nargs;
+    do {
+        head = __LDREXW((uint32_t*)&dlog_head);
+        if(((head - dlog_tail) + words) > DLOG_RING_WORDS) {
+            __CLREX();
+            DLOG_CountDropped();
+            return;
+        }
+    } while(__STREXW(head + words, (uint32_t*)&dlog_head) != 0);
+
+    dlog_ring[(head + 1) & (DLOG_RING_WORDS - 1)] = DWT->CYCCNT;
+    for(i = 0; i < nargs; i++) {
+        dlog_ring[(head + 2 + i) & (DLOG_RING_WORDS - 1)] = args[i];
+    }
+    // The record is only visible to the reader once the header is in
+    __DMB();
+    dlog_ring[head & (DLOG_RING_WORDS - 1)] = (id << DLOG_HEADER_ID_SHIFT)
+            | DLOG_HEADER_VALID | nargs;
+}
+
+/**
+ * @brief  Takes as many whole records out of the ring as fit in one
+ *         packet. Only one caller at a time, from the main loop.
+ * @param  data - Response buffer, DLOG_DOWNLOAD_BYTES long
+ * @retval Number of bytes in the response
+ */
+uint16_t DLOG_Download(uint8_t* data) {
+    uint32_t tail = dlog_tail;
+    uint32_t dropped;
+    uint16_t place = DLOG_DOWNLOAD_HEADER_BYTES;
+    uint16_t free_words = DLOG_DOWNLOAD_WORDS;
+
+    while(tail != dlog_head) {
+        uint32_t header = dlog_ring[tail & (DLOG_RING_WORDS - 1)];
+        uint32_t words, i;
+        if(header == 0) {
+            // Reserved, but the writer isn't done with it yet
+            break;
+        }
+        words = 2 + (header & DLOG_HEADER_NARGS_MASK);
+        if(words > free_words) {
+            break;
+        }
+        __DMB();
+        for(i = 0; i < words; i++) {
+            data_packet_pack_32b(&(data[place]), dlog_ring[(tail + i) & (DLOG_RING_WORDS - 1)]);
+            dlog_ring[(tail + i) & (DLOG_RING_WORDS - 1)] = 0;
+            place += 4;
+        }
+        free_words -= words;
+        tail += words;
+        // Space is free again only after it's been cleared
+        __DMB();
+        dlog_tail = tail;
+    }
+    // Take the count and clear it together, a writer can drop one at any time
+    do {
+        dropped = __LDREXW((uint32_t*)&dlog_dropped);
+    } while(__STREXW(0, (uint32_t*)&dlog_dropped) != 0);
+    data_packet_pack_32b(&(data[0]), dropped);
+    return place;
+}
+
+/**
+ * @brief  Counts a record that didn't fit. Exclusive access, so a higher
+ *         priority interrupt dropping one at the same time isn't lost.
+ * @retval None
+ */
+static void DLOG_CountDropped(void) {
+    uint32_t dropped;
+    do {
+        dropped = __LDREXW((uint32_t*)&dlog_dropped);
+    } while(__STREXW(dropped + 1, (uint32_t*)&dlog_dropped) != 0);
+}
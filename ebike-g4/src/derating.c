@@ -0,0 +1,199 @@
+/******************************************************************************
+ * Filename: derating.c
+ * Description: Derating engine. Combines every soft and hard limit in the
+ *              main configuration into a single current limit scale from
+ *              0 (no current allowed) to 1 (full current).
+ *
+ *              Each source ramps linearly from full scale at its soft limit
+ *              down to zero at its hard limit:
+ *               - Bus voltage, from VoltageSoftCap down to VoltageHardCap
+ *               - FET temperature, from FetTempSoftCap up to FetTempHardCap
+ *               - Motor temperature, from MotorTempSoftCap up to MotorTempHardCap
+ *               - Phase current, from MaxPhaseCurrent up to CurrentFault
+ *               - Estimated battery current, from MaxBatteryCurrent up to
+ *                 DERATE_BATT_OVERSHOOT times that
+ *
+ *              The lowest source wins. The output follows a falling limit
+ *              immediately but recovers at a fixed rate, so a sagging
+ *              battery doesn't make the limit oscillate. The reason code
+ *              reports which source is holding the scale down.
+ *
+ *              Regen gets a second scale from the temperatures alone. A low
+ *              battery or a high discharge current is no reason to brake
+ *              less, since braking charges the battery.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+
+Biquad_Bank_Type Derate_Filt;
+static float derate_scale;
+static float derate_regen_scale;
+static Main_Limit_Type derate_reason;
+static uint8_t derate_filt_primed;
+
+static float DERATE_Ramp(float x, float x_full, float x_zero);
+static uint8_t DERATE_Follow(float* scale, float target);
+static void DERATE_Check(float scale, Main_Limit_Type soft, Main_Limit_Type hard,
+        float* lowest, Main_Limit_Type* reason);
+
+void DERATE_Init(void) {
+    FOC_BiquadBankInit(&Derate_Filt, DERATE_FILT_CHANNELS);
+    FOC_BiquadBankDesign(&Derate_Filt, DERATE_FILT_VBUS, Biquad_LowPass,
+            DERATE_SAMPLING_RATE, DERATE_VBUS_FILT, DERATE_VBUS_FILT_Q);
+    FOC_BiquadBankDesign(&Derate_Filt, DERATE_FILT_FET_TEMP, Biquad_LowPass,
+            DERATE_SAMPLING_RATE, DERATE_TEMP_FILT, DERATE_TEMP_FILT_Q);
+    FOC_BiquadBankDesign(&Derate_Filt, DERATE_FILT_MOTOR_TEMP, Biquad_LowPass,
+            DERATE_SAMPLING_RATE, DERATE_TEMP_FILT, DERATE_TEMP_FILT_Q);
+    derate_filt_primed = 0;
+    // Start at zero. Current is allowed in gradually after startup.
+    derate_scale = 0.0f;
+    derate_regen_scale = 0.0f;
+    derate_reason = Main_Limit_None;
+}
+
+/**
+ * @brief  Updates the current limit scales.
+ * @param  cfg - Main configuration. The results are written to
+ *               cfg->throttle_limit_scale and cfg->regen_limit_scale.
+ * @param  vbus - Bus voltage (V)
+ * @param  fet_temp - Controller FET temperature (degC)
+ * @param  motor_temp - Motor temperature (degC)
+ * @param  phase_current - Magnitude of the phase current vector (A)
+ * @param  batt_current - Filtered battery current estimate (A)
+ * @retval The new limit scale, 0 to 1
+ */
+float DERATE_Process(Config_Main* cfg, float vbus, float fet_temp,
+        float motor_temp, float phase_current, float batt_current) {
+    float target = 1.0f;
+    float fet_scale, motor_scale;
+    Main_Limit_Type reason = Main_Limit_None;
+
+    // Bus voltage and temperatures are filtered together. Start the filters
+    // at the first readings instead of ramping up from zero.
+    if(derate_filt_primed == 0) {
+        FOC_BiquadBankPrime(&Derate_Filt, DERATE_FILT_VBUS, vbus);
+        FOC_BiquadBankPrime(&Derate_Filt, DERATE_FILT_FET_TEMP, fet_temp);
+        FOC_BiquadBankPrime(&Derate_Filt, DERATE_FILT_MOTOR_TEMP, motor_temp);
+        derate_filt_primed = 1;
+    }
+    Derate_Filt.X[DERATE_FILT_VBUS] = vbus;
+    Derate_Filt.X[DERATE_FILT_FET_TEMP] = fet_temp;
+    Derate_Filt.X[DERATE_FILT_MOTOR_TEMP] = motor_temp;
+    FOC_BiquadBankCalc(&Derate_Filt);
+
+    DERATE_Check(DERATE_Ramp(Derate_Filt.Y[DERATE_FILT_VBUS], cfg->VoltageSoftCap, cfg->VoltageHardCap),
+            Main_Limit_SoftVoltage, Main_Limit_HardVoltage, &target, &reason);
+    fet_scale = DERATE_Ramp(Derate_Filt.Y[DERATE_FILT_FET_TEMP], cfg->FetTempSoftCap, cfg->FetTempHardCap);
+    DERATE_Check(fet_scale, Main_Limit_SoftFetTemp, Main_Limit_HardFetTemp, &target, &reason);
+    motor_scale = DERATE_Ramp(Derate_Filt.Y[DERATE_FILT_MOTOR_TEMP], cfg->MotorTempSoftCap, cfg->MotorTempHardCap);
+    DERATE_Check(motor_scale, Main_Limit_SoftMotorTemp, Main_Limit_HardMotorTemp, &target, &reason);
+    DERATE_Check(DERATE_Ramp(phase_current, cfg->MaxPhaseCurrent, cfg->CurrentFault),
+            Main_Limit_PhaseCurrent, Main_Limit_CurrentFault, &target, &reason);
+    DERATE_Check(DERATE_Ramp(batt_current, cfg->MaxBatteryCurrent,
+            cfg->MaxBatteryCurrent * DERATE_BATT_OVERSHOOT),
+            Main_Limit_BattCurrent, Main_Limit_BattCurrent, &target, &reason);
+
+    if(DERATE_Follow(&derate_scale, target) != 0) {
+        derate_reason = reason;
+    }
+    // Otherwise keep the old reason until fully recovered
+    DERATE_Follow(&derate_regen_scale, (fet_scale < motor_scale) ? fet_scale : motor_scale);
+
+    cfg->throttle_limit_scale = derate_scale;
+    cfg->regen_limit_scale = derate_regen_scale;
+    return derate_scale;
+}
+
+float DERATE_GetScale(void) {
+    return derate_scale;
+}
+
+float DERATE_GetRegenScale(void) {
+    return derate_regen_scale;
+}
+
+Main_Limit_Type DERATE_GetReason(void) {
+    return derate_reason;
+}
+
+/**
+ * @brief  Linear ramp between two limits.
+ * @param  x - Measured value
+ * @param  x_full - Full scale at or on this side of this value
+ * @param  x_zero - Zero at or beyond this value
+ * @retval Scale from 0 to 1
+ */
+static float DERATE_Ramp(float x, float x_full, float x_zero) {
+    float span = x_full - x_zero;
+    float scale;
+    if(span == 0.0f) {
+        // No room for a ramp, just a step
+        return ((x - x_zero) * (x_full >= x_zero ? 1.0f : -1.0f) > 0.0f) ? 1.0f : 0.0f;
+    }
+    scale = (x - x_zero) / span;
+    if(scale > 1.0f) {
+        scale = 1.0f;
+    }
+    if(scale < 0.0f) {
+        scale = 0.0f;
+    }
+    return scale;
+}
+
+/**
+ * @brief  Moves a scale towards its target. Falling is immediate, recovering
+ *         is rate limited.
+ * @param  scale - Scale to update
+ * @param  target - Lowest of its sources
+ * @retval Non-zero once the scale is at the target
+ */
+static uint8_t DERATE_Follow(float* scale, float target) {
+    if(target <= *scale) {
+        *scale = target;
+        return 1;
+    }
+    *scale += DERATE_RECOVERY_RATE / DERATE_SAMPLING_RATE;
+    if(*scale >= target) {
+        *scale = target;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief  Keeps the lowest scale and the reason for it.
+ * @param  scale - Scale from one source
+ * @param  soft - Reason code when the source is between its limits
+ * @param  hard - Reason code when the source is past its hard limit
+ * @param  lowest - Lowest scale so far, updated if this one is lower
+ * @param  reason - Reason for the lowest scale so far
+ * @retval None
+ */
+static void DERATE_Check(float scale, Main_Limit_Type soft, Main_Limit_Type hard,
+        float* lowest, Main_Limit_Type* reason) {
+    if(scale < *lowest) {
+        *lowest = scale;
+        *reason = (scale <= 0.0f) ? hard : soft;
+    }
+}
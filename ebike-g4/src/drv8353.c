@@ -12,6 +12,13 @@
  *              the 11 data bits presently in the register for both
  *              reads and writes after the end of the address bits.
  *
+ *              After initialization, all SPI traffic goes through a job
+ *              queue that runs from the SPI interrupt, so nothing waits on
+ *              the bus. A shadow copy of every register is kept in RAM.
+ *              Getters read the shadow, setters update it and queue a
+ *              write followed by a read back to check it. A main loop task
+ *              polls the fault status registers in the background.
+ *
  ******************************************************************************
 
  Copyright (c) 2020 David Miller
@@ -37,7 +44,30 @@
 
 #include "main.h"
 
+// Shadow copy of the chip registers, 11 data bits each
+uint16_t Drv_Shadow[DRV_NUM_REGS];
+DRV_Status_Type Drv_Status;
+
+// SPI job queue. Filled from anywhere, emptied by the SPI interrupt.
+static DRV_Job_Type drv_jobs[DRV_MAX_JOBS];
+static volatile uint8_t drv_job_head;
+static volatile uint8_t drv_job_tail;
+static volatile uint8_t drv_job_count;
+static volatile uint8_t drv_busy;
+// Writes queued to each register and not yet read back. Until they are,
+// the shadow holds the newest value asked for, not what a read returns.
+static volatile uint8_t drv_writes_pending[DRV_NUM_REGS];
+static uint32_t drv_cs_high_time;
+static uint32_t drv_cs_gap_cycles;
+static uint32_t drv_wake_tick; // When the enable pin went high
+
 static uint8_t DRV8353_CheckConnection(void);
+static uint16_t DRV8353_Transaction(uint16_t DataOut);
+static uint16_t DRV8353_Read(uint8_t reg_addr);
+static uint16_t DRV8353_Write(uint8_t reg_addr, uint16_t reg_value);
+static uint8_t DRV8353_Queue(uint16_t frame, uint16_t expect, uint8_t type, uint8_t retries);
+static void DRV8353_StartNext(void);
+static void DRV8353_Complete(DRV_Job_Type* job, uint16_t data);
 
 /**
  * @brief SPI init for DRV8353.
@@ -45,13 +75,15 @@ static uint8_t DRV8353_CheckConnection(void);
  * Initializes the SPI and GPIO for communication with the
  * DRV8353 driver IC. Obeys restrictions in the DRV8353
  * datasheet (16-bit, clock idles low, data changes on
- * rising edge, max bitrate 10MHz).
+ * rising edge, max bitrate 10MHz). Then brings the enable
+ * pin high, and the chip wakes up while the rest of startup
+ * carries on. DRV8353_Init sets up the registers.
  *
  * @param  None
  * @retval None
  */
 
-void DRV8353_Init(void) {
+void DRV8353_PowerUp(void) {
     // Clock the needed GPIOs and the SPI peripheral
     GPIO_Clk(SPI_PORT);
     DRV_SPI_CLK_ENABLE();
@@ -122,12 +154,26 @@ void DRV8353_Init(void) {
 
     // Start the chip by bringing enable high
     GPIO_High(DRV_EN_PORT, DRV_EN_PIN);
-    Delay(5); // Wait a little bit for initialization.
+    drv_wake_tick = GetTick();
+    drv_cs_high_time = DWT->CYCCNT;
+    drv_cs_gap_cycles = (SystemCoreClock / 1000000u) * DRV_CS_HIGH_NS / 1000u;
+}
+
+/**
+ * @brief  Sets up the DRV8353 registers, after DRV8353_PowerUp, and
+ *         starts the SPI job queue. Frames only need the chip select
+ *         high time between them, so the writes go back to back.
+ * @retval None
+ */
+void DRV8353_Init(void) {
+    // Give the chip time to wake up, if startup hasn't already
+    while((GetTick() - drv_wake_tick) < DRV_WAKE_DELAY_MS) {
+        // pass
+    }
 
     // Initialize the registers
     // CTRL - all three bridges will shutdown if one has a fault. PWM 6x mode
     DRV8353_Write(DRVREG_CTRL, DRVBIT_CTRL_OCPACT);
-    Delay(5); // Wait after each write - there's some necessary time between SPI_EN going high and back low again
 
     // Gate drive settings.
     // Using TPW4R50ANH mosfets with 58nC total gate charge, 12nC gate-drain charge
@@ -141,32 +187,54 @@ void DRV8353_Init(void) {
 
     // Gate HS - Mid range current source and sink (300mA source, 600mA sink)
     DRV8353_Write(DRVREG_GATEH, DRVBIT_GATEH_IDRIVEHS_2 | DRVBIT_GATEH_IDRIVENHS_2);
-    Delay(5);
     // Gate LS - Mid range current source and sink (300mA source, 600mA sink), Tdrive = 500ns,
     //              and new PWM input needed to clear VDS_OCP or SEN_OCP faults.
     DRV8353_Write(DRVREG_GATEL, DRVBIT_GATEL_CBC | DRVBIT_GATEL_IDRIVELS_2 | DRVBIT_GATEL_IDRIVENLS_2);
-    Delay(5);
     // OCP - 100ns dead time (generally dead time is set by the MCU), overcurrent faults are latched,
     //          deglitch time is 2us, and VDS over current level is 0.6V (worst case
     //          100degC Rdson = 6mOhm, trip at 100A) (setting is 1001b)
     DRV8353_Write(DRVREG_OCP, DRVBIT_OCP_DEADTIME_0 | DRVBIT_OCP_DEG_1 | DRVBIT_OCP_VDSLVL_3 | DRVBIT_OCP_VDSLVL_0);
-    Delay(5);
     // CSA - Normal shunt resistor connections, bidirectional, 2nd smallest gain (10V/V, setting of 01b),
     //          sense over current threshold is 0.25V (equivalent to 125A with 2mOhm shunt, setting of 00b)
     DRV8353_Write(DRVREG_CSA, DRVBIT_CSA_VREFDIV | DRVBIT_CSA_GAIN_0);
-    Delay(5);
 
     // No need to set the final register, auto-calibration is done at startup anyway.
+
+    // Fill in the shadow copy
+    for(uint8_t reg = 0; reg < DRV_NUM_REGS; reg++) {
+        Drv_Shadow[reg] = DRV8353_Read(reg) & DRV_DATA;
+    }
+
+    // From here on, transfers are run from the SPI interrupt
+    drv_job_head = 0;
+    drv_job_tail = 0;
+    drv_job_count = 0;
+    drv_busy = 0;
+    for(uint8_t reg = 0; reg < DRV_NUM_REGS; reg++) {
+        drv_writes_pending[reg] = 0;
+    }
+    Drv_Status.Transfers = 0;
+    Drv_Status.VerifyFailures = 0;
+    Drv_Status.QueueFull = 0;
+    Drv_Status.Polls = 0;
+    DRV_SPI->CR2 |= SPI_CR2_RXNEIE;
+    NVIC_SetPriority(DRV_IRQn, PRIO_DRV_SPI);
+    NVIC_EnableIRQ(DRV_IRQn);
 }
 
 /**
- * @brief  Launches a transaction (read/write) on SPI.
+ * @brief  Launches a transaction (read/write) on SPI and waits for it.
+ *         Only used during initialization, before the job queue starts.
  * @param  DataOut The 16-bit data to write to the DRV8353
  * @retval The 16-bit data read from the chip.
  */
-uint16_t DRV8353_Transaction(uint16_t DataOut) {
+static uint16_t DRV8353_Transaction(uint16_t DataOut) {
     uint32_t timeout_tracker;
     uint16_t retval = 0xFFFFU;
+    // The chip needs chip select high for a while between frames
+    while((DWT->CYCCNT - drv_cs_high_time) < drv_cs_gap_cycles) {
+        // pass
+    }
     // First pull chip select line low.
     GPIO_Low(SPI_PORT, SPI_CS_PIN);
 
@@ -192,16 +260,18 @@ uint16_t DRV8353_Transaction(uint16_t DataOut) {
 
     // Return CS line high
     GPIO_High(SPI_PORT, SPI_CS_PIN);
+    drv_cs_high_time = DWT->CYCCNT;
 
     return retval;
 }
 
 /**
- * @brief Read from a register in DRV8353 chip
+ * @brief Read from a register in DRV8353 chip, waiting for the result.
+ *        Only used during initialization.
  * @param reg_addr The 4-bit register address (lowest 4 bits of the byte)
  * @retval The 16-bit read data, only bits 10 to 0 are meaningful.
  */
-uint16_t DRV8353_Read(uint8_t reg_addr) {
+static uint16_t DRV8353_Read(uint8_t reg_addr) {
     uint16_t spi_out_val = (reg_addr & 0x0F);
     spi_out_val <<= DRV_ADDR_SHIFT;
     spi_out_val += DRV_RW;
@@ -209,41 +279,122 @@ uint16_t DRV8353_Read(uint8_t reg_addr) {
 }
 
 /**
- * @brief Write to a register in DRV8353 chip
+ * @brief Write to a register in DRV8353 chip, waiting for it to finish.
+ *        Only used during initialization.
  * @param reg_addr The 4-bit register address (lowest 4 bits of the byte)
  * @param reg_value The new 11-bit register value (aligned right, lowest 11 bits of half-word)
  * @retval The 16-bit read data (previous register value), only bits 10 to 0 are meaningful.
  */
-uint16_t DRV8353_Write(uint8_t reg_addr, uint16_t reg_value) {
+static uint16_t DRV8353_Write(uint8_t reg_addr, uint16_t reg_value) {
     uint16_t spi_out_val = (reg_addr & 0x0F);
     spi_out_val <<= DRV_ADDR_SHIFT;
     spi_out_val += (reg_value & DRV_DATA);
     return DRV8353_Transaction(spi_out_val);
 }
 
+/**
+ * @brief  Reads a register from the shadow copy. No SPI traffic.
+ * @param  reg_addr The 4-bit register address
+ * @retval The 11-bit register value, as last written or read back
+ */
+uint16_t DRV8353_GetRegister(uint8_t reg_addr) {
+    return Drv_Shadow[reg_addr & 0x07];
+}
+
+/**
+ * @brief  Queues a read of a register into the shadow copy.
+ * @param  reg_addr The 4-bit register address
+ * @retval RETVAL_OK if queued, RETVAL_FAIL if the queue is full
+ */
+uint8_t DRV8353_QueueRead(uint8_t reg_addr) {
+    uint16_t frame = ((uint16_t)(reg_addr & 0x0F) << DRV_ADDR_SHIFT) | DRV_RW;
+    return DRV8353_Queue(frame, 0, DRV_JOB_READ, 0);
+}
+
+/**
+ * @brief  Queues a write to a register, followed by a read back to check it.
+ *         The shadow copy takes the new value right away, and the read back
+ *         of the last queued write to the register refreshes it. If the
+ *         read back doesn't match, the write is tried again a couple of
+ *         times, and the shadow ends up holding whatever the chip really has.
+ * @param  reg_addr The 4-bit register address
+ * @param  reg_value The new 11-bit register value
+ * @retval RETVAL_OK if queued, RETVAL_FAIL if the queue is full
+ */
+uint8_t DRV8353_QueueWrite(uint8_t reg_addr, uint16_t reg_value) {
+    uint16_t old = Drv_Shadow[reg_addr & 0x07];
+    Drv_Shadow[reg_addr & 0x07] = reg_value & DRV_DATA;
+    if((reg_addr & 0x07) == DRVREG_CTRL) {
+        // The fault clear bit doesn't stay set in the chip
+        Drv_Shadow[reg_addr & 0x07] &= ~(DRVBIT_CTRL_CLRFLT);
+    }
+    if(DRV8353_Queue(((uint16_t)(reg_addr & 0x0F) << DRV_ADDR_SHIFT) | (reg_value & DRV_DATA),
+            0, DRV_JOB_WRITE, 0) != RETVAL_OK) {
+        Drv_Shadow[reg_addr & 0x07] = old;
+        return RETVAL_FAIL;
+    }
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Main loop task. Queues a read of both fault status registers,
+ *         and every so often the control register to make sure the chip
+ *         is still there with its settings intact.
+ * @retval None
+ */
+void DRV8353_Poll(void) {
+    static uint8_t ctrl_countdown = 0;
+    DRV8353_QueueRead(DRVREG_FAULT1);
+    DRV8353_QueueRead(DRVREG_FAULT2);
+    if(ctrl_countdown == 0) {
+        ctrl_countdown = DRV_POLL_CTRL_DIVIDER;
+        DRV8353_QueueRead(DRVREG_CTRL);
+    }
+    ctrl_countdown--;
+    Drv_Status.Polls++;
+}
+
+/**
+ * @brief  SPI interrupt. Finishes the transfer in progress, updates the
+ *         shadow copy, and starts the next queued job.
+ * @retval None
+ */
+void DRV8353_IRQ(void) {
+    DRV_Job_Type job;
+    uint16_t data;
+    if((DRV_SPI->SR & SPI_SR_RXNE) == 0) {
+        return;
+    }
+    data = (uint16_t)(DRV_SPI->DR) & DRV_DATA;
+    GPIO_High(SPI_PORT, SPI_CS_PIN);
+    drv_cs_high_time = DWT->CYCCNT;
+    Drv_Status.Transfers++;
+
+    // Take a copy, a retry can reuse the slot
+    job = drv_jobs[drv_job_tail];
+    drv_job_tail = (drv_job_tail + 1) % DRV_MAX_JOBS;
+    drv_job_count--;
+    drv_busy = 0;
+    DRV8353_Complete(&job, data);
+
+    DRV8353_StartNext();
+}
+
 /**
  * @brief  Set the Current Sense Amplifier gain in DRV8353 chip
  * @param  gain Choice of 5V/V, 10V/V, 20V/V, or 40V/V. Use the predefined enum
- * @retval RETVAL_OK if setting correctly applied, otherwise RETVAL_FAIL
+ * @retval RETVAL_OK if the change was queued, otherwise RETVAL_FAIL
  */
 uint8_t DRV8353_SetGain(DRV_Gain gain) {
     uint16_t temp_csa;
     // Input check
     if(gain <= 0x03) {
-
-        // First read the present value
-        temp_csa = DRV8353_Read(DRVREG_CSA);
+        temp_csa = Drv_Shadow[DRVREG_CSA];
         // Choose new gain setting
         temp_csa &= ~(DRVBIT_CSA_GAIN);
         temp_csa |= (gain << DRVBIT_CSA_GAIN_SHIFT);
-
-        // Write the new value
-        DRV8353_Write(DRVREG_CSA, temp_csa);
-        // Double-check
-        temp_csa = DRV8353_Read(DRVREG_CSA);
-        if( (temp_csa & DRVBIT_CSA_GAIN) == (gain << DRVBIT_CSA_GAIN_SHIFT) ) {
-            return RETVAL_OK;
-        }
+        // Write and check in the background
+        return DRV8353_QueueWrite(DRVREG_CSA, temp_csa);
     }
     return RETVAL_FAIL;
 }
@@ -253,18 +404,9 @@ uint8_t DRV8353_SetGain(DRV_Gain gain) {
  * @retval Value from DRV_Gain enum. If chip isn't connected, DRV_Gain_Unknown will be returned.
  */
 DRV_Gain DRV8353_GetGain(void) {
-    uint16_t temp_csa;
     if(DRV8353_CheckConnection() == RETVAL_OK) {
-        temp_csa = DRV8353_Read(DRVREG_CSA);
-        if((temp_csa & DRVBIT_CSA_GAIN) == 0x00) {
-            return DRV_Gain_5;
-        } else if((temp_csa & DRVBIT_CSA_GAIN) == DRVBIT_CSA_GAIN_0) {
-            return DRV_Gain_10;
-        } else if((temp_csa & DRVBIT_CSA_GAIN) == DRVBIT_CSA_GAIN_1) {
-            return DRV_Gain_20;
-        } else if((temp_csa & DRVBIT_CSA_GAIN) == (DRVBIT_CSA_GAIN_1 | DRVBIT_CSA_GAIN_0)) {
-            return DRV_Gain_40;
-        }
+        // The register field directly maps to the enum settings
+        return (DRV_Gain)((Drv_Shadow[DRVREG_CSA] & DRVBIT_CSA_GAIN) >> DRVBIT_CSA_GAIN_SHIFT);
     }
     return DRV_Gain_Unknown;
 }
@@ -272,24 +414,18 @@ DRV_Gain DRV8353_GetGain(void) {
 /**
  * @brief  Set the VDS limit voltage in DRV8353 chip
  * @param  gain Choice of DRV_VDS_Limit (0.06V to 2.0V)
- * @retval RETVAL_OK if setting correctly applied, otherwise RETVAL_FAIL
+ * @retval RETVAL_OK if the change was queued, otherwise RETVAL_FAIL
  */
 uint8_t DRV8353_SetVDSLimit(DRV_VDS_Limit lmt) {
     uint16_t temp_ocp;
     // Input check
     if(lmt <= 0xF) {
-        // First read the present value
-        temp_ocp = DRV8353_Read(DRVREG_CSA);
+        temp_ocp = Drv_Shadow[DRVREG_OCP];
         // Choose new limit
         temp_ocp &= ~(DRVBIT_OCP_VDSLVL);
         temp_ocp |= lmt;
-        // Write the new value
-        DRV8353_Write(DRVREG_CSA, temp_ocp);
-        // Double-check
-        temp_ocp = DRV8353_Read(DRVREG_CSA);
-        if((temp_ocp & DRVBIT_OCP_VDSLVL) == lmt) {
-            return RETVAL_OK;
-        }
+        // Write and check in the background
+        return DRV8353_QueueWrite(DRVREG_OCP, temp_ocp);
     }
     return RETVAL_FAIL;
 }
@@ -299,10 +435,9 @@ uint8_t DRV8353_SetVDSLimit(DRV_VDS_Limit lmt) {
  * @retval Value from DRV_VDS_Limit enum. If chip isn't connected, DRV_VDS_Unknown will be returned.
  */
 DRV_VDS_Limit DRV8353_GetVDSLimit(void) {
-    uint16_t temp_ocp;
     if(DRV8353_CheckConnection() == RETVAL_OK) {
-        temp_ocp = DRV8353_Read(DRVREG_OCP) & DRVBIT_OCP_VDSLVL;
-        return (DRV_VDS_Limit)temp_ocp; // the register value directly maps to the enum settings
+        // The register value directly maps to the enum settings
+        return (DRV_VDS_Limit)(Drv_Shadow[DRVREG_OCP] & DRVBIT_OCP_VDSLVL);
     }
     return DRV_VDS_Unknown;
 }
@@ -316,29 +451,20 @@ DRV_VDS_Limit DRV8353_GetVDSLimit(void) {
  *         per each gate. Rising edge ranges between 50mA to 1000mA and falling edge is
  *         between 100mA to 2000mA. Smaller number is less current. Check the DRV8353
  *         datasheet for more details.
- * @retval RETVAL_OK if setting correctly applied, otherwise RETVAL_FAIL
+ * @retval RETVAL_OK if the change was queued, otherwise RETVAL_FAIL
  */
 uint8_t DRV8353_SetGateStrength(uint32_t strength) {
-    uint16_t temp_hs, temp_ls, temp_check;
+    uint16_t temp_hs, temp_ls;
     if(strength <= 0x0000FFFFu) {
         // Don't care about previous value, only other field is LOCK which will be set to 000b
         temp_hs = ((strength & 0xFF00) >> 8u);
-        DRV8353_Write(DRVREG_GATEH, temp_hs);
-
-        // Get present value
-        temp_ls = DRV8353_Read(DRVREG_GATEL);
-        // Set new drive strength
+        // Keep the other low side settings
+        temp_ls = Drv_Shadow[DRVREG_GATEL];
         temp_ls &= ~(DRVBIT_GATEL_IDRIVELS | DRVBIT_GATEL_IDRIVENLS);
         temp_ls |= (strength & 0x00FF);
-        DRV8353_Write(DRVREG_GATEL, temp_ls);
-
-        // Double-check
-        temp_check = DRV8353_Read(DRVREG_GATEH);
-        if((temp_check & (DRVBIT_GATEH_IDRIVEHS | DRVBIT_GATEH_IDRVENHS)) == temp_hs) {
-            temp_check = DRV8353_Read(DRVREG_GATEL);
-            if((temp_check & DRV_DATA) == temp_ls) {
-                return RETVAL_OK;
-            }
+
+        if(DRV8353_QueueWrite(DRVREG_GATEH, temp_hs) == RETVAL_OK) {
+            return DRV8353_QueueWrite(DRVREG_GATEL, temp_ls);
         }
     }
     return RETVAL_FAIL;
@@ -351,9 +477,8 @@ uint8_t DRV8353_SetGateStrength(uint32_t strength) {
 uint32_t DRV8353_GetGateStrength(void) {
     uint16_t temp_hs, temp_ls;
     if(DRV8353_CheckConnection() == RETVAL_OK) {
-        temp_hs = DRV8353_Read(DRVREG_GATEH);
-        Delay(1);
-        temp_ls = DRV8353_Read(DRVREG_GATEL);
+        temp_hs = Drv_Shadow[DRVREG_GATEH];
+        temp_ls = Drv_Shadow[DRVREG_GATEL];
         temp_hs = (temp_hs & (DRVBIT_GATEH_IDRIVEHS | DRVBIT_GATEH_IDRVENHS)) << 8u;
         temp_hs = temp_hs | (temp_ls & (DRVBIT_GATEL_IDRIVELS | DRVBIT_GATEL_IDRIVENLS));
         return temp_hs;
@@ -382,8 +507,7 @@ void DRV8353_SetCalibration(uint8_t channel) {
 
     // Check that input is valid
     if(channel <= (DRV_CHANNEL_A_CAL|DRV_CHANNEL_B_CAL|DRV_CHANNEL_C_CAL)) {
-        // First read the present value
-        temp_csa = DRV8353_Read(DRVREG_CSA);
+        temp_csa = Drv_Shadow[DRVREG_CSA];
 
         // Select the inputs to short for calibration
         if((channel & DRV_CHANNEL_A_CAL) != 0) {
@@ -403,24 +527,133 @@ void DRV8353_SetCalibration(uint8_t channel) {
         }
 
         // Write the new value
-        DRV8353_Write(DRVREG_CSA, temp_csa);
+        DRV8353_QueueWrite(DRVREG_CSA, temp_csa);
     }
 }
 
 /**
  * @brief  Checks if the DRV8353 SPI connection is working.
  *
- *         Simply reads the control register and makes sure its value matches
- *         what was set during the initialization phase. If the chip isn't
- *         powered up or connected properly, the value will probably be all
- *         '1's instead of what was written.
+ *         Checks that the control register, as last read back by the
+ *         background poll, matches what was set during initialization.
+ *         If the chip isn't powered up or connected properly, the value
+ *         will probably be all '1's instead of what was written.
  * @retval RETVAL_OK if connected, RETVAL_FAIL otherwise
  */
 static uint8_t DRV8353_CheckConnection(void) {
-    uint16_t tempreg;
-    tempreg = DRV8353_Read(DRVREG_CTRL) & DRV_DATA;
-    if(tempreg == DRVBIT_CTRL_OCPACT) {
+    if(Drv_Shadow[DRVREG_CTRL] == DRVBIT_CTRL_OCPACT) {
         return RETVAL_OK;
     }
     return RETVAL_FAIL;
 }
+
+/**
+ * @brief  Adds a job to the queue and starts it if the SPI is idle.
+ *         Safe to call from any context.
+ * @param  frame - The 16-bit SPI frame to send
+ * @param  expect - For a verify job, the value the register should have
+ * @param  type - DRV_JOB_xxx
+ * @param  retries - Number of times the write has already been retried
+ * @retval RETVAL_OK if queued, RETVAL_FAIL if the queue is full
+ */
+static uint8_t DRV8353_Queue(uint16_t frame, uint16_t expect, uint8_t type, uint8_t retries) {
+    DRV_Job_Type* job;
+    // Writes are always followed by a read back
+    uint8_t needed = (type == DRV_JOB_WRITE) ? 2 : 1;
+    __disable_irq();
+    if((drv_job_count + needed) > DRV_MAX_JOBS) {
+        Drv_Status.QueueFull++;
+        __enable_irq();
+        return RETVAL_FAIL;
+    }
+    job = &(drv_jobs[drv_job_head]);
+    job->Frame = frame;
+    job->Expect = expect;
+    job->Type = type;
+    job->Retries = retries;
+    drv_job_head = (drv_job_head + 1) % DRV_MAX_JOBS;
+    drv_job_count++;
+    if(type == DRV_JOB_WRITE) {
+        job = &(drv_jobs[drv_job_head]);
+        job->Frame = (frame & DRV_ADDR) | DRV_RW;
+        job->Expect = frame & DRV_DATA;
+        job->Type = DRV_JOB_VERIFY;
+        job->Retries = retries;
+        drv_job_head = (drv_job_head + 1) % DRV_MAX_JOBS;
+        drv_job_count++;
+        drv_writes_pending[((frame & DRV_ADDR) >> DRV_ADDR_SHIFT) & 0x07]++;
+    }
+    DRV8353_StartNext();
+    __enable_irq();
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Starts the next queued job, if there is one and the SPI is
+ *         idle. Call from the SPI interrupt, or with interrupts disabled.
+ * @retval None
+ */
+static void DRV8353_StartNext(void) {
+    if((drv_busy != 0) || (drv_job_count == 0)) {
+        return;
+    }
+    // The chip needs chip select high for a while between frames
+    if((DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) != 0) {
+        while((DWT->CYCCNT - drv_cs_high_time) < drv_cs_gap_cycles) {
+        }
+    }
+    drv_busy = 1;
+    GPIO_Low(SPI_PORT, SPI_CS_PIN);
+    DRV_SPI->DR = drv_jobs[drv_job_tail].Frame;
+}
+
+/**
+ * @brief  Handles the result of a finished job.
+ * @param  job - The job that finished
+ * @param  data - The 11 data bits the chip sent back
+ * @retval None
+ */
+static void DRV8353_Complete(DRV_Job_Type* job, uint16_t data) {
+    uint8_t reg = (job->Frame & DRV_ADDR) >> DRV_ADDR_SHIFT;
+    uint16_t old, mask;
+    if(reg > DRVREG_CAL) {
+        return;
+    }
+    switch(job->Type) {
+    case DRV_JOB_READ:
+        if(drv_writes_pending[reg] != 0) {
+            // Read before a write that's still to be checked went out
+            break;
+        }
+        old = Drv_Shadow[reg];
+        Drv_Shadow[reg] = data;
+        if((reg == DRVREG_FAULT1) && ((data & DRVBIT_FAULT1_FAULT) != 0)
+                && ((old & DRVBIT_FAULT1_FAULT) == 0)) {
+            // New fault on the gate driver. The fault 2 register is read next.
+            ELOG_Record(ELOG_EVENT_DRV_FAULT, data);
+        }
+        break;
+    case DRV_JOB_VERIFY:
+        drv_writes_pending[reg]--;
+        // The fault clear bit doesn't read back
+        mask = (reg == DRVREG_CTRL) ? (DRV_DATA & ~(DRVBIT_CTRL_CLRFLT)) : DRV_DATA;
+        if((data & mask) != (job->Expect & mask)) {
+            Drv_Status.VerifyFailures++;
+            // Try again, unless a newer write to the same register replaced it
+            if((job->Retries < DRV_WRITE_RETRIES) && ((Drv_Shadow[reg] & mask) == (job->Expect & mask))
+                    && (DRV8353_Queue((job->Frame & DRV_ADDR) | job->Expect, 0, DRV_JOB_WRITE,
+                            job->Retries + 1) == RETVAL_OK)) {
+                break;
+            }
+            // Otherwise give up, and show what's really there
+        }
+        if(drv_writes_pending[reg] == 0) {
+            // The chip has the last write, or as much of it as would go in
+            Drv_Shadow[reg] = data;
+        }
+        break;
+    case DRV_JOB_WRITE:
+    default:
+        break;
+    }
+}
@@ -44,16 +44,12 @@ uint32_t EE_Page0_Base_Address;
 uint32_t EE_Page1_Base_Address;
 uint32_t EE_Page_Size;
 
-
-#define FLASH_KEY1               ((uint32_t)0x45670123)
-#define FLASH_KEY2               ((uint32_t)0xCDEF89AB)
 static void FLASH_Unlock(void);
 static void FLASH_Lock(void);
 static FLASH_Status FLASH_GetStatus(void);
 static FLASH_Status FLASH_WaitForLastOperation(void);
 static FLASH_Status FLASH_WaitForErase(void);
 static FLASH_Status FLASH_ErasePage(uint32_t FLASH_Page, uint8_t FLASH_Bank);
-FLASH_Status FLASH_ProgramDoubleWord(uint32_t Address, uint32_t Data1, uint32_t Data2);
 static FLASH_Status FLASH_CheckErasedAndFix(uint32_t Address);
 
 static EE_Page_Status EE_GetPageStatus(uint16_t Page);
@@ -95,6 +91,10 @@ void EE_Config_Addr_Table(uint16_t* addrTab) {
     for (uint32_t i = 0; i < (CONFIG_DRV_NUMVARS); i++) {
         addrTab[tabptr++] = (1 + CONFIG_DRV_PREFIX + i);
     }
+    // Add PAS variables
+    for (uint32_t i = 0; i < (CONFIG_PAS_NUMVARS); i++) {
+        addrTab[tabptr++] = (1 + CONFIG_PAS_PREFIX + i);
+    }
 }
 
 /**
@@ -113,6 +113,8 @@ uint16_t EE_Init(uint16_t* addrTab) {
     // Check what bank mode we are in, dual bank or single bank.
     // The current mode determines the Flash addresses and page sizes
     RCC->AHB1ENR |= RCC_AHB1ENR_FLASHEN;
+    NVIC_SetPriority(FLASH_IRQn, PRIO_FLASH);
+    NVIC_EnableIRQ(FLASH_IRQn);
     if((FLASH->OPTR & FLASH_OPTR_DBANK) == 0) {
         // Single bank mode
         EE_Page0_Base_Address = PAGE0_BASE_ADDRESS_SINGLE;
@@ -406,6 +408,8 @@ static void FLASH_Unlock(void) {
         FLASH->KEYR = FLASH_KEY1;
         FLASH->KEYR = FLASH_KEY2;
     }
+    // Interrupt at the end of each program or erase operation
+    FLASH->CR |= FLASH_CR_EOPIE;
 }
 
 /**
@@ -503,6 +507,8 @@ static FLASH_Status FLASH_ErasePage(uint32_t FLASH_Page, uint8_t FLASH_Bank) {
 
     // Wait for last operation to be completed
     status = FLASH_WaitForLastOperation();
+    // Tidy up after a background erase, if there was one
+    FLASH_FinishErase();
 
     if (status == FLASH_COMPLETE) {
         FLASH_Unlock();
@@ -529,6 +535,55 @@ static FLASH_Status FLASH_ErasePage(uint32_t FLASH_Page, uint8_t FLASH_Bank) {
     return status;
 }
 
+/**
+ * @brief  Starts erasing a FLASH page and returns right away, without
+ *         waiting for the erase to finish. Call FLASH_FinishErase until
+ *         it stops returning FLASH_BUSY.
+ *
+ * @param  FLASH_Page The page number to be erased.
+ *          This parameter can be a value between 0 and 255
+ * @param  FLASH_Bank The bank in which the page will be erased, 0 or 1.
+ *          If dual bank is disabled (single bank mode), this should always be zero
+ *
+ * @retval FLASH_COMPLETE if the erase was started, FLASH_BUSY if another
+ *         operation is still going.
+ */
+FLASH_Status FLASH_StartErasePage(uint32_t FLASH_Page, uint8_t FLASH_Bank) {
+    if (FLASH_GetStatus() == FLASH_BUSY) {
+        return FLASH_BUSY;
+    }
+    FLASH_Unlock();
+    // Clear the error flags left from before by writing 1
+    FLASH->SR = (0x3EAu | FLASH_SR_WRPERR);
+    FLASH->CR &= ~(FLASH_CR_PG | FLASH_CR_PNB);
+    FLASH->CR |= FLASH_CR_PER;
+    if(FLASH_Bank == 1) {
+        FLASH->CR |= FLASH_CR_BKER;
+    } else {
+        FLASH->CR &= ~(FLASH_CR_BKER);
+    }
+    FLASH->CR |= FLASH_Page << 3u;
+    FLASH->CR |= FLASH_CR_STRT;
+    return FLASH_COMPLETE;
+}
+
+/**
+ * @brief  Finishes a page erase started by FLASH_StartErasePage.
+ *         Does nothing harmful if there wasn't one.
+ * @param  None
+ * @retval FLASH_BUSY if the erase is still going, otherwise the result
+ */
+FLASH_Status FLASH_FinishErase(void) {
+    FLASH_Status status = FLASH_GetStatus();
+    if (status != FLASH_BUSY) {
+        if ((FLASH->CR & FLASH_CR_PER) != 0) {
+            FLASH->CR &= ~(FLASH_CR_PER | FLASH_CR_BKER | FLASH_CR_PNB);
+            FLASH_Lock();
+        }
+    }
+    return status;
+}
+
 /**
  * @brief  Programs a double word (64-bit) at a specified address.
  *
@@ -549,6 +604,8 @@ FLASH_Status FLASH_ProgramDoubleWord(uint32_t Address, uint32_t Data1, uint32_t
 
     // Wait for last operation to be completed
     status = FLASH_WaitForLastOperation();
+    // Tidy up after a background erase, if there was one
+    FLASH_FinishErase();
 
     if (status == FLASH_ERROR_PROGRAM) {
         // try to clear the flags
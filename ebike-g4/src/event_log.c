@@ -0,0 +1,449 @@
+/******************************************************************************
+ * Filename: event_log.c
+ * Description: Persistent event log. Faults, resets, and a few key signals
+ *              at the time of each event are recorded into a small RAM
+ *              buffer, which is safe to do from any interrupt. A main loop
+ *              task drains the buffer into a ring of dedicated flash pages,
+ *              one double word at a time, so the log survives a power cycle
+ *              without the control loops ever waiting on the flash.
+ *
+ *              The pages are used in order. When the write position reaches
+ *              a new page, that page is erased first, which throws away the
+ *              oldest page of records. On startup the pages are scanned for
+ *              the newest valid record, and writing carries on after it.
+ *
+ *              In single bank mode the whole flash stalls while programming,
+ *              including the interrupt code, so the log is only drained
+ *              while the outputs are off.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+
+ELog_Stats_Type ELog_Stats;
+
+// Records waiting to be written. Filled from interrupts, emptied by the drain task.
+static ELog_Record_Type elog_ram[ELOG_RAM_RECORDS];
+static volatile uint8_t elog_ram_head;
+static volatile uint8_t elog_ram_tail;
+static volatile uint8_t elog_ram_count;
+static uint32_t elog_next_sequence;
+
+// Latest signals, saved with each record
+static uint32_t elog_timestamp;
+static float elog_vbus;
+static float elog_current;
+static float elog_speed;
+static float elog_fet_temp;
+
+// Flash layout
+static uint32_t elog_base_address;
+static uint32_t elog_page_size;
+static uint8_t elog_bank;
+static uint16_t elog_slots_per_page;
+static uint16_t elog_num_slots;
+
+// Drain state
+static uint16_t elog_write_slot;
+static ELog_Record_Type elog_staged;
+static uint8_t elog_staged_valid;
+static uint8_t elog_staged_dw;
+static uint8_t elog_erasing;
+static uint8_t elog_clear_pages;
+static volatile uint8_t elog_clear_request;
+
+static uint8_t ELOG_IsValid(ELog_Record_Type* rec);
+static uint32_t ELOG_CalcCRC(ELog_Record_Type* rec);
+static uint8_t ELOG_IsBlank(uint32_t address, uint32_t length);
+static ELog_Record_Type* ELOG_Slot(uint16_t slot);
+static uint16_t ELOG_OldestSlot(void);
+static void ELOG_NextSlot(void);
+
+/**
+ * @brief  Finds the end of the log in flash and records the reset cause.
+ *         Call after CRC_Init.
+ * @retval None
+ */
+void ELOG_Init(void) {
+    uint32_t newest = 0;
+    uint16_t newest_slot = 0;
+    uint8_t found = 0;
+
+    elog_ram_head = 0;
+    elog_ram_tail = 0;
+    elog_ram_count = 0;
+    elog_staged_valid = 0;
+    elog_staged_dw = 0;
+    elog_erasing = 0;
+    elog_clear_pages = 0;
+    elog_clear_request = 0;
+    ELog_Stats.Written = 0;
+    ELog_Stats.Dropped = 0;
+    ELog_Stats.FlashErrors = 0;
+
+    // Same bank mode check as the EEPROM emulation
+    if((FLASH->OPTR & FLASH_OPTR_DBANK) == 0) {
+        elog_base_address = ELOG_START_ADDRESS_SINGLE;
+        elog_page_size = PAGE_SIZE_SINGLE;
+        elog_bank = 0;
+    } else {
+        elog_base_address = ELOG_START_ADDRESS_DUAL;
+        elog_page_size = PAGE_SIZE_DUAL;
+        elog_bank = 1;
+    }
+    elog_slots_per_page = elog_page_size / sizeof(ELog_Record_Type);
+    elog_num_slots = elog_slots_per_page * ELOG_NUM_PAGES;
+
+    // Newest good record
+    for(uint16_t slot = 0; slot < elog_num_slots; slot++) {
+        ELog_Record_Type* rec = ELOG_Slot(slot);
+        if(ELOG_IsValid(rec) && ((found == 0) || (rec->Sequence > newest))) {
+            newest = rec->Sequence;
+            newest_slot = slot;
+            found = 1;
+        }
+    }
+    if(found) {
+        elog_next_sequence = newest + 1;
+        elog_write_slot = newest_slot;
+        ELOG_NextSlot();
+        // Step over anything left half written, but not into the next page.
+        // That page gets erased before it's written.
+        while(((elog_write_slot % elog_slots_per_page) != 0)
+                && !ELOG_IsBlank((uint32_t)ELOG_Slot(elog_write_slot), sizeof(ELog_Record_Type))) {
+            ELOG_NextSlot();
+        }
+    } else {
+        elog_next_sequence = 1;
+        elog_write_slot = 0;
+    }
+    ELog_Stats.Sequence = elog_next_sequence - 1;
+
+    // Why did we (re)start? Then reset the flags for next time.
+    ELOG_Record(ELOG_EVENT_RESET, RCC->CSR & 0xFE000000u);
+    RCC->CSR |= RCC_CSR_RMVF;
+}
+
+/**
+ * @brief  Saves the latest signals, to be stored with the next record.
+ * @param  timestamp - PWM cycle count
+ * @param  vbus - Bus voltage (V)
+ * @param  current - Magnitude of the phase current vector (A)
+ * @param  speed_eHz - Rotor speed (electrical Hz)
+ * @param  fet_temp - FET temperature (degC)
+ * @retval None
+ */
+void ELOG_UpdateSignals(uint32_t timestamp, float vbus, float current, float speed_eHz, float fet_temp) {
+    elog_timestamp = timestamp;
+    elog_vbus = vbus;
+    elog_current = current;
+    elog_speed = speed_eHz;
+    elog_fet_temp = fet_temp;
+}
+
+/**
+ * @brief  Adds an event to the log. Safe to call from any interrupt.
+ *         If the RAM buffer is full, the event is dropped and counted.
+ * @param  type - ELOG_EVENT_xxx
+ * @param  code - Event details, depending on the type
+ * @retval None
+ */
+void ELOG_Record(uint8_t type, uint32_t code) {
+    ELog_Record_Type* rec;
+    __disable_irq();
+    if(elog_ram_count >= ELOG_RAM_RECORDS) {
+        ELog_Stats.Dropped++;
+        __enable_irq();
+        return;
+    }
+    rec = &(elog_ram[elog_ram_head]);
+    rec->Sequence = elog_next_sequence++;
+    rec->Timestamp = elog_timestamp;
+    rec->Code = code;
+    rec->DrvFault1 = 0;
+    rec->DrvFault2 = 0;
+    rec->Vbus = elog_vbus;
+    rec->Current = elog_current;
+    rec->Speed = (int16_t)elog_speed;
+    rec->Type = type;
+    rec->FetTemp = (int8_t)elog_fet_temp;
+    elog_ram_head = (elog_ram_head + 1) % ELOG_RAM_RECORDS;
+    elog_ram_count++;
+    __enable_irq();
+}
+
+/**
+ * @brief  Main loop task that moves records from RAM into flash.
+ *         Does at most one flash operation per run: starts a page erase,
+ *         or programs one double word. Runs periodically and whenever
+ *         a flash operation finishes.
+ * @retval None
+ */
+void ELOG_Drain(void) {
+    FLASH_Status status;
+    uint32_t address;
+    uint32_t* words;
+
+    if((elog_bank == 0) && ((PWM_TIM->BDTR & TIM_BDTR_MOE) != 0)) {
+        // Single bank, the motor interrupts can't wait on the flash
+        return;
+    }
+
+    if(elog_erasing) {
+        status = FLASH_FinishErase();
+        if(status == FLASH_BUSY) {
+            return;
+        }
+        elog_erasing = 0;
+        if(status != FLASH_COMPLETE) {
+            ELog_Stats.FlashErrors++;
+        }
+    }
+    if((FLASH->SR & FLASH_SR_BSY) != 0) {
+        // The cogging table or updater is using the flash. Programming now
+        // would hold up the main loop until it's done, so try again later.
+        return;
+    }
+
+    // Clearing the log erases every page, one per run
+    if(elog_clear_request && (elog_staged_dw == 0)) {
+        elog_clear_request = 0;
+        elog_clear_pages = ELOG_NUM_PAGES;
+        elog_write_slot = 0;
+    }
+    if(elog_clear_pages > 0) {
+        status = FLASH_StartErasePage(ELOG_FIRST_PAGE_NUM + elog_clear_pages - 1, elog_bank);
+        if(status == FLASH_BUSY) {
+            return;
+        }
+        elog_clear_pages--;
+        if(status == FLASH_COMPLETE) {
+            elog_erasing = 1;
+        } else {
+            ELog_Stats.FlashErrors++;
+        }
+        if(elog_clear_pages == 0) {
+            ELOG_Record(ELOG_EVENT_LOG_CLEARED, 0);
+        }
+        return;
+    }
+
+    if((elog_ram_count == 0) && (elog_staged_valid == 0)) {
+        // Nothing to do
+        return;
+    }
+
+    // Moving into a page that still has old records in it
+    if((elog_write_slot % elog_slots_per_page) == 0) {
+        address = (uint32_t)ELOG_Slot(elog_write_slot);
+        if((elog_staged_dw == 0) && !ELOG_IsBlank(address, elog_page_size)) {
+            status = FLASH_StartErasePage(ELOG_FIRST_PAGE_NUM + (elog_write_slot / elog_slots_per_page),
+                    elog_bank);
+            if(status == FLASH_COMPLETE) {
+                elog_erasing = 1;
+            } else if(status != FLASH_BUSY) {
+                ELog_Stats.FlashErrors++;
+            }
+            return;
+        }
+    }
+
+    if(elog_staged_valid == 0) {
+        if(elog_ram_count == 0) {
+            return;
+        }
+        __disable_irq();
+        elog_staged = elog_ram[elog_ram_tail];
+        elog_ram_tail = (elog_ram_tail + 1) % ELOG_RAM_RECORDS;
+        elog_ram_count--;
+        __enable_irq();
+        if((elog_staged.Type == ELOG_EVENT_FAULT) || (elog_staged.Type == ELOG_EVENT_DRV_FAULT)) {
+            // The gate driver holds its fault bits until they're cleared,
+            // so the latest background poll is good enough.
+            elog_staged.DrvFault1 = DRV8353_GetRegister(DRVREG_FAULT1);
+            elog_staged.DrvFault2 = DRV8353_GetRegister(DRVREG_FAULT2);
+        }
+        elog_staged.Crc = ELOG_CalcCRC(&elog_staged);
+        elog_staged_valid = 1;
+        elog_staged_dw = 0;
+    }
+
+    address = (uint32_t)ELOG_Slot(elog_write_slot) + (elog_staged_dw * 8u);
+    words = ((uint32_t*)(&elog_staged)) + (elog_staged_dw * 2u);
+    status = FLASH_ProgramDoubleWord(address, words[0], words[1]);
+    if(status == FLASH_BUSY) {
+        return;
+    }
+    if(status != FLASH_COMPLETE) {
+        // Give up on this slot and start the record again in the next one
+        ELog_Stats.FlashErrors++;
+        elog_staged_dw = 0;
+        ELOG_NextSlot();
+        return;
+    }
+    elog_staged_dw++;
+    if(elog_staged_dw >= ELOG_RECORD_DOUBLE_WORDS) {
+        ELog_Stats.Written++;
+        ELog_Stats.Sequence = elog_staged.Sequence;
+        elog_staged_valid = 0;
+        elog_staged_dw = 0;
+        ELOG_NextSlot();
+    }
+}
+
+/**
+ * @brief  Erases the whole log. The erase is done in the background by
+ *         the drain task. Sequence numbers carry on from where they were.
+ * @retval RETVAL_OK
+ */
+uint8_t ELOG_Clear(void) {
+    elog_clear_request = 1;
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Fills one bulk download packet, oldest records first.
+ *         Format, big endian:
+ *          - I32: Index to ask for next
+ *          - I32: End index. Keep asking until the next index reaches this.
+ *          - Records, ELOG_DOWNLOAD_RECORD_BYTES each: I32 sequence,
+ *            I32 timestamp, I32 code, I16 DRV fault 1, I16 DRV fault 2,
+ *            F32 vbus, F32 current, I16 speed, I8 type, I8 FET temp
+ *         Empty and damaged slots are skipped, so a packet can hold
+ *         fewer records than the indexes it covers.
+ * @param  index - Position in the log to start from, zero is the oldest
+ * @param  data - Buffer of at least ELOG_DOWNLOAD_BYTES
+ * @retval Number of bytes put in the buffer
+ */
+uint16_t ELOG_Download(uint32_t index, uint8_t* data) {
+    uint16_t oldest = ELOG_OldestSlot();
+    uint32_t end = (elog_write_slot + elog_num_slots - oldest) % elog_num_slots;
+    uint16_t place = ELOG_DOWNLOAD_HEADER_BYTES;
+    uint8_t num_records = 0;
+
+    while((index < end) && (num_records < ELOG_RECORDS_PER_PACKET)) {
+        ELog_Record_Type* rec = ELOG_Slot((oldest + index) % elog_num_slots);
+        index++;
+        if(ELOG_IsValid(rec) == 0) {
+            continue;
+        }
+        data_packet_pack_32b(&(data[place]), rec->Sequence);
+        data_packet_pack_32b(&(data[place + 4]), rec->Timestamp);
+        data_packet_pack_32b(&(data[place + 8]), rec->Code);
+        data_packet_pack_16b(&(data[place + 12]), rec->DrvFault1);
+        data_packet_pack_16b(&(data[place + 14]), rec->DrvFault2);
+        data_packet_pack_float(&(data[place + 16]), rec->Vbus);
+        data_packet_pack_float(&(data[place + 20]), rec->Current);
+        data_packet_pack_16b(&(data[place + 24]), (uint16_t)rec->Speed);
+        data_packet_pack_8b(&(data[place + 26]), rec->Type);
+        data_packet_pack_8b(&(data[place + 27]), (uint8_t)rec->FetTemp);
+        place += ELOG_DOWNLOAD_RECORD_BYTES;
+        num_records++;
+    }
+    if(index > end) {
+        index = end;
+    }
+    data_packet_pack_32b(&(data[0]), index);
+    data_packet_pack_32b(&(data[4]), end);
+    return place;
+}
+
+/**
+ * @brief  Gets event log information for the data interface.
+ * @param  value_ID - CONFIG_ELOG_STATUS_xxx ID
+ * @retval The requested value, or zero if the ID is invalid
+ */
+uint32_t ELOG_GetStatistic(uint16_t value_ID) {
+    switch(value_ID) {
+    case CONFIG_ELOG_STATUS_WRITTEN:
+        return ELog_Stats.Written;
+    case CONFIG_ELOG_STATUS_PENDING:
+        return elog_ram_count + elog_staged_valid;
+    case CONFIG_ELOG_STATUS_DROPPED:
+        return ELog_Stats.Dropped;
+    case CONFIG_ELOG_STATUS_ERRORS:
+        return ELog_Stats.FlashErrors;
+    case CONFIG_ELOG_STATUS_SEQUENCE:
+        return ELog_Stats.Sequence;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief  Checks that a record in flash was completely written.
+ * @param  rec - Record to check
+ * @retval 1 if the record is good, 0 if it's empty or damaged
+ */
+static uint8_t ELOG_IsValid(ELog_Record_Type* rec) {
+    if(rec->Sequence == ELOG_ERASED) {
+        return 0;
+    }
+    return (ELOG_CalcCRC(rec) == rec->Crc) ? 1 : 0;
+}
+
+/**
+ * @brief  CRC of a record, not including the CRC field itself.
+ * @param  rec - Record to check
+ * @retval CRC32
+ */
+static uint32_t ELOG_CalcCRC(ELog_Record_Type* rec) {
+    // Software CRC, the CRC unit belongs to the packet interface
+    return CRC_Software_CRC32((uint8_t*)rec, sizeof(ELog_Record_Type) - sizeof(uint32_t));
+}
+
+/**
+ * @brief  Checks if a section of flash is erased.
+ * @param  address - Start address, word aligned
+ * @param  length - Number of bytes to check, multiple of 4
+ * @retval 1 if every byte is 0xFF
+ */
+static uint8_t ELOG_IsBlank(uint32_t address, uint32_t length) {
+    for(uint32_t i = 0; i < length; i += 4) {
+        if(*((__IO uint32_t*)(address + i)) != ELOG_ERASED) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static ELog_Record_Type* ELOG_Slot(uint16_t slot) {
+    return (ELog_Record_Type*)(elog_base_address + (slot * sizeof(ELog_Record_Type)));
+}
+
+/**
+ * @brief  The oldest records are in the page after the one being written,
+ *         since that's the next one to be erased.
+ * @retval Slot number of the start of the oldest page
+ */
+static uint16_t ELOG_OldestSlot(void) {
+    uint16_t page = elog_write_slot / elog_slots_per_page;
+    return ((page + 1) % ELOG_NUM_PAGES) * elog_slots_per_page;
+}
+
+static void ELOG_NextSlot(void) {
+    elog_write_slot++;
+    if(elog_write_slot >= elog_num_slots) {
+        elog_write_slot = 0;
+    }
+}
@@ -0,0 +1,188 @@
+/******************************************************************************
+ * Filename: faults.c
+ * Description: Fault manager. Checks for overcurrent, over and under
+ *              voltage, and over temperature every PWM cycle. Any fault
+ *              turns off the outputs (MOE) in the same cycle it is seen,
+ *              and is latched until cleared through the data interface
+ *              (except undervoltage, which clears itself).
+ *              The gate driver can also shut down the outputs in hardware
+ *              through the TIM1 break input, which is latched here too.
+ *
+ *              While any fault is latched, the outputs are forced off every
+ *              cycle. Only the motor interrupt turns them on, through
+ *              FAULT_MotorON, so nothing can write MOE back over a fault.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+#include <math.h>
+
+Fault_Type Faults;
+// PWM cycle count from the latest check
+static uint32_t fault_timestamp;
+
+void FAULT_Init(void) {
+    Faults.Active = 0;
+    Faults.First = 0;
+    Faults.Count = 0;
+    Faults.Timestamp = 0;
+    fault_timestamp = 0;
+}
+
+/**
+ * @brief  Checks all the fault limits. Call every PWM cycle, right after
+ *         the currents are read.
+ * @param  cfg - Main configuration, for the fault limits
+ * @param  obv - Latest phase currents and temperatures
+ * @param  vbus - Bus voltage (V)
+ * @param  timestamp - PWM cycle count
+ * @retval Latched fault codes, zero if there are none
+ */
+uint32_t CCMRAM_FUNC FAULT_Check(Config_Main* cfg, Motor_Observations* obv, float vbus, uint32_t timestamp) {
+    uint32_t found = 0;
+    fault_timestamp = timestamp;
+
+    if((fabsf(obv->iA) > cfg->CurrentFault) || (fabsf(obv->iB) > cfg->CurrentFault)
+            || (fabsf(obv->iC) > cfg->CurrentFault)) {
+        found |= FAULT_OVERCURRENT;
+    }
+    if(vbus > cfg->MaxVoltFault) {
+        found |= FAULT_OVERVOLTAGE;
+    }
+    if(vbus < cfg->MinVoltFault) {
+        found |= FAULT_UNDERVOLTAGE;
+    }
+    if(obv->FetTempDegC > (cfg->FetTempHardCap + FAULT_OVERTEMP_MARGIN)) {
+        found |= FAULT_FET_OVERTEMP;
+    }
+    if(obv->MotorTempDegC > (cfg->MotorTempHardCap + FAULT_OVERTEMP_MARGIN)) {
+        found |= FAULT_MOTOR_OVERTEMP;
+    }
+
+    // Undervoltage doesn't latch. The bus is low at power up and
+    // sags under load, and comes back on its own.
+    if(((found & FAULT_UNDERVOLTAGE) == 0) && ((Faults.Active & FAULT_UNDERVOLTAGE) != 0)) {
+        __disable_irq();
+        Faults.Active &= ~(FAULT_UNDERVOLTAGE);
+        __enable_irq();
+    }
+
+    if(found != 0) {
+        FAULT_Set(found);
+    } else if(Faults.Active != 0) {
+        // Keep the outputs off until the faults are cleared
+        PWM_MotorOFF();
+    }
+    return Faults.Active;
+}
+
+/**
+ * @brief  Latches faults and turns off the outputs immediately.
+ *         Safe to call from any interrupt.
+ * @param  faults - FAULT_xxx codes to latch
+ * @retval None
+ */
+void CCMRAM_FUNC FAULT_Set(uint32_t faults) {
+    uint32_t new_faults;
+    // Outputs off first, bookkeeping after
+    PWM_MotorOFF();
+    __disable_irq();
+    new_faults = faults & ~(Faults.Active);
+    if(new_faults != 0) {
+        // Something new
+        if(Faults.Active == 0) {
+            Faults.First = faults;
+            Faults.Timestamp = fault_timestamp;
+        }
+        Faults.Count++;
+    }
+    Faults.Active |= faults;
+    __enable_irq();
+    // Undervoltage comes and goes with a sagging battery. Logging every
+    // time would wear out the flash.
+    new_faults &= ~(FAULT_UNDERVOLTAGE);
+    if(new_faults != 0) {
+        ELOG_Record(ELOG_EVENT_FAULT, new_faults);
+    }
+}
+
+/**
+ * @brief  Clears the latched faults. If a fault condition is still there,
+ *         it will latch again on the next check.
+ * @retval RETVAL_OK
+ */
+uint8_t FAULT_Clear(void) {
+    uint32_t cleared;
+    __disable_irq();
+    cleared = Faults.Active;
+    Faults.Active = 0;
+    Faults.First = 0;
+    __enable_irq();
+    ELOG_Record(ELOG_EVENT_FAULT_CLEAR, cleared);
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Turns on the outputs, unless a fault is latched or the break
+ *         input has tripped and not been handled yet. Call only from the
+ *         motor interrupt, after FAULT_Check.
+ *         MOE is set with a read-modify-write. The check and the write are
+ *         one critical section, so a fault from a higher priority interrupt
+ *         can't land in between and have its MOE clear written over.
+ * @retval RETVAL_OK if the outputs are on, RETVAL_FAIL if not
+ */
+uint8_t CCMRAM_FUNC FAULT_MotorON(void) {
+    uint8_t retval = RETVAL_FAIL;
+    __disable_irq();
+    // The break clears MOE in hardware before its interrupt gets to run
+    if((Faults.Active == 0) && ((PWM_TIM->SR & TIM_SR_BIF) == 0)) {
+        PWM_MotorON();
+        retval = RETVAL_OK;
+    }
+    __enable_irq();
+    return retval;
+}
+
+uint32_t FAULT_GetActive(void) {
+    return Faults.Active;
+}
+
+/**
+ * @brief  Gets fault information for the data interface.
+ * @param  value_ID - CONFIG_FAULT_STATUS_xxx ID
+ * @retval The requested value, or zero if the ID is invalid
+ */
+uint32_t FAULT_GetStatistic(uint16_t value_ID) {
+    switch(value_ID) {
+    case CONFIG_FAULT_STATUS_ACTIVE:
+        return Faults.Active;
+    case CONFIG_FAULT_STATUS_FIRST:
+        return Faults.First;
+    case CONFIG_FAULT_STATUS_COUNT:
+        return Faults.Count;
+    case CONFIG_FAULT_STATUS_TIMESTAMP:
+        return Faults.Timestamp;
+    default:
+        return 0;
+    }
+}
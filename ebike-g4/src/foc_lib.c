@@ -44,7 +44,7 @@
 
 #include "main.h"
 
-void FOC_SVM(float alpha, float beta, float* tA, float* tB, float* tC) {
+void CCMRAM_FUNC FOC_SVM(float alpha, float beta, float* tA, float* tB, float* tC) {
     // Sector determination
     uint8_t sector = 0;
     float X, Y, Z, T1, T2;
@@ -110,17 +110,17 @@ void FOC_SVM(float alpha, float beta, float* tA, float* tB, float* tC) {
     }
 }
 
-void FOC_Ipark(float D, float Q, float sin, float cos, float* alpha, float* beta) {
+void CCMRAM_FUNC FOC_Ipark(float D, float Q, float sin, float cos, float* alpha, float* beta) {
     *alpha = D * cos - Q * sin;
     *beta = Q * cos + D * sin;
 }
 
-void FOC_Clarke(float A, float B, float* Alpha, float* Beta) {
+void CCMRAM_FUNC FOC_Clarke(float A, float B, float* Alpha, float* Beta) {
     *Alpha = A;
     *Beta = (2.0f * B + A) * INV_SQRT3;
 }
 
-void FOC_Park(float alpha, float beta, float sin, float cos, float* D, float* Q) {
+void CCMRAM_FUNC FOC_Park(float alpha, float beta, float sin, float cos, float* D, float* Q) {
     *D = alpha * cos + beta * sin;
     *Q = beta * cos - alpha * sin;
 }
@@ -135,25 +135,181 @@ void FOC_BiquadCalc(Biquad_Type* biq) {
     biq->U1 = intermed;
 }
 
-void FOC_BiquadLPF(Biquad_Type* biq, float Fs, float f0, float Q) {
+/**
+ * @brief  Calculates biquad filter constants (RBJ audio EQ cookbook).
+ *         The delay registers are left alone.
+ * @param  biq - Filter to set
+ * @param  shape - Biquad_LowPass, Biquad_HighPass, Biquad_Notch or Biquad_BandPass
+ * @param  Fs - Rate the filter is calculated at (Hz)
+ * @param  f0 - Cutoff or center frequency (Hz), below Fs/2
+ * @param  Q - Quality factor. Sharper peak or notch as it goes up.
+ * @retval None
+ */
+void FOC_BiquadDesign(Biquad_Type* biq, Biquad_Shape shape, float Fs, float f0, float Q) {
     // Intermediate values
-    float w0, sinw0, cosw0, alpha;
+    float sinw0, cosw0, alpha, a0_inv;
     // Cancel operation if inputs are invalid
     if ((Fs == 0.0f) || (f0 == 0.0f) || (Q == 0.0f)) {
         return;
     }
     // Calculate the intermediates
-    w0 = 2.0f * (f0 / Fs); // Leaving out PI, the CORDIC input is scaled by 1/PI anyway
-    CORDIC_CalcSinCos(w0, &sinw0, &cosw0);
+    // w0 = 2*pi*f0/Fs, which is f0/Fs of a revolution
+    CORDIC_CalcSinCos(ANGLE_FROM_FLOAT(f0 / Fs), &sinw0, &cosw0);
     alpha = sinw0 / (2.0f * Q);
+    a0_inv = 1.0f / (1.0f + alpha);
+
+    // Calculate the filter constants. Poles are the same for every shape.
+    switch(shape) {
+    case Biquad_HighPass:
+        biq->B0 = (1.0f + cosw0) / (2.0f) * a0_inv;
+        biq->B1 = -(1.0f + cosw0) * a0_inv;
+        biq->B2 = biq->B0;
+        break;
+    case Biquad_Notch:
+        biq->B0 = a0_inv;
+        biq->B1 = ((-2.0f) * cosw0) * a0_inv;
+        biq->B2 = biq->B0;
+        break;
+    case Biquad_BandPass:
+        biq->B0 = alpha * a0_inv;
+        biq->B1 = 0.0f;
+        biq->B2 = -(biq->B0);
+        break;
+    case Biquad_LowPass:
+    default:
+        biq->B0 = (1.0f - cosw0) / (2.0f) * a0_inv;
+        biq->B1 = (1.0f - cosw0) * a0_inv;
+        biq->B2 = biq->B0;
+        break;
+    }
+    biq->A1 = ((-2.0f) * cosw0) * a0_inv;
+    biq->A2 = (1.0f - alpha) * a0_inv;
+}
+
+void FOC_BiquadLPF(Biquad_Type* biq, float Fs, float f0, float Q) {
+    FOC_BiquadDesign(biq, Biquad_LowPass, Fs, f0, Q);
+}
+
+/**
+ * @brief  Clears a filter bank. Every channel passes its input straight
+ *         through until it is designed.
+ * @param  bank - Filter bank to clear
+ * @param  channels - Number of channels in use, up to BIQUAD_BANK_MAX_CHANNELS
+ * @retval None
+ */
+void FOC_BiquadBankInit(Biquad_Bank_Type* bank, uint8_t channels) {
+    if(channels > BIQUAD_BANK_MAX_CHANNELS) {
+        channels = BIQUAD_BANK_MAX_CHANNELS;
+    }
+    bank->Channels = channels;
+    for(uint8_t i = 0; i < BIQUAD_BANK_MAX_CHANNELS; i++) {
+        bank->A1[i] = 0.0f;
+        bank->A2[i] = 0.0f;
+        bank->B0[i] = 1.0f;
+        bank->B1[i] = 0.0f;
+        bank->B2[i] = 0.0f;
+        bank->U1[i] = 0.0f;
+        bank->U2[i] = 0.0f;
+        bank->X[i] = 0.0f;
+        bank->Y[i] = 0.0f;
+    }
+}
+
+/**
+ * @brief  Sets the filter constants of one channel in a bank. Same
+ *         arguments as FOC_BiquadDesign.
+ * @param  bank - Filter bank
+ * @param  ch - Channel to set
+ * @retval None
+ */
+void FOC_BiquadBankDesign(Biquad_Bank_Type* bank, uint8_t ch, Biquad_Shape shape,
+        float Fs, float f0, float Q) {
+    Biquad_Type biq;
+    if(ch >= bank->Channels) {
+        return;
+    }
+    biq.A1 = bank->A1[ch];
+    biq.A2 = bank->A2[ch];
+    biq.B0 = bank->B0[ch];
+    biq.B1 = bank->B1[ch];
+    biq.B2 = bank->B2[ch];
+    FOC_BiquadDesign(&biq, shape, Fs, f0, Q);
+    bank->A1[ch] = biq.A1;
+    bank->A2[ch] = biq.A2;
+    bank->B0[ch] = biq.B0;
+    bank->B1[ch] = biq.B1;
+    bank->B2[ch] = biq.B2;
+}
 
-    // Calculate the filter constants
-    biq->B0 = (1.0f - cosw0) / (2.0f) / (1.0f + alpha);
-    biq->B1 = (1.0f - cosw0) / (1.0f + alpha);
-    biq->B2 = biq->B0;
-    biq->A1 = ((-2.0f) * cosw0) / (1.0f + alpha);
-    biq->A2 = (1.0f - alpha) / (1.0f + alpha);
+/**
+ * @brief  Sets one channel's delay registers to the steady state for a
+ *         constant input, so it starts there instead of ramping up from zero.
+ * @param  bank - Filter bank
+ * @param  ch - Channel to set
+ * @param  x - Constant input value
+ * @retval None
+ */
+void FOC_BiquadBankPrime(Biquad_Bank_Type* bank, uint8_t ch, float x) {
+    if(ch >= bank->Channels) {
+        return;
+    }
+    bank->U1[ch] = x / (1.0f + bank->A1[ch] + bank->A2[ch]);
+    bank->U2[ch] = bank->U1[ch];
+}
 
+/**
+ * @brief  Runs every channel of a filter bank, X in and Y out. Same math
+ *         as FOC_BiquadCalc, without a call and struct hop per filter.
+ *         The arrays are restrict and the channel count is read once, so
+ *         a store to Y or U1 can't change what the next channel loads and
+ *         the compiler is free to run channels side by side.
+ * @param  bank - Filter bank
+ * @retval None
+ */
+void FOC_BiquadBankCalc(Biquad_Bank_Type* bank) {
+    const float* restrict a1 = bank->A1;
+    const float* restrict a2 = bank->A2;
+    const float* restrict b0 = bank->B0;
+    const float* restrict b1 = bank->B1;
+    const float* restrict b2 = bank->B2;
+    const float* restrict x = bank->X;
+    float* restrict u1 = bank->U1;
+    float* restrict u2 = bank->U2;
+    float* restrict y = bank->Y;
+    uint32_t channels = bank->Channels;
+    float intermed;
+    for(uint32_t i = 0; i < channels; i++) {
+        // Calculate intermediate value
+        intermed = (x[i]) - (u1[i] * a1[i]) - (u2[i] * a2[i]);
+        // Calculate output value
+        y[i] = (intermed * b0[i]) + (u1[i] * b1[i]) + (u2[i] * b2[i]);
+        // Update stored values
+        u2[i] = u1[i];
+        u1[i] = intermed;
+    }
+}
+
+/**
+ * @brief  Sets PI gains for a current loop by pole-zero cancellation. The
+ *         controller zero cancels the R-L pole, and the loop gain crosses
+ *         over at the requested bandwidth. The motor interrupt's 1.5 PWM
+ *         cycles of delay widen the closed loop past that, by 1.4x at
+ *         fs/40 and 2.2x at fs/20 (test_foc_lib).
+ * @param  pid - Controller to set. An output of 1.0 is full_scale volts.
+ * @param  r - Plant resistance (Ohm)
+ * @param  l - Plant inductance (H)
+ * @param  full_scale - Volts for an output of 1.0
+ * @param  fs - Rate the controller runs at (Hz)
+ * @param  bandwidth - Closed loop bandwidth (Hz)
+ * @retval None
+ */
+void FOC_PIsynth(PID_Type* pid, float r, float l, float full_scale, float fs, float bandwidth) {
+    pid->Kp = l * 2.0f * PI * bandwidth / full_scale;
+    // Integral gain is relative to Kp, per sample. Ki/Kp = R/L.
+    pid->Ki = r / (l * fs);
+    pid->Kd = 0.0f;
+    // Integrator unwinds with the same time constant it winds up with
+    pid->Kc = pid->Ki;
 }
 
 void FOC_PIDdefaults(PID_Type* pid) {
@@ -169,7 +325,7 @@ void FOC_PIDdefaults(PID_Type* pid) {
     pid->Out = 0.0f;
     pid->Up1 = 0.0f;
 }
-void FOC_PIDreset(PID_Type* pid) {
+void CCMRAM_FUNC FOC_PIDreset(PID_Type* pid) {
     pid->Err = 0.0f;
     pid->Ui = 0.0f;
     pid->SatErr = 0.0f;
@@ -194,7 +350,7 @@ void FOC_PIDcalc(PID_Type* pid) {
     pid->Up1 = Up;
 }
 
-void FOC_PIcalc(PID_Type* pid) {
+void CCMRAM_FUNC FOC_PIcalc(PID_Type* pid) {
     float OutPreSat, Up;
     Up = pid->Err * pid->Kp;
     pid->Ui = pid->Ui + Up * pid->Ki + pid->Kc * pid->SatErr;
@@ -210,19 +366,14 @@ void FOC_PIcalc(PID_Type* pid) {
 }
 
 /**
- * @brief  Creates a ramping output, wrapping around at +/-1.0
+ * @brief  Creates a ramping angle output, wrapping around once per revolution
  * @param  rampAngle: current output value, passed in by reference and incremented
- * @param  rampInc: amount to increment / decrement the angle by
+ * @param  rampInc: amount to increment the angle by. Negative steps are
+ *         made by a two's complement increment (see ANGLE_DELTA_FROM_FLOAT).
  * @retval None
  */
-void FOC_RampGen(float* rampAngle, float rampInc) {
-    *rampAngle += rampInc;
-    if (*rampAngle > 1.0f) {
-        *rampAngle -= 1.0f;
-    }
-    if (*rampAngle < 0.0f) {
-        *rampAngle += 1.0f;
-    }
+void CCMRAM_FUNC FOC_RampGen(Angle_Type* rampAngle, Angle_Type rampInc) {
+    *rampAngle += rampInc; // Wraps by integer overflow
 }
 
 /**
@@ -231,8 +382,8 @@ void FOC_RampGen(float* rampAngle, float rampInc) {
  * @param  rampFreq: frequency of desired ramp output
  * @retval The calculated increment amount.
  */
-float FOC_RampCtrl(float callingFreq, float rampFreq) {
-    return rampFreq / callingFreq;
+Angle_Type FOC_RampCtrl(float callingFreq, float rampFreq) {
+    return ANGLE_DELTA_FROM_FLOAT(rampFreq / callingFreq);
 }
 
 
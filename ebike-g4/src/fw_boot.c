@@ -0,0 +1,307 @@
+/******************************************************************************
+ * Filename: fw_boot.c
+ * Description: Boot stage for in-application firmware updates. It lives in
+ *              the first flash sector, which updates never touch, and runs
+ *              before the application on every reset.
+ *
+ *              If an update has been committed, the staged image and the
+ *              running image are swapped a sector at a time through the
+ *              scratch sector, and the new image gets one run. If it resets
+ *              before confirming itself (see fw_update.c), the two are
+ *              swapped back. Every step is journaled in the update record,
+ *              so a power loss anywhere just means the swap carries on from
+ *              the same step on the next reset.
+ *
+ *              Nothing in here can call into the application, which might
+ *              be half swapped. Everything runs from this sector, straight
+ *              out of reset, on the 16MHz internal oscillator, without any
+ *              initialized RAM.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+
+#define FWBOOT_FUNC     __attribute__((section(".fwboot_text")))
+// Attempts at each step before giving up and resetting
+#define FWBOOT_RETRIES  (3)
+#define FWBOOT_FLASH_ERRORS (0x3EAu | FLASH_SR_WRPERR | FLASH_SR_OPERR)
+
+extern unsigned int _estack;
+
+FWBOOT_FUNC static void FWUP_BootReset(void);
+FWBOOT_FUNC static void FWUP_BootFault(void);
+FWBOOT_FUNC static uint8_t FWUP_BootSwap(const uint64_t (*journal)[FWUP_SWAP_STEPS], uint32_t sectors);
+FWBOOT_FUNC static uint8_t FWUP_BootStep(uint32_t to, uint32_t from, const uint64_t* flag);
+FWBOOT_FUNC static uint8_t FWUP_BootErase(uint32_t address);
+FWBOOT_FUNC static uint8_t FWUP_BootCopy(uint32_t to, uint32_t from);
+FWBOOT_FUNC static uint8_t FWUP_BootMark(const uint64_t* flag);
+FWBOOT_FUNC static uint8_t FWUP_BootIsMarked(const uint64_t* flag);
+FWBOOT_FUNC static uint8_t FWUP_BootWait(void);
+FWBOOT_FUNC static void FWUP_BootFlushCaches(void);
+FWBOOT_FUNC static void FWUP_BootStartApp(void);
+
+// Just enough of a vector table to get started. The application's own
+// table takes over before any interrupts are turned on.
+__attribute__((section(".fwboot_vector"), used))
+static void (* const fwup_boot_vectors[])(void) = {
+    (void (*)(void))(&_estack),
+    FWUP_BootReset,
+    FWUP_BootFault, // NMI
+    FWUP_BootFault, // HardFault
+    FWUP_BootFault, // MemManage
+    FWUP_BootFault, // BusFault
+    FWUP_BootFault // UsageFault
+};
+
+/**
+ * @brief  Reset entry. Carries on with any swap that's due, then starts
+ *         the application.
+ * @retval None
+ */
+FWBOOT_FUNC static void FWUP_BootReset(void) {
+    const Fwup_Record_Type* record = (const Fwup_Record_Type*)FWUP_RECORD_ADDRESS;
+    uint32_t sectors;
+    uint8_t result = RETVAL_OK;
+
+    if((record->Magic == FWUP_MAGIC) && (record->Size > 0) && (record->Size <= FWUP_SLOT_SIZE)
+            && (FWUP_BootIsMarked(&(record->Confirmed)) == 0)
+            && (FWUP_BootIsMarked(&(record->Reverted)) == 0)) {
+        sectors = (record->Size + FWUP_SECTOR_SIZE - 1) / FWUP_SECTOR_SIZE;
+        FLASH->KEYR = FLASH_KEY1;
+        FLASH->KEYR = FLASH_KEY2;
+        FLASH->SR = FWBOOT_FLASH_ERRORS;
+        if(FWUP_BootIsMarked(&(record->Trial)) == 0) {
+            // Newly committed. Swap it in and give it a run.
+            result = FWUP_BootSwap(record->Swap, sectors);
+            if(result == RETVAL_OK) {
+                result = FWUP_BootMark(&(record->Trial));
+            }
+        } else {
+            // It had its run and reset before confirming. Put the old one back.
+            result = FWUP_BootSwap(record->Revert, sectors);
+            if(result == RETVAL_OK) {
+                result = FWUP_BootMark(&(record->Reverted));
+            }
+        }
+        FLASH->CR |= FLASH_CR_LOCK;
+        if(result != RETVAL_OK) {
+            // The journal knows how far it got, try again from there
+            FWUP_BootFault();
+        }
+    }
+    FWUP_BootStartApp();
+}
+
+/**
+ * @brief  Anything unexpected resets and tries again. Can't use
+ *         NVIC_SystemReset, it isn't in this sector in a debug build.
+ * @retval None
+ */
+FWBOOT_FUNC static void FWUP_BootFault(void) {
+    __DSB();
+    SCB->AIRCR = (0x5FAUL << SCB_AIRCR_VECTKEY_Pos) | (SCB->AIRCR & SCB_AIRCR_PRIGROUP_Msk)
+            | SCB_AIRCR_SYSRESETREQ_Msk;
+    __DSB();
+    while(1) { }
+}
+
+/**
+ * @brief  Swaps the first few sectors of the running image with staging,
+ *         skipping steps the journal says are already done. Running it
+ *         twice over the same sectors puts everything back.
+ * @param  journal - Swap or Revert, from the update record
+ * @param  sectors - Number of sectors to swap
+ * @retval RETVAL_OK if every step finished
+ */
+FWBOOT_FUNC static uint8_t FWUP_BootSwap(const uint64_t (*journal)[FWUP_SWAP_STEPS], uint32_t sectors) {
+    uint32_t app, staging;
+
+    for(uint32_t i = 0; i < sectors; i++) {
+        app = FWUP_APP_ADDRESS + (i * FWUP_SECTOR_SIZE);
+        staging = FWUP_STAGING_ADDRESS + (i * FWUP_SECTOR_SIZE);
+        // Each step only reads from sectors that no later step has written yet
+        if(FWUP_BootStep(FWUP_SCRATCH_ADDRESS, app, &(journal[i][FWUP_STEP_SAVE])) != RETVAL_OK) {
+            return RETVAL_FAIL;
+        }
+        if(FWUP_BootStep(app, staging, &(journal[i][FWUP_STEP_LOAD])) != RETVAL_OK) {
+            return RETVAL_FAIL;
+        }
+        if(FWUP_BootStep(staging, FWUP_SCRATCH_ADDRESS, &(journal[i][FWUP_STEP_STASH])) != RETVAL_OK) {
+            return RETVAL_FAIL;
+        }
+    }
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Copies one sector over another, unless the journal flag says
+ *         it's been done, then sets the flag.
+ * @param  to - Start address of the sector to write
+ * @param  from - Start address of the sector to copy
+ * @param  flag - Journal entry for this step
+ * @retval RETVAL_OK if the step is done
+ */
+FWBOOT_FUNC static uint8_t FWUP_BootStep(uint32_t to, uint32_t from, const uint64_t* flag) {
+    if(FWUP_BootIsMarked(flag)) {
+        return RETVAL_OK;
+    }
+    for(uint8_t tries = 0; tries < FWBOOT_RETRIES; tries++) {
+        if((FWUP_BootErase(to) == RETVAL_OK) && (FWUP_BootCopy(to, from) == RETVAL_OK)) {
+            return FWUP_BootMark(flag);
+        }
+    }
+    return RETVAL_FAIL;
+}
+
+/**
+ * @brief  Erases one sector, in whichever bank mode the flash is in
+ * @param  address - Start address of the sector
+ * @retval RETVAL_OK if it erased without errors
+ */
+FWBOOT_FUNC static uint8_t FWUP_BootErase(uint32_t address) {
+    uint32_t page, pages, bank;
+    uint8_t result = RETVAL_OK;
+
+    if((FLASH->OPTR & FLASH_OPTR_DBANK) == 0) {
+        page = (address - FLASH_START_ADDRESS) / PAGE_SIZE_SINGLE;
+        pages = 1;
+        bank = 0;
+    } else if(address >= BANK2_START_ADDRESS) {
+        page = (address - BANK2_START_ADDRESS) / PAGE_SIZE_DUAL;
+        pages = 2;
+        bank = FLASH_CR_BKER;
+    } else {
+        page = (address - FLASH_START_ADDRESS) / PAGE_SIZE_DUAL;
+        pages = 2;
+        bank = 0;
+    }
+    for(uint32_t i = 0; i < pages; i++) {
+        FLASH->CR &= ~(FLASH_CR_PG | FLASH_CR_PNB | FLASH_CR_BKER);
+        FLASH->CR |= FLASH_CR_PER | bank | ((page + i) << FLASH_CR_PNB_Pos);
+        FLASH->CR |= FLASH_CR_STRT;
+        if(FWUP_BootWait() != RETVAL_OK) {
+            result = RETVAL_FAIL;
+        }
+        FLASH->CR &= ~(FLASH_CR_PER | FLASH_CR_PNB | FLASH_CR_BKER);
+    }
+    FWUP_BootFlushCaches();
+    return result;
+}
+
+/**
+ * @brief  Programs an erased sector with a copy of another, then reads
+ *         it back. Erased double words are skipped, since most images
+ *         don't fill their last sector.
+ * @param  to - Start address of the erased sector
+ * @param  from - Start address of the sector to copy
+ * @retval RETVAL_OK if the copy matches
+ */
+FWBOOT_FUNC static uint8_t FWUP_BootCopy(uint32_t to, uint32_t from) {
+    const uint32_t* source = (const uint32_t*)from;
+    const uint32_t* copy = (const uint32_t*)to;
+    uint8_t result = RETVAL_OK;
+
+    for(uint32_t i = 0; i < (FWUP_SECTOR_SIZE / 4); i += 2) {
+        if((source[i] == FLASH_ERASED) && (source[i + 1] == FLASH_ERASED)) {
+            continue;
+        }
+        FLASH->CR |= FLASH_CR_PG;
+        *(__IO uint32_t*)(to + (i * 4)) = source[i];
+        *(__IO uint32_t*)(to + (i * 4) + 4) = source[i + 1];
+        if(FWUP_BootWait() != RETVAL_OK) {
+            result = RETVAL_FAIL;
+        }
+        FLASH->CR &= ~FLASH_CR_PG;
+        if(result != RETVAL_OK) {
+            return result;
+        }
+    }
+    FWUP_BootFlushCaches();
+    for(uint32_t i = 0; i < (FWUP_SECTOR_SIZE / 4); i++) {
+        if(copy[i] != source[i]) {
+            return RETVAL_FAIL;
+        }
+    }
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Zeroes a journal or record flag
+ * @param  flag - The flag's double word in the update record
+ * @retval RETVAL_OK if it programmed without errors
+ */
+FWBOOT_FUNC static uint8_t FWUP_BootMark(const uint64_t* flag) {
+    uint8_t result;
+
+    FLASH->CR |= FLASH_CR_PG;
+    *(__IO uint32_t*)flag = FLASH_ZEROED;
+    *(((__IO uint32_t*)flag) + 1) = FLASH_ZEROED;
+    result = FWUP_BootWait();
+    FLASH->CR &= ~FLASH_CR_PG;
+    FWUP_BootFlushCaches();
+    return result;
+}
+
+FWBOOT_FUNC static uint8_t FWUP_BootIsMarked(const uint64_t* flag) {
+    const uint32_t* words = (const uint32_t*)flag;
+    return ((words[0] != FLASH_ERASED) || (words[1] != FLASH_ERASED)) ? 1 : 0;
+}
+
+/**
+ * @brief  Waits for the flash to finish, and clears any errors
+ * @retval RETVAL_OK if there weren't any errors
+ */
+FWBOOT_FUNC static uint8_t FWUP_BootWait(void) {
+    while((FLASH->SR & FLASH_SR_BSY) != 0) { }
+    if((FLASH->SR & FWBOOT_FLASH_ERRORS) != 0) {
+        FLASH->SR = FWBOOT_FLASH_ERRORS; // Clear by writing 1
+        return RETVAL_FAIL;
+    }
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Throws away anything the flash caches picked up from sectors
+ *         that have since been rewritten
+ * @retval None
+ */
+FWBOOT_FUNC static void FWUP_BootFlushCaches(void) {
+    FLASH->ACR &= ~(FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+    FLASH->ACR |= FLASH_ACR_ICRST | FLASH_ACR_DCRST;
+    FLASH->ACR &= ~(FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+    FLASH->ACR |= FLASH_ACR_ICEN | FLASH_ACR_DCEN;
+}
+
+/**
+ * @brief  Starts the application the same way the reset would have, from
+ *         its vector table. Doesn't return.
+ * @retval None
+ */
+FWBOOT_FUNC static void FWUP_BootStartApp(void) {
+    const uint32_t* vectors = (const uint32_t*)FWUP_APP_ADDRESS;
+    void (*app_reset)(void) = (void (*)(void))vectors[1];
+
+    SCB->VTOR = FWUP_APP_ADDRESS;
+    __set_MSP(vectors[0]);
+    app_reset();
+}
@@ -0,0 +1,441 @@
+/******************************************************************************
+ * Filename: fw_update.c
+ * Description: In-application firmware updates over the packet protocol.
+ *              The host starts an update with the image size and CRC-32,
+ *              then sends the image in FIRMWARE_CHUNK packets, in order.
+ *              The image is everything from the application's start
+ *              address (FWUP_APP_ADDRESS) on, not the boot stage sector.
+ *              Each chunk is copied out of the packet and programmed into
+ *              the staging slot from a main loop task, one flash operation
+ *              per run like the event log. A chunk that arrives before the
+ *              last one is written is NACKed, and the host sends it again.
+ *              One that's already been taken is ACKed again, in case the
+ *              first ACK was lost.
+ *
+ *              In dual bank mode staging is in bank 2, so it keeps filling
+ *              while the motor runs. In single bank mode it only fills while
+ *              the outputs are off. The update record is in bank 1 either
+ *              way, so it's only written with the outputs off.
+ *
+ *              Committing checks the CRC of the whole staged image, then
+ *              writes the record header. The boot stage (fw_boot.c) swaps
+ *              the image in on the next reset. Once the new image has run
+ *              for FWUP_CONFIRM_MS it confirms itself in the record. If it
+ *              resets before then, the boot stage swaps the old one back.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+
+// Update record writes, done in this order
+#define FWUP_JOB_ERASE_RECORD   (0x01)
+#define FWUP_JOB_HEADER         (0x02)
+#define FWUP_JOB_CONFIRM        (0x04)
+#define FWUP_JOB_REPORT         (0x08)
+
+static Fwup_State fwup_state;
+static uint32_t fwup_size;
+static uint32_t fwup_crc;
+static uint32_t fwup_received; // Image bytes taken, also the next offset expected
+static uint32_t fwup_programmed; // Bytes written to staging
+static uint32_t fwup_running_crc; // Software CRC of the staging slot as read back
+static uint32_t fwup_erased; // Staging bytes erased, ahead of the programming
+static uint32_t fwup_chunk[FWUP_CHUNK_BYTES / 4];
+static uint16_t fwup_chunk_bytes; // Left to program, zero when the buffer is free
+static uint16_t fwup_chunk_done;
+static uint8_t fwup_jobs; // FWUP_JOB_xxx
+static uint8_t fwup_record_pages; // Record pages left to erase
+static uint8_t fwup_header_dw; // Record header double words written
+static uint8_t fwup_erasing;
+static uint8_t fwup_dual;
+static uint32_t fwup_page_size;
+static uint32_t fwup_errors;
+
+static void FWUP_RecordJob(void);
+static void FWUP_ProgramStaging(void);
+static uint8_t FWUP_Program(uint32_t address, uint32_t data1, uint32_t data2);
+static uint8_t FWUP_StartErase(uint32_t address);
+static void FWUP_Fail(void);
+static void FWUP_FlushDataCache(void);
+static uint8_t FWUP_IsMarked(const uint64_t* flag);
+
+/**
+ * @brief  Finds out how the last update went from the update record.
+ *         Logs a rollback, so call after ELOG_Init.
+ * @retval None
+ */
+void FWUP_Init(void) {
+    const Fwup_Record_Type* record = (const Fwup_Record_Type*)FWUP_RECORD_ADDRESS;
+
+    fwup_state = Fwup_Idle;
+    fwup_size = 0;
+    fwup_crc = 0;
+    fwup_received = 0;
+    fwup_programmed = 0;
+    fwup_running_crc = CRC_SOFT_INIT;
+    fwup_erased = 0;
+    fwup_chunk_bytes = 0;
+    fwup_chunk_done = 0;
+    fwup_jobs = 0;
+    fwup_record_pages = 0;
+    fwup_header_dw = 0;
+    fwup_erasing = 0;
+    fwup_errors = 0;
+
+    // Same bank mode check as the EEPROM emulation
+    if((FLASH->OPTR & FLASH_OPTR_DBANK) == 0) {
+        fwup_dual = 0;
+        fwup_page_size = PAGE_SIZE_SINGLE;
+    } else {
+        fwup_dual = 1;
+        fwup_page_size = PAGE_SIZE_DUAL;
+    }
+
+    if(record->Magic != FWUP_MAGIC) {
+        return;
+    }
+    if(FWUP_IsMarked(&(record->Reverted))) {
+        fwup_state = Fwup_RolledBack;
+        if(FWUP_IsMarked(&(record->Reported)) == 0) {
+            ELOG_Record(ELOG_EVENT_FW_UPDATE, FWUP_RESULT_ROLLED_BACK);
+            fwup_jobs |= FWUP_JOB_REPORT;
+        }
+    } else if(FWUP_IsMarked(&(record->Confirmed))) {
+        fwup_state = Fwup_Confirmed;
+    } else if(FWUP_IsMarked(&(record->Trial))) {
+        fwup_state = Fwup_Trial;
+    } else {
+        // Committed, but started without going through the boot stage
+        fwup_state = Fwup_Ready;
+    }
+}
+
+/**
+ * @brief  Starts taking a new image. Cancels any update that was waiting
+ *         for a reset.
+ * @param  size - Image length (bytes)
+ * @param  crc - CRC-32 of the whole image, same as the packet CRC
+ * @retval RETVAL_OK if the image fits, and a new image isn't on trial
+ */
+uint8_t FWUP_Begin(uint32_t size, uint32_t crc) {
+    if((fwup_state == Fwup_Trial) || (size == 0) || (size > FWUP_SLOT_SIZE)) {
+        return RETVAL_FAIL;
+    }
+    fwup_size = size;
+    fwup_crc = crc;
+    fwup_received = 0;
+    fwup_programmed = 0;
+    fwup_running_crc = CRC_SOFT_INIT;
+    fwup_erased = 0;
+    fwup_chunk_bytes = 0;
+    fwup_chunk_done = 0;
+    // The old record goes first, so a half written staging slot can
+    // never be swapped in
+    fwup_jobs = FWUP_JOB_ERASE_RECORD;
+    fwup_record_pages = FWUP_SECTOR_SIZE / fwup_page_size;
+    fwup_state = Fwup_Receiving;
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Takes the next piece of the image
+ * @param  offset - Where the piece goes in the image
+ * @param  data - Image bytes
+ * @param  length - Number of bytes. A multiple of 8, except for the last piece.
+ * @retval RETVAL_OK if it was taken, or was already taken before
+ */
+uint8_t FWUP_Chunk(uint32_t offset, uint8_t* data, uint16_t length) {
+    if(fwup_state != Fwup_Receiving) {
+        return RETVAL_FAIL;
+    }
+    if((length > 0) && ((offset + length) == fwup_received)) {
+        // Sent again, the host didn't hear the ACK
+        return RETVAL_OK;
+    }
+    if((fwup_chunk_bytes != 0) || (offset != fwup_received) || (length == 0)
+            || (length > FWUP_CHUNK_BYTES) || (length > (fwup_size - offset))) {
+        return RETVAL_FAIL;
+    }
+    if(((length & 0x07u) != 0) && ((offset + length) != fwup_size)) {
+        return RETVAL_FAIL;
+    }
+    // The last double word is padded out with erased bytes
+    memset(fwup_chunk, 0xFF, sizeof(fwup_chunk));
+    memcpy(fwup_chunk, data, length);
+    fwup_chunk_done = 0;
+    fwup_chunk_bytes = (length + 7u) & ~(0x07u);
+    fwup_received += length;
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Checks the whole staged image against its CRC, and if it's
+ *         good, sets it up to be swapped in on the next reset. The CRC
+ *         was built up as each double word was read back after
+ *         programming, so this is quick.
+ * @retval RETVAL_OK if the image is good
+ */
+uint8_t FWUP_Commit(void) {
+    if((fwup_state != Fwup_Receiving) || (fwup_received != fwup_size)
+            || (fwup_chunk_bytes != 0) || (fwup_jobs != 0)) {
+        return RETVAL_FAIL;
+    }
+    if(CRC_Software_Finish(fwup_running_crc, fwup_size) != fwup_crc) {
+        FWUP_Fail();
+        return RETVAL_FAIL;
+    }
+    fwup_header_dw = 0;
+    fwup_jobs |= FWUP_JOB_HEADER;
+    fwup_state = Fwup_Committing;
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Stops an update. One that was waiting for a reset won't be
+ *         swapped in. A new image on trial can't be stopped.
+ * @retval RETVAL_OK unless a new image is on trial
+ */
+uint8_t FWUP_Abort(void) {
+    switch(fwup_state) {
+    case Fwup_Trial:
+        return RETVAL_FAIL;
+    case Fwup_Receiving:
+    case Fwup_Committing:
+    case Fwup_Ready:
+    case Fwup_Failed:
+        fwup_chunk_bytes = 0;
+        fwup_jobs = FWUP_JOB_ERASE_RECORD;
+        fwup_record_pages = FWUP_SECTOR_SIZE / fwup_page_size;
+        fwup_state = Fwup_Idle;
+        break;
+    default:
+        break;
+    }
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Main loop task that does the flash work, at most one erase or
+ *         one double word per run. Also confirms a new image once it has
+ *         run long enough.
+ * @retval None
+ */
+void FWUP_Task(void) {
+    FLASH_Status status;
+    uint8_t motor_on = ((PWM_TIM->BDTR & TIM_BDTR_MOE) != 0) ? 1 : 0;
+
+    if(fwup_erasing) {
+        status = FLASH_FinishErase();
+        if(status == FLASH_BUSY) {
+            return;
+        }
+        fwup_erasing = 0;
+        if(status != FLASH_COMPLETE) {
+            FWUP_Fail();
+            return;
+        }
+    }
+
+    if((fwup_state == Fwup_Trial) && (GetTick() >= FWUP_CONFIRM_MS)) {
+        fwup_state = Fwup_Confirmed;
+        fwup_jobs |= FWUP_JOB_CONFIRM;
+    }
+
+    if((fwup_jobs == 0) && (fwup_chunk_bytes == 0)) {
+        return;
+    }
+    if((FLASH->SR & FLASH_SR_BSY) != 0) {
+        // The event log or cogging table is using the flash
+        return;
+    }
+    // The record is in bank 1, so it waits for the motor to stop. So does
+    // the staging slot, since it can't be written before the old record
+    // is gone.
+    if(fwup_jobs != 0) {
+        if(motor_on == 0) {
+            FWUP_RecordJob();
+        }
+        return;
+    }
+    if((fwup_dual == 0) && motor_on) {
+        // Single bank, the motor interrupts can't wait on the flash
+        return;
+    }
+    FWUP_ProgramStaging();
+}
+
+uint32_t FWUP_GetStatistic(uint16_t value_ID) {
+    switch(value_ID) {
+    case CONFIG_FWUP_STATUS_STATE:
+        return (uint32_t)fwup_state;
+    case CONFIG_FWUP_STATUS_RECEIVED:
+        return fwup_received;
+    case CONFIG_FWUP_STATUS_PROGRAMMED:
+        return fwup_programmed;
+    case CONFIG_FWUP_STATUS_ERRORS:
+        return fwup_errors;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief  Does the next update record write
+ * @retval None
+ */
+static void FWUP_RecordJob(void) {
+    const Fwup_Record_Type* record = (const Fwup_Record_Type*)FWUP_RECORD_ADDRESS;
+
+    if((fwup_jobs & FWUP_JOB_ERASE_RECORD) != 0) {
+        if(FWUP_StartErase(FWUP_RECORD_ADDRESS + (FWUP_SECTOR_SIZE - (fwup_record_pages * fwup_page_size)))) {
+            fwup_record_pages--;
+            if(fwup_record_pages == 0) {
+                fwup_jobs &= ~(FWUP_JOB_ERASE_RECORD);
+            }
+        }
+        return;
+    }
+    if((fwup_jobs & FWUP_JOB_HEADER) != 0) {
+        // Magic number last, so a half written header doesn't count
+        if(fwup_header_dw == 0) {
+            if(FWUP_Program((uint32_t)&(record->Size), fwup_size, fwup_crc)) {
+                fwup_header_dw++;
+            }
+        } else if(FWUP_Program((uint32_t)&(record->Magic), FWUP_MAGIC, FLASH_ERASED)) {
+            fwup_jobs &= ~(FWUP_JOB_HEADER);
+            fwup_state = Fwup_Ready;
+        }
+        return;
+    }
+    if((fwup_jobs & FWUP_JOB_CONFIRM) != 0) {
+        if(FWUP_Program((uint32_t)&(record->Confirmed), FLASH_ZEROED, FLASH_ZEROED)) {
+            fwup_jobs &= ~(FWUP_JOB_CONFIRM);
+            ELOG_Record(ELOG_EVENT_FW_UPDATE, FWUP_RESULT_CONFIRMED);
+        }
+        return;
+    }
+    if((fwup_jobs & FWUP_JOB_REPORT) != 0) {
+        if(FWUP_Program((uint32_t)&(record->Reported), FLASH_ZEROED, FLASH_ZEROED)) {
+            fwup_jobs &= ~(FWUP_JOB_REPORT);
+        }
+    }
+}
+
+/**
+ * @brief  Writes the next double word of the chunk into staging, or
+ *         erases the page it goes in first
+ * @retval None
+ */
+static void FWUP_ProgramStaging(void) {
+    uint32_t address = FWUP_STAGING_ADDRESS + fwup_programmed;
+    uint32_t* words;
+    uint32_t image_bytes;
+
+    if(fwup_programmed >= fwup_erased) {
+        if(FWUP_StartErase(address)) {
+            fwup_erased += fwup_page_size;
+        }
+        return;
+    }
+    words = &(fwup_chunk[fwup_chunk_done / 4]);
+    if(FWUP_Program(address, words[0], words[1]) == 0) {
+        return;
+    }
+    // Add what actually landed in flash to the image CRC. The padding
+    // after the end of the image isn't part of it.
+    FWUP_FlushDataCache();
+    image_bytes = fwup_size - fwup_programmed;
+    if(image_bytes > 8) {
+        image_bytes = 8;
+    }
+    fwup_running_crc = CRC_Software_Update(fwup_running_crc, (const uint8_t*)address, image_bytes);
+    fwup_programmed += 8;
+    fwup_chunk_done += 8;
+    if(fwup_chunk_done >= fwup_chunk_bytes) {
+        fwup_chunk_bytes = 0;
+        fwup_chunk_done = 0;
+    }
+}
+
+/**
+ * @brief  Programs one double word. Any failure stops the update.
+ * @retval 1 if it worked, 0 if it didn't
+ */
+static uint8_t FWUP_Program(uint32_t address, uint32_t data1, uint32_t data2) {
+    if(FLASH_ProgramDoubleWord(address, data1, data2) != FLASH_COMPLETE) {
+        FWUP_Fail();
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief  Starts erasing the page at an address, in whichever bank mode
+ *         the flash is in. The task finishes it off on later runs.
+ * @param  address - Start of the page
+ * @retval 1 if the erase started, 0 if it didn't
+ */
+static uint8_t FWUP_StartErase(uint32_t address) {
+    uint32_t page;
+    uint8_t bank = 0;
+
+    if(fwup_dual == 0) {
+        page = (address - FLASH_START_ADDRESS) / PAGE_SIZE_SINGLE;
+    } else if(address >= BANK2_START_ADDRESS) {
+        page = (address - BANK2_START_ADDRESS) / PAGE_SIZE_DUAL;
+        bank = 1;
+    } else {
+        page = (address - FLASH_START_ADDRESS) / PAGE_SIZE_DUAL;
+    }
+    if(FLASH_StartErasePage(page, bank) != FLASH_COMPLETE) {
+        // Something else got in first, try again next time
+        return 0;
+    }
+    fwup_erasing = 1;
+    return 1;
+}
+
+static void FWUP_Fail(void) {
+    fwup_errors++;
+    fwup_chunk_bytes = 0;
+    fwup_jobs = 0;
+    fwup_state = Fwup_Failed;
+}
+
+/**
+ * @brief  Throws away anything the flash data cache picked up from the
+ *         staging slot before it was rewritten, including the erased
+ *         neighbours of the double word just programmed
+ * @retval None
+ */
+static void FWUP_FlushDataCache(void) {
+    FLASH->ACR &= ~(FLASH_ACR_DCEN);
+    FLASH->ACR |= FLASH_ACR_DCRST;
+    FLASH->ACR &= ~(FLASH_ACR_DCRST);
+    FLASH->ACR |= FLASH_ACR_DCEN;
+}
+
+static uint8_t FWUP_IsMarked(const uint64_t* flag) {
+    const uint32_t* words = (const uint32_t*)flag;
+    return ((words[0] != FLASH_ERASED) || (words[1] != FLASH_ERASED)) ? 1 : 0;
+}
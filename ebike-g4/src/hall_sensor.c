@@ -51,31 +51,25 @@
 #include <math.h>
 
 static void HALL_CalcSpeed(void);
-static float HALL_CalcMidPoint(float a1, float a2);
-static float HALL_ClipToOne(float unclipped);
+static Angle_Type HALL_CalcMidPoint(Angle_Type a1, Angle_Type a2);
+static Angle_Type HALL_AngleFromFloat(float angle);
 static void HALL_UpdateLookupTables(void);
 
-HallSensor_HandleTypeDef HallSensor;
+HallSensor_HandleTypeDef HallSensor CCMRAM_BSS;
 HallSensorPLL_HandleTypeDef HallSensorPLL;
-float HallStateAnglesMidFloat[8]; // Midpoints of states. Angle is 0.0 (0deg) to 1.0 (360deg)
-float HallStateAnglesFwdFloat[8]; // Entry angle for states when rotating forwards. Angle is 0.0 (0deg) to 1.0 (360deg)
-float HallStateAnglesRevFloat[8]; // Entry angle for states when rotating reverse. Angle is 0.0 (0deg) to 1.0 (360deg)
+Angle_Type HallStateAnglesMid[8]; // Midpoints of states. Angle is 0 (0deg) to 2^32 (360deg)
+Angle_Type HallStateAnglesFwd[8]; // Entry angle for states when rotating forwards. Angle is 0 (0deg) to 2^32 (360deg)
+Angle_Type HallStateAnglesRev[8]; // Entry angle for states when rotating reverse. Angle is 0 (0deg) to 2^32 (360deg)
 uint8_t HallStateForwardOrder[8]; // List of states, lowest to highest angle
 uint8_t HallStateReverseOrder[8]; // List of states, highest to lowest angle
 uint8_t HallStateForwardRotation[8]; // Lookup where index is current state, value is next state when rotating forwards
 uint8_t HallStateReverseRotation[8]; // Lookup where index is current state, value is next state when rotating reverse
-float* HallDetectAngleTable;
+Angle_Type* HallDetectAngleTable;
 uint8_t HallDetectTableLength;
 uint32_t HallDetectTransitionsDone[6];
 
 uint32_t HallInputDebouncer[16];
 
-
-uint8_t DebugStateTracker[256];
-uint8_t DebugDirTracker[256];
-uint16_t DebugCaptureTracker[256];
-uint8_t DebugCounter;
-
 /**
  * @brief  Initializes the Hall effect sensor interface
  * @param  callingFrequency: The frequency (Hz) at which
@@ -122,6 +116,7 @@ void HALL_Init(uint32_t callingFrequency) {
     HallSensor.Status = 0;
     HallSensor.Speed = 0.0f;
     HallSensor.PreviousSpeed = 0.0f;
+    HallSensor.SectorSpeed = 0.0f;
     HallSensor.CallingFrequency = callingFrequency;
     HallSensor.OverflowCount = 0;
     HallSensor.SteadyRotationCount = 0;
@@ -152,29 +147,23 @@ void HALL_Init(uint32_t callingFrequency) {
  *          at location 6. Locations 0 and 7 are ignored
  * @retval RETVAL_OK if succeeded (the math works out) otherwise RETVAL_FAIL
  */
-uint8_t HALL_GenFwdOrder(float* angleTab, uint8_t* fwdOrderTab) {
+uint8_t HALL_GenFwdOrder(Angle_Type* angleTab, uint8_t* fwdOrderTab) {
     // Assume all tables are length 8. That's enough for all possible combos
     // of the three Hall sensors, including the undefined 0 and 7 states.
-
-    // Enforce all states are valid (angle between 0.0 and 1.0)
-    for (uint8_t i = 1; i <= 6; i++) {
-        if ((angleTab[i] > 1.0f) || (angleTab[i] < 0.0f)) {
-            return RETVAL_FAIL;
-        }
-    }
+    // Every Angle_Type value is a valid angle, no range check needed.
 
     uint8_t already_used_states = 0;    // Bits set to one if the correspoding
                                         // state was already selected.
-    float lowestval;
+    Angle_Type lowestval;
     uint8_t loweststate;
     for (uint8_t j = 1; j <= 6; j++) {
 
         // Find the next lowest Hall state
-        lowestval = 99.9f;
+        lowestval = 0;
         loweststate = 7;
         for (uint8_t k = 1; k <= 6; k++) {
             if ((already_used_states & (1 << k)) == 0) {
-                if (angleTab[k] < lowestval) {
+                if ((loweststate == 7) || (angleTab[k] < lowestval)) {
                     lowestval = angleTab[k];
                     loweststate = k;
                 }
@@ -194,29 +183,23 @@ uint8_t HALL_GenFwdOrder(float* angleTab, uint8_t* fwdOrderTab) {
  *          at location 6. Locations 0 and 7 are ignored
  * @retval RETVAL_OK if succeeded (the math works out) otherwise RETVAL_FAIL
  */
-uint8_t HALL_GenRevOrder(float* angleTab, uint8_t* revOrderTab) {
+uint8_t HALL_GenRevOrder(Angle_Type* angleTab, uint8_t* revOrderTab) {
     // Assume all tables are length 8. That's enough for all possible combos
     // of the three Hall sensors, including the undefined 0 and 7 states.
-
-    // Enforce all states are valid (angle between 0.0 and 1.0)
-    for (uint8_t i = 1; i <= 6; i++) {
-        if ((angleTab[i] > 1.0f) || (angleTab[i] < 0.0f)) {
-            return RETVAL_FAIL;
-        }
-    }
+    // Every Angle_Type value is a valid angle, no range check needed.
 
     uint8_t already_used_states = 0;    // Bits set to one if the correspoding
                                         // state was already selected.
-    float highestval;
+    Angle_Type highestval;
     uint8_t higheststate;
     for (uint8_t j = 1; j <= 6; j++) {
 
         // Find the next highest Hall state
-        highestval = -1.0f;
+        highestval = 0;
         higheststate = 7;
         for (uint8_t k = 1; k <= 6; k++) {
             if ((already_used_states & (1 << k)) == 0) {
-                if (angleTab[k] > highestval) {
+                if ((higheststate == 7) || (angleTab[k] > highestval)) {
                     highestval = angleTab[k];
                     higheststate = k;
                 }
@@ -368,32 +351,23 @@ uint8_t HALL_GenRevInvTable(uint8_t* revTab, uint8_t* revInvTab) {
     return RETVAL_OK;
 }
 
-uint8_t HALL_GetState(void) {
+uint8_t CCMRAM_FUNC HALL_GetState(void) {
     return HallSensor.CurrentState;
 }
-void HALL_IncAngle(void) {
+void CCMRAM_FUNC HALL_IncAngle(void) {
     // Increment the angle by the pre-calculated increment amount
+    // Wraparound is free, the angle is a phase accumulator.
     if (HallSensor.RotationDirection == HALL_ROT_FORWARD) {
         HallSensor.Angle += HallSensor.AngleIncrement;
     } else if (HallSensor.RotationDirection == HALL_ROT_REVERSE) {
         HallSensor.Angle -= HallSensor.AngleIncrement;
     }
     // Don't do anything if rotation is unknown.
-    // Wraparound for floating point.
-       HallSensor.Angle = HALL_ClipToOne(HallSensor.Angle);
-}
-
-uint16_t HALL_GetAngle(void) {
-    if ((HallSensor.Status & HALL_STOPPED) != 0) {
-        return (uint16_t) (HallStateAnglesFwdFloat[HALL_GetState()]
-                * 65536.0f);
-    }
-    return (uint16_t) (HallSensor.Angle * 65536.0f);
 }
 
-float HALL_GetAngleF(void) {
+Angle_Type CCMRAM_FUNC HALL_GetAngle(void) {
     if ((HallSensor.Status & HALL_STOPPED) != 0) {
-        return HallStateAnglesFwdFloat[HALL_GetState()];
+        return HallStateAnglesFwd[HALL_GetState()];
     }
     return HallSensor.Angle;
 }
@@ -402,15 +376,25 @@ uint32_t HALL_GetSpeed(void) {
     return (uint32_t) (HallSensor.Speed * 65536.0f);
 }
 
-float HALL_GetSpeedF(void) {
+float CCMRAM_FUNC HALL_GetSpeedF(void) {
     return HallSensor.Speed;
 }
 
-uint8_t HALL_GetDirection(void) {
+/**
+ * @brief  Speed over the Hall state that just finished, instead of the
+ *         whole electrical revolution. Follows the ripple within a
+ *         revolution that HALL_GetSpeedF averages away.
+ * @retval Electrical Hz
+ */
+float CCMRAM_FUNC HALL_GetSectorSpeedF(void) {
+    return HallSensor.SectorSpeed;
+}
+
+uint8_t CCMRAM_FUNC HALL_GetDirection(void) {
     return HallSensor.RotationDirection;
 }
 
-uint8_t HALL_IsValid(void)
+uint8_t CCMRAM_FUNC HALL_IsValid(void)
 {
     return HallSensor.Valid;
 }
@@ -418,16 +402,10 @@ uint8_t HALL_IsValid(void)
 void HALL_PLLUpdate(void) {
     // Run the PLL to create a smoothed angle output
     float phase_difference;
-    phase_difference =  HallSensor.Angle - HallSensorPLL.Phase;
-    while(phase_difference > 0.5f) {
-        phase_difference -= 1.0f;
-    }
-    while(phase_difference < -0.5f) {
-        phase_difference += 1.0f;
-    }
+    // Two's complement difference is already wrapped to [-0.5, 0.5)
+    phase_difference = ANGLE_DELTA_TO_FLOAT(HallSensor.Angle - HallSensorPLL.Phase);
     HallSensorPLL.Frequency += HallSensorPLL.Beta*phase_difference;
-    HallSensorPLL.Phase += HallSensorPLL.Alpha*phase_difference + HallSensorPLL.Frequency;
-    HallSensorPLL.Phase = HALL_ClipToOne(HallSensorPLL.Phase);
+    HallSensorPLL.Phase += ANGLE_DELTA_FROM_FLOAT(HallSensorPLL.Alpha*phase_difference + HallSensorPLL.Frequency);
 
     // Check for phase lock
 
@@ -451,10 +429,7 @@ void HALL_PLLUpdate(void) {
     }
 }
 
-uint16_t HALL_GetPLLAngle(void) {
-    return (uint16_t)(HallSensorPLL.Phase * 65536.0f);
-}
-float HALL_GetPLLAngleF(void) {
+Angle_Type HALL_GetPLLAngle(void) {
     return HallSensorPLL.Phase;
 }
 
@@ -475,12 +450,12 @@ uint8_t HALL_SetAngle(uint8_t state, float newAngle) {
         // Out of range, only valid for states 1 to 6
         return RETVAL_FAIL;
     }
-    if((newAngle < 0.0f) || (newAngle > 1.0f)) {
+    if(!((newAngle >= 0.0f) && (newAngle <= 1.0f))) {
         // Out of range, only angles zero to one allowed
         return RETVAL_FAIL;
     }
     // Copy the angle
-    HallStateAnglesFwdFloat[state] = newAngle;
+    HallStateAnglesFwd[state] = HALL_AngleFromFloat(newAngle);
     // Update forward and reverse lookup tables
     HALL_UpdateLookupTables();
     return RETVAL_OK;
@@ -490,33 +465,33 @@ uint8_t HALL_SetAngleTable(float* angleTab) {
     // Check that angles are okay
     uint8_t i;
     for (i = 1; i <= 6; i++) {
-        if ((angleTab[i] < 0.0f) || (angleTab[i] > 1.0f)) {
+        if (!((angleTab[i] >= 0.0f) && (angleTab[i] <= 1.0f))) {
             // Fail, this is outside of the proper range
             return RETVAL_FAIL;
         }
     }
     // Copy over the forward angle table
     for (i = 0; i < 8; i++) {
-        HallStateAnglesFwdFloat[i] = angleTab[i];
+        HallStateAnglesFwd[i] = HALL_AngleFromFloat(angleTab[i]);
     }
 
     HALL_UpdateLookupTables();
     return RETVAL_OK;
 }
 
-float* HALL_GetAngleTable(void) {
-    return HallStateAnglesFwdFloat;
+Angle_Type* HALL_GetAngleTable(void) {
+    return HallStateAnglesFwd;
 }
 
-float HALL_GetAngleFromTable(uint8_t state) {
-    return HallStateAnglesFwdFloat[state];
+Angle_Type HALL_GetAngleFromTable(uint8_t state) {
+    return HallStateAnglesFwd[state];
 }
 
-float HALL_GetStateMidpoint(uint8_t state) {
+Angle_Type CCMRAM_FUNC HALL_GetStateMidpoint(uint8_t state) {
     if((state < 1) || (state > 6)) {
-        return 0.0f;
+        return U32_0_DEG;
     }
-    return HallStateAnglesMidFloat[state];
+    return HallStateAnglesMid[state];
 }
 
 void HALL_ChangeFrequency(uint32_t newfreq) {
@@ -527,7 +502,7 @@ void HALL_ChangeFrequency(uint32_t newfreq) {
     HallSensorPLL.Beta = (0.5f)*(HallSensorPLL.Alpha)*(HallSensorPLL.Alpha);
 }
 
-void HALL_EnableHallDetection(float* angleTable, uint8_t tableLength) {
+void HALL_EnableHallDetection(Angle_Type* angleTable, uint8_t tableLength) {
     HallDetectAngleTable = angleTable;
     HallDetectTableLength = tableLength;
     for (uint8_t i = 0; i < 6; i++) {
@@ -536,7 +511,7 @@ void HALL_EnableHallDetection(float* angleTable, uint8_t tableLength) {
 }
 
 void HALL_DisableHallDetection(void) {
-    HallDetectAngleTable = (float*) 0;
+    HallDetectAngleTable = (Angle_Type*) 0;
     HallDetectTableLength = 0;
 }
 
@@ -547,7 +522,11 @@ void HALL_UpdateCallback(void) {
         HallSensor.OverflowCount = HALL_MAX_OVERFLOWS;
         // Set speed to zero - stopped motor
         HallSensor.Speed = 0.0f;
-        HallSensor.AngleIncrement = 0.0f;
+        HallSensor.SectorSpeed = 0.0f;
+        HallSensor.AngleIncrement = 0;
+        if ((HallSensor.Status & HALL_STOPPED) == 0) {
+            DTRACE_RECORD(DTRACE_CH_HALL, DTRACE_HALL_STOPPED, HallSensor.OverflowCount, 0);
+        }
         HallSensor.Status |= HALL_STOPPED;
         HallSensor.Prescaler = HALL_PSC_MAX;
         HALL_TIM->PSC = HALL_PSC_MAX;
@@ -569,7 +548,6 @@ void HALL_CaptureCallback(void) {
     uint8_t hall_a_vote, hall_b_vote, hall_c_vote;
 
     HallSensor.CaptureValue = HALL_TIM->CCR1;
-    DebugCaptureTracker[DebugCounter] = HallSensor.CaptureValue;
     // Figure out which way we're turning.
     // Simple debouncing. Read the input data register 16 times, and vote on
     // the real value.
@@ -593,7 +571,6 @@ void HALL_CaptureCallback(void) {
     HallSensor.CurrentState = ((hall_a_vote > 8) ? 1 : 0)
             + ((hall_b_vote > 8) ? 2 : 0)
             + ((hall_c_vote > 8) ? 4 : 0) ;
-    DebugStateTracker[DebugCounter] = HallSensor.CurrentState;
 //    thisState =
 //            (HALL_PORT->IDR & (1 << HALL_A_PIN)) != 0 ? 1 : 0;
 //    thisState +=
@@ -607,7 +584,8 @@ void HALL_CaptureCallback(void) {
         HallSensor.RotationDirection = HALL_ROT_REVERSE;
     else
         HallSensor.RotationDirection = HALL_ROT_UNKNOWN;
-    DebugDirTracker[DebugCounter++] = HallSensor.RotationDirection;
+    DTRACE_RECORD(DTRACE_CH_HALL, DTRACE_HALL_EDGE, HallSensor.CaptureValue,
+            HallSensor.CurrentState + ((uint32_t)HallSensor.RotationDirection << 8));
     // Update the angle - just encountered a 60deg marker (the Hall state change)
     // If we're rotating forward, the actual angle will be at the beginning of the state.
     // For example, if we entered State 5 (210->270), we will be at 210 if rotating forwards,
@@ -616,18 +594,18 @@ void HALL_CaptureCallback(void) {
 
     switch (HallSensor.RotationDirection) {
     case HALL_ROT_FORWARD:
-        HallSensor.Angle = HallStateAnglesFwdFloat[HallSensor.CurrentState];
+        HallSensor.Angle = HallStateAnglesFwd[HallSensor.CurrentState];
         HallSensor.CaptureForState[HallSensor.CurrentState] = HallSensor.CaptureValue;
         HallSensor.PrescalerForState[HallSensor.CurrentState] = HallSensor.Prescaler;
         break;
     case HALL_ROT_REVERSE:
-        HallSensor.Angle = HallStateAnglesRevFloat[HallSensor.CurrentState];
+        HallSensor.Angle = HallStateAnglesRev[HallSensor.CurrentState];
         HallSensor.CaptureForState[HallSensor.CurrentState] = HallSensor.CaptureValue;
         HallSensor.PrescalerForState[HallSensor.CurrentState] = HallSensor.Prescaler;
         break;
     case HALL_ROT_UNKNOWN:
     default:
-        HallSensor.Angle = HallStateAnglesMidFloat[HallSensor.CurrentState];
+        HallSensor.Angle = HallStateAnglesMid[HallSensor.CurrentState];
         break;
     }
 
@@ -696,24 +674,26 @@ void HALL_CaptureCallback(void) {
     HallSensor.PreviousState = HallSensor.CurrentState;
 }
 
+// The EEPROM keeps the angles as floats in [0,1), same as before the
+// angles became phase accumulators, so stored settings still load.
 void HALL_SaveVariables(void) {
-    EE_SaveFloat(CONFIG_MOTOR_HALL1, HallStateAnglesFwdFloat[1]);
-    EE_SaveFloat(CONFIG_MOTOR_HALL2, HallStateAnglesFwdFloat[2]);
-    EE_SaveFloat(CONFIG_MOTOR_HALL3, HallStateAnglesFwdFloat[3]);
-    EE_SaveFloat(CONFIG_MOTOR_HALL4, HallStateAnglesFwdFloat[4]);
-    EE_SaveFloat(CONFIG_MOTOR_HALL5, HallStateAnglesFwdFloat[5]);
-    EE_SaveFloat(CONFIG_MOTOR_HALL6, HallStateAnglesFwdFloat[6]);
+    EE_SaveFloat(CONFIG_MOTOR_HALL1, ANGLE_TO_FLOAT(HallStateAnglesFwd[1]));
+    EE_SaveFloat(CONFIG_MOTOR_HALL2, ANGLE_TO_FLOAT(HallStateAnglesFwd[2]));
+    EE_SaveFloat(CONFIG_MOTOR_HALL3, ANGLE_TO_FLOAT(HallStateAnglesFwd[3]));
+    EE_SaveFloat(CONFIG_MOTOR_HALL4, ANGLE_TO_FLOAT(HallStateAnglesFwd[4]));
+    EE_SaveFloat(CONFIG_MOTOR_HALL5, ANGLE_TO_FLOAT(HallStateAnglesFwd[5]));
+    EE_SaveFloat(CONFIG_MOTOR_HALL6, ANGLE_TO_FLOAT(HallStateAnglesFwd[6]));
 }
 
 void HALL_LoadVariables(void) {
-    HallStateAnglesFwdFloat[0] = F32_0_DEG;
-    HallStateAnglesFwdFloat[7] = F32_0_DEG;
-    HallStateAnglesFwdFloat[1] = EE_ReadFloatWithDefault(CONFIG_MOTOR_HALL1, DFLT_MOTOR_HALL1);
-    HallStateAnglesFwdFloat[2] = EE_ReadFloatWithDefault(CONFIG_MOTOR_HALL2, DFLT_MOTOR_HALL2);
-    HallStateAnglesFwdFloat[3] = EE_ReadFloatWithDefault(CONFIG_MOTOR_HALL3, DFLT_MOTOR_HALL3);
-    HallStateAnglesFwdFloat[4] = EE_ReadFloatWithDefault(CONFIG_MOTOR_HALL4, DFLT_MOTOR_HALL4);
-    HallStateAnglesFwdFloat[5] = EE_ReadFloatWithDefault(CONFIG_MOTOR_HALL5, DFLT_MOTOR_HALL5);
-    HallStateAnglesFwdFloat[6] = EE_ReadFloatWithDefault(CONFIG_MOTOR_HALL6, DFLT_MOTOR_HALL6);
+    HallStateAnglesFwd[0] = U32_0_DEG;
+    HallStateAnglesFwd[7] = U32_0_DEG;
+    HallStateAnglesFwd[1] = HALL_AngleFromFloat(EE_ReadFloatWithDefault(CONFIG_MOTOR_HALL1, DFLT_MOTOR_HALL1));
+    HallStateAnglesFwd[2] = HALL_AngleFromFloat(EE_ReadFloatWithDefault(CONFIG_MOTOR_HALL2, DFLT_MOTOR_HALL2));
+    HallStateAnglesFwd[3] = HALL_AngleFromFloat(EE_ReadFloatWithDefault(CONFIG_MOTOR_HALL3, DFLT_MOTOR_HALL3));
+    HallStateAnglesFwd[4] = HALL_AngleFromFloat(EE_ReadFloatWithDefault(CONFIG_MOTOR_HALL4, DFLT_MOTOR_HALL4));
+    HallStateAnglesFwd[5] = HALL_AngleFromFloat(EE_ReadFloatWithDefault(CONFIG_MOTOR_HALL5, DFLT_MOTOR_HALL5));
+    HallStateAnglesFwd[6] = HALL_AngleFromFloat(EE_ReadFloatWithDefault(CONFIG_MOTOR_HALL6, DFLT_MOTOR_HALL6));
 
     HALL_UpdateLookupTables();
 
@@ -724,20 +704,20 @@ void HALL_LoadVariables(void) {
  */
 static void HALL_UpdateLookupTables(void) {
     // Create forward and reverse state transition order tables
-    HALL_GenFwdOrder(HallStateAnglesFwdFloat, HallStateForwardOrder);
-    HALL_GenRevOrder(HallStateAnglesFwdFloat, HallStateReverseOrder);
+    HALL_GenFwdOrder(HallStateAnglesFwd, HallStateForwardOrder);
+    HALL_GenRevOrder(HallStateAnglesFwd, HallStateReverseOrder);
 
     // Create the forward and reverse lookup tables
     HALL_GenFwdTable(HallStateForwardOrder, HallStateForwardRotation);
     HALL_GenRevTable(HallStateReverseOrder, HallStateReverseRotation);
     // Generate the reverse angle table
     for (uint8_t i = 1; i <= 6; i++) {
-        HallStateAnglesRevFloat[HallStateReverseRotation[i]] =
-                HallStateAnglesFwdFloat[i];
+        HallStateAnglesRev[HallStateReverseRotation[i]] =
+                HallStateAnglesFwd[i];
     }
     // Generate the midpoint angle table
     for (uint8_t i = 1; i <= 6; i++) {
-        HallStateAnglesMidFloat[i] = HALL_CalcMidPoint(HallStateAnglesRevFloat[i],HallStateAnglesFwdFloat[i]);
+        HallStateAnglesMid[i] = HALL_CalcMidPoint(HallStateAnglesRev[i],HallStateAnglesFwd[i]);
 
     }
 }
@@ -754,9 +734,11 @@ static void HALL_UpdateLookupTables(void) {
  * @retval The electrical motor speed in Hz
  */
 static void HALL_CalcSpeed(void) {
-    // Sum up all 6 states
+    // Sum up all 6 states, numbered 1 to 6
     float full_rotation_capture = 0.0f;
-    for (uint8_t i = 0; i < 6; i++) {
+    float sector_capture = ((float) (HallSensor.CaptureForState[HallSensor.CurrentState]))
+            * ((float) (HallSensor.PrescalerForState[HallSensor.CurrentState] + 1));
+    for (uint8_t i = 1; i <= 6; i++) {
         full_rotation_capture += ((float) (HallSensor.CaptureForState[i]))
                 * ((float) (HallSensor.PrescalerForState[i] + 1));
     }
@@ -765,42 +747,32 @@ static void HALL_CalcSpeed(void) {
             || (HallSensor.RotationDirection == HALL_ROT_REVERSE)) {
         HallSensor.Speed = ((float) HALL_CLK)
                 / full_rotation_capture;
-        HallSensor.AngleIncrement = HallSensor.Speed
-                / ((float) HallSensor.CallingFrequency);
+        HallSensor.SectorSpeed = ((float) HALL_CLK)
+                / (6.0f * sector_capture);
+        HallSensor.AngleIncrement = ANGLE_FROM_FLOAT(HallSensor.Speed
+                / ((float) HallSensor.CallingFrequency));
     } else {
         HallSensor.Speed = 0;
+        HallSensor.SectorSpeed = 0;
         HallSensor.AngleIncrement = 0;
     }
 }
 
-// Determines the midpoint of two angles.
-// Includes checking for wraparound.
-static float HALL_CalcMidPoint(float a1, float a2) {
-    float retval = 0.0f;
-    // Take care of the case where we are wrapping around 1.0
-    // If we didn't do this, the average angle would be close to 0.5 when it should instead
-    // be close to either 0.0 or 1.0
-    // If one angle is above 3/4 and the other is below 1/4, that's a wraparound case
-    if( ((a1 > (0.75f)) && (a2 < (0.25f))) ||
-        ((a2 > (0.75f)) && (a1 < (0.25f)))) {
-        retval = (1.0f + a1 + a2) / 2.0f;
-        if(retval > 1.0f) {
-            retval -= 1.0f;
-        }
-    } else {
-        retval = (a1 + a2) / 2.0f;
+// Converts an angle from outside, saved or sent as a float, to Angle_Type.
+// One is a full revolution, the same as zero, but converting it directly
+// overflows. So can a saved angle just under 360deg, which rounds up to one
+// as a float. Anything outside [0,1) is wrapped back into it.
+static Angle_Type HALL_AngleFromFloat(float angle) {
+    angle -= floorf(angle);
+    if(!(angle < 1.0f)) {
+        // Tiny negative angles round up to one, and NaN has no angle
+        angle = 0.0f;
     }
-    return retval;
+    return ANGLE_FROM_FLOAT(angle);
 }
 
-static float HALL_ClipToOne(float unclipped) {
-    // Output is allowed to be [0, 1)
-    // Value of zero is allowed, but one is the same as zero.
-    while(unclipped < 0.0f) {
-        unclipped += 1.0f;
-    }
-    while(unclipped >= 1.0f) {
-        unclipped -= 1.0f;
-    }
-    return unclipped;
+// Determines the midpoint of two angles, along the shorter arc between them.
+// The two's complement difference takes care of wrapping around 360deg.
+static Angle_Type HALL_CalcMidPoint(Angle_Type a1, Angle_Type a2) {
+    return a1 + (Angle_Type)(((int32_t)(a2 - a1)) / 2);
 }
@@ -50,13 +50,18 @@ void SysTick_Handler (void) {
  * - DMA1 Channel 2 end of transfer (TCIF)
  */
 
-void ADC1_2_IRQHandler(void) {
+void CCMRAM_FUNC ADC1_2_IRQHandler(void) {
     if((ADC1->ISR & ADC_ISR_JEOS) != 0) {
         // Injected end of conversion
         ADC1->ISR |= ADC_ISR_JEOS; // Clear the flag by writing 1 to it
 
         // Call the motor control loop
+        SCHED_Begin(Sched_Current);
         MAIN_MotorISR();
+        SCHED_End(Sched_Current);
+
+        // Release any slower rate groups that are due
+        SCHED_Tick();
     }
 }
 
@@ -116,17 +121,35 @@ void TIM4_IRQHandler(void) {
 
 }
 
+void TIM5_IRQHandler(void) {
+    if((TIM5->SR & TIM_SR_UIF) != 0) {
+        // Update (no cadence pulse within the timeout)
+        TIM5->SR &= ~(TIM_SR_UIF);
+        PAS_TimeoutCallback();
+    }
+    if((TIM5->SR & TIM_SR_CC1IF) != 0) {
+        // Capture (rising edge of a cadence pulse)
+        TIM5->SR &= ~(TIM_SR_CC1IF);
+        PAS_CaptureCallback();
+    }
+}
+
 /**
- * Handler for application timer.
- * One interrupt:
- *  - TIM6 Update (UIF)
+ * Handlers for scheduler rate groups.
+ * The timers aren't running. These are pended in software by SCHED_Tick:
+ *  - TIM7 vector: speed and limit loops (2kHz)
+ *  - TIM6 vector: housekeeping (100Hz)
  */
+void TIM7_DAC_IRQHandler(void) {
+    SCHED_Begin(Sched_Speed);
+    MAIN_SpeedISR();
+    SCHED_End(Sched_Speed);
+}
+
 void TIM6_DAC_IRQHandler(void) {
-    if((TIM6->SR & TIM_SR_UIF) != 0) {
-        // Update (timer rollover)
-        TIM6->SR &= ~(TIM_SR_UIF); // Clear by writing 0
-        MAIN_AppTimerISR(); // Call the application timer ISR in main
-    }
+    SCHED_Begin(Sched_Housekeeping);
+    MAIN_HousekeepingISR();
+    SCHED_End(Sched_Housekeeping);
 }
 
 /**
@@ -145,8 +168,9 @@ void TIM1_UP_TIM16_IRQHandler(void) {
 
 void TIM1_BRK_TIM15_IRQHandler(void) {
     if((TIM1->SR & TIM_SR_BIF) != 0) {
-        // Break interrupt
+        // Break interrupt. Hardware has already cleared MOE.
         TIM1->SR &= ~(TIM_SR_BIF); // Clear the flag by writing 0
+        FAULT_Set(FAULT_HW_BREAK);
     }
 }
 
@@ -170,6 +194,32 @@ void USART3_IRQHandler(void) {
 }
 
 
+/**
+ * Handler for DRV8353 SPI
+ * One interrupt used:
+ * - SPI1 receiver not empty (RXNE), end of each 16-bit frame
+ */
+
+void SPI1_IRQHandler(void) {
+    // RXNE is cleared automatically when the data register is read
+    DRV8353_IRQ();
+}
+
+
+/**
+ * Handler for Flash
+ * One interrupt used:
+ * - End of operation (EOP)
+ */
+
+void FLASH_IRQHandler(void) {
+    if((FLASH->SR & FLASH_SR_EOP) != 0) {
+        // Program or erase finished
+        FLASH->SR = FLASH_SR_EOP; // Clear the flag by writing 1
+        TASK_PostEvent(TASK_EVENT_FLASH_DONE);
+    }
+}
+
 /**
  * Handlers for USB
  * One interrupt handler, but many sources are activated:
@@ -57,7 +57,7 @@ void LIVE_Init(uint32_t calling_freq) {
     live_packet_buffer_pos = 0;
 }
 
-void LIVE_AssemblePacket(Main_Variables* mvar) {
+void CCMRAM_FUNC LIVE_AssemblePacket(Main_Variables* mvar) {
     float temp_data;
 
     if (live_data_on && (lconf.Num_Outputs > 0)) {
@@ -97,7 +97,7 @@ void LIVE_AssemblePacket(Main_Variables* mvar) {
                         temp_data = mvar->Ctrl->ThrottleCommand;
                         break;
                     case LIVE_CHOICE_HALLANGLE:
-                        temp_data = mvar->Obv->RotorAngle;
+                        temp_data = ANGLE_TO_FLOAT(mvar->Obv->RotorAngle);
                         break;
                     case LIVE_CHOICE_HALLSPEED:
                         temp_data = mvar->Obv->RotorSpeed_eHz;
@@ -121,7 +121,7 @@ void LIVE_AssemblePacket(Main_Variables* mvar) {
                         temp_data = mvar->Foc->Iq_PID->Out;
                         break;
                     case LIVE_CHOICE_ERRORCODE:
-                        temp_data = 0.0f;
+                        temp_data = (float)(mvar->Obv->FaultCode);
                         break;
                     default:
                         temp_data = 0.0f;
@@ -134,6 +134,7 @@ void LIVE_AssemblePacket(Main_Variables* mvar) {
                 if (data_packet_create(&live_packet, CONTROLLER_STREAM_DATA, live_data_buffer,
                     sizeof(uint32_t) + lconf.Num_Outputs * sizeof(float))) {
                     live_packet_buffer_pos = live_packet.TxLength;
+                    TASK_PostEvent(TASK_EVENT_LIVE_READY);
                 } else {
                     live_packet_buffer_pos = 0;
                 }
@@ -37,20 +37,30 @@ uint16_t VirtAddVarTab[TOTAL_EE_VARS];
 uint32_t DBG_Flags=0;
 uint8_t DBG_Usb_Buffer[DBG_USB_BUF_LEN];
 
-float DBG_RampAngle;
-float DBG_RampIncrement;
-
-Main_Variables Mvar;
-Motor_Controls Mctrl;
-Motor_Observations Mobv;
-Motor_PWMDuties Mpwm;
-FOC_StateVariables Mfoc;
-PID_Type Mpid_Id;
-PID_Type Mpid_Iq;
+Angle_Type DBG_RampAngle;
+Angle_Type DBG_RampIncrement;
+
+Main_Variables Mvar CCMRAM_BSS;
+Motor_Controls Mctrl CCMRAM_BSS;
+Motor_Observations Mobv CCMRAM_BSS;
+Motor_PWMDuties Mpwm CCMRAM_BSS;
+FOC_StateVariables Mfoc CCMRAM_BSS;
+PID_Type Mpid_Id CCMRAM_BSS;
+PID_Type Mpid_Iq CCMRAM_BSS;
+volatile uint8_t Mpid_GainsPending CCMRAM_BSS;
+// Gains written over the data interface, held until they're all in
+static PID_Type Mpid_Staged;
+
+Config_Main config_main;
 
 static void MAIN_InitializeClocks(void);
 static void MAIN_CheckBootloader(void);
-static void MAIN_StartAppTimer(void);
+static void MAIN_CurrentLoop(float sin, float cos);
+static void MAIN_CalcMotorConstants(void);
+static void MAIN_SaveMotorModel(void);
+static void MAIN_CopyGains(PID_Type* pid);
+static void MAIN_ApplyGains(PID_Type* gains);
+static void MAIN_SaveCurrentGains(void);
 
 int main (
         __attribute__((unused)) int argc,
@@ -71,6 +81,10 @@ int main (
 
     // Initialize clock resources, including power regulators and Flash latency.
     MAIN_InitializeClocks();
+    // Time each init step from here on
+    BOOT_Start();
+    // Before anything can leave a watchdog breadcrumb over the old ones
+    WDT_CheckLastReset();
 
     // Set the NVIC priority grouping to the maximum number of preemption levels
     // Setting of PRIGROUP = b011 (0x03) means that the upper 4 bits are group
@@ -82,19 +96,30 @@ int main (
     // Start the systick timer for a simple delay timer
     DelayInit();
 
+    // Power up the parts that need time to settle first. The DRV8353
+    // wakes up, and the ADCs calibrate and measure Vrefint, while the
+    // EEPROM loads.
+    DRV8353_PowerUp();
+    ADC_PowerUp();
+
     // Start up the EEPROM emulation
     EE_Config_Addr_Table(VirtAddVarTab);
     EE_Init(VirtAddVarTab);
+    MAIN_LoadVariables();
+    BOOT_Mark(Boot_Eeprom);
 
     // Initialize peripherals
     ADC_Init();
+    BOOT_Mark(Boot_Adc);
     CORDIC_Init();
     CRC_Init();
     DRV8353_Init();
+    BOOT_Mark(Boot_Drv);
     PWM_Init(DFLT_FOC_PWM_FREQ);
     UART_Init();
     USB_Init();
     THROTTLE_Init();
+    PAS_Init();
     HALL_Init(DFLT_FOC_PWM_FREQ);
 
     // Enable the USB CRC class
@@ -102,6 +127,7 @@ int main (
     USB_Start();
 
     USB_Data_Comm_Init();
+    BOOT_Mark(Boot_Peripherals);
 
     // LED init
     GPIO_Clk(LED_PORT);
@@ -119,8 +145,12 @@ int main (
     // Initialize a ramp
     DBG_RampIncrement = FOC_RampCtrl(20000.0f, 25.0f); // Called at 20kHz, 25Hz wave.
 
-    // Start the app timer
-    MAIN_StartAppTimer();
+    // Current is allowed in slowly once the limits have settled
+    DERATE_Init();
+
+    // Start the rate group scheduler. Slower loops are released every few
+    // PWM cycles from the motor control interrupt.
+    SCHED_Init(DFLT_FOC_PWM_FREQ);
 
     LIVE_Init(20000); // Live data streaming will be called at 20kHz
 
@@ -132,63 +162,161 @@ int main (
     Mvar.Pwm = &Mpwm;
     Mfoc.Id_PID = &Mpid_Id;
     Mfoc.Iq_PID = &Mpid_Iq;
+    FOC_PIDdefaults(&Mpid_Id);
+    FOC_PIDdefaults(&Mpid_Iq);
+    // Saved gains go in on the first PWM cycle
+    Mpid_GainsPending = 1;
+    IBATT_Init();
+    FAULT_Init();
+    SPEED_Init();
+    REGEN_Init();
+    BLDC_Init();
+    MOTID_Init();
+    COG_Init();
+    DASH_Init();
+    config_main.ControlMethod = Control_Debug;
+    // Find the end of the event log, and log this reset
+    ELOG_Init();
+    // Needs the event log, to log a firmware update that rolled back
+    FWUP_Init();
+
+    // Main loop tasks. The watchdog supervisor is added by TASK_Init.
+    TASK_Init();
+    uint8_t tasks[] = {
+        TASK_Register(USB_Data_Comm_OneByte_Check, TASK_EVENT_USB_RX, MAIN_USB_POLL_US),
+        TASK_Register(LIVE_SendPacket, TASK_EVENT_LIVE_READY, 0), // Will only send when ready to do so
+        TASK_Register(ELOG_Drain, TASK_EVENT_FLASH_DONE, ELOG_DRAIN_PERIOD_US),
+        TASK_Register(DRV8353_Poll, 0, DRV_POLL_PERIOD_US),
+        TASK_Register(MAIN_SaveMotorModel, TASK_EVENT_MOTOR_ID, 0),
+        TASK_Register(MAIN_SaveCurrentGains, TASK_EVENT_CURRENT_GAINS, 0),
+        TASK_Register(COG_SaveTask, TASK_EVENT_FLASH_DONE, COG_SAVE_PERIOD_US),
+        TASK_Register(FWUP_Task, TASK_EVENT_FLASH_DONE, FWUP_TASK_PERIOD_US)
+    };
+    // A full table is a build mistake (TASK_MAX_TASKS), so make it show up in the log
+    uint32_t tasks_lost = 0;
+    for(uint8_t i = 0; i < (sizeof(tasks) / sizeof(tasks[0])); i++) {
+        if(tasks[i] == TASK_INVALID) {
+            tasks_lost++;
+        }
+    }
+    if(tasks_lost != 0) {
+        ELOG_Record(ELOG_EVENT_TASKS_LOST, tasks_lost);
+    }
+    BOOT_Mark(Boot_Control);
 
     // Start the watchdog
     WDT_Init();
+    BOOT_Mark(Boot_Ready);
     // Infinite loop, never return.
     while (1)
     {
-        WDT_Feed();
-
-        USB_Data_Comm_OneByte_Check();
-        LIVE_SendPacket(); // Will only send when ready to do so
+        SCHED_Begin(Sched_Background);
+        TASK_Run();
+        SCHED_End(Sched_Background);
     }
 }
 
-// Called at 1kHz
-void MAIN_AppTimerISR(void) {
+// Called at 100Hz
+void MAIN_HousekeepingISR(void) {
     static uint16_t led_timer = 0;
+    Main_Snapshot snap;
+
+    WDT_CheckIn(Wdt_HousekeepingISR);
+
+    // Temperatures change slowly, no need to do the math any faster
+    Mobv.FetTempDegC = ADC_GetFetTempDegC();
+    Mobv.MotorTempDegC = ADC_GetMotorTempDegC();
+
+    // Dashboard data, ready for whenever it's asked for
+    SNAP_Get(&snap);
+    DASH_Update(&config_main, &snap, IBATT_GetFilteredCurrent(), FAULT_GetActive());
+
     led_timer++;
-    if(led_timer == 500) {
+    if(led_timer == 50) {
         GPIO_Low(LED_PORT, GLED_PIN);
     }
-    if(led_timer >= 1000) {
+    if(led_timer >= 100) {
         GPIO_High(LED_PORT, GLED_PIN);
         led_timer = 0;
     }
+    // Fixed rate, so this is where the window watchdog is refreshed
+    WDT_RefreshWindow();
+    WDT_CheckOut(Wdt_HousekeepingISR);
+}
+
+// Called at 2kHz
+void MAIN_SpeedISR(void) {
+    static uint8_t throttle_timer = 0;
+    float alpha, beta, phase_current, regen, request;
+    Main_Snapshot snap;
+
+    WDT_CheckIn(Wdt_SpeedISR);
+
+    // Motor state from the latest PWM cycle, all from the same cycle
+    SNAP_Get(&snap);
 
     // Slow ADC conversions
     ADC_RegSeqComplete();
-
-    // PWM output
-    if((DBG_Flags & DBG_FLAG_PWM_ENABLE) != 0 ) {
-        PWM_TIM->BDTR |= TIM_BDTR_MOE;
-    } else {
-        PWM_TIM->BDTR &= ~(TIM_BDTR_MOE);
-    }
+    Mctrl.BusVoltage = ADC_GetVbus();
+
+    // Current limit from all the derating sources
+    FOC_Clarke(snap.Obv.iA, snap.Obv.iB, &alpha, &beta);
+    phase_current = sqrtf(alpha * alpha + beta * beta);
+    DASH_AddCurrentSample(phase_current);
+    DERATE_Process(&config_main, Mctrl.BusVoltage, snap.Obv.FetTempDegC,
+            snap.Obv.MotorTempDegC, phase_current, IBATT_GetFilteredCurrent());
+    // Signals saved with each event log record
+    ELOG_UpdateSignals(snap.Timestamp, Mctrl.BusVoltage, phase_current,
+            snap.Obv.RotorSpeed_eHz, snap.Obv.FetTempDegC);
 
     // Throttle processing
-    THROTTLE_Process();
-    Mctrl.ThrottleCommand = THROTTLE_GetCommand();
+    // The throttle filter and rise rate are set up for 1kHz
+    throttle_timer++;
+    if(throttle_timer >= MAIN_THROTTLE_DIVIDER) {
+        throttle_timer = 0;
+        if(PAS_IsEnabled() == 0) {
+            THROTTLE_Process();
+        }
+        PAS_Process();
+    }
+    // A pedal sensor takes the place of the throttle
+    request = (PAS_IsEnabled() != 0) ? PAS_GetCommand() : THROTTLE_GetCommand();
+    // Torque command, either straight from the request or from the speed loop
+    Mctrl.ThrottleCommand = SPEED_Process(&config_main, request,
+            snap.Obv.RotorSpeed_eHz, IBATT_IsLimiting());
+    // Brake overrides everything. Negative commands are regen, derated
+    // for temperature only.
+    regen = REGEN_Process(&config_main, Mctrl.BusVoltage, SPEED_GetSpeedKmh(),
+            IBATT_GetFilteredCurrent(), HALL_GetDirection());
+    if((REGEN_IsBraking() != 0) || (regen > 0.0f)) {
+        Mctrl.ThrottleCommand = -regen;
+    }
+    WDT_CheckOut(Wdt_SpeedISR);
 }
 
 // Called at 20kHz
-void MAIN_MotorISR(void) {
+void CCMRAM_FUNC MAIN_MotorISR(void) {
     float sin, cos;
     uint16_t dac1, dac2;
 
     // Increment timestamp
     Mvar.Timestamp++;
+    WDT_CheckIn(Wdt_MotorISR);
+
+    // New current loop gains go in between PWM cycles, both axes together
+    if(Mpid_GainsPending != 0) {
+        MAIN_CopyGains(&Mpid_Id);
+        MAIN_CopyGains(&Mpid_Iq);
+        Mpid_GainsPending = 0;
+    }
 
     // Increment the ramp angle
     FOC_RampGen(&DBG_RampAngle, DBG_RampIncrement);
     // And the real motor angle
     HALL_IncAngle();
-    Mobv.RotorAngle = HALL_GetAngleF();
+    Mobv.RotorAngle = HALL_GetAngle();
     Mobv.RotorSpeed_eHz = HALL_GetSpeedF();
     Mobv.HallState = HALL_GetState();
-    // Calculate the Sin/Cos using CORDIC
-    CORDIC_CalcSinCos(DBG_RampAngle*2.0f-1.0f, &sin, &cos);
 
     // All injected ADC should be done by now. Read them in.
     ADC_InjSeqComplete();
@@ -196,9 +324,55 @@ void MAIN_MotorISR(void) {
     Mobv.iB = ADC_GetCurrent(ADC_IB);
     Mobv.iC = ADC_GetCurrent(ADC_IC);
 
-    // Make some waves
-    FOC_Ipark(0.75f, 0.0f, sin, cos, &(Mfoc.Clarke_Alpha), &(Mfoc.Clarke_Beta));
-    FOC_SVM((Mfoc.Clarke_Alpha), (Mfoc.Clarke_Beta), &(Mpwm.tA), &(Mpwm.tB), &(Mpwm.tC));
+    // Shut down in this cycle if anything is wrong
+    Mobv.FaultCode = FAULT_Check(&config_main, &Mobv, ADC_GetVbus(), Mvar.Timestamp);
+    // PWM output, never while there's a fault. Only turned on here, so
+    // nothing at a lower priority can race a fault for MOE.
+    if((DBG_Flags & DBG_FLAG_PWM_ENABLE) != 0) {
+        FAULT_MotorON();
+    } else {
+        PWM_MotorOFF();
+    }
+
+    // Six-step hands over to FOC once the Hall angle is good enough,
+    // and takes over again if it stops being good enough
+    if(config_main.ControlMethod == Control_BLDC) {
+        if(BLDC_CheckHandover(&config_main, Mobv.RotorSpeed_eHz, HALL_IsValid()) != 0) {
+            BLDC_Release();
+            config_main.ControlMethod = Control_FOC;
+            DTRACE_RECORD(DTRACE_CH_CONTROL, DTRACE_CTRL_TO_FOC, Mobv.HallState, Mvar.Timestamp);
+        }
+    } else if((config_main.ControlMethod == Control_FOC) && (BLDC_IsEnabled() != 0)
+            && (HALL_IsValid() != ANGLE_VALID)) {
+        BLDC_Fallback();
+        config_main.ControlMethod = Control_BLDC;
+        DTRACE_RECORD(DTRACE_CH_CONTROL, DTRACE_CTRL_TO_BLDC, Mobv.HallState, Mvar.Timestamp);
+    }
+
+    if(MOTID_IsRunning() != 0) {
+        // Identification has the motor to itself until it's done
+        MOTID_Process(&Mvar, &config_main, ((PWM_TIM->BDTR & TIM_BDTR_MOE) != 0) ? 1 : 0);
+    } else if((config_main.ControlMethod == Control_FOC) || (config_main.ControlMethod == Control_BLDC)) {
+        if((config_main.ControlMethod == Control_BLDC) && (HALL_IsValid() != ANGLE_VALID)) {
+            // Not interpolating yet, the middle of the Hall state is the best guess
+            Mobv.RotorAngle = HALL_GetStateMidpoint(Mobv.HallState);
+        }
+        CORDIC_CalcSinCos(Mobv.RotorAngle, &sin, &cos);
+        MAIN_CurrentLoop(sin, cos);
+        COG_Learn(Mobv.RotorAngle, Mobv.HallState, HALL_GetSectorSpeedF(),
+                HALL_GetDirection(), HALL_IsValid());
+    } else {
+        // Make some waves
+        CORDIC_CalcSinCos(DBG_RampAngle + U32_180_DEG, &sin, &cos);
+        FOC_Ipark(0.75f, 0.0f, sin, cos, &(Mfoc.Clarke_Alpha), &(Mfoc.Clarke_Beta));
+    }
+    if(config_main.ControlMethod == Control_BLDC) {
+        // Same q axis voltage, applied as the nearest six-step vector
+        BLDC_Commutate(Mobv.HallState, Mobv.RotorAngle, Mfoc.Vq, &Mpwm);
+    } else {
+        BLDC_Release();
+        FOC_SVM((Mfoc.Clarke_Alpha), (Mfoc.Clarke_Beta), &(Mpwm.tA), &(Mpwm.tB), &(Mpwm.tC));
+    }
     // Show Ta and Tb on the DAC outputs
     dac1 = (uint16_t)(65535.0f*Mpwm.tA);
     dac2 = (uint16_t)(65535.0f*Mpwm.tB);
@@ -207,8 +381,85 @@ void MAIN_MotorISR(void) {
     // Also apply Ta, Tb, and Tc to the PWM outputs
     PWM_SetDutyF(Mpwm.tA, Mpwm.tB, Mpwm.tC);
 
+    // Everything from this cycle, for the slower loops
+    SNAP_Publish(&Mvar);
+
     // Output live data if it's enabled
     LIVE_AssemblePacket(&Mvar);
+    WDT_CheckOut(Wdt_MotorISR);
+}
+
+/**
+ * @brief  Field oriented current loop. Runs the d and q axis PI
+ *         controllers and leaves the voltage vector in Mfoc.Clarke_Alpha
+ *         and Mfoc.Clarke_Beta, ready for SVM. In six-step mode the d
+ *         axis is held at zero and Mfoc.Vq sets the duty cycle.
+ * @param  sin - Sine of the rotor angle
+ * @param  cos - Cosine of the rotor angle
+ * @retval None
+ */
+static void CCMRAM_FUNC MAIN_CurrentLoop(float sin, float cos) {
+    float iq_ref, w, volts_to_duty, vd_ff, vq_ff, vmax;
+
+    // Measured currents into the rotor frame
+    FOC_Clarke(Mobv.iA, Mobv.iB, &(Mfoc.Clarke_Alpha), &(Mfoc.Clarke_Beta));
+    FOC_Park(Mfoc.Clarke_Alpha, Mfoc.Clarke_Beta, sin, cos, &(Mfoc.Park_D), &(Mfoc.Park_Q));
+
+    // Battery current, using the voltages applied during this cycle
+    IBATT_Estimate(Mfoc.Vd, Mfoc.Vq, Mfoc.Park_D, Mfoc.Park_Q);
+
+    if((PWM_TIM->BDTR & TIM_BDTR_MOE) == 0) {
+        // Outputs are off, don't let the integrators wind up
+        FOC_PIDreset(&Mpid_Id);
+        FOC_PIDreset(&Mpid_Iq);
+    }
+
+    // Throttle is already scaled down by the derating engine.
+    // Clip it some more if the battery can't supply it, or take it.
+    if(Mctrl.ThrottleCommand >= 0.0f) {
+        iq_ref = Mctrl.ThrottleCommand * config_main.MaxPhaseCurrent;
+    } else {
+        iq_ref = Mctrl.ThrottleCommand * config_main.MaxPhaseRegenCurrent;
+    }
+    if(Mctrl.ThrottleCommand != 0.0f) {
+        // Cancel the cogging torque, but don't push a motor that's meant to be idle
+        iq_ref += COG_GetOffset(Mobv.RotorAngle);
+    }
+    iq_ref = IBATT_LimitIq(&config_main, iq_ref, Mfoc.Vd, Mfoc.Vq,
+            Mfoc.Park_D, Mfoc.Park_Q);
+
+    // Cross coupling between the axes and back EMF, from the motor model.
+    // All zero until the motor has been identified.
+    w = 2.0f * PI * Mobv.RotorSpeed_eHz;
+    if(HALL_GetDirection() == HALL_ROT_REVERSE) {
+        w = -w;
+    }
+    volts_to_duty = (Mctrl.BusVoltage > 1.0f) ? (1.0f / (INV_SQRT3 * Mctrl.BusVoltage)) : 0.0f;
+    vd_ff = -w * config_main.MotorLq * Mfoc.Park_Q * volts_to_duty;
+    vq_ff = w * (config_main.MotorLd * Mfoc.Park_D + config_main.MotorFluxLinkage) * volts_to_duty;
+
+    // Limits are shifted by the feedforward, so the total stays in range
+    // and the integrators know when it doesn't
+    if(config_main.ControlMethod == Control_BLDC) {
+        // Six-step only sets the length of the voltage vector, not its angle
+        FOC_PIDreset(&Mpid_Id);
+        Mfoc.Vd = 0.0f;
+    } else {
+        Mpid_Id.OutMax = 1.0f - vd_ff;
+        Mpid_Id.OutMin = -1.0f - vd_ff;
+        Mpid_Id.Err = 0.0f - Mfoc.Park_D;
+        FOC_PIcalc(&Mpid_Id);
+        Mfoc.Vd = Mpid_Id.Out + vd_ff;
+    }
+    // Whatever voltage is left after Vd goes to Vq
+    vmax = sqrtf(1.0f - Mfoc.Vd * Mfoc.Vd);
+    Mpid_Iq.OutMax = vmax - vq_ff;
+    Mpid_Iq.OutMin = -vmax - vq_ff;
+    Mpid_Iq.Err = iq_ref - Mfoc.Park_Q;
+    FOC_PIcalc(&Mpid_Iq);
+    Mfoc.Vq = Mpid_Iq.Out + vq_ff;
+
+    FOC_Ipark(Mfoc.Vd, Mfoc.Vq, sin, cos, &(Mfoc.Clarke_Alpha), &(Mfoc.Clarke_Beta));
 }
 
 
@@ -330,23 +581,6 @@ static void MAIN_CheckBootloader(void) {
     }
 }
 
-/**
- * @brief  Initializes a 1kHz application timer and enables its interrupt.
- * @retval None
- */
-static void MAIN_StartAppTimer(void) {
-    RCC->APB1ENR1 |= RCC_APB1ENR1_TIM6EN;
-    APP_TIM->PSC = (APP_CLK / 1000000u) - 1; // Clocked at 1MHz, 170MHz is too fast for a 1kHz update with a 16-bit register
-    APP_TIM->ARR = (1000000u / APP_TIM_RATE) - 1;
-    APP_TIM->DIER = TIM_DIER_UIE; // Enable update interrupt
-
-    NVIC_SetPriority(APP_IRQn, PRIO_APPTIMER);
-    NVIC_EnableIRQ(APP_IRQn);
-
-    APP_TIM->CR1 = TIM_CR1_CEN; // Enable counting
-}
-
-
 void MAIN_GoToBootloader(void) {
     // Enable access to backup registers
     RCC->APB1ENR1 |= RCC_APB1ENR1_PWREN; // Enable power control
@@ -373,41 +607,525 @@ uint8_t MAIN_DisableDebugPWM(void) {
     return RETVAL_OK;
 }
 
+uint8_t MAIN_EnableFOC(void) {
+    BLDC_Disable();
+    FOC_PIDreset(&Mpid_Id);
+    FOC_PIDreset(&Mpid_Iq);
+    config_main.ControlMethod = Control_FOC;
+    return RETVAL_OK;
+}
+
+uint8_t MAIN_DisableFOC(void) {
+    BLDC_Disable();
+    config_main.ControlMethod = Control_Debug;
+    return RETVAL_OK;
+}
+
+uint8_t MAIN_RequestBLDC(void) {
+    if((config_main.ControlMethod != Control_FOC) && (config_main.ControlMethod != Control_BLDC)) {
+        // Coming from debug waves, start from zero torque
+        FOC_PIDreset(&Mpid_Id);
+        FOC_PIDreset(&Mpid_Iq);
+        config_main.ControlMethod = Control_BLDC;
+    }
+    // Already in FOC, the motor ISR falls back to six-step when needed
+    return BLDC_Enable();
+}
+
+uint8_t MAIN_RequestFOC(void) {
+    // Stays in six-step until the next handover, then no more fallbacks
+    BLDC_Disable();
+    return RETVAL_OK;
+}
+
+uint8_t MAIN_IdentifyMotor(float test_current) {
+    // Needs the outputs on, and no more current than the motor is allowed
+    if((MOTID_IsRunning() != 0) || ((DBG_Flags & DBG_FLAG_PWM_ENABLE) == 0)
+            || (FAULT_GetActive() != 0) || (test_current > config_main.MaxPhaseCurrent)) {
+        return RETVAL_FAIL;
+    }
+    // Back to FOC afterwards, at whatever the throttle asks for
+    MAIN_EnableFOC();
+    return MOTID_Start(test_current);
+}
+
 uint8_t MAIN_GetDashboardData(uint8_t* data) {
-    // Param1: F32: Throttle position (%)
-    // Param2: F32: Speed (rpm)
-    // Param3: F32: Phase Amps
-    // Param4: F32: Battery Amps
-    // Param5: F32: Battery Volts
-    // Param6: F32: Controller FET Temperature (degC)
-    // Param7: F32: Motor Temperature (degC)
-    // Param8: I32: Fault Code
-
-    // MPH = eHz * wheel circ *3600 / polepairs
-    // RPM = eHz * 60 / polepairs
-//    float rpm_conversion = 60.0f * config_main.inv_pole_pairs;
-
-//    data_packet_pack_float(data, Mctrl.ThrottleCommand);
-    data_packet_pack_float(data, 0.0f);
-    data+=4;
-//    data_packet_pack_float(data, rpm_conversion*HallSensor_Get_Speedf());
-    data_packet_pack_float(data, 0.0f);
-    data+=4;
-//    data_packet_pack_float(data, Mpc.PhaseCurrent);
-    data_packet_pack_float(data, 0.0f);
-    data+=4;
-//    data_packet_pack_float(data, Mpc.BatteryCurrent);
-    data_packet_pack_float(data, 0.0f);
-    data+=4;
-    data_packet_pack_float(data, ADC_GetVbus());
-    data+=4;
-    data_packet_pack_float(data, ADC_GetFetTempDegC());
-    data+=4;
-//    data_packet_pack_float(data, g_MotorTemp);
-    data_packet_pack_float(data, 0.0f);
-    data+=4;
-//    data_packet_pack_32b(data, g_errorCode);
-    data_packet_pack_32b(data, 0);
+    // Kept up to date by the housekeeping loop, see DASHBOARD_DATA_LENGTH
+    // for the format
+    DASH_GetData(data);
+    return RETVAL_OK;
+}
+
+uint8_t MAIN_SetLimit(Main_Limit_Type limit, float value) {
+    // Soft limits have to come before hard limits, or the derating
+    // ramp would run backwards. Set them in the right order when
+    // moving both.
+    switch(limit) {
+    case Main_Limit_PhaseCurrent:
+        if((value <= 0.0f) || (value > config_main.CurrentFault)) {
+            return RETVAL_FAIL;
+        }
+        config_main.MaxPhaseCurrent = value;
+        config_main.inv_max_phase_current = 1.0f / value;
+        break;
+    case Main_Limit_PhaseRegenCurrent:
+        if(value < 0.0f) {
+            return RETVAL_FAIL;
+        }
+        config_main.MaxPhaseRegenCurrent = value;
+        break;
+    case Main_Limit_BattCurrent:
+        if(value <= 0.0f) {
+            return RETVAL_FAIL;
+        }
+        config_main.MaxBatteryCurrent = value;
+        break;
+    case Main_Limit_BattRegenCurrent:
+        if(value < 0.0f) {
+            return RETVAL_FAIL;
+        }
+        config_main.MaxBatteryRegenCurrent = value;
+        break;
+    case Main_Limit_SoftVoltage:
+        if(value < config_main.VoltageHardCap) {
+            return RETVAL_FAIL;
+        }
+        config_main.VoltageSoftCap = value;
+        break;
+    case Main_Limit_HardVoltage:
+        if((value < 0.0f) || (value > config_main.VoltageSoftCap)) {
+            return RETVAL_FAIL;
+        }
+        config_main.VoltageHardCap = value;
+        break;
+    case Main_Limit_SoftFetTemp:
+        if(value > config_main.FetTempHardCap) {
+            return RETVAL_FAIL;
+        }
+        config_main.FetTempSoftCap = value;
+        break;
+    case Main_Limit_HardFetTemp:
+        if(value < config_main.FetTempSoftCap) {
+            return RETVAL_FAIL;
+        }
+        config_main.FetTempHardCap = value;
+        break;
+    case Main_Limit_SoftMotorTemp:
+        if(value > config_main.MotorTempHardCap) {
+            return RETVAL_FAIL;
+        }
+        config_main.MotorTempSoftCap = value;
+        break;
+    case Main_Limit_HardMotorTemp:
+        if(value < config_main.MotorTempSoftCap) {
+            return RETVAL_FAIL;
+        }
+        config_main.MotorTempHardCap = value;
+        break;
+    case Main_Limit_MinVoltFault:
+        if((value < 0.0f) || (value > config_main.MaxVoltFault)) {
+            return RETVAL_FAIL;
+        }
+        config_main.MinVoltFault = value;
+        break;
+    case Main_Limit_MaxVoltFault:
+        if(value < config_main.MinVoltFault) {
+            return RETVAL_FAIL;
+        }
+        config_main.MaxVoltFault = value;
+        break;
+    case Main_Limit_CurrentFault:
+        if(value < config_main.MaxPhaseCurrent) {
+            return RETVAL_FAIL;
+        }
+        config_main.CurrentFault = value;
+        break;
+    default:
+        return RETVAL_FAIL;
+    }
+    return RETVAL_OK;
+}
+
+float MAIN_GetLimit(Main_Limit_Type limit) {
+    switch(limit) {
+    case Main_Limit_PhaseCurrent:
+        return config_main.MaxPhaseCurrent;
+    case Main_Limit_PhaseRegenCurrent:
+        return config_main.MaxPhaseRegenCurrent;
+    case Main_Limit_BattCurrent:
+        return config_main.MaxBatteryCurrent;
+    case Main_Limit_BattRegenCurrent:
+        return config_main.MaxBatteryRegenCurrent;
+    case Main_Limit_SoftVoltage:
+        return config_main.VoltageSoftCap;
+    case Main_Limit_HardVoltage:
+        return config_main.VoltageHardCap;
+    case Main_Limit_SoftFetTemp:
+        return config_main.FetTempSoftCap;
+    case Main_Limit_HardFetTemp:
+        return config_main.FetTempHardCap;
+    case Main_Limit_SoftMotorTemp:
+        return config_main.MotorTempSoftCap;
+    case Main_Limit_HardMotorTemp:
+        return config_main.MotorTempHardCap;
+    case Main_Limit_MinVoltFault:
+        return config_main.MinVoltFault;
+    case Main_Limit_MaxVoltFault:
+        return config_main.MaxVoltFault;
+    case Main_Limit_CurrentFault:
+        return config_main.CurrentFault;
+    default:
+        return 0.0f;
+    }
+}
+
+uint8_t MAIN_SetPolePairs(uint16_t pole_pairs) {
+    if(pole_pairs == 0) {
+        return RETVAL_FAIL;
+    }
+    config_main.MotorPolePairs = pole_pairs;
+    MAIN_CalcMotorConstants();
+    return RETVAL_OK;
+}
+
+uint16_t MAIN_GetPolePairs(void) {
+    return config_main.MotorPolePairs;
+}
+
+uint8_t MAIN_SetGearRatio(float ratio) {
+    if(ratio <= 0.0f) {
+        return RETVAL_FAIL;
+    }
+    config_main.GearRatio = ratio;
+    return RETVAL_OK;
+}
+
+float MAIN_GetGearRatio(void) {
+    return config_main.GearRatio;
+}
+
+uint8_t MAIN_SetWheelSize(float wheel_mm) {
+    if(wheel_mm <= 0.0f) {
+        return RETVAL_FAIL;
+    }
+    config_main.WheelSizeMM = wheel_mm;
+    return RETVAL_OK;
+}
+
+float MAIN_GetWheelSize(void) {
+    return config_main.WheelSizeMM;
+}
+
+uint8_t MAIN_SetKv(float kv) {
+    if(kv < 0.0f) {
+        return RETVAL_FAIL;
+    }
+    config_main.MotorKv = kv;
+    MAIN_CalcMotorConstants();
+    return RETVAL_OK;
+}
+
+float MAIN_GetKv(void) {
+    return config_main.MotorKv;
+}
+
+uint8_t MAIN_SetMotorModel(uint16_t value_ID, float value) {
+    // Zero is allowed, it means unknown
+    if(value < 0.0f) {
+        return RETVAL_FAIL;
+    }
+    switch(value_ID) {
+    case CONFIG_MOTOR_RESISTANCE:
+        config_main.MotorResistance = value;
+        break;
+    case CONFIG_MOTOR_LD:
+        config_main.MotorLd = value;
+        break;
+    case CONFIG_MOTOR_LQ:
+        config_main.MotorLq = value;
+        break;
+    case CONFIG_MOTOR_FLUX:
+        config_main.MotorFluxLinkage = value;
+        break;
+    default:
+        return RETVAL_FAIL;
+    }
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Stages one of the current loop gains. Nothing changes in the
+ *         running loop until MAIN_CommitCurrentGains, so a set written
+ *         one value at a time never runs half old and half new.
+ * @param  value_ID - CONFIG_FOC_KP, KI, KD or KC
+ * @param  value - New gain, can't be negative
+ * @retval RETVAL_OK if staged, RETVAL_FAIL otherwise
+ */
+uint8_t MAIN_SetCurrentGain(uint16_t value_ID, float value) {
+    if(value < 0.0f) {
+        return RETVAL_FAIL;
+    }
+    switch(value_ID) {
+    case CONFIG_FOC_KP:
+        Mpid_Staged.Kp = value;
+        break;
+    case CONFIG_FOC_KI:
+        Mpid_Staged.Ki = value;
+        break;
+    case CONFIG_FOC_KD:
+        Mpid_Staged.Kd = value;
+        break;
+    case CONFIG_FOC_KC:
+        Mpid_Staged.Kc = value;
+        break;
+    default:
+        return RETVAL_FAIL;
+    }
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Reads back one of the staged current loop gains. These are the
+ *         running gains unless something has been staged since the last
+ *         commit.
+ * @param  value_ID - CONFIG_FOC_KP, KI, KD or KC
+ * @retval The gain, or zero for an unknown ID
+ */
+float MAIN_GetCurrentGain(uint16_t value_ID) {
+    switch(value_ID) {
+    case CONFIG_FOC_KP:
+        return Mpid_Staged.Kp;
+    case CONFIG_FOC_KI:
+        return Mpid_Staged.Ki;
+    case CONFIG_FOC_KD:
+        return Mpid_Staged.Kd;
+    case CONFIG_FOC_KC:
+        return Mpid_Staged.Kc;
+    default:
+        return 0.0f;
+    }
+}
+
+/**
+ * @brief  Applies the staged current loop gains as one set, on the next
+ *         PWM cycle. Not saved to EEPROM, that's left to ROUTINE_SAVE_ALL_EEPROM.
+ * @retval RETVAL_OK
+ */
+uint8_t MAIN_CommitCurrentGains(void) {
+    MAIN_ApplyGains(&Mpid_Staged);
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Sets the current loop gains from the identified motor model,
+ *         for the present bus voltage. Both axes share one set of gains,
+ *         tuned to the average of Ld and Lq. Applied on the next PWM
+ *         cycle, and saved to EEPROM from the main loop.
+ * @param  bandwidth - Closed loop bandwidth (Hz). Zero uses MAIN_CURRENT_BW_DFLT,
+ *         and it's capped at MAIN_CURRENT_BW_MAX.
+ * @retval RETVAL_OK if the gains were changed, RETVAL_FAIL if the motor
+ *         model isn't known or the bus voltage is too low
+ */
+uint8_t MAIN_TuneCurrentLoop(float bandwidth) {
+    PID_Type gains;
+    float vbus = ADC_GetVbus();
+    float l = 0.5f * (config_main.MotorLd + config_main.MotorLq);
+
+    if((config_main.MotorResistance <= 0.0f) || (l <= 0.0f) || (vbus < config_main.MinVoltFault)) {
+        return RETVAL_FAIL;
+    }
+    if(bandwidth <= 0.0f) {
+        bandwidth = MAIN_CURRENT_BW_DFLT;
+    }
+    if(bandwidth > MAIN_CURRENT_BW_MAX) {
+        bandwidth = MAIN_CURRENT_BW_MAX;
+    }
+    // Full scale of the voltage vector is Vbus/sqrt(3) phase volts
+    FOC_PIsynth(&gains, config_main.MotorResistance, l, vbus * INV_SQRT3,
+            (float)DFLT_FOC_PWM_FREQ, bandwidth);
+
+    MAIN_ApplyGains(&gains);
+    // Saving erases a flash page, far too long to wait for in here
+    TASK_PostEvent(TASK_EVENT_CURRENT_GAINS);
+    return RETVAL_OK;
+}
 
+float MAIN_GetMotorModel(uint16_t value_ID) {
+    switch(value_ID) {
+    case CONFIG_MOTOR_RESISTANCE:
+        return config_main.MotorResistance;
+    case CONFIG_MOTOR_LD:
+        return config_main.MotorLd;
+    case CONFIG_MOTOR_LQ:
+        return config_main.MotorLq;
+    case CONFIG_MOTOR_FLUX:
+        return config_main.MotorFluxLinkage;
+    default:
+        return 0.0f;
+    }
+}
+
+uint8_t MAIN_SetCountsToFOC(int32_t counts) {
+    if(counts < 0) {
+        return RETVAL_FAIL;
+    }
+    config_main.CountsToFOC = (uint32_t)counts;
+    return RETVAL_OK;
+}
+
+int32_t MAIN_GetCountsToFOC(void) {
+    return (int32_t)config_main.CountsToFOC;
+}
+
+uint8_t MAIN_SetSpeedToFOC(float speed) {
+    if(speed < 0.0f) {
+        return RETVAL_FAIL;
+    }
+    config_main.SpeedToFOC = speed;
     return RETVAL_OK;
 }
+
+float MAIN_GetSpeedToFOC(void) {
+    return config_main.SpeedToFOC;
+}
+
+uint8_t MAIN_SetSwitchEpsilon(float eps) {
+    // Six-step vectors are 1/6 apart, so the error is never more than 1/12
+    if((eps <= 0.0f) || (eps > (1.0f / 12.0f))) {
+        return RETVAL_FAIL;
+    }
+    config_main.SwitchEpsilon = eps;
+    return RETVAL_OK;
+}
+
+float MAIN_GetSwitchEpsilon(void) {
+    return config_main.SwitchEpsilon;
+}
+
+void MAIN_SaveVariables(void) {
+    EE_SaveInt16(CONFIG_MOTOR_POLEPAIRS, (int16_t)config_main.MotorPolePairs);
+    EE_SaveFloat(CONFIG_MOTOR_GEAR_RATIO, config_main.GearRatio);
+    EE_SaveFloat(CONFIG_MOTOR_WHEEL_SIZE, config_main.WheelSizeMM);
+    EE_SaveFloat(CONFIG_MOTOR_KV, config_main.MotorKv);
+    MAIN_SaveMotorModel();
+    MAIN_SaveCurrentGains();
+    EE_SaveFloat(CONFIG_LMT_VOLT_FAULT_MIN, config_main.MinVoltFault);
+    EE_SaveFloat(CONFIG_LMT_VOLT_FAULT_MAX, config_main.MaxVoltFault);
+    EE_SaveFloat(CONFIG_LMT_CUR_FAULT_MAX, config_main.CurrentFault);
+    EE_SaveFloat(CONFIG_LMT_VOLT_SOFTCAP, config_main.VoltageSoftCap);
+    EE_SaveFloat(CONFIG_LMT_VOLT_HARDCAP, config_main.VoltageHardCap);
+    EE_SaveFloat(CONFIG_LMT_PHASE_CUR_MAX, config_main.MaxPhaseCurrent);
+    EE_SaveFloat(CONFIG_LMT_PHASE_REGEN_MAX, config_main.MaxPhaseRegenCurrent);
+    EE_SaveFloat(CONFIG_LMT_BATT_CUR_MAX, config_main.MaxBatteryCurrent);
+    EE_SaveFloat(CONFIG_LMT_BATT_REGEN_MAX, config_main.MaxBatteryRegenCurrent);
+    EE_SaveFloat(CONFIG_LMT_FET_TEMP_SOFTCAP, config_main.FetTempSoftCap);
+    EE_SaveFloat(CONFIG_LMT_FET_TEMP_HARDCAP, config_main.FetTempHardCap);
+    EE_SaveFloat(CONFIG_LMT_MOTOR_TEMP_SOFTCAP, config_main.MotorTempSoftCap);
+    EE_SaveFloat(CONFIG_LMT_MOTOR_TEMP_HARDCAP, config_main.MotorTempHardCap);
+    EE_SaveInt32(CONFIG_MAIN_COUNTS_TO_FOC, (int32_t)config_main.CountsToFOC);
+    EE_SaveFloat(CONFIG_MAIN_SPEED_TO_FOC, config_main.SpeedToFOC);
+    EE_SaveFloat(CONFIG_MAIN_SWITCH_EPS, config_main.SwitchEpsilon);
+}
+
+void MAIN_LoadVariables(void) {
+    config_main.MotorPolePairs = (uint16_t)EE_ReadInt16WithDefault(CONFIG_MOTOR_POLEPAIRS, DFLT_MOTOR_POLEPAIRS);
+    config_main.GearRatio = EE_ReadFloatWithDefault(CONFIG_MOTOR_GEAR_RATIO, DFLT_MOTOR_GEAR_RATIO);
+    config_main.WheelSizeMM = EE_ReadFloatWithDefault(CONFIG_MOTOR_WHEEL_SIZE, DFLT_MOTOR_WHEEL_SIZE);
+    config_main.MotorKv = EE_ReadFloatWithDefault(CONFIG_MOTOR_KV, DFLT_MOTOR_KV);
+    config_main.MotorResistance = EE_ReadFloatWithDefault(CONFIG_MOTOR_RESISTANCE, DFLT_MOTOR_RESISTANCE);
+    config_main.MotorLd = EE_ReadFloatWithDefault(CONFIG_MOTOR_LD, DFLT_MOTOR_LD);
+    config_main.MotorLq = EE_ReadFloatWithDefault(CONFIG_MOTOR_LQ, DFLT_MOTOR_LQ);
+    config_main.MotorFluxLinkage = EE_ReadFloatWithDefault(CONFIG_MOTOR_FLUX, DFLT_MOTOR_FLUX);
+    config_main.CurrentKp = EE_ReadFloatWithDefault(CONFIG_FOC_KP, DFLT_FOC_KP);
+    config_main.CurrentKi = EE_ReadFloatWithDefault(CONFIG_FOC_KI, DFLT_FOC_KI);
+    config_main.CurrentKd = EE_ReadFloatWithDefault(CONFIG_FOC_KD, DFLT_FOC_KD);
+    config_main.CurrentKc = EE_ReadFloatWithDefault(CONFIG_FOC_KC, DFLT_FOC_KC);
+    MAIN_CopyGains(&Mpid_Staged);
+    Mpid_GainsPending = 1;
+    config_main.MinVoltFault = EE_ReadFloatWithDefault(CONFIG_LMT_VOLT_FAULT_MIN, DFLT_LMT_VOLT_FAULT_MIN);
+    config_main.MaxVoltFault = EE_ReadFloatWithDefault(CONFIG_LMT_VOLT_FAULT_MAX, DFLT_LMT_VOLT_FAULT_MAX);
+    config_main.CurrentFault = EE_ReadFloatWithDefault(CONFIG_LMT_CUR_FAULT_MAX, DFLT_LMT_CUR_FAULT_MAX);
+    config_main.VoltageSoftCap = EE_ReadFloatWithDefault(CONFIG_LMT_VOLT_SOFTCAP, DFLT_LMT_VOLT_SOFTCAP);
+    config_main.VoltageHardCap = EE_ReadFloatWithDefault(CONFIG_LMT_VOLT_HARDCAP, DFLT_LMT_VOLT_HARDCAP);
+    config_main.MaxPhaseCurrent = EE_ReadFloatWithDefault(CONFIG_LMT_PHASE_CUR_MAX, DFLT_LMT_PHASE_CUR_MAX);
+    config_main.MaxPhaseRegenCurrent = EE_ReadFloatWithDefault(CONFIG_LMT_PHASE_REGEN_MAX, DFLT_LMT_PHASE_REGEN_MAX);
+    config_main.MaxBatteryCurrent = EE_ReadFloatWithDefault(CONFIG_LMT_BATT_CUR_MAX, DFLT_LMT_BATT_CUR_MAX);
+    config_main.MaxBatteryRegenCurrent = EE_ReadFloatWithDefault(CONFIG_LMT_BATT_REGEN_MAX, DFLT_LMT_BATT_REGEN_MAX);
+    config_main.FetTempSoftCap = EE_ReadFloatWithDefault(CONFIG_LMT_FET_TEMP_SOFTCAP, DFLT_LMT_FET_TEMP_SOFTCAP);
+    config_main.FetTempHardCap = EE_ReadFloatWithDefault(CONFIG_LMT_FET_TEMP_HARDCAP, DFLT_LMT_FET_TEMP_HARDCAP);
+    config_main.MotorTempSoftCap = EE_ReadFloatWithDefault(CONFIG_LMT_MOTOR_TEMP_SOFTCAP, DFLT_LMT_MOTOR_TEMP_SOFTCAP);
+    config_main.MotorTempHardCap = EE_ReadFloatWithDefault(CONFIG_LMT_MOTOR_TEMP_HARDCAP, DFLT_LMT_MOTOR_TEMP_HARDCAP);
+    config_main.CountsToFOC = (uint32_t)EE_ReadInt32WithDefault(CONFIG_MAIN_COUNTS_TO_FOC, DFLT_MAIN_COUNTS_TO_FOC);
+    config_main.SpeedToFOC = EE_ReadFloatWithDefault(CONFIG_MAIN_SPEED_TO_FOC, DFLT_MAIN_SPEED_TO_FOC);
+    config_main.SwitchEpsilon = EE_ReadFloatWithDefault(CONFIG_MAIN_SWITCH_EPS, DFLT_MAIN_SWITCH_EPS);
+    // For convenience
+    config_main.inv_max_phase_current = 1.0f / config_main.MaxPhaseCurrent;
+    MAIN_CalcMotorConstants();
+    // Starts at zero, the derating engine brings it up
+    config_main.throttle_limit_scale = 0.0f;
+    config_main.regen_limit_scale = 0.0f;
+}
+
+static void MAIN_CalcMotorConstants(void) {
+    if(config_main.MotorPolePairs != 0) {
+        config_main.inv_pole_pairs = 1.0f / (float)config_main.MotorPolePairs;
+    } else {
+        config_main.inv_pole_pairs = 0.0f;
+    }
+    // Volts per electrical Hz = 60 / (pole pairs * Kv). Zero Kv turns off feedforward.
+    if(config_main.MotorKv > 0.0f) {
+        config_main.kv_volts_per_ehz = 60.0f * config_main.inv_pole_pairs / config_main.MotorKv;
+    } else {
+        config_main.kv_volts_per_ehz = 0.0f;
+    }
+}
+
+/**
+ * @brief  Saves the identified motor model. Main loop task, runs when
+ *         motor identification finishes.
+ * @retval None
+ */
+static void MAIN_SaveMotorModel(void) {
+    EE_SaveFloat(CONFIG_MOTOR_RESISTANCE, config_main.MotorResistance);
+    EE_SaveFloat(CONFIG_MOTOR_LD, config_main.MotorLd);
+    EE_SaveFloat(CONFIG_MOTOR_LQ, config_main.MotorLq);
+    EE_SaveFloat(CONFIG_MOTOR_FLUX, config_main.MotorFluxLinkage);
+}
+
+static void CCMRAM_FUNC MAIN_CopyGains(PID_Type* pid) {
+    pid->Kp = config_main.CurrentKp;
+    pid->Ki = config_main.CurrentKi;
+    pid->Kd = config_main.CurrentKd;
+    pid->Kc = config_main.CurrentKc;
+}
+
+/**
+ * @brief  Replaces the running current loop gains with a whole new set.
+ *         The motor ISR is held off until all four are written, then
+ *         picks them up on its next cycle. The staged copy follows along.
+ * @param  gains - New set, only Kp, Ki, Kd and Kc are used
+ * @retval None
+ */
+static void MAIN_ApplyGains(PID_Type* gains) {
+    Mpid_GainsPending = 0;
+    __DMB();
+    config_main.CurrentKp = gains->Kp;
+    config_main.CurrentKi = gains->Ki;
+    config_main.CurrentKd = gains->Kd;
+    config_main.CurrentKc = gains->Kc;
+    __DMB();
+    Mpid_GainsPending = 1;
+    MAIN_CopyGains(&Mpid_Staged);
+}
+
+/**
+ * @brief  Saves the running current loop gains. Main loop task, runs when
+ *         the current loop is retuned.
+ * @retval None
+ */
+static void MAIN_SaveCurrentGains(void) {
+    EE_SaveFloat(CONFIG_FOC_KP, config_main.CurrentKp);
+    EE_SaveFloat(CONFIG_FOC_KI, config_main.CurrentKi);
+    EE_SaveFloat(CONFIG_FOC_KD, config_main.CurrentKd);
+    EE_SaveFloat(CONFIG_FOC_KC, config_main.CurrentKc);
+}
@@ -0,0 +1,349 @@
+/******************************************************************************
+ * Filename: motor_id.c
+ * Description: Motor parameter identification. Runs in the motor ISR and
+ *              takes over the voltage vector until it's done:
+ *               - Align: DC current along phase A ramps up. A free wheel
+ *                 turns so the d axis lines up with it.
+ *               - Resistance: the current loop holds half, then all of
+ *                 the test current. Two points cancel out the dead time
+ *                 voltage error. R = dV / dI.
+ *               - Inductance: the DC voltage is held, and a square wave
+ *                 goes on top of it, first along the d axis, then the q
+ *                 axis. The current ripple along the same axis gives
+ *                 L = V * (T/2) / Ipp.
+ *               - Flux linkage: FOC with a small q axis current spins
+ *                 the motor. Above MOTID_FLUX_SPEED, with Id = 0,
+ *                 lambda = (Vq - R * Iq) / w. A blocked wheel never gets
+ *                 up to speed, so this step times out and the previous
+ *                 flux linkage is kept.
+ *              A rotor that changed Hall state while aligning is free, and
+ *              its d axis is on phase A. Otherwise the wheel may be blocked
+ *              anywhere, so the d axis is the middle of the Hall state. That
+ *              is up to 30 degrees off, which mixes Ld and Lq by up to a
+ *              quarter of the difference between them.
+ *              Results go into the main configuration and are saved to
+ *              EEPROM from the main loop.
+ ******************************************************************************
+
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+#include <math.h>
+
+MotId_Type Motid;
+
+static void MOTID_NextState(MotId_State next);
+static void MOTID_Finish(Main_Variables* mvar, Config_Main* cfg, uint32_t error);
+static void MOTID_StationaryLoop(FOC_StateVariables* foc, float ialpha_ref, float ialpha, float ibeta);
+
+void MOTID_Init(void) {
+    Motid.State = MotId_Idle;
+    Motid.Error = MOTID_ERR_NONE;
+    Motid.Counter = 0;
+    Motid.ElapsedCycles = 0;
+    Motid.Resistance = 0.0f;
+    Motid.Ld = 0.0f;
+    Motid.Lq = 0.0f;
+    Motid.FluxLinkage = 0.0f;
+    Motid.FluxValid = 0;
+    Motid.Aligned = 0;
+}
+
+/**
+ * @brief  Starts the identification. The motor ISR does the rest.
+ * @param  test_current - Phase current used for the measurements (A).
+ *         Zero or less uses MOTID_DEFAULT_CURRENT.
+ * @retval RETVAL_OK if started, RETVAL_FAIL if already running
+ */
+uint8_t MOTID_Start(float test_current) {
+    if(MOTID_IsRunning() != 0) {
+        return RETVAL_FAIL;
+    }
+    if(test_current <= 0.0f) {
+        test_current = MOTID_DEFAULT_CURRENT;
+    }
+    Motid.TestCurrent = test_current;
+    Motid.Error = MOTID_ERR_NONE;
+    Motid.ElapsedCycles = 0;
+    Motid.FluxValid = 0;
+    Motid.Aligned = 0;
+    // State goes last, the motor ISR is looking at it
+    MOTID_NextState(MotId_Align);
+    return RETVAL_OK;
+}
+
+uint8_t CCMRAM_FUNC MOTID_IsRunning(void) {
+    return ((Motid.State != MotId_Idle) && (Motid.State != MotId_Done)
+            && (Motid.State != MotId_Failed)) ? 1 : 0;
+}
+
+/**
+ * @brief  Runs one step of the identification. Call every PWM cycle
+ *         while MOTID_IsRunning, after the currents and rotor angle
+ *         are updated. Leaves the voltage vector in Clarke_Alpha and
+ *         Clarke_Beta, ready for SVM.
+ * @param  mvar - Main variables, for currents, angle, speed, Vbus, and the
+ *         current loop PI controllers
+ * @param  cfg - Main configuration, receives the results
+ * @param  outputs_on - Non-zero if the PWM outputs are enabled
+ * @retval None
+ */
+void MOTID_Process(Main_Variables* mvar, Config_Main* cfg, uint8_t outputs_on) {
+    FOC_StateVariables* foc = mvar->Foc;
+    Motor_Observations* obv = mvar->Obv;
+    // Full scale of the voltage vector, in phase volts
+    float volts_per_unit = mvar->Ctrl->BusVoltage * INV_SQRT3;
+    float ialpha, ibeta, iref, inj, amps, sin, cos;
+    uint32_t phase;
+
+    if(MOTID_IsRunning() == 0) {
+        return;
+    }
+    if(outputs_on == 0) {
+        MOTID_Finish(mvar, cfg, MOTID_ERR_ABORTED);
+        return;
+    }
+    Motid.Counter++;
+    Motid.ElapsedCycles++;
+    FOC_Clarke(obv->iA, obv->iB, &ialpha, &ibeta);
+
+    switch(Motid.State) {
+    case MotId_Align:
+        // Ramp up to the first resistance point so the rotor doesn't jump
+        iref = Motid.TestCurrent * (float)Motid.Counter * (1.0f / (float)MOTID_ALIGN_CYCLES);
+        MOTID_StationaryLoop(foc, 0.5f * iref, ialpha, ibeta);
+        if(Motid.Counter == 1) {
+            Motid.AlignHallState = obv->HallState;
+        } else if(obv->HallState != Motid.AlignHallState) {
+            Motid.Aligned = 1;
+        }
+        if(Motid.Counter >= MOTID_ALIGN_CYCLES) {
+            MOTID_NextState(MotId_Resistance1);
+        }
+        break;
+
+    case MotId_Resistance1:
+    case MotId_Resistance2:
+        iref = (Motid.State == MotId_Resistance1) ? (0.5f * Motid.TestCurrent) : Motid.TestCurrent;
+        MOTID_StationaryLoop(foc, iref, ialpha, ibeta);
+        if(Motid.Counter > MOTID_SETTLE_CYCLES) {
+            Motid.SumVolts += foc->Clarke_Alpha * volts_per_unit;
+            Motid.SumAmps += ialpha;
+            Motid.Samples++;
+        }
+        if(Motid.Counter >= (MOTID_SETTLE_CYCLES + MOTID_AVERAGE_CYCLES)) {
+            amps = Motid.SumAmps / (float)Motid.Samples;
+            if(amps < (MOTID_MIN_CURRENT_RATIO * iref)) {
+                MOTID_Finish(mvar, cfg, MOTID_ERR_NO_CURRENT);
+                break;
+            }
+            if(Motid.State == MotId_Resistance1) {
+                Motid.R1Volts = Motid.SumVolts / (float)Motid.Samples;
+                Motid.R1Amps = amps;
+                MOTID_NextState(MotId_Resistance2);
+            } else {
+                Motid.Resistance = ((Motid.SumVolts / (float)Motid.Samples) - Motid.R1Volts)
+                        / (amps - Motid.R1Amps);
+                if(Motid.Resistance <= 0.0f) {
+                    MOTID_Finish(mvar, cfg, MOTID_ERR_BAD_RESULT);
+                    break;
+                }
+                // Hold this voltage from now on, the current stays put
+                Motid.BiasAlpha = foc->Clarke_Alpha;
+                Motid.BiasBeta = foc->Clarke_Beta;
+                Motid.Injection = MOTID_HF_VOLTS / volts_per_unit;
+                if(Motid.Aligned != 0) {
+                    Motid.AxisSin = 0.0f;
+                    Motid.AxisCos = 1.0f;
+                } else {
+                    CORDIC_CalcSinCos(HALL_GetStateMidpoint(obv->HallState), &(Motid.AxisSin), &(Motid.AxisCos));
+                }
+                MOTID_NextState(MotId_InductanceD);
+            }
+        }
+        break;
+
+    case MotId_InductanceD:
+    case MotId_InductanceQ:
+        phase = (Motid.Counter - 1) % (2 * MOTID_HF_HALF_PERIOD);
+        inj = (phase < MOTID_HF_HALF_PERIOD) ? Motid.Injection : -Motid.Injection;
+        if(Motid.State == MotId_InductanceD) {
+            amps = ialpha * Motid.AxisCos + ibeta * Motid.AxisSin;
+        } else {
+            amps = ibeta * Motid.AxisCos - ialpha * Motid.AxisSin;
+        }
+        if(phase == 0) {
+            // One full period since the last one. The first is a transient, skip it.
+            if(Motid.Counter > (2 * MOTID_HF_HALF_PERIOD)) {
+                Motid.SumAmps += Motid.IMax - Motid.IMin;
+                Motid.Samples++;
+            }
+            Motid.IMin = amps;
+            Motid.IMax = amps;
+        } else {
+            if(amps < Motid.IMin) {
+                Motid.IMin = amps;
+            }
+            if(amps > Motid.IMax) {
+                Motid.IMax = amps;
+            }
+        }
+        if(Motid.State == MotId_InductanceD) {
+            foc->Clarke_Alpha = Motid.BiasAlpha + inj * Motid.AxisCos;
+            foc->Clarke_Beta = Motid.BiasBeta + inj * Motid.AxisSin;
+        } else {
+            foc->Clarke_Alpha = Motid.BiasAlpha - inj * Motid.AxisSin;
+            foc->Clarke_Beta = Motid.BiasBeta + inj * Motid.AxisCos;
+        }
+        if(Motid.Samples >= MOTID_HF_PERIODS) {
+            if(Motid.SumAmps <= 0.0f) {
+                MOTID_Finish(mvar, cfg, MOTID_ERR_BAD_RESULT);
+                break;
+            }
+            // Ripple is V * (T/2) / L, peak to peak
+            amps = Motid.Injection * volts_per_unit * (float)MOTID_HF_HALF_PERIOD
+                    * (float)Motid.Samples / (MOTID_SAMPLING_RATE * Motid.SumAmps);
+            if(Motid.State == MotId_InductanceD) {
+                Motid.Ld = amps;
+                MOTID_NextState(MotId_InductanceQ);
+            } else {
+                Motid.Lq = amps;
+                MOTID_NextState(MotId_Spin);
+                FOC_PIDreset(foc->Id_PID);
+                FOC_PIDreset(foc->Iq_PID);
+            }
+        }
+        break;
+
+    case MotId_Spin:
+        // Plain FOC with Id = 0 on the Hall angle
+        CORDIC_CalcSinCos(obv->RotorAngle, &sin, &cos);
+        FOC_Park(ialpha, ibeta, sin, cos, &(foc->Park_D), &(foc->Park_Q));
+        foc->Id_PID->Err = 0.0f - foc->Park_D;
+        FOC_PIcalc(foc->Id_PID);
+        foc->Iq_PID->Err = (MOTID_SPIN_FRACTION * Motid.TestCurrent) - foc->Park_Q;
+        FOC_PIcalc(foc->Iq_PID);
+        FOC_Ipark(foc->Id_PID->Out, foc->Iq_PID->Out, sin, cos, &(foc->Clarke_Alpha), &(foc->Clarke_Beta));
+
+        if(fabsf(obv->RotorSpeed_eHz) >= MOTID_FLUX_SPEED) {
+            // Back EMF is whatever is left after the resistive drop
+            Motid.SumVolts += fabsf(foc->Iq_PID->Out * volts_per_unit - Motid.Resistance * foc->Park_Q);
+            Motid.SumSpeed += fabsf(obv->RotorSpeed_eHz);
+            Motid.Samples++;
+        }
+        if(Motid.Samples >= MOTID_FLUX_CYCLES) {
+            Motid.FluxLinkage = Motid.SumVolts / (2.0f * PI * Motid.SumSpeed);
+            Motid.FluxValid = 1;
+            MOTID_Finish(mvar, cfg, MOTID_ERR_NONE);
+        } else if(Motid.Counter >= MOTID_SPIN_TIMEOUT_CYCLES) {
+            // Wheel must be blocked. Everything else is still good.
+            MOTID_Finish(mvar, cfg, MOTID_ERR_NONE);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+uint32_t MOTID_GetStatistic(uint16_t value_ID) {
+    switch(value_ID) {
+    case CONFIG_MOTID_STATUS_STATE:
+        return (uint32_t)Motid.State;
+    case CONFIG_MOTID_STATUS_ERROR:
+        return Motid.Error;
+    case CONFIG_MOTID_STATUS_TIME:
+        return (uint32_t)((float)Motid.ElapsedCycles * (1000.0f / MOTID_SAMPLING_RATE));
+    case CONFIG_MOTID_STATUS_FLUX_VALID:
+        return Motid.FluxValid;
+    default:
+        return 0;
+    }
+}
+
+static void MOTID_NextState(MotId_State next) {
+    Motid.Counter = 0;
+    Motid.Samples = 0;
+    Motid.SumVolts = 0.0f;
+    Motid.SumAmps = 0.0f;
+    Motid.SumSpeed = 0.0f;
+    Motid.State = next;
+}
+
+/**
+ * @brief  Ends the identification, leaving zero voltage on the motor.
+ *         On success the results go into the main configuration, and
+ *         the main loop is told to save them.
+ * @param  mvar - Main variables
+ * @param  cfg - Main configuration
+ * @param  error - MOTID_ERR_xxx code
+ * @retval None
+ */
+static void MOTID_Finish(Main_Variables* mvar, Config_Main* cfg, uint32_t error) {
+    mvar->Foc->Clarke_Alpha = 0.0f;
+    mvar->Foc->Clarke_Beta = 0.0f;
+    FOC_PIDreset(mvar->Foc->Id_PID);
+    FOC_PIDreset(mvar->Foc->Iq_PID);
+    mvar->Foc->Id_PID->OutMax = 1.0f;
+    mvar->Foc->Id_PID->OutMin = -1.0f;
+    mvar->Foc->Iq_PID->OutMax = 1.0f;
+    mvar->Foc->Iq_PID->OutMin = -1.0f;
+    Motid.Error = error;
+    if(error != MOTID_ERR_NONE) {
+        DLOG("Motor ID failed in state %lu, error %lu", Motid.State, error);
+        Motid.State = MotId_Failed;
+        return;
+    }
+    DLOG("Motor ID: R %f ohm, Ld %f H, Lq %f H, flux %f Wb", DLOG_Float(Motid.Resistance),
+            DLOG_Float(Motid.Ld), DLOG_Float(Motid.Lq), DLOG_Float(Motid.FluxLinkage));
+    cfg->MotorResistance = Motid.Resistance;
+    cfg->MotorLd = Motid.Ld;
+    cfg->MotorLq = Motid.Lq;
+    if(Motid.FluxValid != 0) {
+        cfg->MotorFluxLinkage = Motid.FluxLinkage;
+    }
+    Motid.State = MotId_Done;
+    TASK_PostEvent(TASK_EVENT_MOTOR_ID);
+}
+
+/**
+ * @brief  Current loop in the stationary frame, for DC currents along
+ *         the alpha axis. Beta is held at zero.
+ * @param  foc - FOC state, the d and q PI controllers are used for alpha and beta
+ * @param  ialpha_ref - Alpha axis current reference (A)
+ * @param  ialpha - Measured alpha current (A)
+ * @param  ibeta - Measured beta current (A)
+ * @retval None
+ */
+static void MOTID_StationaryLoop(FOC_StateVariables* foc, float ialpha_ref, float ialpha, float ibeta) {
+    foc->Id_PID->OutMax = MOTID_MAX_VOLTAGE;
+    foc->Id_PID->OutMin = -MOTID_MAX_VOLTAGE;
+    foc->Iq_PID->OutMax = MOTID_MAX_VOLTAGE;
+    foc->Iq_PID->OutMin = -MOTID_MAX_VOLTAGE;
+    foc->Id_PID->Err = ialpha_ref - ialpha;
+    FOC_PIcalc(foc->Id_PID);
+    foc->Iq_PID->Err = 0.0f - ibeta;
+    FOC_PIcalc(foc->Iq_PID);
+    foc->Clarke_Alpha = foc->Id_PID->Out;
+    foc->Clarke_Beta = foc->Iq_PID->Out;
+}
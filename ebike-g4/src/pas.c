@@ -0,0 +1,441 @@
+/******************************************************************************
+ * Filename: pas.c
+ * Description: Pedal assist. Reads a cadence sensor or a torque sensor on
+ *              the throttle input, and turns pedaling into a torque request
+ *              at the selected assist level.
+ *
+ *              Cadence pulses are captured by the PAS timer in PWM input
+ *              mode. Each rising edge captures the period and resets the
+ *              counter, and the falling edge before it gives the high time,
+ *              so the duty cycle tells which way the cranks are turning.
+ *              If no edge arrives within the timeout, the counter rolls
+ *              over and pedaling has stopped. Between edges, the cadence
+ *              falls off with the time since the last edge, so the assist
+ *              stops as soon as the pedals slow down rather than at the
+ *              timeout.
+ *
+ *              A torque sensor is read through the throttle ADC channel.
+ *
+ *              The assist curve is the same shape for both sensors:
+ *              command = LevelAssist[level] * min(1, input / full scale)
+ *              where the input is cadence or rider torque.
+ ******************************************************************************
+
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include "main.h"
+
+static Config_PAS config_pas;
+static PAS_Type sPas;
+
+static void PAS_ConfigPin(void);
+static void PAS_SetTimeoutTicks(void);
+static void PAS_CadenceProcess(void);
+static void PAS_TorqueProcess(void);
+
+/**
+ * @brief  Sets up the PAS timer and the throttle input pin for whichever
+ *         sensor is configured. Call after ADC_Init, which sets the pin
+ *         to analog.
+ * @retval None
+ */
+void PAS_Init(void) {
+    sPas.Period = 0;
+    sPas.Pulses = 0;
+    sPas.Pedaling = PAS_PEDAL_STOPPED;
+    sPas.Stopped = 1;
+    sPas.Cadence = 0.0f;
+    sPas.Torque = 0.0f;
+    sPas.Command = 0.0f;
+
+    PAS_TIM_CLK_ENABLE();
+    PAS_TIM->CR1 = TIM_CR1_CKD_1 | TIM_CR1_URS; // Only overflows cause an update interrupt
+    PAS_TIM->PSC = (PAS_CLK / PAS_TICK_HZ) - 1;
+    // Channel 1 captures TI1 rising edges (period), channel 2 captures
+    // TI1 falling edges (high time). Filter is fDTS/32, N=8.
+    PAS_TIM->CCMR1 = TIM_CCMR1_CC1S_0 | TIM_CCMR1_CC2S_1
+            | TIM_CCMR1_IC1F_3 | TIM_CCMR1_IC1F_2 | TIM_CCMR1_IC1F_1 | TIM_CCMR1_IC1F_0;
+    PAS_TIM->CCER = TIM_CCER_CC1E | TIM_CCER_CC2E | TIM_CCER_CC2P;
+    PAS_TIM->SMCR = TIM_SMCR_TS_2 | TIM_SMCR_TS_0 | TIM_SMCR_SMS_2; // Reset mode, input is TI1FP1
+    PAS_TIM->EGR |= TIM_EGR_UG; // Latch the prescaler
+    PAS_TIM->SR = 0;
+
+    NVIC_SetPriority(PAS_IRQn, PRIO_PAS);
+    NVIC_EnableIRQ(PAS_IRQn);
+
+    PAS_TIM->DIER = TIM_DIER_CC1IE | TIM_DIER_UIE;
+    PAS_TIM->CR1 |= TIM_CR1_CEN;
+
+    // Sets the timeout and connects the pin
+    PAS_LoadVariables();
+}
+
+/**
+ * @brief  Rising edge of a cadence pulse. Called from the PAS timer interrupt.
+ * @retval None
+ */
+void PAS_CaptureCallback(void) {
+    uint32_t period = PAS_TIM->CCR1;
+    uint32_t high = PAS_TIM->CCR2;
+    uint8_t pedaling;
+
+    if(sPas.Stopped != 0) {
+        // The counter was free running, this period doesn't mean anything
+        sPas.Stopped = 0;
+        sPas.Pulses = 0;
+        return;
+    }
+    pedaling = PAS_PEDAL_FORWARD;
+    if(config_pas.Direction != PAS_DIR_NONE) {
+        if(((2u * high) > period) != (config_pas.Direction == PAS_DIR_HIGH_FORWARD)) {
+            pedaling = PAS_PEDAL_BACKWARD;
+        }
+    }
+    if(pedaling != sPas.Pedaling) {
+        sPas.Pulses = 0;
+        sPas.Pedaling = pedaling;
+    }
+    if(sPas.Pulses < 0xFFu) {
+        sPas.Pulses++;
+    }
+    sPas.Period = period;
+}
+
+/**
+ * @brief  No cadence pulse within the timeout. Called from the PAS timer interrupt.
+ * @retval None
+ */
+void PAS_TimeoutCallback(void) {
+    sPas.Stopped = 1;
+    sPas.Pulses = 0;
+    sPas.Period = 0;
+    sPas.Pedaling = PAS_PEDAL_STOPPED;
+}
+
+/**
+ * @brief  Updates the assist command from the pedal sensor. Runs at 1kHz.
+ * @retval None
+ */
+void PAS_Process(void) {
+    float target = 0.0f;
+    float assist;
+
+    switch(config_pas.InputMode) {
+    case PAS_INPUT_CADENCE:
+        PAS_CadenceProcess();
+        target = sPas.Cadence / config_pas.CadenceFull;
+        break;
+    case PAS_INPUT_TORQUE:
+        PAS_TorqueProcess();
+        if(sPas.Torque > PAS_TORQUE_DEADBAND) {
+            target = sPas.Torque / config_pas.TorqueFull;
+        }
+        break;
+    default:
+        sPas.Command = 0.0f;
+        return;
+    }
+
+    if(config_pas.Level == 0) {
+        target = 0.0f;
+    } else {
+        assist = config_pas.LevelAssist[config_pas.Level - 1];
+        if(target > 1.0f) {
+            target = 1.0f;
+        }
+        target *= assist;
+    }
+    // Ramp up gently, but stop right away
+    if(target > (sPas.Command + PAS_RISE)) {
+        target = sPas.Command + PAS_RISE;
+    }
+    sPas.Command = target;
+}
+
+uint8_t PAS_IsEnabled(void) {
+    return (config_pas.InputMode != PAS_INPUT_THROTTLE) ? 1 : 0;
+}
+
+float PAS_GetCommand(void) {
+    return sPas.Command;
+}
+
+float PAS_GetCadence(void) {
+    return sPas.Cadence;
+}
+
+float PAS_GetTorque(void) {
+    return sPas.Torque;
+}
+
+uint16_t PAS_GetPedaling(void) {
+    return sPas.Pedaling;
+}
+
+/**** Interfacing with UI ****/
+uint8_t PAS_SetInputMode(uint16_t mode) {
+    if(mode <= PAS_INPUT_MAX) {
+        config_pas.InputMode = mode;
+        PAS_ConfigPin();
+        return RETVAL_OK;
+    }
+    return RETVAL_FAIL;
+}
+
+uint16_t PAS_GetInputMode(void) {
+    return config_pas.InputMode;
+}
+
+uint8_t PAS_SetPulsesPerRev(uint16_t pulses) {
+    if((pulses >= PAS_PULSES_MIN) && (pulses <= PAS_PULSES_MAX)) {
+        config_pas.PulsesPerRev = pulses;
+        return RETVAL_OK;
+    }
+    return RETVAL_FAIL;
+}
+
+uint16_t PAS_GetPulsesPerRev(void) {
+    return config_pas.PulsesPerRev;
+}
+
+uint8_t PAS_SetDirection(uint16_t direction) {
+    if(direction <= PAS_DIR_MAX) {
+        config_pas.Direction = direction;
+        return RETVAL_OK;
+    }
+    return RETVAL_FAIL;
+}
+
+uint16_t PAS_GetDirection(void) {
+    return config_pas.Direction;
+}
+
+uint8_t PAS_SetLevel(uint16_t level) {
+    if(level <= PAS_NUM_LEVELS) {
+        config_pas.Level = level;
+        return RETVAL_OK;
+    }
+    return RETVAL_FAIL;
+}
+
+uint16_t PAS_GetLevel(void) {
+    return config_pas.Level;
+}
+
+/**
+ * @brief  Sets one of the floating point assist settings.
+ * @param  value_ID - CONFIG_PAS_xxx
+ * @param  value - New setting
+ * @retval RETVAL_OK if it's in range, RETVAL_FAIL otherwise
+ */
+uint8_t PAS_SetCurve(uint16_t value_ID, float value) {
+    switch(value_ID) {
+    case CONFIG_PAS_TIMEOUT:
+        if((value >= PAS_TIMEOUT_MIN) && (value <= PAS_TIMEOUT_MAX)) {
+            config_pas.Timeout = value;
+            PAS_SetTimeoutTicks();
+            return RETVAL_OK;
+        }
+        break;
+    case CONFIG_PAS_CADENCE_FULL:
+        if(value > 0.0f) {
+            config_pas.CadenceFull = value;
+            return RETVAL_OK;
+        }
+        break;
+    case CONFIG_PAS_TORQUE_ZERO:
+        if((value >= PAS_TORQUE_MIN_VOLTS) && (value <= PAS_TORQUE_MAX_VOLTS)) {
+            config_pas.TorqueZero = value;
+            return RETVAL_OK;
+        }
+        break;
+    case CONFIG_PAS_TORQUE_SCALE:
+        if(value > 0.0f) {
+            config_pas.TorqueScale = value;
+            return RETVAL_OK;
+        }
+        break;
+    case CONFIG_PAS_TORQUE_FULL:
+        if(value > 0.0f) {
+            config_pas.TorqueFull = value;
+            return RETVAL_OK;
+        }
+        break;
+    case CONFIG_PAS_LEVEL1:
+    case CONFIG_PAS_LEVEL2:
+    case CONFIG_PAS_LEVEL3:
+    case CONFIG_PAS_LEVEL4:
+    case CONFIG_PAS_LEVEL5:
+        if((value >= 0.0f) && (value <= PAS_OUTPUT_MAX)) {
+            config_pas.LevelAssist[value_ID - CONFIG_PAS_LEVEL1] = value;
+            return RETVAL_OK;
+        }
+        break;
+    default:
+        break;
+    }
+    return RETVAL_FAIL;
+}
+
+float PAS_GetCurve(uint16_t value_ID) {
+    switch(value_ID) {
+    case CONFIG_PAS_TIMEOUT:
+        return config_pas.Timeout;
+    case CONFIG_PAS_CADENCE_FULL:
+        return config_pas.CadenceFull;
+    case CONFIG_PAS_TORQUE_ZERO:
+        return config_pas.TorqueZero;
+    case CONFIG_PAS_TORQUE_SCALE:
+        return config_pas.TorqueScale;
+    case CONFIG_PAS_TORQUE_FULL:
+        return config_pas.TorqueFull;
+    case CONFIG_PAS_LEVEL1:
+    case CONFIG_PAS_LEVEL2:
+    case CONFIG_PAS_LEVEL3:
+    case CONFIG_PAS_LEVEL4:
+    case CONFIG_PAS_LEVEL5:
+        return config_pas.LevelAssist[value_ID - CONFIG_PAS_LEVEL1];
+    default:
+        return 0.0f;
+    }
+}
+
+void PAS_SaveVariables(void) {
+    EE_SaveInt16(CONFIG_PAS_INPUT_MODE, (int16_t)config_pas.InputMode);
+    EE_SaveInt16(CONFIG_PAS_PULSES, (int16_t)config_pas.PulsesPerRev);
+    EE_SaveInt16(CONFIG_PAS_DIRECTION, (int16_t)config_pas.Direction);
+    EE_SaveInt16(CONFIG_PAS_LEVEL, (int16_t)config_pas.Level);
+    EE_SaveFloat(CONFIG_PAS_TIMEOUT, config_pas.Timeout);
+    EE_SaveFloat(CONFIG_PAS_CADENCE_FULL, config_pas.CadenceFull);
+    EE_SaveFloat(CONFIG_PAS_TORQUE_ZERO, config_pas.TorqueZero);
+    EE_SaveFloat(CONFIG_PAS_TORQUE_SCALE, config_pas.TorqueScale);
+    EE_SaveFloat(CONFIG_PAS_TORQUE_FULL, config_pas.TorqueFull);
+    for(uint16_t i = 0; i < PAS_NUM_LEVELS; i++) {
+        EE_SaveFloat(CONFIG_PAS_LEVEL1 + i, config_pas.LevelAssist[i]);
+    }
+}
+
+void PAS_LoadVariables(void) {
+    const float level_defaults[PAS_NUM_LEVELS] = {
+            DFLT_PAS_LEVEL1, DFLT_PAS_LEVEL2, DFLT_PAS_LEVEL3,
+            DFLT_PAS_LEVEL4, DFLT_PAS_LEVEL5 };
+
+    config_pas.InputMode = (uint16_t)EE_ReadInt16WithDefault(CONFIG_PAS_INPUT_MODE, DFLT_PAS_INPUT_MODE);
+    config_pas.PulsesPerRev = (uint16_t)EE_ReadInt16WithDefault(CONFIG_PAS_PULSES, DFLT_PAS_PULSES);
+    config_pas.Direction = (uint16_t)EE_ReadInt16WithDefault(CONFIG_PAS_DIRECTION, DFLT_PAS_DIRECTION);
+    config_pas.Level = (uint16_t)EE_ReadInt16WithDefault(CONFIG_PAS_LEVEL, DFLT_PAS_LEVEL);
+    config_pas.Timeout = EE_ReadFloatWithDefault(CONFIG_PAS_TIMEOUT, DFLT_PAS_TIMEOUT);
+    config_pas.CadenceFull = EE_ReadFloatWithDefault(CONFIG_PAS_CADENCE_FULL, DFLT_PAS_CADENCE_FULL);
+    config_pas.TorqueZero = EE_ReadFloatWithDefault(CONFIG_PAS_TORQUE_ZERO, DFLT_PAS_TORQUE_ZERO);
+    config_pas.TorqueScale = EE_ReadFloatWithDefault(CONFIG_PAS_TORQUE_SCALE, DFLT_PAS_TORQUE_SCALE);
+    config_pas.TorqueFull = EE_ReadFloatWithDefault(CONFIG_PAS_TORQUE_FULL, DFLT_PAS_TORQUE_FULL);
+    for(uint16_t i = 0; i < PAS_NUM_LEVELS; i++) {
+        config_pas.LevelAssist[i] = EE_ReadFloatWithDefault(CONFIG_PAS_LEVEL1 + i, level_defaults[i]);
+    }
+    // Anything out of range goes back to something safe
+    if(config_pas.InputMode > PAS_INPUT_MAX) {
+        config_pas.InputMode = PAS_INPUT_THROTTLE;
+    }
+    if((config_pas.PulsesPerRev < PAS_PULSES_MIN) || (config_pas.PulsesPerRev > PAS_PULSES_MAX)) {
+        config_pas.PulsesPerRev = DFLT_PAS_PULSES;
+    }
+    if(config_pas.Direction > PAS_DIR_MAX) {
+        config_pas.Direction = DFLT_PAS_DIRECTION;
+    }
+    if(config_pas.Level > PAS_NUM_LEVELS) {
+        config_pas.Level = DFLT_PAS_LEVEL;
+    }
+    if((config_pas.Timeout < PAS_TIMEOUT_MIN) || (config_pas.Timeout > PAS_TIMEOUT_MAX)) {
+        config_pas.Timeout = DFLT_PAS_TIMEOUT;
+    }
+    if(config_pas.CadenceFull <= 0.0f) {
+        config_pas.CadenceFull = DFLT_PAS_CADENCE_FULL;
+    }
+    if(config_pas.TorqueFull <= 0.0f) {
+        config_pas.TorqueFull = DFLT_PAS_TORQUE_FULL;
+    }
+    PAS_SetTimeoutTicks();
+    PAS_ConfigPin();
+}
+
+/**
+ * @brief  Connects the throttle input pin to the PAS timer for a cadence
+ *         sensor, or to the ADC for anything else.
+ * @retval None
+ */
+static void PAS_ConfigPin(void) {
+    if(config_pas.InputMode == PAS_INPUT_CADENCE) {
+        GPIO_AF(PAS_PORT, PAS_PIN, PAS_AF);
+    } else {
+        GPIO_Analog(PAS_PORT, PAS_PIN);
+    }
+    sPas.Stopped = 1;
+    sPas.Pedaling = PAS_PEDAL_STOPPED;
+}
+
+static void PAS_SetTimeoutTicks(void) {
+    PAS_TIM->ARR = (uint32_t)(config_pas.Timeout * ((float)PAS_TICK_HZ));
+}
+
+/**
+ * @brief  Cadence from the latest pulse period. Once the time since the
+ *         last edge is longer than that period, the cadence can't be any
+ *         higher than what the elapsed time gives.
+ * @retval None
+ */
+static void PAS_CadenceProcess(void) {
+    uint32_t period = sPas.Period;
+    uint32_t elapsed = PAS_TIM->CNT;
+    float ticks_per_rev;
+
+    if((sPas.Pedaling != PAS_PEDAL_FORWARD) || (sPas.Pulses < PAS_START_PULSES) || (period == 0)) {
+        sPas.Cadence = 0.0f;
+        return;
+    }
+    if(elapsed > period) {
+        period = elapsed;
+    }
+    ticks_per_rev = ((float)period) * ((float)config_pas.PulsesPerRev);
+    sPas.Cadence = (60.0f * ((float)PAS_TICK_HZ)) / ticks_per_rev;
+}
+
+/**
+ * @brief  Rider torque from the analog torque sensor.
+ * @retval None
+ */
+static void PAS_TorqueProcess(void) {
+    float volts = ADC_GetThrottle() * THROTTLE_GetRatio(); // At the connector
+    float torque;
+
+    if((volts < PAS_TORQUE_MIN_VOLTS) || (volts > PAS_TORQUE_MAX_VOLTS)) {
+        // Broken wire or short, no assist
+        sPas.Torque = 0.0f;
+        return;
+    }
+    torque = (volts - config_pas.TorqueZero) * config_pas.TorqueScale;
+    if(torque < 0.0f) {
+        torque = 0.0f;
+    }
+    sPas.Torque += PAS_TORQUE_FILT * (torque - sPas.Torque);
+}
@@ -168,6 +168,9 @@ void PWM_Init(int32_t freq) {
 
     NVIC_SetPriority(PWM_IRQn, PRIO_PWM); // Highest priority
     NVIC_EnableIRQ(PWM_IRQn);
+    // Gate driver faults shut the outputs off in hardware, this just records it
+    NVIC_SetPriority(PWM_BRK_IRQn, PRIO_PWM_BRK);
+    NVIC_EnableIRQ(PWM_BRK_IRQn);
 
     // For odd values of RCR in center aligned mode, the update is either on overflows
     // or underflows depending on when RCR was written and counter was launched.
@@ -199,19 +202,18 @@ int32_t PWM_GetDeadTime(void) {
 uint8_t PWM_SetFreq(int32_t newFreq) {
     int32_t temp = PWM_CLK;
     int32_t tempcr1;
-    int32_t tempbdtr;
     if((newFreq >= PWM_MIN_FREQ) && (newFreq <= PWM_MAX_FREQ)) {
         temp = temp / newFreq;
         temp = temp / 2;
         temp = temp - 1;
-        tempbdtr = PWM_TIM->BDTR;
         PWM_MotorOFF();
         tempcr1 = PWM_TIM->CR1; // Save current CR1 value
         PWM_TIM->CR1 &= ~TIM_CR1_CEN; // Stop the timer if it's running
         PWM_TIM->ARR = temp;
         PWM_TIM->EGR |= TIM_EGR_UG; // Generate an update event to latch in all the settings
         PWM_TIM->CR1 = tempcr1; // Restart the timer if it was running
-        PWM_TIM->BDTR = tempbdtr; // Turn on outputs if they were on
+        // Outputs stay off. The motor interrupt turns them back on next
+        // cycle if there's no fault, and nothing else may set MOE.
 
         return RETVAL_OK;
     }
@@ -247,7 +249,7 @@ void PWM_SetDuty(uint16_t tA, uint16_t tB, uint16_t tC) {
     PWM_TIM->CCR3 = temp;
 }
 
-void PWM_SetDutyF(float tA, float tB, float tC) {
+void CCMRAM_FUNC PWM_SetDutyF(float tA, float tB, float tC) {
     PWM_TIM->CCR1 = (uint16_t) (tC * PWM_TIM_arr_f);
     PWM_TIM->CCR2 = (uint16_t) (tB * PWM_TIM_arr_f);
     PWM_TIM->CCR3 = (uint16_t) (tA * PWM_TIM_arr_f);
@@ -0,0 +1,142 @@
+/******************************************************************************
+ * Filename: regen.c
+ * Description: Regenerative braking. While the brake is applied, the motor
+ *              is asked for negative torque, ramped up smoothly so the bike
+ *              doesn't lurch. The request is limited by:
+ *               - MaxPhaseRegenCurrent, which sets full scale
+ *               - The thermal part of the derating scale. Undervoltage
+ *                 and discharge current derating don't apply to charging.
+ *               - Bus voltage, fading out before it reaches MaxVoltFault
+ *               - Speed, fading out at low speed
+ *               - Direction, none unless rolling forwards. Negative torque
+ *                 while rolling backwards would drive the wheel backwards.
+ *              The battery charge current limit is held by the battery
+ *              current limiter in the current loop.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+
+Regen_Type Regen;
+
+static float REGEN_Fade(float x, float x_zero, float x_full);
+
+void REGEN_Init(void) {
+    Regen.Brake = 0;
+    Regen.Level = 0.0f;
+    Regen.Command = 0.0f;
+    Regen.RecoveredWh = 0.0f;
+}
+
+/**
+ * @brief  Updates the regen request. Call from the speed rate group.
+ * @param  cfg - Main configuration, for the voltage limit and regen derating scale
+ * @param  vbus - Bus voltage (V)
+ * @param  speed_kmh - Road speed
+ * @param  batt_current - Estimated battery current (A), negative when charging
+ * @param  direction - HALL_ROT_xxx
+ * @retval Regen command, 0 to 1, as a fraction of MaxPhaseRegenCurrent
+ */
+float REGEN_Process(Config_Main* cfg, float vbus, float speed_kmh, float batt_current, uint8_t direction) {
+    float command;
+
+    // Smooth ramp towards the brake request
+    if(Regen.Brake != 0) {
+        Regen.Level += REGEN_RISE_RATE / REGEN_SAMPLING_RATE;
+        if(Regen.Level > 1.0f) {
+            Regen.Level = 1.0f;
+        }
+    } else {
+        Regen.Level -= REGEN_FALL_RATE / REGEN_SAMPLING_RATE;
+        if(Regen.Level < 0.0f) {
+            Regen.Level = 0.0f;
+        }
+    }
+
+    command = Regen.Level * cfg->regen_limit_scale
+            * REGEN_Fade(vbus, cfg->MaxVoltFault - REGEN_VBUS_MARGIN,
+                    cfg->MaxVoltFault - REGEN_VBUS_MARGIN - REGEN_VBUS_FADE)
+            * REGEN_Fade(speed_kmh, REGEN_FADE_LOW_KMH, REGEN_FADE_HIGH_KMH);
+    if(direction != HALL_ROT_FORWARD) {
+        // Speed is unsigned, so rolling backwards on a hill looks the same
+        // as riding forwards. Leave that to the mechanical brake.
+        command = 0.0f;
+    }
+    // Drops immediately, but comes back no faster than the ramp. The bus
+    // voltage answers the charge current within a cycle, so following the
+    // voltage fade straight back up would make it oscillate.
+    if(command > Regen.Command + (REGEN_RISE_RATE / REGEN_SAMPLING_RATE)) {
+        command = Regen.Command + (REGEN_RISE_RATE / REGEN_SAMPLING_RATE);
+    }
+    Regen.Command = command;
+
+    // Keep track of what went back into the battery
+    if(batt_current < 0.0f) {
+        Regen.RecoveredWh -= batt_current * vbus / (REGEN_SAMPLING_RATE * 3600.0f);
+    }
+    return Regen.Command;
+}
+
+/**
+ * @brief  Applies or releases the brake. Applying the brake also
+ *         cancels cruise control.
+ * @param  brake - Non-zero when the brake is applied
+ * @retval RETVAL_OK
+ */
+uint8_t REGEN_SetBrake(uint8_t brake) {
+    Regen.Brake = brake;
+    if(brake != 0) {
+        SPEED_Disengage();
+    }
+    return RETVAL_OK;
+}
+
+uint8_t REGEN_IsBraking(void) {
+    return Regen.Brake;
+}
+
+float REGEN_GetCommand(void) {
+    return Regen.Command;
+}
+
+float REGEN_GetRecoveredWh(void) {
+    return Regen.RecoveredWh;
+}
+
+/**
+ * @brief  Linear fade between two points.
+ * @param  x - Measured value
+ * @param  x_zero - Zero at or beyond this value
+ * @param  x_full - Full scale at or beyond this value
+ * @retval Scale from 0 to 1
+ */
+static float REGEN_Fade(float x, float x_zero, float x_full) {
+    float scale = (x - x_zero) / (x_full - x_zero);
+    if(scale > 1.0f) {
+        scale = 1.0f;
+    }
+    if(scale < 0.0f) {
+        scale = 0.0f;
+    }
+    return scale;
+}
@@ -0,0 +1,229 @@
+/******************************************************************************
+ * Filename: scheduler.c
+ * Description: Multi-rate control scheduler. All control timing is derived
+ *              from the PWM cycle: the current loop runs in the ADC injected
+ *              conversion interrupt, and at the end of each cycle the slower
+ *              rate groups are released by pending their (otherwise unused)
+ *              interrupt vectors in software. The NVIC then runs each group
+ *              at its own preemption level, so the current loop always
+ *              interrupts the speed loop, which always interrupts
+ *              housekeeping, which always interrupts the main loop.
+ *
+ *              Each group is timed with the DWT cycle counter. Time spent in
+ *              higher priority groups is subtracted, so the statistics show
+ *              the true execution time of the group itself. A release that
+ *              finds the previous instance of the group still running is
+ *              skipped and counted as an overrun.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+
+Sched_Stats_Type Sched_Stats[Sched_NumGroups];
+
+// Net cycles used by each group since startup. Only ever written by the
+// group's own context, so lower priority groups can read them without locking.
+static volatile uint32_t sched_busy[Sched_NumGroups];
+// Cycle count and busy totals captured when each group started
+static uint32_t sched_start[Sched_NumGroups];
+static uint32_t sched_busy_start[Sched_NumGroups];
+static volatile uint8_t sched_running[Sched_NumGroups];
+
+static uint32_t sched_tick_cycles;
+static uint32_t sched_late_cycles;
+static uint16_t sched_speed_count;
+static uint16_t sched_housekeeping_count;
+
+static void SCHED_Release(Sched_Group group, IRQn_Type irq);
+
+/**
+ * @brief  Starts the cycle counter, sets the execution budgets for each
+ *         rate group, and enables the software triggered interrupts.
+ * @param  tick_freq - Frequency that SCHED_Tick is called (the PWM frequency)
+ * @retval None
+ */
+void SCHED_Init(uint32_t tick_freq) {
+    // Turn on the DWT cycle counter. It's already running for the boot
+    // profile, so don't reset it.
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    sched_tick_cycles = SystemCoreClock / tick_freq;
+    sched_late_cycles = (sched_tick_cycles * SCHED_LATE_TICK_PCT) / 100u;
+    sched_speed_count = 0;
+    sched_housekeeping_count = 0;
+
+    SCHED_ResetStats();
+    Sched_Stats[Sched_Current].BudgetCycles =
+            (sched_tick_cycles * SCHED_CURRENT_BUDGET_PCT) / 100u;
+    Sched_Stats[Sched_Speed].BudgetCycles =
+            (sched_tick_cycles * SCHED_SPEED_DIVIDER * SCHED_SPEED_BUDGET_PCT) / 100u;
+    Sched_Stats[Sched_Housekeeping].BudgetCycles =
+            (sched_tick_cycles * SCHED_HOUSEKEEPING_DIVIDER * SCHED_HOUSEKEEPING_BUDGET_PCT) / 100u;
+    Sched_Stats[Sched_Background].BudgetCycles =
+            (SystemCoreClock / 1000000u) * SCHED_BACKGROUND_BUDGET_US;
+
+    // The slower groups borrow interrupt vectors from unused timers.
+    // They are only ever triggered by setting the pending bit.
+    NVIC_SetPriority(SCHED_SPEED_IRQn, PRIO_SCHED_SPEED);
+    NVIC_EnableIRQ(SCHED_SPEED_IRQn);
+    NVIC_SetPriority(SCHED_HOUSEKEEPING_IRQn, PRIO_SCHED_HOUSEKEEPING);
+    NVIC_EnableIRQ(SCHED_HOUSEKEEPING_IRQn);
+}
+
+/**
+ * @brief  Advances the scheduler by one PWM cycle and releases any slower
+ *         rate groups that are due. Called at the end of the current loop.
+ * @retval None
+ */
+void CCMRAM_FUNC SCHED_Tick(void) {
+    sched_speed_count++;
+    if(sched_speed_count >= SCHED_SPEED_DIVIDER) {
+        sched_speed_count = 0;
+        SCHED_Release(Sched_Speed, SCHED_SPEED_IRQn);
+    }
+    sched_housekeeping_count++;
+    if(sched_housekeeping_count >= SCHED_HOUSEKEEPING_DIVIDER) {
+        sched_housekeeping_count = 0;
+        SCHED_Release(Sched_Housekeeping, SCHED_HOUSEKEEPING_IRQn);
+    }
+}
+
+/**
+ * @brief  Marks the start of a rate group. Must be paired with SCHED_End
+ *         from the same interrupt level.
+ * @param  group - The rate group that is starting
+ * @retval None
+ */
+void CCMRAM_FUNC SCHED_Begin(Sched_Group group) {
+    uint32_t now = DWT->CYCCNT;
+    if(group == Sched_Current) {
+        // The current loop is triggered by hardware, so it can't be skipped.
+        // Check for a late start instead.
+        if((Sched_Stats[group].Runs != 0) && ((now - sched_start[group]) > sched_late_cycles)) {
+            Sched_Stats[group].Overruns++;
+        }
+    }
+    sched_running[group] = 1;
+    sched_start[group] = now;
+    sched_busy_start[group] = 0;
+    for(uint8_t i = 0; i < group; i++) {
+        sched_busy_start[group] += sched_busy[i];
+    }
+}
+
+/**
+ * @brief  Marks the end of a rate group and updates its statistics.
+ * @param  group - The rate group that has finished
+ * @retval None
+ */
+void CCMRAM_FUNC SCHED_End(Sched_Group group) {
+    uint32_t elapsed = DWT->CYCCNT - sched_start[group];
+    // Remove the time spent in higher priority groups
+    uint32_t preempted = 0;
+    for(uint8_t i = 0; i < group; i++) {
+        preempted += sched_busy[i];
+    }
+    preempted -= sched_busy_start[group];
+    if(preempted < elapsed) {
+        elapsed -= preempted;
+    } else {
+        elapsed = 0;
+    }
+
+    Sched_Stats_Type* stats = &(Sched_Stats[group]);
+    stats->Runs++;
+    stats->LastCycles = elapsed;
+    if(elapsed > stats->MaxCycles) {
+        stats->MaxCycles = elapsed;
+    }
+    if(elapsed > stats->BudgetCycles) {
+        stats->BudgetOverruns++;
+    }
+    sched_busy[group] += elapsed;
+    sched_running[group] = 0;
+}
+
+/**
+ * @brief  Clears the run counters and worst case timing. Budgets are kept.
+ * @retval None
+ */
+void SCHED_ResetStats(void) {
+    for(uint8_t i = 0; i < Sched_NumGroups; i++) {
+        // Briefly hold off interrupts so a group can't finish halfway through
+        __disable_irq();
+        Sched_Stats[i].Runs = 0;
+        Sched_Stats[i].Overruns = 0;
+        Sched_Stats[i].BudgetOverruns = 0;
+        Sched_Stats[i].LastCycles = 0;
+        Sched_Stats[i].MaxCycles = 0;
+        __enable_irq();
+    }
+}
+
+/**
+ * @brief  Gets one scheduler statistic for the data interface.
+ * @param  value_ID - CONFIG_SCHED_xxx ID, plus the rate group number
+ *                    times CONFIG_SCHED_GROUP_OFFSET
+ * @retval The requested statistic, or zero if the ID is invalid
+ */
+uint32_t SCHED_GetStatistic(uint16_t value_ID) {
+    uint16_t group = (value_ID - CONFIG_SCHED_PREFIX) / CONFIG_SCHED_GROUP_OFFSET;
+    uint16_t stat = value_ID - (group * CONFIG_SCHED_GROUP_OFFSET);
+    if(group >= Sched_NumGroups) {
+        return 0;
+    }
+    Sched_Stats_Type* stats = &(Sched_Stats[group]);
+    switch(stat) {
+    case CONFIG_SCHED_RUNS:
+        return stats->Runs;
+    case CONFIG_SCHED_OVERRUNS:
+        return stats->Overruns;
+    case CONFIG_SCHED_BUDGET_OVERRUNS:
+        return stats->BudgetOverruns;
+    case CONFIG_SCHED_LAST_CYCLES:
+        return stats->LastCycles;
+    case CONFIG_SCHED_MAX_CYCLES:
+        return stats->MaxCycles;
+    case CONFIG_SCHED_BUDGET_CYCLES:
+        return stats->BudgetCycles;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief  Releases a software triggered rate group, unless the previous
+ *         release hasn't finished yet.
+ * @param  group - The rate group to release
+ * @param  irq - The interrupt vector that runs the group
+ * @retval None
+ */
+static void CCMRAM_FUNC SCHED_Release(Sched_Group group, IRQn_Type irq) {
+    if((sched_running[group] != 0) || (NVIC_GetPendingIRQ(irq) != 0)) {
+        // Still busy from last time. Skip it rather than letting it pile up.
+        Sched_Stats[group].Overruns++;
+    } else {
+        NVIC_SetPendingIRQ(irq);
+    }
+}
@@ -0,0 +1,81 @@
+/******************************************************************************
+ * Filename: snapshot.c
+ * Description: Motor state from a single PWM cycle, for code outside the
+ *              motor interrupt. The motor interrupt publishes a copy every
+ *              cycle, and readers copy it out again. A sequence count makes
+ *              it a seqlock: the count is odd while a copy is being
+ *              published, and a reader that sees it change tries again.
+ *              The motor interrupt never waits.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+
+// Odd sequence means a copy is in progress
+static Main_Snapshot Msnap CCMRAM_BSS;
+static volatile uint32_t Msnap_Sequence CCMRAM_BSS;
+
+/**
+ * @brief  Publishes this cycle's motor state for SNAP_Get. Call from the
+ *         motor interrupt only, once the cycle's outputs are set.
+ * @param  mvar - The motor state
+ * @retval None
+ */
+void CCMRAM_FUNC SNAP_Publish(Main_Variables* mvar) {
+    Msnap_Sequence++;
+    __DMB();
+    Msnap.Timestamp = mvar->Timestamp;
+    Msnap.Ctrl = *(mvar->Ctrl);
+    Msnap.Obv = *(mvar->Obv);
+    Msnap.Pwm = *(mvar->Pwm);
+    Msnap.Park_D = mvar->Foc->Park_D;
+    Msnap.Park_Q = mvar->Foc->Park_Q;
+    Msnap.Vd = mvar->Foc->Vd;
+    Msnap.Vq = mvar->Foc->Vq;
+    __DMB();
+    Msnap_Sequence++;
+}
+
+/**
+ * @brief  Copies the motor state published by the motor interrupt. All of
+ *         it comes from the same PWM cycle. If the interrupt publishes a
+ *         new one partway through the copy, the copy is done again.
+ *
+ *         Only call from code that the motor interrupt can preempt (the
+ *         speed and housekeeping loops, and the main loop). Anything that
+ *         preempts the motor interrupt would wait forever on a copy it
+ *         interrupted.
+ * @param  snap - Filled in with the latest motor state
+ * @retval Number of snapshots published since startup
+ */
+uint32_t SNAP_Get(Main_Snapshot* snap) {
+    uint32_t sequence;
+
+    do {
+        sequence = Msnap_Sequence;
+        __DMB();
+        *snap = Msnap;
+        __DMB();
+    } while(((sequence & 1u) != 0) || (sequence != Msnap_Sequence));
+    return (sequence >> 1);
+}
@@ -0,0 +1,182 @@
+/******************************************************************************
+ * Filename: speed_control.c
+ * Description: Outer speed loop. Sits above the current loop and sets the
+ *              torque command, as a fraction of full torque, the same way
+ *              the throttle does. Used for:
+ *               - Cruise control, which holds the speed from the moment it
+ *                 was engaged. The throttle can still ask for more.
+ *               - Walk assist, which pushes the bike at walking pace with
+ *                 limited torque, only for as long as it keeps being
+ *                 requested.
+ *
+ *              The PI output is clamped to the present derating scale, so
+ *              the integrator can't wind up past what the current loop is
+ *              allowed to deliver. When the battery current limiter is
+ *              clipping Iq, the integrator is held as well.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+
+Speed_Control_Type Speed;
+static Speed_Mode speed_prev_mode;
+static float speed_last_command;
+
+void SPEED_Init(void) {
+    Speed.Mode = Speed_Off;
+    Speed.SetpointKmh = 0.0f;
+    Speed.SpeedKmh = 0.0f;
+    Speed.KmhPerEHz = 0.0f;
+    Speed.WalkTimeout = 0;
+    FOC_PIDreset(&Speed.Loop);
+    Speed.Loop.Kp = SPEED_KP;
+    Speed.Loop.Ki = SPEED_KI;
+    Speed.Loop.Kd = 0.0f;
+    Speed.Loop.Kc = SPEED_KC;
+    Speed.Loop.OutMin = 0.0f;
+    Speed.Loop.OutMax = 0.0f;
+    speed_prev_mode = Speed_Off;
+    speed_last_command = 0.0f;
+}
+
+/**
+ * @brief  Runs the speed loop. Call from the speed rate group.
+ * @param  cfg - Main configuration, for the wheel and motor settings
+ *               and the derating scale
+ * @param  throttle - Throttle position, 0 to 1
+ * @param  speed_eHz - Electrical frequency of the motor
+ * @param  batt_limiting - Non-zero if the battery limiter is clipping Iq
+ * @retval Torque command, 0 to cfg->throttle_limit_scale
+ */
+float SPEED_Process(Config_Main* cfg, float throttle, float speed_eHz, uint8_t batt_limiting) {
+    float command;
+    float held_ui;
+
+    Speed.KmhPerEHz = SPEED_KmhPerEHz(cfg);
+    Speed.SpeedKmh = speed_eHz * Speed.KmhPerEHz;
+
+    // Never ask for more than the derating engine allows
+    Speed.Loop.OutMax = cfg->throttle_limit_scale;
+    Speed.Loop.OutMin = 0.0f;
+    if(Speed.Mode == Speed_Walk) {
+        if(Speed.WalkTimeout == 0) {
+            // No longer being requested
+            Speed.Mode = Speed_Off;
+        } else {
+            Speed.WalkTimeout--;
+            if(Speed.Loop.OutMax > SPEED_WALK_MAX_TORQUE) {
+                Speed.Loop.OutMax = SPEED_WALK_MAX_TORQUE;
+            }
+        }
+    }
+
+    if(Speed.Mode == Speed_Off) {
+        FOC_PIDreset(&Speed.Loop);
+        command = throttle * cfg->throttle_limit_scale;
+    } else {
+        if(speed_prev_mode == Speed_Off) {
+            // Just engaged. Start from the torque we already had.
+            Speed.Loop.Ui = speed_last_command;
+            Speed.Loop.SatErr = 0.0f;
+        }
+        Speed.Loop.Err = Speed.SetpointKmh - Speed.SpeedKmh;
+        held_ui = Speed.Loop.Ui;
+        FOC_PIcalc(&Speed.Loop);
+        if(((batt_limiting != 0) || (Speed.Loop.SatErr < 0.0f))
+                && (Speed.Loop.Err > 0.0f) && (Speed.Loop.Ui > held_ui)) {
+            // More torque wouldn't get through anyway. Back calculation
+            // alone lets the integral creep up to the cap while
+            // accelerating, and that overshoots the setpoint.
+            Speed.Loop.Ui = held_ui;
+        }
+        command = Speed.Loop.Out;
+        if(Speed.Mode == Speed_Cruise) {
+            // Rider can override with the throttle
+            if((throttle * cfg->throttle_limit_scale) > command) {
+                command = throttle * cfg->throttle_limit_scale;
+            }
+        }
+    }
+
+    speed_prev_mode = Speed.Mode;
+    speed_last_command = command;
+    return command;
+}
+
+/**
+ * @brief  Holds the present speed.
+ * @retval RETVAL_OK if engaged, RETVAL_FAIL if going too slowly
+ */
+uint8_t SPEED_EngageCruise(void) {
+    if(Speed.SpeedKmh < SPEED_CRUISE_MIN_KMH) {
+        return RETVAL_FAIL;
+    }
+    Speed.SetpointKmh = Speed.SpeedKmh;
+    Speed.Mode = Speed_Cruise;
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Starts or continues walk assist. Has to be called again within
+ *         SPEED_WALK_TIMEOUT to keep going, like holding down a button.
+ * @retval RETVAL_OK
+ */
+uint8_t SPEED_EngageWalk(void) {
+    Speed.WalkTimeout = (uint16_t)(SPEED_WALK_TIMEOUT * SPEED_SAMPLING_RATE);
+    Speed.SetpointKmh = SPEED_WALK_KMH;
+    Speed.Mode = Speed_Walk;
+    return RETVAL_OK;
+}
+
+/**
+ * @brief  Back to torque from the throttle.
+ * @retval RETVAL_OK
+ */
+uint8_t SPEED_Disengage(void) {
+    Speed.Mode = Speed_Off;
+    return RETVAL_OK;
+}
+
+Speed_Mode SPEED_GetMode(void) {
+    return Speed.Mode;
+}
+
+float SPEED_GetSpeedKmh(void) {
+    return Speed.SpeedKmh;
+}
+
+/**
+ * @brief  Road speed per electrical Hz of the motor. Wheel turns = motor
+ *         electrical turns / pole pairs / gear ratio.
+ * @param  cfg - Main configuration, for the wheel and motor settings
+ * @retval km/h per electrical Hz, zero until the gear ratio and pole pairs are set
+ */
+float SPEED_KmhPerEHz(Config_Main* cfg) {
+    float denom = cfg->GearRatio * (float)cfg->MotorPolePairs;
+
+    if(denom > 0.0f) {
+        // Wheel circumference in m, and m/s to km/h
+        return 3.6f * PI * cfg->WheelSizeMM * 0.001f / denom;
+    }
+    return 0.0f;
+}
@@ -0,0 +1,265 @@
+/******************************************************************************
+ * Filename: tasks.c
+ * Description: Cooperative task executor for the main loop. Tasks run to
+ *              completion, one after another, so they must never block.
+ *              A task becomes ready when one of its event flags is posted
+ *              (usually from an interrupt) or when its period comes due.
+ *              Every pass of TASK_Run gives each ready task one run, in
+ *              the order they were registered, so no task can starve
+ *              another.
+ *
+ *              The latency from a task becoming ready to actually running
+ *              is measured with the DWT cycle counter. Every pass, each
+ *              task that isn't waiting, or was run within its deadline,
+ *              checks in by echoing the watchdog supervisor's token. A task
+ *              that was kept waiting too long doesn't, and the supervisor
+ *              holds off feeding the watchdog. So does an interrupt that
+ *              hasn't checked in (see wdt.c). Each run also leaves a
+ *              breadcrumb, so a task that never returns can be found after
+ *              the watchdog reset.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+
+Task_Type Tasks[TASK_MAX_TASKS];
+uint8_t Task_Count = 0;
+
+// Pending events. Set from interrupts, taken by the main loop.
+static volatile uint32_t task_events;
+// Cycle count when each event was first posted
+static volatile uint32_t task_event_time[TASK_NUM_EVENTS];
+static uint32_t task_cycles_per_us;
+static uint32_t task_event_deadline;
+
+static void TASK_Supervise(void);
+static uint32_t TASK_TakeEvents(void);
+
+/**
+ * @brief  Clears the task list and registers the watchdog supervisor.
+ *         Call after SCHED_Init, which starts the cycle counter.
+ * @retval None
+ */
+void TASK_Init(void) {
+    task_events = 0;
+    Task_Count = 0;
+    task_cycles_per_us = SystemCoreClock / 1000000u;
+    task_event_deadline = TASK_EVENT_DEADLINE_US * task_cycles_per_us;
+
+    TASK_Register(TASK_Supervise, 0, TASK_SUPERVISOR_PERIOD_US);
+}
+
+/**
+ * @brief  Adds a task to the executor.
+ * @param  function - The task. Must run to completion without blocking.
+ * @param  events - TASK_EVENT_xxx flags that make the task ready
+ * @param  period_us - Time between periodic runs, or zero if only event driven
+ * @retval Task number, or TASK_INVALID if the task list is full
+ */
+uint8_t TASK_Register(void (*function)(void), uint32_t events, uint32_t period_us) {
+    if((Task_Count >= TASK_MAX_TASKS) || (function == 0)) {
+        return TASK_INVALID;
+    }
+    Task_Type* task = &(Tasks[Task_Count]);
+    task->Function = function;
+    task->Events = events;
+    task->PeriodCycles = period_us * task_cycles_per_us;
+    task->NextRelease = DWT->CYCCNT + task->PeriodCycles;
+    task->Runs = 0;
+    task->LastLatency = 0;
+    task->MaxLatency = 0;
+    task->MaxRunCycles = 0;
+    task->MissedCheckins = 0;
+    task->Echo = Wdt_Token;
+    task->LateToken = Wdt_Token - 1;
+    return Task_Count++;
+}
+
+/**
+ * @brief  Marks events as pending. Safe to call from any interrupt level.
+ * @param  events - TASK_EVENT_xxx flags to post
+ * @retval None
+ */
+void CCMRAM_FUNC TASK_PostEvent(uint32_t events) {
+    uint32_t now = DWT->CYCCNT;
+    uint32_t pending;
+    // Latency is measured from the first post of an event
+    for(uint8_t i = 0; i < TASK_NUM_EVENTS; i++) {
+        if(((events & (1u << i)) != 0) && ((task_events & (1u << i)) == 0)) {
+            task_event_time[i] = now;
+        }
+    }
+    // Exclusive access so a higher priority interrupt can't lose our update
+    do {
+        pending = __LDREXW(&task_events);
+    } while(__STREXW(pending | events, &task_events) != 0);
+}
+
+/**
+ * @brief  One pass of the executor. Runs each ready task once.
+ * @retval None
+ */
+void TASK_Run(void) {
+    uint32_t events = TASK_TakeEvents();
+    uint32_t event_time[TASK_NUM_EVENTS];
+    for(uint8_t i = 0; i < TASK_NUM_EVENTS; i++) {
+        event_time[i] = task_event_time[i];
+    }
+
+    for(uint8_t t = 0; t < Task_Count; t++) {
+        Task_Type* task = &(Tasks[t]);
+        uint32_t now = DWT->CYCCNT;
+        uint32_t latency = 0;
+        uint32_t deadline = task_event_deadline;
+        uint8_t ready = 0;
+
+        // Event driven
+        if((task->Events & events) != 0) {
+            ready = 1;
+            for(uint8_t i = 0; i < TASK_NUM_EVENTS; i++) {
+                if(((task->Events & events & (1u << i)) != 0) && ((now - event_time[i]) > latency)) {
+                    latency = now - event_time[i];
+                }
+            }
+        }
+        // Periodic
+        if((task->PeriodCycles != 0) && ((int32_t)(now - task->NextRelease) >= 0)) {
+            ready = 1;
+            deadline = task->PeriodCycles;
+            if((now - task->NextRelease) > latency) {
+                latency = now - task->NextRelease;
+            }
+            task->NextRelease += task->PeriodCycles;
+            if((int32_t)(now - task->NextRelease) >= 0) {
+                // Missed more than one period. Don't try to catch up.
+                task->NextRelease = now + task->PeriodCycles;
+            }
+        }
+
+        if(ready) {
+            WDT_TaskStart(t);
+            task->Function();
+            WDT_TaskEnd();
+            uint32_t run_cycles = DWT->CYCCNT - now;
+            task->Runs++;
+            task->LastLatency = latency;
+            if(latency > task->MaxLatency) {
+                task->MaxLatency = latency;
+            }
+            if(run_cycles > task->MaxRunCycles) {
+                task->MaxRunCycles = run_cycles;
+            }
+            if(latency > deadline) {
+                // Kept waiting too long. Take back this pass's check in,
+                // and no more until the supervisor's next pass, which
+                // holds back that feed.
+                task->LateToken = Wdt_Token;
+                task->Echo = Wdt_Token - 1;
+            }
+        }
+        if(task->LateToken != Wdt_Token) {
+            task->Echo = Wdt_Token;
+        }
+    }
+}
+
+/**
+ * @brief  Clears the task timing statistics.
+ * @retval None
+ */
+void TASK_ResetStats(void) {
+    for(uint8_t t = 0; t < Task_Count; t++) {
+        Tasks[t].Runs = 0;
+        Tasks[t].LastLatency = 0;
+        Tasks[t].MaxLatency = 0;
+        Tasks[t].MaxRunCycles = 0;
+        Tasks[t].MissedCheckins = 0;
+    }
+}
+
+/**
+ * @brief  Gets one task statistic for the data interface.
+ * @param  value_ID - CONFIG_TASK_xxx ID, plus the task number
+ *                    times CONFIG_TASK_OFFSET
+ * @retval The requested statistic, or zero if the ID is invalid
+ */
+uint32_t TASK_GetStatistic(uint16_t value_ID) {
+    uint16_t t = (value_ID - CONFIG_TASK_PREFIX) / CONFIG_TASK_OFFSET;
+    uint16_t stat = value_ID - (t * CONFIG_TASK_OFFSET);
+    if(t >= Task_Count) {
+        return 0;
+    }
+    switch(stat) {
+    case CONFIG_TASK_RUNS:
+        return Tasks[t].Runs;
+    case CONFIG_TASK_LAST_LATENCY:
+        return Tasks[t].LastLatency;
+    case CONFIG_TASK_MAX_LATENCY:
+        return Tasks[t].MaxLatency;
+    case CONFIG_TASK_MAX_RUN_CYCLES:
+        return Tasks[t].MaxRunCycles;
+    case CONFIG_TASK_MISSED_CHECKINS:
+        return Tasks[t].MissedCheckins;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief  Watchdog supervisor task. Feeds the watchdog only when every
+ *         task has echoed the token handed out on the last pass, and
+ *         every interrupt source has checked in. A single late run
+ *         holds back one feed. If a task keeps running late, the watchdog
+ *         times out, and the first thing that missed is kept for the
+ *         event log.
+ * @retval None
+ */
+static void TASK_Supervise(void) {
+    uint32_t token = Wdt_Token;
+    // Hands out the next token
+    uint32_t miss = WDT_CheckSources();
+    for(uint8_t t = 0; t < Task_Count; t++) {
+        if(Tasks[t].Echo != token) {
+            Tasks[t].MissedCheckins++;
+            if(miss == WDT_MISS_NONE) {
+                miss = WDT_MISS_TASK + t;
+            }
+        }
+    }
+    WDT_RecordMiss(miss);
+    if(miss == WDT_MISS_NONE) {
+        WDT_Feed();
+    }
+}
+
+/**
+ * @brief  Atomically reads and clears all pending events.
+ * @retval The events that were pending
+ */
+static uint32_t TASK_TakeEvents(void) {
+    uint32_t pending;
+    do {
+        pending = __LDREXW(&task_events);
+    } while(__STREXW(0, &task_events) != 0);
+    return pending;
+}
@@ -311,6 +311,7 @@ void CDC_DataOut(uint8_t epnum) {
         USB_CDC_RxBuffer.Position = 0;
         USB_CDC_RxBuffer.Size = USB_CDC_ClassData.RxLength;
         USB_CDC_RxBuffer.ReadDone = 1;
+        TASK_PostEvent(TASK_EVENT_USB_RX);
         // Next packet reception is enabled by VCP_Read.
         // This means that the USB core will NAK all packets until the
         // application reads the buffer.
@@ -35,9 +35,13 @@ int32_t USB_Data_Comm_RxBuffer_WrPlace;
 #endif
 uint8_t USB_Data_Comm_DataBuffer[PACKET_MAX_DATA_LENGTH];
 Data_Packet_Type USB_Data_Comm_Packet;
+// Part of the response that hasn't been sent yet
+static uint8_t* USB_Data_Comm_TxNext;
+static uint16_t USB_Data_Comm_TxRemaining;
 
 // Private functions
 static void USB_Data_Comm_Process_Command(void);
+static uint8_t USB_Data_Comm_Send(void);
 
 // Public functions
 
@@ -53,6 +57,7 @@ void USB_Data_Comm_Init(void) {
     USB_Data_Comm_Packet.TxBuffer = USB_Data_Comm_TxBuffer;
     USB_Data_Comm_Packet.TxReady = 0;
     USB_Data_Comm_Packet.RxReady = 0;
+    USB_Data_Comm_TxRemaining = 0;
 #if 0
     USB_Data_Comm_RxBuffer_WrPlace = 0;
 #endif
@@ -65,10 +70,17 @@ void USB_Data_Comm_Init(void) {
  *         if a properly encoded packet has been received, and
  *         sends to the appropriate handler if it has. Operates
  *         one byte at a time using an internal state machine.
+ *         Never waits on the USB port. If a response can't be sent all
+ *         at once, the rest is sent on the next call, and no new bytes
+ *         are processed until it's gone.
  * @param  None
  * @retval None
  */
 void USB_Data_Comm_OneByte_Check(void) {
+    // Finish off the previous response first
+    if(USB_Data_Comm_Send() == 0) {
+        return;
+    }
     // Loop through each incoming byte
     int32_t numbytes = VCP_InWaiting();
     uint8_t this_byte;
@@ -83,6 +95,10 @@ void USB_Data_Comm_OneByte_Check(void) {
             if(USB_Data_Comm_Packet.RxReady == 1) {
                 // Double checked and good to go
                 USB_Data_Comm_Process_Command();
+                if(USB_Data_Comm_TxRemaining > 0) {
+                    // Come back for the rest of the bytes later
+                    return;
+                }
             }
         }
     }
@@ -99,14 +115,28 @@ void USB_Data_Comm_OneByte_Check(void) {
 static void USB_Data_Comm_Process_Command(void) {
     uint16_t errCode = data_process_command(&USB_Data_Comm_Packet);
     if ((errCode == DATA_PACKET_SUCCESS) && USB_Data_Comm_Packet.TxReady) {
-        uint8_t* send_buffer = USB_Data_Comm_Packet.TxBuffer;
-        uint16_t len_to_send = USB_Data_Comm_Packet.TxLength;
-        uint16_t actually_sent = 0;
-        while (len_to_send > 0) {
-            actually_sent = VCP_Write(send_buffer, len_to_send);
-            len_to_send -= actually_sent;
-            send_buffer += actually_sent;
+        USB_Data_Comm_TxNext = USB_Data_Comm_Packet.TxBuffer;
+        USB_Data_Comm_TxRemaining = USB_Data_Comm_Packet.TxLength;
+        USB_Data_Comm_Send();
+    }
+}
+
+/**
+ * @brief  USB Data Communications Send
+ *         Sends as much of the pending response as the USB port will
+ *         take right now.
+ * @param  None
+ * @retval 1 if the whole response has been sent, 0 if bytes remain
+ */
+static uint8_t USB_Data_Comm_Send(void) {
+    if (USB_Data_Comm_TxRemaining > 0) {
+        uint16_t actually_sent = VCP_Write(USB_Data_Comm_TxNext, USB_Data_Comm_TxRemaining);
+        USB_Data_Comm_TxRemaining -= actually_sent;
+        USB_Data_Comm_TxNext += actually_sent;
+        if (USB_Data_Comm_TxRemaining > 0) {
+            return 0;
         }
         USB_Data_Comm_Packet.TxReady = 0;
     }
+    return 1;
 }
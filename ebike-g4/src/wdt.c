@@ -9,6 +9,22 @@
  *              MCU resets.
  *              Once started, the watchdog cannot be stopped.
  *              Feed the watchdog!
+ *
+ *              The window watchdog (WWDG) runs alongside it. It's refreshed
+ *              every time from the housekeeping interrupt, which runs at a
+ *              fixed rate, and resets the MCU if that comes too soon or
+ *              stops coming.
+ *
+ *              Feeding the IWDG is up to the task supervisor. The motor,
+ *              speed, and housekeeping interrupts check in by echoing a
+ *              token that changes every supervisor pass, and main loop
+ *              tasks check in through the task executor. If anything misses
+ *              its deadline the watchdog goes hungry, and what missed is
+ *              kept in RAM that survives the reset, to go in the event log
+ *              next boot. Something that hangs keeps the supervisor from
+ *              running at all, so interrupts and tasks also leave
+ *              breadcrumbs in that RAM as they start and finish, and the
+ *              culprit is worked out from those after the reset.
  ******************************************************************************
 
  Copyright (c) 2020 David Miller
@@ -34,7 +50,86 @@
 
 #include "main.h"
 
+#if ((WWDG_RELOAD - WWDG_WINDOW + 1) * WWDG_COUNT_US) >= WWDG_REFRESH_US
+#error "The window watchdog window opens after the next refresh"
+#endif
+#if ((WWDG_RELOAD - 0x3F) * WWDG_COUNT_US) < (3 * WWDG_REFRESH_US)
+#error "The window watchdog times out too close to the refresh period"
+#endif
+
+volatile uint32_t Wdt_Token = 1;
+volatile uint32_t Wdt_Echo[Wdt_NumSources];
+// Not cleared at startup, so it's still there after a watchdog reset
+volatile Wdt_Breadcrumbs Wdt_Crumbs __attribute__((section(".noinit")));
+
+static const uint8_t wdt_deadline[Wdt_NumSources] = {
+        WDT_DEADLINE_MOTOR, WDT_DEADLINE_SPEED, WDT_DEADLINE_HOUSEKEEPING };
+static uint32_t wdt_last_ok[Wdt_NumSources]; // Token when each source last checked in
+static uint32_t wdt_misses; // Supervisor passes that held back the feed
+static uint32_t wdt_last_reset_miss; // What was holding it back when we last reset
+static volatile uint8_t wdt_window_on; // Housekeeping starts the window watchdog
+
+/**
+ * @brief  Works out what held back the watchdog before the last reset,
+ *         and sets up the breadcrumbs for this run. Must be called before
+ *         any interrupt or task can leave a breadcrumb, and before
+ *         ELOG_Init clears the reset flags.
+ * @retval None
+ */
+void WDT_CheckLastReset(void) {
+    uint32_t miss = WDT_MISS_NONE;
+    uint32_t tick = Wdt_Crumbs.Tick;
+
+    if(Wdt_Crumbs.Magic == WDT_MISS_MAGIC) {
+        // The supervisor saw it coming
+        miss = Wdt_Crumbs.Miss;
+        if((miss == WDT_MISS_NONE)
+                && ((RCC->CSR & (RCC_CSR_IWDGRSTF | RCC_CSR_WWDGRSTF)) != 0)) {
+            // It didn't get the chance. An interrupt that's been running
+            // far too long blocks everything below it, check the highest
+            // priority first. The motor interrupt stops the tick when it's
+            // stuck, so it's only blamed when nothing else explains it.
+            if((Wdt_Crumbs.Entered[Wdt_SpeedISR] != WDT_NOT_RUNNING)
+                    && ((tick - Wdt_Crumbs.Entered[Wdt_SpeedISR]) >= WDT_STUCK_SPEED)) {
+                miss = WDT_MISS_SOURCE + Wdt_SpeedISR;
+            } else if((Wdt_Crumbs.Entered[Wdt_HousekeepingISR] != WDT_NOT_RUNNING)
+                    && ((tick - Wdt_Crumbs.Entered[Wdt_HousekeepingISR]) >= WDT_STUCK_HOUSEKEEPING)) {
+                miss = WDT_MISS_SOURCE + Wdt_HousekeepingISR;
+            } else if((Wdt_Crumbs.Task != WDT_MISS_NONE)
+                    && ((tick - Wdt_Crumbs.TaskStart) >= WDT_STUCK_TASK)) {
+                miss = Wdt_Crumbs.Task;
+            } else if(Wdt_Crumbs.Entered[Wdt_MotorISR] != WDT_NOT_RUNNING) {
+                miss = WDT_MISS_SOURCE + Wdt_MotorISR;
+            } else {
+                miss = Wdt_Crumbs.Task;
+            }
+        }
+    }
+    wdt_last_reset_miss = miss;
+
+    Wdt_Crumbs.Miss = WDT_MISS_NONE;
+    Wdt_Crumbs.Tick = 0;
+    Wdt_Crumbs.Task = WDT_MISS_NONE;
+    Wdt_Crumbs.TaskStart = 0;
+    for(uint8_t s = 0; s < Wdt_NumSources; s++) {
+        Wdt_Crumbs.Entered[s] = WDT_NOT_RUNNING;
+    }
+    Wdt_Crumbs.Magic = WDT_MISS_MAGIC;
+}
+
+/**
+ * @brief  Starts both watchdogs. Reports what held back the watchdog
+ *         before the last reset, if anything, to the event log.
+ * @retval None
+ */
 void WDT_Init(void) {
+    if(wdt_last_reset_miss != WDT_MISS_NONE) {
+        ELOG_Record(ELOG_EVENT_WATCHDOG, wdt_last_reset_miss);
+    }
+    for(uint8_t s = 0; s < Wdt_NumSources; s++) {
+        wdt_last_ok[s] = Wdt_Token;
+    }
+
     // Timer is stopped in debug (e.g. breakpoints)
     DBGMCU->APB1FZR1 |= DBGMCU_APB1FZR1_DBG_IWDG_STOP;
     // Start/enable the countdown timer
@@ -54,8 +149,79 @@ void WDT_Init(void) {
         // pass
 //    }
 
+    // Window watchdog
+    RCC->APB1ENR1 |= RCC_APB1ENR1_WWDGEN;
+    DBGMCU->APB1FZR1 |= DBGMCU_APB1FZR1_DBG_WWDG_STOP;
+    WWDG->CFR = WWDG_TIMEBASE | WWDG_WINDOW;
+    // Started by the next housekeeping interrupt, so the first refresh
+    // after that is a whole period later
+    wdt_window_on = 1;
 }
 
+/**
+ * @brief  Feeds the independent watchdog.
+ * @retval None
+ */
 void WDT_Feed(void) {
     IWDG->KR = IWDG_RELOAD;
 }
+
+/**
+ * @brief  Refreshes the window watchdog. Call from the housekeeping
+ *         interrupt only, every time it runs.
+ * @retval None
+ */
+void WDT_RefreshWindow(void) {
+    if(wdt_window_on != 0) {
+        WWDG->CR = WWDG_CR_WDGA | WWDG_RELOAD;
+    }
+}
+
+/**
+ * @brief  Checks that every interrupt source has echoed the token within
+ *         its deadline, then hands out a new token. Called once per
+ *         supervisor pass.
+ * @retval WDT_MISS_NONE, or WDT_MISS_SOURCE plus the first late source
+ */
+uint32_t WDT_CheckSources(void) {
+    uint32_t token = Wdt_Token;
+    uint32_t miss = WDT_MISS_NONE;
+    for(uint8_t s = 0; s < Wdt_NumSources; s++) {
+        if(Wdt_Echo[s] == token) {
+            wdt_last_ok[s] = token;
+        } else if(((token - wdt_last_ok[s]) >= wdt_deadline[s]) && (miss == WDT_MISS_NONE)) {
+            miss = WDT_MISS_SOURCE + s;
+        }
+    }
+    Wdt_Token = token + 1;
+    return miss;
+}
+
+/**
+ * @brief  Keeps track of what's holding back the watchdog, in RAM that
+ *         survives a reset.
+ * @param  miss - WDT_MISS_xxx code, WDT_MISS_NONE when it was fed
+ * @retval None
+ */
+void WDT_RecordMiss(uint32_t miss) {
+    if(miss != WDT_MISS_NONE) {
+        wdt_misses++;
+    }
+    Wdt_Crumbs.Miss = miss;
+}
+
+/**
+ * @brief  Gets watchdog information for the data interface.
+ * @param  value_ID - CONFIG_WDT_STATUS_xxx ID
+ * @retval The requested value, or zero if the ID is invalid
+ */
+uint32_t WDT_GetStatistic(uint16_t value_ID) {
+    switch(value_ID) {
+    case CONFIG_WDT_STATUS_MISSES:
+        return wdt_misses;
+    case CONFIG_WDT_STATUS_LAST_RESET:
+        return wdt_last_reset_miss;
+    default:
+        return 0;
+    }
+}
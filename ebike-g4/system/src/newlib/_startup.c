@@ -58,6 +58,12 @@
 
 // ----------------------------------------------------------------------------
 
+// CCMRAM holds the motor interrupt code and data (see sections.ld),
+// so its regions have to be copied and cleared along with the main ones.
+#if !defined(OS_INCLUDE_STARTUP_INIT_MULTIPLE_RAM_SECTIONS)
+#define OS_INCLUDE_STARTUP_INIT_MULTIPLE_RAM_SECTIONS
+#endif
+
 #if !defined(OS_INCLUDE_STARTUP_GUARD_CHECKS)
 #define OS_INCLUDE_STARTUP_GUARD_CHECKS (1)
 #endif
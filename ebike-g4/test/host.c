@@ -0,0 +1,122 @@
+/******************************************************************************
+ * Filename: host.c
+ * Description: Peripherals and checks shared by the host tests.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+
+RCC_TypeDef host_rcc;
+DBGMCU_TypeDef host_dbgmcu;
+IWDG_TypeDef host_iwdg;
+WWDG_TypeDef host_wwdg;
+DWT_Type host_dwt;
+SCB_Type host_scb;
+NVIC_Type host_nvic;
+CoreDebug_Type host_coredebug;
+TIM_TypeDef host_tim1;
+
+uint32_t SystemCoreClock = 170000000;
+unsigned int _estack;
+
+jmp_buf host_reset_jmp;
+int host_reset_cause;
+uint8_t host_irq_masked;
+void (*host_irq_hook)(uint8_t masked);
+void (*host_barrier_hook)(void);
+
+static unsigned long host_checks;
+static unsigned long host_failures;
+
+void host_barrier(void) {
+    if(host_barrier_hook != NULL) {
+        host_barrier_hook();
+    }
+    if((host_scb.AIRCR & SCB_AIRCR_SYSRESETREQ_Msk) != 0) {
+        host_scb.AIRCR = 0;
+        host_reset(HOST_RESET);
+    }
+}
+
+void host_irq_mask(uint8_t masked) {
+    host_irq_masked = masked;
+    if(host_irq_hook != NULL) {
+        host_irq_hook(masked);
+    }
+}
+
+void host_start_app(uint32_t msp) {
+    (void)msp;
+    host_reset(HOST_APP_STARTED);
+}
+
+/**
+ * @brief  Ends the code under test, back to the setjmp on host_reset_jmp
+ * @param  cause - HOST_xxx reason
+ * @retval Doesn't return
+ */
+void host_reset(int cause) {
+    host_reset_cause = cause;
+    longjmp(host_reset_jmp, 1);
+}
+
+void host_nvic_enable(IRQn_Type irq, uint8_t enable) {
+    uint32_t bit = 1u << ((uint32_t)irq & 0x1Fu);
+    if(enable != 0) {
+        host_nvic.ISER[(uint32_t)irq >> 5] |= bit;
+    } else {
+        host_nvic.ISER[(uint32_t)irq >> 5] &= ~bit;
+    }
+}
+
+void host_nvic_set_pending(IRQn_Type irq, uint8_t pending) {
+    uint32_t bit = 1u << ((uint32_t)irq & 0x1Fu);
+    if(pending != 0) {
+        host_nvic.ISPR[(uint32_t)irq >> 5] |= bit;
+    } else {
+        host_nvic.ISPR[(uint32_t)irq >> 5] &= ~bit;
+    }
+}
+
+uint32_t host_nvic_get_pending(IRQn_Type irq) {
+    uint32_t bit = 1u << ((uint32_t)irq & 0x1Fu);
+    return ((host_nvic.ISPR[(uint32_t)irq >> 5] & bit) != 0) ? 1u : 0u;
+}
+
+void host_check(int ok, const char* what, const char* file, int line) {
+    host_checks++;
+    if(!ok) {
+        host_failures++;
+        printf("%s:%d: check failed: %s\n", file, line, what);
+    }
+}
+
+/**
+ * @brief  Prints how the checks went
+ * @param  name - Test program name
+ * @retval Exit code, zero if every check passed
+ */
+int host_summary(const char* name) {
+    printf("%s: %lu checks, %lu failed\n", name, host_checks, host_failures);
+    return (host_failures == 0) ? 0 : 1;
+}
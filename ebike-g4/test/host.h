@@ -0,0 +1,123 @@
+/******************************************************************************
+ * Filename: host.h
+ * Description: Lets parts of the firmware run on a PC for testing. Include
+ *              this first, then the source file under test. Peripherals
+ *              become plain structs the test can look at and poke, and
+ *              the Cortex-M intrinsics become C.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include "stm32g4xx.h"
+#include <setjmp.h>
+#include <stdio.h>
+
+// Remapped before main.h, so the inline functions in its headers (the
+// PHASE_x_yyy output modes in pwm.h) use the host structs too.
+extern RCC_TypeDef host_rcc;
+extern DBGMCU_TypeDef host_dbgmcu;
+extern IWDG_TypeDef host_iwdg;
+extern WWDG_TypeDef host_wwdg;
+extern DWT_Type host_dwt;
+extern SCB_Type host_scb;
+extern NVIC_Type host_nvic;
+extern CoreDebug_Type host_coredebug;
+extern TIM_TypeDef host_tim1;
+
+#undef RCC
+#define RCC         (&host_rcc)
+#undef DBGMCU
+#define DBGMCU      (&host_dbgmcu)
+#undef IWDG
+#define IWDG        (&host_iwdg)
+#undef WWDG
+#define WWDG        (&host_wwdg)
+#undef DWT
+#define DWT         (&host_dwt)
+#undef SCB
+#define SCB         (&host_scb)
+#undef NVIC
+#define NVIC        (&host_nvic)
+#undef CoreDebug
+#define CoreDebug   (&host_coredebug)
+#undef TIM1
+#define TIM1        (&host_tim1)
+
+#include "main.h"
+
+// The NVIC functions in core_cm4.h were already compiled against the real
+// NVIC address, so they are replaced too. Pending bits stay set until the
+// test runs the handler and clears them.
+#define NVIC_EnableIRQ(irq)         host_nvic_enable((irq), 1)
+#define NVIC_DisableIRQ(irq)        host_nvic_enable((irq), 0)
+#define NVIC_SetPendingIRQ(irq)     host_nvic_set_pending((irq), 1)
+#define NVIC_ClearPendingIRQ(irq)   host_nvic_set_pending((irq), 0)
+#define NVIC_GetPendingIRQ(irq)     host_nvic_get_pending(irq)
+#define NVIC_SetPriority(irq, prio) ((void)(irq), (void)(prio))
+
+// Interrupts are never taken by themselves, so masking them only sets a
+// flag that tests can look at. A test can set host_irq_hook to be called
+// at every mask and unmask, to raise an interrupt in a critical section
+// and run it when the section ends.
+#define __disable_irq()         host_irq_mask(1)
+#define __enable_irq()          host_irq_mask(0)
+
+// Only one thread, so exclusive stores always succeed
+#define __LDREXW(addr)          (*(addr))
+#define __STREXW(value, addr)   ((*(addr) = (value)), 0u)
+#define __CLREX()               ((void)0)
+// A barrier is where a reset requested through SCB->AIRCR takes effect.
+// A test can set host_barrier_hook to be called there too, to preempt
+// code at exactly that point.
+#define __DSB()                 host_barrier()
+#define __DMB()                 host_barrier()
+// Starting the application ends the run
+#define __set_MSP(msp)          host_start_app(msp)
+
+// How a run ended, from host_run
+#define HOST_RETURNED       (1)
+#define HOST_APP_STARTED    (2)
+#define HOST_RESET          (3) // Software reset through SCB->AIRCR
+#define HOST_POWER_LOSS     (4)
+
+extern jmp_buf host_reset_jmp;
+extern int host_reset_cause;
+extern uint8_t host_irq_masked;
+extern void (*host_irq_hook)(uint8_t masked);
+extern void (*host_barrier_hook)(void);
+
+#define CHECK(cond)     host_check((cond), #cond, __FILE__, __LINE__)
+
+void host_barrier(void);
+void host_irq_mask(uint8_t masked);
+void host_start_app(uint32_t msp);
+void host_reset(int cause);
+void host_nvic_enable(IRQn_Type irq, uint8_t enable);
+void host_nvic_set_pending(IRQn_Type irq, uint8_t pending);
+uint32_t host_nvic_get_pending(IRQn_Type irq);
+void host_check(int ok, const char* what, const char* file, int line);
+int host_summary(const char* name);
+
+#endif //_HOST_H_
@@ -0,0 +1,213 @@
+/******************************************************************************
+ * Filename: test_angle.c
+ * Description: Host test of the Angle_Type conversions and the ramp
+ *              generator, mostly how they wrap around a revolution. Also
+ *              times the per cycle angle work against the float angles it
+ *              replaced.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <math.h>
+#include <time.h>
+#include "../src/foc_lib.c"
+
+// Only FOC_BiquadDesign uses the CORDIC, and it isn't tested here
+void CORDIC_CalcSinCos(Angle_Type theta, float* sin, float* cos) {
+    *sin = sinf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+    *cos = cosf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+}
+
+static void test_conversions(void) {
+    CHECK(ANGLE_FROM_FLOAT(0.0f) == 0x00000000u);
+    CHECK(ANGLE_FROM_FLOAT(0.25f) == 0x40000000u);
+    CHECK(ANGLE_FROM_FLOAT(0.5f) == 0x80000000u);
+    CHECK(ANGLE_FROM_FLOAT(0.75f) == 0xC0000000u);
+    // The largest float below one still fits
+    CHECK(ANGLE_FROM_FLOAT(0.99999994f) == 0xFFFFFF00u);
+
+    CHECK(ANGLE_TO_FLOAT(0x40000000u) == 0.25f);
+    CHECK(ANGLE_TO_FLOAT(0xC0000000u) == 0.75f);
+    CHECK(ANGLE_TO_FLOAT(0xFFFFFFFFu) < 1.0f + 1e-7f);
+
+    // Round trip, to within the float's precision
+    for(int i = 0; i < 4096; i++) {
+        float x = (float)i / 4096.0f;
+        CHECK(ANGLE_TO_FLOAT(ANGLE_FROM_FLOAT(x)) == x);
+    }
+}
+
+static void test_deltas(void) {
+    CHECK(ANGLE_DELTA_FROM_FLOAT(0.25f) == 0x40000000u);
+    CHECK(ANGLE_DELTA_FROM_FLOAT(-0.25f) == 0xC0000000u);
+    CHECK(ANGLE_DELTA_FROM_FLOAT(-0.0f) == 0u);
+    CHECK(ANGLE_DELTA_TO_FLOAT(0x40000000u) == 0.25f);
+    CHECK(ANGLE_DELTA_TO_FLOAT(0xC0000000u) == -0.25f);
+    CHECK(ANGLE_DELTA_TO_FLOAT(0x80000000u) == -0.5f);
+
+    // Differences across zero come out as the short way round
+    Angle_Type before = ANGLE_FROM_FLOAT(0.9375f);
+    Angle_Type after = ANGLE_FROM_FLOAT(0.0625f);
+    CHECK(ANGLE_DELTA_TO_FLOAT(after - before) == 0.125f);
+    CHECK(ANGLE_DELTA_TO_FLOAT(before - after) == -0.125f);
+
+    // Stepping backwards past zero, like the hall PLL running in reverse
+    Angle_Type phase = ANGLE_FROM_FLOAT(1.0f / 256.0f);
+    phase += ANGLE_DELTA_FROM_FLOAT(-2.0f / 256.0f);
+    CHECK(phase == ANGLE_FROM_FLOAT(255.0f / 256.0f));
+}
+
+static void test_ramp(void) {
+    // 50Hz from a 20kHz interrupt is 400 steps per revolution
+    Angle_Type step = FOC_RampCtrl(20000.0f, 50.0f);
+    Angle_Type angle = 0;
+    CHECK(fabsf(ANGLE_DELTA_TO_FLOAT(step) - 0.0025f) < 1e-9f);
+    for(int i = 0; i < 100; i++) {
+        FOC_RampGen(&angle, step);
+    }
+    CHECK(fabsf(ANGLE_TO_FLOAT(angle) - 0.25f) < 1e-6f);
+    for(int i = 100; i < 400; i++) {
+        FOC_RampGen(&angle, step);
+    }
+    // One full revolution, back to the start
+    CHECK(fabsf(ANGLE_DELTA_TO_FLOAT(angle)) < 1e-6f);
+
+    // Running backwards
+    step = FOC_RampCtrl(20000.0f, -50.0f);
+    angle = 0;
+    for(int i = 0; i < 100; i++) {
+        FOC_RampGen(&angle, step);
+    }
+    CHECK(fabsf(ANGLE_TO_FLOAT(angle) - 0.75f) < 1e-6f);
+    for(int i = 100; i < 400; i++) {
+        FOC_RampGen(&angle, step);
+    }
+    CHECK(fabsf(ANGLE_DELTA_TO_FLOAT(angle)) < 1e-6f);
+}
+
+/*
+ * The float angle path as it was before Angle_Type: an angle in [0,1) kept
+ * in range by compare-and-subtract, doubled and wrapped to the CORDIC's
+ * [-1,1), then converted to Q31. The VCVT.S32.F32 #31 in float_to_q31
+ * saturates, so does this.
+ */
+static float old_clip_to_one(float unclipped) {
+    while(unclipped < 0.0f) {
+        unclipped += 1.0f;
+    }
+    while(unclipped >= 1.0f) {
+        unclipped -= 1.0f;
+    }
+    return unclipped;
+}
+
+static int32_t old_float_to_q31(float input) {
+    float scaled = input * 2147483648.0f;
+    if(scaled >= 2147483647.0f) {
+        return INT32_MAX;
+    }
+    if(scaled <= -2147483648.0f) {
+        return INT32_MIN;
+    }
+    return (int32_t)scaled;
+}
+
+static int32_t old_cordic_input(float angle) {
+    float theta = angle * 2.0f;
+    if(theta >= 1.0f) {
+        theta -= 2.0f;
+    }
+    return old_float_to_q31(theta);
+}
+
+/**
+ * @brief  Both paths give the same CORDIC input
+ */
+static void test_old_path(void) {
+    for(int i = 0; i < 4096; i++) {
+        float x = (float)i / 4096.0f;
+        CHECK(old_cordic_input(x) == (int32_t)ANGLE_FROM_FLOAT(x));
+    }
+    // Five seconds of steps at 20kHz. The phase accumulator lands exactly
+    // where it should, the float angle drifts as its rounding builds up.
+    float old_angle = 0.0f;
+    Angle_Type angle = 0, step = ANGLE_DELTA_FROM_FLOAT(0.0123f);
+    for(int i = 0; i < 100000; i++) {
+        old_angle = old_clip_to_one(old_angle + 0.0123f);
+        angle += step;
+    }
+    CHECK(angle == (Angle_Type)(100000u * step));
+    printf("Float angle drift after 100000 steps: %.3fdeg\n",
+            (double)fabsf(ANGLE_DELTA_TO_FLOAT(ANGLE_FROM_FLOAT(old_angle) - angle)) * 360.0);
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief  Per call cost of the angle work done every PWM cycle: step the
+ *         hall angle, and turn it into the CORDIC input. The step changes
+ *         sign every 4096 calls so both wrap directions run.
+ */
+static void test_cost(void) {
+    uint32_t n = 20000000;
+    volatile int32_t sink = 0;
+    float old_angle = 0.0f, old_step = 0.0123f;
+    Angle_Type angle = 0, step = ANGLE_DELTA_FROM_FLOAT(0.0123f);
+    double start, t_old, t_new;
+
+    start = now();
+    for(uint32_t i = 0; i < n; i++) {
+        if((i & 0xFFF) == 0) {
+            old_step = -old_step;
+        }
+        old_angle = old_clip_to_one(old_angle + old_step);
+        sink = old_cordic_input(old_angle);
+    }
+    t_old = (now() - start) / n;
+
+    start = now();
+    for(uint32_t i = 0; i < n; i++) {
+        if((i & 0xFFF) == 0) {
+            step = 0u - step;
+        }
+        FOC_RampGen(&angle, step);
+        sink = (int32_t)angle;
+    }
+    t_new = (now() - start) / n;
+    (void)sink;
+    printf("On this PC an angle step and CORDIC input takes %.2fns with float angles, "
+            "%.2fns with Angle_Type\n", t_old * 1e9, t_new * 1e9);
+}
+
+int main(void) {
+    test_conversions();
+    test_deltas();
+    test_ramp();
+    test_old_path();
+    test_cost();
+    return host_summary("test_angle");
+}
@@ -0,0 +1,287 @@
+/******************************************************************************
+ * Filename: test_battery_current.c
+ * Description: Host test of the battery current estimate and limiter. The
+ *              plant is an averaged inverter: the voltage commands go
+ *              through the firmware's own SVM, dead time moves each duty
+ *              against its phase current, and the DC link current is the
+ *              sum of duty times phase current. The motor is a PMSM in
+ *              steady state, in both directions of rotation.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <math.h>
+#include "../src/foc_lib.c"
+#include "../src/battery_current.c"
+
+void CORDIC_CalcSinCos(Angle_Type theta, float* sin, float* cos) {
+    *sin = sinf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+    *cos = cosf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+}
+
+// Hub motor
+#define MOTOR_R         (0.1f) // Ohm
+#define MOTOR_L         (100e-6f) // H
+#define MOTOR_FLUX      (0.02f) // Wb
+#define STEPS_PER_REV   (400)
+
+static Config_Main cfg;
+
+// One operating point. Voltages are fractions of the SVM full scale,
+// Vbus/sqrt(3) phase volts, the same as the current loop output.
+typedef struct {
+    float vbus;
+    float td;
+    float tq;
+    float id;
+    float iq;
+} Op_Point;
+
+static float sign(float x) {
+    return (x > 0.0f) ? 1.0f : ((x < 0.0f) ? -1.0f : 0.0f);
+}
+
+/**
+ * @brief  Steady state voltages for a current and speed
+ * @param  ehz - Electrical speed, negative in reverse
+ */
+static Op_Point steady(float vbus, float ehz, float id, float iq) {
+    Op_Point op;
+    float w = 2.0f * (float)M_PI * ehz;
+    float full_scale = vbus * INV_SQRT3;
+    op.vbus = vbus;
+    op.id = id;
+    op.iq = iq;
+    op.td = (MOTOR_R * id - w * MOTOR_L * iq) / full_scale;
+    op.tq = (MOTOR_R * iq + w * (MOTOR_L * id + MOTOR_FLUX)) / full_scale;
+    return op;
+}
+
+/**
+ * @brief  Battery current drawn by the averaged inverter at one rotor angle
+ */
+static float plant_current(const Op_Point* op, float angle) {
+    float s = sinf(angle * 2.0f * (float)M_PI);
+    float c = cosf(angle * 2.0f * (float)M_PI);
+    float va, vb, ia_, ib_, duty[3], i[3];
+    FOC_Ipark(op->td, op->tq, s, c, &va, &vb);
+    FOC_SVM(va, vb, &duty[0], &duty[1], &duty[2]);
+    FOC_Ipark(op->id, op->iq, s, c, &ia_, &ib_);
+    i[0] = ia_;
+    i[1] = -0.5f * ia_ + SQRT3_OVER_2 * ib_;
+    i[2] = -i[0] - i[1];
+    float idc = 0.0f;
+    float imag = sqrtf(op->id * op->id + op->iq * op->iq);
+    for(uint8_t k = 0; k < 3; k++) {
+        // Dead time delays the edge the current isn't helping along
+        float d = duty[k] - sign(i[k]) * IBATT_DEADTIME_FRACTION;
+        CHECK((duty[k] >= 0.0f) && (duty[k] <= 1.0f));
+        idc += d * i[k];
+    }
+    // The same switching loss and supply current the estimate assumes.
+    // They're calibration constants, not something this test can check.
+    return idc + (IBATT_SWITCHING_LOSS * imag) + IBATT_IDLE_CURRENT;
+}
+
+/**
+ * @brief  Runs one electrical revolution
+ * @param  worst - Largest single-cycle error
+ * @retval Mean of (estimate - plant)
+ */
+static float revolution(const Op_Point* op, float* worst, float* mean_plant) {
+    float sum_err = 0.0f;
+    float sum_plant = 0.0f;
+    *worst = 0.0f;
+    for(uint32_t n = 0; n < STEPS_PER_REV; n++) {
+        float plant = plant_current(op, (float)n / (float)STEPS_PER_REV);
+        float est = IBATT_Estimate(op->td, op->tq, op->id, op->iq);
+        sum_err += est - plant;
+        sum_plant += plant;
+        if(fabsf(est - plant) > *worst) {
+            *worst = fabsf(est - plant);
+        }
+    }
+    *mean_plant = sum_plant / STEPS_PER_REV;
+    return sum_err / STEPS_PER_REV;
+}
+
+static void setup(void) {
+    cfg.MaxPhaseCurrent = DFLT_LMT_PHASE_CUR_MAX;
+    cfg.MaxBatteryCurrent = DFLT_LMT_BATT_CUR_MAX;
+    cfg.MaxBatteryRegenCurrent = DFLT_LMT_BATT_REGEN_MAX;
+    IBATT_Init();
+}
+
+static void test_estimate(void) {
+    const float vbus[] = {36.0f, 48.0f, 52.0f};
+    const float ehz[] = {-150.0f, -50.0f, 0.0f, 20.0f, 100.0f, 200.0f};
+    const float iq[] = {-20.0f, -5.0f, 0.0f, 10.0f, 40.0f};
+    const float id[] = {0.0f, -10.0f};
+    setup();
+    for(uint8_t v = 0; v < 3; v++) {
+        for(uint8_t s = 0; s < 6; s++) {
+            for(uint8_t q = 0; q < 5; q++) {
+                for(uint8_t d = 0; d < 2; d++) {
+                    Op_Point op = steady(vbus[v], ehz[s], id[d], iq[q]);
+                    float worst, plant;
+                    if(sqrtf(op.td * op.td + op.tq * op.tq) > 0.95f) {
+                        continue; // Past the linear range of the SVM
+                    }
+                    float err = revolution(&op, &worst, &plant);
+                    float imag = sqrtf(op.id * op.id + op.iq * op.iq);
+                    // Over a revolution the dead time comes out exactly.
+                    // Cycle by cycle it's a square wave in each phase, and
+                    // the estimate only has the fundamental.
+                    CHECK(fabsf(err) < 0.01f + 0.002f * fabsf(plant));
+                    CHECK(worst < 0.01f + (0.2f * IBATT_DEADTIME_FRACTION * imag));
+                }
+            }
+        }
+    }
+}
+
+static void test_estimate_sign(void) {
+    setup();
+    float worst, plant;
+    // Motoring forwards and backwards both draw from the battery
+    Op_Point fwd = steady(48.0f, 150.0f, 0.0f, 30.0f);
+    Op_Point rev = steady(48.0f, -150.0f, 0.0f, -30.0f);
+    revolution(&fwd, &worst, &plant);
+    CHECK(plant > 5.0f);
+    CHECK(IBATT_GetCurrent() > 5.0f);
+    revolution(&rev, &worst, &plant);
+    CHECK(plant > 5.0f);
+    CHECK(IBATT_GetCurrent() > 5.0f);
+    // Braking in either direction charges it
+    Op_Point fwd_brake = steady(48.0f, 150.0f, 0.0f, -30.0f);
+    Op_Point rev_brake = steady(48.0f, -150.0f, 0.0f, 30.0f);
+    revolution(&fwd_brake, &worst, &plant);
+    CHECK(plant < -5.0f);
+    CHECK(IBATT_GetCurrent() < -5.0f);
+    revolution(&rev_brake, &worst, &plant);
+    CHECK(plant < -5.0f);
+    CHECK(IBATT_GetCurrent() < -5.0f);
+}
+
+static void test_filter(void) {
+    setup();
+    Op_Point op = steady(48.0f, 100.0f, 0.0f, 30.0f);
+    float worst, plant;
+    // 50Hz, so a time constant of about 3.2ms, or 64 PWM cycles
+    for(uint8_t r = 0; r < 3; r++) {
+        revolution(&op, &worst, &plant);
+    }
+    CHECK(fabsf(IBATT_GetFilteredCurrent() - plant) < 0.02f * plant);
+    // Settled now, so the ripple left is tiny
+    revolution(&op, &worst, &plant);
+    CHECK(fabsf(IBATT_GetFilteredCurrent() - plant) < 0.01f * plant);
+}
+
+/**
+ * @brief  Runs the limiter at a speed until the current settles on what it
+ *         allows, the way the current loop follows its reference
+ * @retval The plant's battery current at that current
+ */
+static float settle_limit(float ehz, float iq_ref, float* iq_out) {
+    float iq = 0.0f;
+    for(uint8_t n = 0; n < 50; n++) {
+        Op_Point op = steady(48.0f, ehz, 0.0f, iq);
+        iq = IBATT_LimitIq(&cfg, iq_ref, op.td, op.tq, op.id, op.iq);
+    }
+    *iq_out = iq;
+    Op_Point op = steady(48.0f, ehz, 0.0f, iq);
+    float worst, plant;
+    revolution(&op, &worst, &plant);
+    return plant;
+}
+
+static void test_limit_forward(void) {
+    setup();
+    float iq, ibatt;
+    // Plenty of back EMF, full throttle would pull far more than 30A
+    ibatt = settle_limit(150.0f, 60.0f, &iq);
+    CHECK(IBATT_IsLimiting() != 0);
+    CHECK(iq < 60.0f);
+    CHECK(fabsf(ibatt - DFLT_LMT_BATT_CUR_MAX) < 0.3f);
+    // A small request goes through untouched
+    ibatt = settle_limit(150.0f, 5.0f, &iq);
+    CHECK(IBATT_IsLimiting() == 0);
+    CHECK(iq == 5.0f);
+    // Hard braking is held to the charge limit
+    ibatt = settle_limit(150.0f, -60.0f, &iq);
+    CHECK(IBATT_IsLimiting() != 0);
+    CHECK(iq > -60.0f);
+    CHECK(iq < 0.0f);
+    CHECK(fabsf(ibatt + DFLT_LMT_BATT_REGEN_MAX) < 0.3f);
+}
+
+static void test_limit_reverse(void) {
+    setup();
+    float iq, ibatt;
+    // Spinning backwards, the q axis voltage is negative. Full throttle
+    // backwards is negative Iq, and still limited to the battery draw.
+    ibatt = settle_limit(-150.0f, -60.0f, &iq);
+    CHECK(IBATT_IsLimiting() != 0);
+    CHECK(iq > -60.0f);
+    CHECK(iq < 0.0f);
+    CHECK(fabsf(ibatt - DFLT_LMT_BATT_CUR_MAX) < 0.3f);
+    CHECK(IBatt.IqMin < 0.0f);
+    CHECK(IBatt.IqMax > 0.0f);
+    // Braking backwards is positive Iq, held to the charge limit
+    ibatt = settle_limit(-150.0f, 60.0f, &iq);
+    CHECK(IBATT_IsLimiting() != 0);
+    CHECK(iq < 60.0f);
+    CHECK(iq > 0.0f);
+    CHECK(fabsf(ibatt + DFLT_LMT_BATT_REGEN_MAX) < 0.3f);
+    // And small requests either way go through
+    ibatt = settle_limit(-150.0f, -5.0f, &iq);
+    CHECK(IBATT_IsLimiting() == 0);
+    CHECK(iq == -5.0f);
+    ibatt = settle_limit(-150.0f, 2.0f, &iq);
+    CHECK(IBATT_IsLimiting() == 0);
+    CHECK(iq == 2.0f);
+}
+
+static void test_limit_standstill(void) {
+    setup();
+    float iq;
+    // Too little voltage to solve for Iq. The phase limit is all that's
+    // left, and the battery current is small anyway.
+    float ibatt = settle_limit(0.0f, 60.0f, &iq);
+    CHECK(iq == 60.0f);
+    CHECK(IBATT_IsLimiting() == 0);
+    CHECK(ibatt < 10.0f);
+    IBATT_LimitIq(&cfg, 80.0f, 0.0f, 0.01f, 0.0f, 0.0f);
+    CHECK(IBatt.IqMax == DFLT_LMT_PHASE_CUR_MAX);
+    CHECK(IBATT_LimitIq(&cfg, -80.0f, 0.0f, -0.01f, 0.0f, 0.0f) == -DFLT_LMT_PHASE_CUR_MAX);
+}
+
+int main(void) {
+    test_estimate();
+    test_estimate_sign();
+    test_filter();
+    test_limit_forward();
+    test_limit_reverse();
+    test_limit_standstill();
+    return host_summary("test_battery_current");
+}
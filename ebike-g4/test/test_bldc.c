@@ -0,0 +1,412 @@
+/******************************************************************************
+ * Filename: test_bldc.c
+ * Description: Host test of six-step commutation and the handover to FOC,
+ *              on a simulated motor. The plant works in phase quantities,
+ *              so a floating phase carries no current once its diode has
+ *              let go, and which phases are driven is read back from the
+ *              timer output modes that six-step sets. The controller is the
+ *              same sequence as the motor interrupt: current loop, handover
+ *              check, then six-step or SVM.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <math.h>
+#include "../src/foc_lib.c"
+#include "../src/bldc.c"
+
+void CORDIC_CalcSinCos(Angle_Type theta, float* sin, float* cos) {
+    *sin = sinf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+    *cos = cosf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+}
+
+#define PWM_FREQ        (20000.0f)
+#define SUBSTEPS        (50) // 1us plant steps
+#define DT              (1.0f / (PWM_FREQ * SUBSTEPS))
+#define VBUS            (48.0f)
+#define MOTOR_R         (0.1f) // Per phase
+#define MOTOR_L         (100e-6f)
+#define MOTOR_FLUX      (0.02f) // V.s, peak per phase
+#define IQ_REF          (20.0f)
+#define VALID_EHZ       (2.0f) // Hall interpolation is good above this
+
+// Output stage, one entry per phase
+#define LEG_PWM         (0)
+#define LEG_LOW         (1)
+#define LEG_FLOAT       (2)
+
+static Config_Main cfg;
+static PID_Type pid_id, pid_iq;
+static Motor_PWMDuties duty;
+static float vd, vq;
+
+// Plant state
+static float cur[3]; // Phase currents, A B C
+static float theta; // True electrical angle, revolutions
+static float speed; // Electrical Hz
+static float hall_offset; // Where the Hall sectors start, revolutions
+static float iq_true; // Torque producing current at the end of the cycle
+static uint8_t foc; // Control_FOC if handed over
+
+/**
+ * @brief  Output mode of a phase, from the timer registers. Phase A is
+ *         channel 3 and C is channel 1, same as PWM_SetDutyF.
+ */
+static uint8_t leg_mode(uint8_t phase) {
+    uint32_t mode, enable;
+    if(phase == 0) {
+        mode = host_tim1.CCMR2 & TIM_CCMR2_OC3M;
+        enable = host_tim1.CCER & TIM_CCER_CC3E;
+        if(mode == (TIM_CCMR2_OC3M_2 | TIM_CCMR2_OC3M_1)) {
+            return (enable != 0) ? LEG_PWM : LEG_FLOAT;
+        }
+    } else if(phase == 1) {
+        mode = host_tim1.CCMR1 & TIM_CCMR1_OC2M;
+        enable = host_tim1.CCER & TIM_CCER_CC2E;
+        if(mode == (TIM_CCMR1_OC2M_2 | TIM_CCMR1_OC2M_1)) {
+            return (enable != 0) ? LEG_PWM : LEG_FLOAT;
+        }
+    } else {
+        mode = host_tim1.CCMR1 & TIM_CCMR1_OC1M;
+        enable = host_tim1.CCER & TIM_CCER_CC1E;
+        if(mode == (TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_1)) {
+            return (enable != 0) ? LEG_PWM : LEG_FLOAT;
+        }
+    }
+    // Forced inactive. The low side is on only with the high side enabled too.
+    return (enable != 0) ? LEG_LOW : LEG_FLOAT;
+}
+
+static void emf(float* e) {
+    float w = 2.0f * (float)M_PI * speed;
+    float s = sinf(theta * 2.0f * (float)M_PI);
+    float c = cosf(theta * 2.0f * (float)M_PI);
+    // Along the q axis, same Park convention as FOC_Park
+    float ea = -w * MOTOR_FLUX * s;
+    float eb = w * MOTOR_FLUX * c;
+    e[0] = ea;
+    e[1] = -0.5f * ea + SQRT3_OVER_2 * eb;
+    e[2] = -0.5f * ea - SQRT3_OVER_2 * eb;
+}
+
+/**
+ * @brief  One PWM cycle of the motor, with averaged leg voltages. A floating
+ *         phase that still has current freewheels through a diode, to the
+ *         bottom rail if the current is going into the motor, the top one
+ *         if it's coming out, until the current gets to zero.
+ */
+static void plant(void) {
+    float v[3], e[3];
+    float d[3] = { duty.tA, duty.tB, duty.tC };
+    uint8_t mode[3];
+    uint8_t driven;
+    for(uint8_t k = 0; k < 3; k++) {
+        mode[k] = leg_mode(k);
+    }
+    for(uint32_t n = 0; n < SUBSTEPS; n++) {
+        emf(e);
+        driven = 0;
+        for(uint8_t k = 0; k < 3; k++) {
+            if(mode[k] == LEG_PWM) {
+                v[k] = d[k] * VBUS;
+            } else if(mode[k] == LEG_LOW) {
+                v[k] = 0.0f;
+            } else if(cur[k] > 0.0f) {
+                v[k] = 0.0f;
+            } else if(cur[k] < 0.0f) {
+                v[k] = VBUS;
+            } else {
+                continue;
+            }
+            driven |= 1 << k;
+        }
+        if(driven == 0x07) {
+            float vn = (v[0] + v[1] + v[2] - e[0] - e[1] - e[2]) / 3.0f;
+            float before[3] = { cur[0], cur[1], cur[2] };
+            for(uint8_t k = 0; k < 3; k++) {
+                cur[k] += (v[k] - vn - MOTOR_R * cur[k] - e[k]) / MOTOR_L * DT;
+            }
+            // Diode stops conducting at zero
+            for(uint8_t k = 0; k < 3; k++) {
+                if((mode[k] == LEG_FLOAT) && ((before[k] > 0.0f) != (cur[k] > 0.0f))) {
+                    float rest = cur[k] / 2.0f;
+                    cur[k] = 0.0f;
+                    cur[(k + 1) % 3] += rest;
+                    cur[(k + 2) % 3] += rest;
+                }
+            }
+        } else if((driven == 0x03) || (driven == 0x05) || (driven == 0x06)) {
+            uint8_t p = (driven == 0x06) ? 1 : 0;
+            uint8_t q = (driven == 0x03) ? 1 : 2;
+            float i = cur[p];
+            i += ((v[p] - v[q]) - 2.0f * MOTOR_R * i - (e[p] - e[q])) / (2.0f * MOTOR_L) * DT;
+            cur[p] = i;
+            cur[q] = -i;
+            cur[3 - p - q] = 0.0f;
+        } else {
+            cur[0] = 0.0f;
+            cur[1] = 0.0f;
+            cur[2] = 0.0f;
+        }
+        theta += speed * DT;
+        theta -= floorf(theta);
+    }
+    float alpha, beta, id;
+    FOC_Clarke(cur[0], cur[1], &alpha, &beta);
+    FOC_Park(alpha, beta, sinf(theta * 2.0f * (float)M_PI), cosf(theta * 2.0f * (float)M_PI), &id, &iq_true);
+}
+
+static uint8_t hall_state(void) {
+    float pos = theta - hall_offset;
+    pos -= floorf(pos);
+    return (uint8_t)(pos * 6.0f) + 1;
+}
+
+/**
+ * @brief  The rotor angle as the firmware sees it. The middle of the Hall
+ *         sector until interpolation is good, then the real angle.
+ */
+static Angle_Type angle_estimate(void) {
+    if(speed < VALID_EHZ) {
+        return ANGLE_FROM_FLOAT(hall_offset + ((float)(hall_state() - 1) + 0.5f) / 6.0f);
+    }
+    return ANGLE_FROM_FLOAT(theta);
+}
+
+/**
+ * @brief  One motor interrupt. Same steps as MAIN_MotorISR and
+ *         MAIN_CurrentLoop, without the battery limiter and cogging.
+ */
+static void motor_isr(float iq_ref) {
+    float alpha, beta, park_d, park_q, sin, cos, w, volts_to_duty, vd_ff, vq_ff, vmax;
+    Angle_Type angle = angle_estimate();
+    uint8_t valid = (speed >= VALID_EHZ) ? ANGLE_VALID : 0;
+
+    if(foc == 0) {
+        if(BLDC_CheckHandover(&cfg, speed, valid) != 0) {
+            BLDC_Release();
+            foc = 1;
+        }
+    }
+
+    CORDIC_CalcSinCos(angle, &sin, &cos);
+    FOC_Clarke(cur[0], cur[1], &alpha, &beta);
+    FOC_Park(alpha, beta, sin, cos, &park_d, &park_q);
+    w = 2.0f * PI * speed;
+    volts_to_duty = 1.0f / (INV_SQRT3 * VBUS);
+    vd_ff = -w * cfg.MotorLq * park_q * volts_to_duty;
+    vq_ff = w * (cfg.MotorLd * park_d + cfg.MotorFluxLinkage) * volts_to_duty;
+    if(foc == 0) {
+        FOC_PIDreset(&pid_id);
+        vd = 0.0f;
+    } else {
+        pid_id.OutMax = 1.0f - vd_ff;
+        pid_id.OutMin = -1.0f - vd_ff;
+        pid_id.Err = 0.0f - park_d;
+        FOC_PIcalc(&pid_id);
+        vd = pid_id.Out + vd_ff;
+    }
+    vmax = sqrtf(1.0f - vd * vd);
+    pid_iq.OutMax = vmax - vq_ff;
+    pid_iq.OutMin = -vmax - vq_ff;
+    pid_iq.Err = iq_ref - park_q;
+    FOC_PIcalc(&pid_iq);
+    vq = pid_iq.Out + vq_ff;
+
+    if(foc == 0) {
+        BLDC_Commutate(hall_state(), angle, vq, &duty);
+    } else {
+        FOC_Ipark(vd, vq, sin, cos, &alpha, &beta);
+        FOC_SVM(alpha, beta, &duty.tA, &duty.tB, &duty.tC);
+    }
+    plant();
+}
+
+static void setup(float offset) {
+    cfg.CountsToFOC = DFLT_MAIN_COUNTS_TO_FOC;
+    cfg.SpeedToFOC = DFLT_MAIN_SPEED_TO_FOC;
+    cfg.SwitchEpsilon = DFLT_MAIN_SWITCH_EPS;
+    cfg.MotorLd = MOTOR_L;
+    cfg.MotorLq = MOTOR_L;
+    cfg.MotorFluxLinkage = MOTOR_FLUX;
+    FOC_PIDdefaults(&pid_id);
+    FOC_PIDdefaults(&pid_iq);
+    // 1kHz current loop bandwidth, from the same synthesis the firmware uses
+    FOC_PIsynth(&pid_id, MOTOR_R, MOTOR_L, INV_SQRT3 * VBUS, PWM_FREQ, 1000.0f);
+    FOC_PIsynth(&pid_iq, MOTOR_R, MOTOR_L, INV_SQRT3 * VBUS, PWM_FREQ, 1000.0f);
+    cur[0] = 0.0f;
+    cur[1] = 0.0f;
+    cur[2] = 0.0f;
+    theta = 0.0f;
+    speed = 0.0f;
+    hall_offset = offset;
+    vd = 0.0f;
+    vq = 0.0f;
+    foc = 0;
+    BLDC_Init();
+    BLDC_Enable();
+    host_tim1.CCMR1 = 0;
+    host_tim1.CCMR2 = 0;
+    host_tim1.CCER = 0;
+    PHASE_A_PWM();
+    PHASE_B_PWM();
+    PHASE_C_PWM();
+}
+
+/**
+ * @brief  Torque from standstill, with the rotor held at each angle in
+ *         turn. Only the Hall sector is known, so the torque depends on
+ *         where the rotor is in the sector, and on where the Hall sectors
+ *         fall against the six-step vectors.
+ * @param  offset - Hall sector start, revolutions
+ * @param  lo - Lowest torque, as a fraction of the command
+ * @param  hi - Highest
+ */
+static void standstill(float offset, float* lo, float* hi) {
+    *lo = 1e6f;
+    *hi = -1e6f;
+    for(uint32_t deg = 0; deg < 360; deg += 2) {
+        float sum = 0.0f;
+        setup(offset);
+        theta = (float)deg / 360.0f + 0.0001f;
+        for(uint32_t i = 0; i < 200; i++) {
+            motor_isr(IQ_REF);
+            if(i >= 160) {
+                sum += iq_true;
+            }
+        }
+        CHECK(foc == 0);
+        *lo = fminf(*lo, sum / 40.0f / IQ_REF);
+        *hi = fmaxf(*hi, sum / 40.0f / IQ_REF);
+    }
+}
+
+static void test_standstill(void) {
+    float lo, hi;
+    // Hall edges half way between the six-step vectors. Every sector has
+    // a vector 90 degrees ahead of its middle, so this is classic
+    // six-step: within 30 degrees of the q axis.
+    // Hall edges half way between the six-step vectors, which are centered
+    // at 30 + 60*n degrees. Every sector has a vector 90 degrees ahead of
+    // its middle, so this is classic six-step: within 30 degrees of the q
+    // axis.
+    standstill(1.0f / 12.0f, &lo, &hi);
+    CHECK(lo > 0.85f);
+    CHECK(hi < 1.01f);
+    // Edges on the vectors. 90 degrees ahead of the middle is a boundary
+    // between two vectors, so the one it picks is 30 degrees off for half
+    // the sector. Still always pushing the right way, at least half the
+    // torque.
+    standstill(0.0f, &lo, &hi);
+    CHECK(lo > 0.55f);
+    CHECK(hi < 1.2f);
+    printf("standstill torque %.2f to %.2f of the command, worst Hall alignment\n",
+            (double)lo, (double)hi);
+}
+
+/**
+ * @brief  Speeds up through the handover at a steady torque command, and
+ *         compares the torque either side of it
+ */
+static void handover(float offset, float accel) {
+    float before = 0.0f, after = 0.0f;
+    float ripple = 0.0f, step = 0.0f;
+    float hist[40];
+    uint32_t cycle = 0;
+    setup(offset);
+    theta = 0.3f;
+    while((foc == 0) && (cycle < 100000)) {
+        speed += accel / PWM_FREQ;
+        motor_isr(IQ_REF);
+        hist[cycle % 40] = iq_true;
+        cycle++;
+    }
+    CHECK(foc != 0);
+    CHECK(Bldc.Handovers == 1);
+    CHECK(speed > cfg.SpeedToFOC);
+    // Six-step before, the last 2ms of it
+    for(uint32_t i = 0; i < 40; i++) {
+        before += hist[i];
+        ripple = fmaxf(ripple, fabsf(hist[i] - IQ_REF));
+    }
+    before /= 40.0f;
+    // FOC after
+    for(uint32_t i = 0; i < 40; i++) {
+        speed += accel / PWM_FREQ;
+        motor_isr(IQ_REF);
+        after += iq_true;
+        step = fmaxf(step, fabsf(iq_true - IQ_REF));
+        // The output stage is back to three phases of PWM
+        CHECK(leg_mode(0) == LEG_PWM);
+        CHECK(leg_mode(1) == LEG_PWM);
+        CHECK(leg_mode(2) == LEG_PWM);
+    }
+    after /= 40.0f;
+    // No step in the average torque, and nothing during the handover
+    // bigger than the six-step ripple before it
+    CHECK(fabsf(after - before) < 0.05f * IQ_REF);
+    CHECK(step <= ripple + 0.02f * IQ_REF);
+    CHECK(fabsf(after - IQ_REF) < 0.02f * IQ_REF);
+}
+
+static void test_handover(void) {
+    handover(0.0f, 20.0f);
+    handover(1.0f / 12.0f, 20.0f);
+    handover(0.37f, 50.0f);
+}
+
+/**
+ * @brief  Losing the Hall angle goes back to six-step, and it hands over
+ *         again once it's good
+ */
+static void test_fallback(void) {
+    setup(0.0f);
+    speed = 10.0f;
+    for(uint32_t i = 0; (i < 20000) && (foc == 0); i++) {
+        motor_isr(IQ_REF);
+    }
+    CHECK(foc != 0);
+    // Same as the motor interrupt when the Hall angle goes bad
+    BLDC_Fallback();
+    foc = 0;
+    speed = 1.0f;
+    for(uint32_t i = 0; i < 400; i++) {
+        motor_isr(IQ_REF);
+    }
+    CHECK(Bldc.Sector != BLDC_SECTOR_NONE);
+    CHECK(iq_true > 0.5f * IQ_REF);
+    speed = 10.0f;
+    for(uint32_t i = 0; (i < 20000) && (foc == 0); i++) {
+        motor_isr(IQ_REF);
+    }
+    CHECK(foc != 0);
+    CHECK(Bldc.Handovers == 2);
+    CHECK(Bldc.Fallbacks == 1);
+}
+
+int main(void) {
+    test_standstill();
+    test_handover();
+    test_fallback();
+    return host_summary("test_bldc");
+}
@@ -0,0 +1,500 @@
+/******************************************************************************
+ * Filename: test_boot_profile.c
+ * Description: Host test of the startup waits. The ADC and DRV8353 init
+ *              code runs against a model of the peripherals, with a clock
+ *              that moves on at every register access, so each busy wait
+ *              lasts as long as the hardware would make it. The boot
+ *              profile times each step from that clock. Startup is timed
+ *              with the waits overlapped as main() does it, with the same
+ *              code one step after another, and with the waits the code
+ *              used to have.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static DWT_Type* host_clock(void);
+static ADC_TypeDef* host_adc(uint8_t n);
+static ADC_Common_TypeDef* host_adc_common(uint8_t n);
+static SPI_TypeDef* host_spi(void);
+static GPIO_TypeDef host_gpiob, host_gpioc;
+static DMA_Channel_TypeDef host_dma[4];
+static DMAMUX_Channel_TypeDef host_dmamux[4];
+
+#undef DWT
+#define DWT         (host_clock())
+#undef ADC1
+#define ADC1        (host_adc(0))
+#undef ADC2
+#define ADC2        (host_adc(1))
+#undef ADC3
+#define ADC3        (host_adc(2))
+#undef ADC4
+#define ADC4        (host_adc(3))
+#undef ADC12_COMMON
+#define ADC12_COMMON    (host_adc_common(0))
+#undef ADC345_COMMON
+#define ADC345_COMMON   (host_adc_common(1))
+#undef SPI1
+#define SPI1        (host_spi())
+#undef GPIOB
+#define GPIOB       (&host_gpiob)
+#undef GPIOC
+#define GPIOC       (&host_gpioc)
+#undef DMA1_Channel1
+#define DMA1_Channel1       (&host_dma[0])
+#undef DMA1_Channel2
+#define DMA1_Channel2       (&host_dma[1])
+#undef DMA1_Channel3
+#define DMA1_Channel3       (&host_dma[2])
+#undef DMA1_Channel4
+#define DMA1_Channel4       (&host_dma[3])
+#undef DMAMUX1_Channel0
+#define DMAMUX1_Channel0    (&host_dmamux[0])
+#undef DMAMUX1_Channel1
+#define DMAMUX1_Channel1    (&host_dmamux[1])
+#undef DMAMUX1_Channel2
+#define DMAMUX1_Channel2    (&host_dmamux[2])
+#undef DMAMUX1_Channel3
+#define DMAMUX1_Channel3    (&host_dmamux[3])
+
+#include "../src/boot_profile.c"
+#include "../src/adc.c"
+#include "../src/drv8353.c"
+
+// Time the CPU takes for a register access, a rough figure for the
+// peripheral buses at 170MHz. Everything else the CPU does is left out,
+// which is small next to the waits.
+#define ACCESS_CYCLES       (4)
+#define CYCLES_PER_US       (SYS_CLK / 1000000u)
+// From the STM32G4 and DRV8353 datasheets
+#define ADC_CLK_HZ          (42500000u)
+#define ADC_CYCLES          (SYS_CLK / ADC_CLK_HZ) // CPU cycles an ADC clock
+#define ADC_VREG_CYCLES     (20u * CYCLES_PER_US) // tADCVREG_STUP
+#define ADC_CAL_CYCLES      (116u * ADC_CYCLES) // tCAL, single ended
+#define DRV_WAKE_CYCLES     (1000u * CYCLES_PER_US) // tWAKE, enable to SPI ready
+#define SPI_FRAME_CYCLES    (16u * SPI_CLKDIV)
+#define VREFINT_CAL         (1655u) // 1.212V at 3.0V
+#define VREFINT_COUNTS      (1504u) // 1.212V at 3.3V
+// Loading the settings is about 60 searches back through a 2KB page of
+// 8 byte entries. With page erases, the EEPROM emulation takes much
+// longer to start when it has to move the variables to the other page.
+#define EEPROM_LOAD_US      (1000u)
+#define EEPROM_TRANSFER_US  (25000u)
+// What the old code waited for
+#define OLD_VREG_DELAY_MS   (1u) // Delay() for the ADC regulators
+#define OLD_VREF_SAMPLES    (128u) // Software started Vrefint conversions
+#define OLD_DRV_DELAY_MS    (5u) // Delay() after enable and after each write
+
+typedef struct {
+    ADC_TypeDef regs;
+    uint64_t vreg_on; // When ADVREGEN was set, 0 if it's off
+    uint64_t cal_end;
+    uint64_t conv_end;
+    uint8_t calibrating;
+    uint8_t enabled;
+    uint8_t converting;
+    uint32_t calibrations;
+} Host_ADC;
+
+static uint64_t now; // CPU cycles since reset
+static Host_ADC adcs[4];
+static ADC_Common_TypeDef host_common[2];
+static uint8_t dual_set;
+static SPI_TypeDef host_spi_regs;
+static uint16_t chip_reg[DRV_NUM_REGS];
+static uint64_t drv_enabled; // When the enable pin went high
+static uint64_t frame_end;
+static uint8_t frame_busy;
+static uint32_t frames;
+
+// Collaborators that don't take any time here
+void GPIO_Clk(GPIO_TypeDef* gpio) {}
+void GPIO_Output(GPIO_TypeDef* gpio, uint8_t pin) {}
+void GPIO_AF(GPIO_TypeDef* gpio, uint8_t pin, uint8_t af) {}
+void GPIO_Analog(GPIO_TypeDef* gpio, uint8_t pin) {}
+uint16_t EE_SaveFloat(uint16_t VirtAddress, float Data) {
+    return 0;
+}
+void ELOG_Record(uint8_t type, uint32_t code) {}
+
+float EE_ReadFloatWithDefault(uint16_t VirtAddress, float defalt) {
+    return defalt;
+}
+
+static void advance(uint32_t cycles);
+
+uint32_t GetTick(void) {
+    advance(ACCESS_CYCLES);
+    return (uint32_t)(now / (SYS_CLK / 1000u));
+}
+
+/**
+ * @brief  Same as Delay() in delay.c, counting SysTick milliseconds
+ */
+static void host_delay(uint32_t ms) {
+    uint32_t start = GetTick();
+    while((GetTick() - start) < ms) {
+        // pass
+    }
+}
+
+static float sample_cycles(uint32_t smp) {
+    const float cycles[8] = { 2.5f, 6.5f, 12.5f, 24.5f, 47.5f, 92.5f, 247.5f, 640.5f };
+    return cycles[smp & 0x07u];
+}
+
+/**
+ * @brief  One ADC: regulator, calibration, enable and disable, and software
+ *         started conversions of the first channel in the sequence, with
+ *         the oversampler if it's on. ADC_Enable waits for ADRDY through a
+ *         pointer, which the clock doesn't see, so enabling is immediate.
+ *         It only takes about a microsecond.
+ */
+static void adc_step(Host_ADC* a) {
+    ADC_TypeDef* r = &(a->regs);
+    if(((r->CR & ADC_CR_ADVREGEN) != 0) && (a->vreg_on == 0)) {
+        a->vreg_on = now;
+    }
+    if(((r->CR & ADC_CR_ADCAL) != 0) && (a->calibrating == 0)) {
+        // Needs the regulator settled, and the ADC disabled
+        CHECK((r->CR & ADC_CR_DEEPPWD) == 0);
+        CHECK((a->vreg_on != 0) && ((now - a->vreg_on) >= ADC_VREG_CYCLES));
+        CHECK((r->CR & ADC_CR_ADEN) == 0);
+        a->calibrating = 1;
+        a->cal_end = now + ADC_CAL_CYCLES;
+    }
+    if((a->calibrating != 0) && (now >= a->cal_end)) {
+        r->CR &= ~ADC_CR_ADCAL;
+        a->calibrating = 0;
+        a->calibrations++;
+    }
+    if(((r->CR & ADC_CR_ADEN) != 0) && (a->enabled == 0)) {
+        // Calibrated first
+        CHECK(a->calibrations > 0);
+        CHECK(a->calibrating == 0);
+        a->enabled = 1;
+    }
+    if((r->CR & ADC_CR_ADDIS) != 0) {
+        r->CR &= ~(ADC_CR_ADDIS | ADC_CR_ADEN | ADC_CR_ADSTART);
+        a->enabled = 0;
+        a->converting = 0;
+    }
+    r->ISR = (r->ISR & ~ADC_ISR_ADRDY) | ((a->enabled != 0) ? ADC_ISR_ADRDY : 0);
+    if(((r->CR & ADC_CR_ADSTART) != 0) && (a->converting == 0)
+            && ((r->CFGR & ADC_CFGR_EXTEN) == 0)) {
+        uint32_t ch = (r->SQR1 >> ADC_SQR1_SQ1_Pos) & 0x1Fu;
+        uint32_t smp = (ch < 10) ? (r->SMPR1 >> (ch * 3u)) : (r->SMPR2 >> ((ch - 10u) * 3u));
+        uint32_t samples = ((r->CFGR2 & ADC_CFGR2_ROVSE) != 0)
+                ? (2u << ((r->CFGR2 & ADC_CFGR2_OVSR) >> ADC_CFGR2_OVSR_Pos)) : 1u;
+        CHECK(a->enabled != 0);
+        a->converting = 1;
+        a->conv_end = now + (uint64_t)((float)samples * (sample_cycles(smp) + 12.5f) * (float)ADC_CYCLES);
+        r->ISR &= ~ADC_ISR_EOC;
+    }
+    if((a->converting != 0) && (now >= a->conv_end)) {
+        a->converting = 0;
+        r->CR &= ~ADC_CR_ADSTART;
+        r->ISR |= ADC_ISR_EOC;
+        r->DR = VREFINT_COUNTS;
+    }
+}
+
+/**
+ * @brief  The DRV8353 end of the SPI. A frame written to DR goes out once
+ *         the SPI is enabled, and the answer is in after 16 clocks.
+ *         Answers are tagged above the frame bits, to tell them apart
+ *         from a new frame.
+ */
+#define CHIP_ANSWERED       (0x10000u)
+
+static void spi_step(void) {
+    SPI_TypeDef* r = &host_spi_regs;
+    if(((host_gpioc.BSRR & (1u << DRV_EN_PIN)) != 0) && (drv_enabled == 0)) {
+        drv_enabled = now;
+    }
+    if((frame_busy == 0) && (r->DR < CHIP_ANSWERED) && ((r->CR1 & SPI_CR1_SPE) != 0)) {
+        // The chip is awake
+        CHECK((drv_enabled != 0) && ((now - drv_enabled) >= DRV_WAKE_CYCLES));
+        frame_busy = 1;
+        frame_end = now + SPI_FRAME_CYCLES;
+        r->SR &= ~SPI_SR_RXNE;
+    }
+    if((frame_busy != 0) && (now >= frame_end)) {
+        uint16_t frame = (uint16_t)r->DR;
+        uint8_t reg = (frame & DRV_ADDR) >> DRV_ADDR_SHIFT;
+        frame_busy = 0;
+        frames++;
+        r->DR = CHIP_ANSWERED | chip_reg[reg];
+        if((frame & DRV_RW) == 0) {
+            chip_reg[reg] = frame & DRV_DATA;
+        }
+        r->SR |= SPI_SR_RXNE;
+    }
+}
+
+/**
+ * @brief  Moves the clock on, and the peripherals with it
+ */
+static void advance(uint32_t cycles) {
+    now += cycles;
+    for(uint8_t i = 0; i < 4; i++) {
+        adc_step(&adcs[i]);
+    }
+    if(((host_common[0].CCR & ADC_CCR_DUAL) != 0) && (dual_set == 0)) {
+        // Dual mode can only be set with both ADCs disabled
+        CHECK((adcs[0].regs.CR & ADC_CR_ADEN) == 0);
+        CHECK((adcs[1].regs.CR & ADC_CR_ADEN) == 0);
+        dual_set = 1;
+    }
+    spi_step();
+}
+
+static DWT_Type* host_clock(void) {
+    advance(ACCESS_CYCLES);
+    host_dwt.CYCCNT = (uint32_t)now;
+    return &host_dwt;
+}
+
+static ADC_TypeDef* host_adc(uint8_t n) {
+    advance(ACCESS_CYCLES);
+    return &(adcs[n].regs);
+}
+
+static ADC_Common_TypeDef* host_adc_common(uint8_t n) {
+    advance(ACCESS_CYCLES);
+    return &host_common[n];
+}
+
+static SPI_TypeDef* host_spi(void) {
+    advance(ACCESS_CYCLES);
+    return &host_spi_regs;
+}
+
+/**
+ * @brief  Power on reset
+ */
+static void reset(void) {
+    memset(adcs, 0, sizeof(adcs));
+    memset(host_common, 0, sizeof(host_common));
+    memset(&host_spi_regs, 0, sizeof(host_spi_regs));
+    memset(chip_reg, 0, sizeof(chip_reg));
+    host_gpioc.BSRR = 0;
+    for(uint8_t i = 0; i < 4; i++) {
+        adcs[i].regs.CR = ADC_CR_DEEPPWD;
+    }
+    host_spi_regs.DR = CHIP_ANSWERED;
+    dual_set = 0;
+    drv_enabled = 0;
+    frame_busy = 0;
+    frames = 0;
+    adc_vref = 0.0f;
+    // Some time for the clock setup before the profile starts
+    now = 1000;
+}
+
+/**
+ * @brief  Starting the EEPROM emulation and loading the settings. All CPU,
+ *         nothing to wait for.
+ */
+static void eeprom(uint32_t us) {
+    for(uint32_t i = 0; i < us; i++) {
+        advance(CYCLES_PER_US);
+    }
+}
+
+static uint32_t boot_us(Boot_Step step) {
+    return BOOT_GetStatistic(CONFIG_BOOT_STATUS_STEP + step);
+}
+
+/**
+ * @brief  In main()'s order. The DRV8353 wakes up, and the ADCs calibrate
+ *         and measure Vrefint, while the EEPROM loads.
+ */
+static void startup_overlapped(uint32_t eeprom_us) {
+    reset();
+    BOOT_Start();
+    DRV8353_PowerUp();
+    ADC_PowerUp();
+    eeprom(eeprom_us);
+    BOOT_Mark(Boot_Eeprom);
+    ADC_Init();
+    BOOT_Mark(Boot_Adc);
+    DRV8353_Init();
+    BOOT_Mark(Boot_Drv);
+}
+
+/**
+ * @brief  The same code, each step started after the one before is done
+ */
+static void startup_serial(uint32_t eeprom_us) {
+    reset();
+    BOOT_Start();
+    eeprom(eeprom_us);
+    BOOT_Mark(Boot_Eeprom);
+    ADC_PowerUp();
+    ADC_Init();
+    BOOT_Mark(Boot_Adc);
+    DRV8353_PowerUp();
+    DRV8353_Init();
+    BOOT_Mark(Boot_Drv);
+}
+
+/**
+ * @brief  The waits the code had before startup was reworked, in series:
+ *         a Delay() for the ADC regulators, the four calibrations one at
+ *         a time, Vrefint converted 128 times from software, and a
+ *         Delay() after enabling the DRV8353 and after each register
+ *         write. The register setup that didn't change is the current
+ *         code's.
+ */
+static void startup_before(uint32_t eeprom_us) {
+    uint32_t sum = 0;
+    reset();
+    BOOT_Start();
+    eeprom(eeprom_us);
+    BOOT_Mark(Boot_Eeprom);
+
+    ADC1->CR &= ~ADC_CR_DEEPPWD;
+    ADC2->CR &= ~ADC_CR_DEEPPWD;
+    ADC3->CR &= ~ADC_CR_DEEPPWD;
+    ADC4->CR &= ~ADC_CR_DEEPPWD;
+    ADC1->CR |= ADC_CR_ADVREGEN;
+    ADC2->CR |= ADC_CR_ADVREGEN;
+    ADC3->CR |= ADC_CR_ADVREGEN;
+    ADC4->CR |= ADC_CR_ADVREGEN;
+    host_delay(OLD_VREG_DELAY_MS);
+    ADC1->CR |= ADC_CR_ADCAL;
+    while((ADC1->CR & ADC_CR_ADCAL) != 0) {
+    }
+    ADC2->CR |= ADC_CR_ADCAL;
+    while((ADC2->CR & ADC_CR_ADCAL) != 0) {
+    }
+    ADC3->CR |= ADC_CR_ADCAL;
+    while((ADC3->CR & ADC_CR_ADCAL) != 0) {
+    }
+    ADC4->CR |= ADC_CR_ADCAL;
+    while((ADC4->CR & ADC_CR_ADCAL) != 0) {
+    }
+    ADC_Enable(ADC1);
+    ADC1->SMPR2 = (0x06) << ((ADC_VREFINT_CH-10U) * 3U);
+    ADC1->SQR1 = ((ADC_VREFINT_CH) << 6U);
+    for(uint32_t i = 0; i < OLD_VREF_SAMPLES; i++) {
+        ADC1->CR |= ADC_CR_ADSTART;
+        while((ADC1->ISR & ADC_ISR_EOC) == 0) {
+        }
+        ADC1->ISR &= ~(ADC_ISR_EOC);
+        sum += ADC1->DR;
+    }
+    CHECK(sum == (OLD_VREF_SAMPLES * VREFINT_COUNTS));
+    ADC1->ISR |= ADC_ISR_EOC;
+    ADC_Init();
+    BOOT_Mark(Boot_Adc);
+
+    DRV8353_PowerUp();
+    host_delay(OLD_DRV_DELAY_MS);
+    DRV8353_Write(DRVREG_CTRL, DRVBIT_CTRL_OCPACT);
+    host_delay(OLD_DRV_DELAY_MS);
+    DRV8353_Write(DRVREG_GATEH, DRVBIT_GATEH_IDRIVEHS_2 | DRVBIT_GATEH_IDRIVENHS_2);
+    host_delay(OLD_DRV_DELAY_MS);
+    DRV8353_Write(DRVREG_GATEL, DRVBIT_GATEL_CBC | DRVBIT_GATEL_IDRIVELS_2 | DRVBIT_GATEL_IDRIVENLS_2);
+    host_delay(OLD_DRV_DELAY_MS);
+    DRV8353_Write(DRVREG_OCP, DRVBIT_OCP_DEADTIME_0 | DRVBIT_OCP_DEG_1 | DRVBIT_OCP_VDSLVL_3 | DRVBIT_OCP_VDSLVL_0);
+    host_delay(OLD_DRV_DELAY_MS);
+    DRV8353_Write(DRVREG_CSA, DRVBIT_CSA_VREFDIV | DRVBIT_CSA_GAIN_0);
+    host_delay(OLD_DRV_DELAY_MS);
+    for(uint8_t reg = 0; reg < DRV_NUM_REGS; reg++) {
+        Drv_Shadow[reg] = DRV8353_Read(reg) & DRV_DATA;
+    }
+    BOOT_Mark(Boot_Drv);
+}
+
+/**
+ * @brief  The hardware ends up the same way whichever order it's done in
+ */
+static void check_result(void) {
+    const float vref = ADC_FACTORY_CAL_VOLTAGE * (float)VREFINT_CAL / (float)VREFINT_COUNTS;
+    CHECK(fabsf(adc_vref - vref) < 0.001f);
+    for(uint8_t i = 0; i < 4; i++) {
+        CHECK(adcs[i].calibrations == 1);
+        CHECK((adcs[i].regs.CR & ADC_CR_ADEN) != 0);
+        CHECK((adcs[i].regs.ISR & ADC_ISR_ADRDY) != 0);
+    }
+    CHECK(dual_set == 1);
+    CHECK(chip_reg[DRVREG_CTRL] == DRVBIT_CTRL_OCPACT);
+    CHECK(chip_reg[DRVREG_CSA] == (DRVBIT_CSA_VREFDIV | DRVBIT_CSA_GAIN_0));
+    CHECK(Drv_Shadow[DRVREG_OCP] == chip_reg[DRVREG_OCP]);
+    // Five writes and the shadow copy, none of them timed out
+    CHECK(frames == (5u + DRV_NUM_REGS));
+    CHECK(drv_busy == 0);
+}
+
+/**
+ * @brief  Each startup, with a quick EEPROM load and with a page transfer.
+ *         The profile is what CONFIG_BOOT_STATUS_STEP reports, read back
+ *         from the model's clock.
+ */
+static void test_startup(void) {
+    const char* names[3] = { "before", "serial", "overlapped" };
+    void (*const startups[3])(uint32_t) = { startup_before, startup_serial, startup_overlapped };
+    const uint32_t loads[2] = { EEPROM_LOAD_US, EEPROM_TRANSFER_US };
+    uint32_t drv[2][3];
+    for(uint32_t l = 0; l < 2; l++) {
+        printf("EEPROM %5uus     EEPROM    ADC   DRV8353, us from clock setup\n", loads[l]);
+        for(uint32_t s = 0; s < 3; s++) {
+            startups[s](loads[l]);
+            check_result();
+            drv[l][s] = boot_us(Boot_Drv);
+            CHECK(boot_us(Boot_Eeprom) >= loads[l]);
+            CHECK(boot_us(Boot_Adc) >= boot_us(Boot_Eeprom));
+            CHECK(boot_us(Boot_Drv) >= boot_us(Boot_Adc));
+            // The profile comes from the same clock
+            CHECK(boot_us(Boot_Drv) == (uint32_t)((now - 1000 - (2 * ACCESS_CYCLES)) / CYCLES_PER_US));
+            printf("  %-12s %9u %6u %9u\n", names[s], boot_us(Boot_Eeprom), boot_us(Boot_Adc),
+                    boot_us(Boot_Drv));
+        }
+        // The waits are shorter, and overlapping them hides what's left
+        CHECK(drv[l][1] < drv[l][0]);
+        CHECK(drv[l][2] < drv[l][1]);
+    }
+    // With a quick EEPROM load, what's left is the DRV8353 wake time the
+    // driver allows for. With a slow one, the waits are all hidden.
+    CHECK((drv[0][2] - (DRV_WAKE_DELAY_MS * 1000u)) < 100);
+    CHECK((drv[1][2] - EEPROM_TRANSFER_US) < 100);
+}
+
+int main(void) {
+    // The factory Vrefint calibration, where the datasheet puts it
+    uint8_t* page = mmap((void*)(uintptr_t)0x1FFF7000u, 4096, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if(page != (uint8_t*)(uintptr_t)0x1FFF7000u) {
+        printf("test_boot_profile: can't map the system memory at 0x1fff7000\n");
+        return 1;
+    }
+    *(uint16_t*)(page + 0x5AA) = VREFINT_CAL;
+    test_startup();
+    return host_summary("test_boot_profile");
+}
@@ -0,0 +1,241 @@
+/******************************************************************************
+ * Filename: test_cogging.c
+ * Description: Host test of cogging compensation. A rotor with torque
+ *              ripple runs at a steady current, and the table learns from
+ *              the Hall edges the way it does in the motor interrupt. The
+ *              speed ripple is compared before and after learning, one
+ *              harmonic at a time and mixed.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <math.h>
+#include "../src/crc.c"
+#include "../src/cogging.c"
+
+FLASH_Status FLASH_StartErasePage(uint32_t FLASH_Page, uint8_t FLASH_Bank) {
+    return FLASH_COMPLETE;
+}
+
+FLASH_Status FLASH_FinishErase(void) {
+    return FLASH_COMPLETE;
+}
+
+FLASH_Status FLASH_ProgramDoubleWord(uint32_t Address, uint32_t Data1, uint32_t Data2) {
+    return FLASH_COMPLETE;
+}
+
+#define RATE            ((float)DFLT_FOC_PWM_FREQ)
+#define DT              (1.0f / RATE)
+// Rotor in electrical units. The torque ripple is in amps of q axis
+// current, same as the table.
+#define ACCEL           (200.0f) // rad/s^2 per amp
+#define FRICTION        (1.0f) // 1/s
+
+typedef struct {
+    float amps[7]; // By harmonic of the electrical angle, 1 to 6
+    float phase[7];
+} Ripple_Type;
+
+static float theta; // Revolutions
+static float omega; // rad/s
+static float hall_offset;
+static uint8_t state;
+static float edge_time;
+static float time_now;
+static float hall_speed; // eHz, over the last sector
+static float iq_mean; // Holds the speed against friction
+
+static float ripple(const Ripple_Type* r, float angle) {
+    float t = 0.0f;
+    for(uint32_t h = 1; h <= 6; h++) {
+        t += r->amps[h] * sinf((float)h * angle * 2.0f * (float)M_PI + r->phase[h]);
+    }
+    return t;
+}
+
+static uint8_t hall_state(void) {
+    float pos = theta - hall_offset;
+    pos -= floorf(pos);
+    return (uint8_t)(pos * 6.0f) + 1;
+}
+
+static void start(float speed) {
+    theta = 0.0f;
+    omega = 2.0f * (float)M_PI * speed;
+    iq_mean = FRICTION * omega / ACCEL;
+    state = hall_state();
+    edge_time = 0.0f;
+    time_now = 0.0f;
+    hall_speed = speed;
+}
+
+/**
+ * @brief  One PWM cycle. The Hall sector speed is updated on each edge,
+ *         from the time the sector took, same as HALL_GetSectorSpeedF.
+ */
+static void step(const Ripple_Type* r) {
+    float iq = iq_mean + COG_GetOffset(ANGLE_FROM_FLOAT(theta));
+    uint8_t now;
+    COG_Learn(ANGLE_FROM_FLOAT(theta), state, hall_speed, HALL_ROT_FORWARD, ANGLE_VALID);
+    omega += (ACCEL * (iq - ripple(r, theta)) - FRICTION * omega) * DT;
+    theta += omega / (2.0f * (float)M_PI) * DT;
+    theta -= floorf(theta);
+    time_now += DT;
+    now = hall_state();
+    if(now != state) {
+        hall_speed = (1.0f / 6.0f) / (time_now - edge_time);
+        edge_time = time_now;
+        state = now;
+    }
+}
+
+/**
+ * @brief  Runs for a while and measures the speed ripple
+ * @retval Peak to peak speed, relative to the mean
+ */
+static float measure(const Ripple_Type* r, float seconds) {
+    float lo = 1e9f, hi = 0.0f, sum = 0.0f;
+    uint32_t n = (uint32_t)(seconds * RATE);
+    for(uint32_t i = 0; i < n; i++) {
+        step(r);
+        lo = fminf(lo, omega);
+        hi = fmaxf(hi, omega);
+        sum += omega;
+    }
+    return (hi - lo) / (sum / (float)n);
+}
+
+/**
+ * @brief  Ripple with no compensation, then learns and measures it again
+ * @param  r - Torque ripple
+ * @param  speed - Electrical Hz
+ * @param  seconds - How long to learn for
+ * @param  before - Ripple before, relative peak to peak speed
+ * @retval Ripple after
+ */
+static float learn(const Ripple_Type* r, float speed, float seconds, float* before) {
+    COG_Clear();
+    Cog.Enabled = 0;
+    Cog.Learning = 0;
+    start(speed);
+    // Settle, then the ripple with no compensation
+    measure(r, 2.0f);
+    *before = measure(r, 2.0f);
+    COG_StartLearning();
+    measure(r, seconds);
+    COG_StopLearning();
+    measure(r, 1.0f);
+    return measure(r, 2.0f);
+}
+
+static float peak(void) {
+    return (float)COG_GetStatistic(CONFIG_COG_STATUS_PEAK) / 1000.0f;
+}
+
+/**
+ * @brief  One harmonic at a time. Only what the Hall sectors can see is
+ *         learned, and the rest mustn't get much worse.
+ */
+static void test_harmonics(void) {
+    float before, after;
+    // Least the ripple has to come down by, or most it can go up by
+    const float better[7] = { 0.0f, 20.0f, 4.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    const float worse[7] = { 0.0f, 0.0f, 0.0f, 1.1f, 1.5f, 1.25f, 1.1f };
+    for(uint32_t h = 1; h <= 6; h++) {
+        Ripple_Type r = { { 0 }, { 0 } };
+        r.amps[h] = 0.2f;
+        r.phase[h] = 0.3f;
+        after = learn(&r, 10.0f, 40.0f, &before);
+        if(better[h] != 0.0f) {
+            CHECK(after < (before / better[h]));
+        } else {
+            CHECK(after < (before * worse[h]));
+        }
+        printf("harmonic %u: speed ripple %.2f%% before, %.2f%% after, table peak %.3fA\n",
+                h, (double)(100.0f * before), (double)(100.0f * after), (double)peak());
+    }
+}
+
+/**
+ * @brief  The table holds the ripple itself, not just something that
+ *         happens to cancel it
+ */
+static void test_amplitude(void) {
+    float before;
+    Ripple_Type r = { { 0 }, { 0 } };
+    r.amps[1] = 0.2f;
+    r.phase[1] = 1.0f;
+    learn(&r, 10.0f, 40.0f, &before);
+    CHECK(fabsf(peak() - r.amps[1]) < 0.15f * r.amps[1]);
+    // Straight lines between the sector midpoints, so it only follows the
+    // sine so closely
+    for(float a = 0.0f; a < 1.0f; a += 0.01f) {
+        CHECK(fabsf(COG_GetOffset(ANGLE_FROM_FLOAT(a)) - ripple(&r, a)) < 0.15f * r.amps[1]);
+    }
+}
+
+/**
+ * @brief  Converges across the learning window. The loop gain goes as one
+ *         over speed squared, so it's slowest at the top.
+ */
+static void test_speeds(void) {
+    float before, after;
+    Ripple_Type r = { { 0 }, { 0 } };
+    r.amps[1] = 0.2f;
+    r.amps[2] = 0.1f;
+    r.phase[2] = 2.0f;
+    after = learn(&r, COG_LEARN_MIN_SPEED + 1.0f, 40.0f, &before);
+    CHECK(after < (before / 5.0f));
+    printf("%.0f eHz: speed ripple %.2f%% before, %.2f%% after\n", (double)(COG_LEARN_MIN_SPEED + 1.0f),
+            (double)(100.0f * before), (double)(100.0f * after));
+    after = learn(&r, 30.0f, 120.0f, &before);
+    CHECK(after < (before / 3.0f));
+    printf("30 eHz: speed ripple %.2f%% before, %.2f%% after\n", (double)(100.0f * before), (double)(100.0f * after));
+}
+
+/**
+ * @brief  Phase imbalance and Hall placement make first and second
+ *         harmonics, the back EMF shape makes the sixth
+ */
+static void test_mixed(void) {
+    float before, after;
+    Ripple_Type r = { { 0 }, { 0 } };
+    r.amps[1] = 0.1f;
+    r.amps[2] = 0.05f;
+    r.amps[6] = 0.15f;
+    r.phase[1] = 0.5f;
+    r.phase[2] = 2.5f;
+    after = learn(&r, 10.0f, 40.0f, &before);
+    CHECK(after < before);
+    printf("mixed: speed ripple %.2f%% before, %.2f%% after, what's left is the sixth\n",
+            (double)(100.0f * before), (double)(100.0f * after));
+}
+
+int main(void) {
+    test_harmonics();
+    test_amplitude();
+    test_speeds();
+    test_mixed();
+    return host_summary("test_cogging");
+}
@@ -0,0 +1,163 @@
+/******************************************************************************
+ * Filename: test_dashboard.c
+ * Description: Host test of the dashboard values. Road speed has to match
+ *              the speed loop's for the same motor speed, and the phase
+ *              current is shown as RMS. Also times a frame: the samples
+ *              from the speed loop, the 100Hz update and a copy out.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <math.h>
+#include <time.h>
+#include "../src/foc_lib.c"
+#include "../src/speed_control.c"
+#include "../src/dashboard.c"
+
+void CORDIC_CalcSinCos(Angle_Type theta, float* sin, float* cos) {
+    *sin = sinf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+    *cos = cosf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+}
+
+// Offsets of the packed values
+#define DASH_RPM        (4)
+#define DASH_PHASE_AMPS (8)
+#define DASH_VOLTS      (16)
+#define DASH_KMH        (32)
+
+static Config_Main cfg;
+static Main_Snapshot snap;
+static uint8_t data[DASHBOARD_DATA_LENGTH];
+
+static void setup(uint16_t pole_pairs, float gears, float wheel_mm) {
+    cfg.MotorPolePairs = pole_pairs;
+    cfg.inv_pole_pairs = (pole_pairs != 0) ? (1.0f / (float)pole_pairs) : 0.0f;
+    cfg.GearRatio = gears;
+    cfg.WheelSizeMM = wheel_mm;
+    cfg.throttle_limit_scale = 1.0f;
+    SPEED_Init();
+    DASH_Init();
+}
+
+static float value(uint32_t offset) {
+    return data_packet_extract_float(&data[offset]);
+}
+
+/**
+ * @brief  Same speed on the dashboard as the speed loop works with, for a
+ *         geared motor, a hub motor, and before the wheel is set up
+ */
+static void test_speed(void) {
+    const uint16_t pole_pairs[] = { 10, 23, 0, 10 };
+    const float gears[] = { 5.0f, 1.0f, 5.0f, 0.0f };
+    for(uint32_t i = 0; i < 4; i++) {
+        setup(pole_pairs[i], gears[i], 660.0f);
+        for(float ehz = 0.0f; ehz < 500.0f; ehz += 12.5f) {
+            snap.Obv.RotorSpeed_eHz = ehz;
+            SPEED_Process(&cfg, 0.0f, ehz, 0);
+            DASH_Update(&cfg, &snap, 0.0f, 0);
+            DASH_GetData(data);
+            CHECK(value(DASH_KMH) == SPEED_GetSpeedKmh());
+            CHECK(fabsf(value(DASH_RPM) - ehz * 60.0f * cfg.inv_pole_pairs) < 1e-3f);
+        }
+    }
+    // 660mm wheel, 50 electrical turns per wheel turn
+    setup(10, 5.0f, 660.0f);
+    snap.Obv.RotorSpeed_eHz = 200.0f;
+    DASH_Update(&cfg, &snap, 0.0f, 0);
+    DASH_GetData(data);
+    CHECK(fabsf(value(DASH_KMH) - 200.0f / 50.0f * 2.0735f * 3.6f) < 0.01f);
+    CHECK(fabsf(value(DASH_RPM) - 1200.0f) < 1e-3f);
+}
+
+/**
+ * @brief  Filtered values settle where they should
+ */
+static void test_filtered(void) {
+    setup(10, 5.0f, 660.0f);
+    snap.Ctrl.BusVoltage = 48.0f;
+    for(uint32_t n = 0; n < 200; n++) {
+        // A balanced set with 20A peak, sampled by the speed loop
+        for(uint32_t k = 0; k < 20; k++) {
+            DASH_AddCurrentSample(20.0f);
+        }
+        DASH_Update(&cfg, &snap, 5.0f, 0);
+    }
+    DASH_GetData(data);
+    CHECK(fabsf(value(DASH_PHASE_AMPS) - 20.0f * (float)M_SQRT1_2) < 0.01f);
+    CHECK(fabsf(value(DASH_VOLTS) - 48.0f) < 0.01f);
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief  Cost of one 100Hz frame, with the inputs changing so nothing is
+ *         folded away: 20 current samples from the 2kHz speed loop, the
+ *         update in the housekeeping loop, and one copy out as answered
+ *         to REQUEST_DASHBOARD_DATA
+ */
+static void test_cost(void) {
+    uint32_t n = 1000000;
+    volatile uint8_t sink = 0;
+    double t_sample, t_update, t_copy, start;
+
+    setup(10, 5.0f, 660.0f);
+    snap.Ctrl.BusVoltage = 48.0f;
+    start = now();
+    for(uint32_t i = 0; i < n; i++) {
+        DASH_AddCurrentSample(20.0f + (float)(i & 0xF));
+    }
+    t_sample = (now() - start) / n;
+    start = now();
+    for(uint32_t i = 0; i < n; i++) {
+        DASH_AddCurrentSample(20.0f);
+        snap.Obv.RotorSpeed_eHz = 200.0f + (float)(i & 0xF);
+        DASH_Update(&cfg, &snap, 5.0f, i & 0x3);
+    }
+    // Less the sample that keeps the RMS path running
+    t_update = (now() - start) / n - t_sample;
+    start = now();
+    for(uint32_t i = 0; i < n; i++) {
+        DASH_GetData(data);
+        sink += data[i % DASHBOARD_DATA_LENGTH];
+    }
+    t_copy = (now() - start) / n;
+    (void)sink;
+    CHECK(fabsf(value(DASH_VOLTS) - 48.0f) < 0.01f);
+    printf("On this PC a current sample takes %.1fns, an update %.1fns and a copy out %.1fns\n",
+            t_sample * 1e9, t_update * 1e9, t_copy * 1e9);
+    printf("A 100Hz frame with 20 samples costs %.1fns, %.4f%% of the CPU\n",
+            (20.0 * t_sample + t_update + t_copy) * 1e9,
+            100.0 * (20.0 * t_sample + t_update + t_copy) * 100.0);
+}
+
+int main(void) {
+    test_speed();
+    test_filtered();
+    test_cost();
+    return host_summary("test_dashboard");
+}
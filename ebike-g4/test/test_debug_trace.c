@@ -0,0 +1,169 @@
+/******************************************************************************
+ * Filename: test_debug_trace.c
+ * Description: Host test of the debug trace rings, built with tracing on.
+ *              Checks the ring and the download format, the channel mask,
+ *              and what a trace point costs with the channel on, masked
+ *              off, and compiled out.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#define DTRACE_ENABLE   (1)
+#include "host.h"
+#include <time.h>
+#include "../src/debug_trace.c"
+
+#define BENCH_RECORDS   (10000000u)
+
+static uint8_t data[DTRACE_DOWNLOAD_BYTES];
+
+static void reset(void) {
+    for(uint32_t ch = 0; ch < DTRACE_NUM_CHANNELS; ch++) {
+        dtrace_head[ch] = 0;
+    }
+    DTRACE_SetMask(DTRACE_DFLT_MASK);
+}
+
+/**
+ * @brief  Downloads a whole channel the way the host tool does, one packet
+ *         after another from where the last one ended
+ * @retval Records downloaded, the first index is in *first
+ */
+static uint32_t download_all(uint8_t channel, uint32_t* first, uint32_t* arg32s, uint32_t max) {
+    uint32_t index = 0, got = 0, next, end;
+    uint16_t len;
+    *first = 0xFFFFFFFFu;
+    do {
+        len = DTRACE_Download(channel, index, data);
+        next = data_packet_extract_32b(&data[0]);
+        end = data_packet_extract_32b(&data[4]);
+        uint32_t bytes = (uint32_t)len - DTRACE_DOWNLOAD_HEADER_BYTES;
+        uint32_t n = bytes / DTRACE_DOWNLOAD_RECORD_BYTES;
+        CHECK(bytes == n * DTRACE_DOWNLOAD_RECORD_BYTES);
+        CHECK(len <= DTRACE_DOWNLOAD_BYTES);
+        if((n > 0) && (*first == 0xFFFFFFFFu)) {
+            *first = next - n;
+        }
+        for(uint32_t i = 0; i < n; i++) {
+            uint8_t* rec = &data[DTRACE_DOWNLOAD_HEADER_BYTES + i * DTRACE_DOWNLOAD_RECORD_BYTES];
+            CHECK(data_packet_extract_8b(&rec[4]) == channel);
+            if(got < max) {
+                arg32s[got] = data_packet_extract_32b(&rec[8]);
+            }
+            got++;
+        }
+        index = next;
+    } while(index < end);
+    return got;
+}
+
+/**
+ * @brief  Fewer records than the ring holds, then enough to wrap it
+ *         several times. Only the newest ring's worth can be downloaded,
+ *         oldest first, and the other channel is untouched.
+ */
+static void test_ring(void) {
+    uint32_t args[DTRACE_RING_RECORDS], first, n;
+    reset();
+    for(uint32_t i = 0; i < 10; i++) {
+        DTRACE_RECORD(DTRACE_CH_HALL, DTRACE_HALL_EDGE, (uint16_t)i, i);
+    }
+    n = download_all(DTRACE_CH_HALL, &first, args, DTRACE_RING_RECORDS);
+    CHECK(n == 10);
+    CHECK(first == 0);
+    for(uint32_t i = 0; i < 10; i++) {
+        CHECK(args[i] == i);
+    }
+    for(uint32_t i = 10; i < (5 * DTRACE_RING_RECORDS + 3); i++) {
+        DTRACE_RECORD(DTRACE_CH_HALL, DTRACE_HALL_EDGE, (uint16_t)i, i);
+    }
+    n = download_all(DTRACE_CH_HALL, &first, args, DTRACE_RING_RECORDS);
+    CHECK(n == DTRACE_RING_RECORDS);
+    CHECK(first == (4 * DTRACE_RING_RECORDS + 3));
+    for(uint32_t i = 0; i < DTRACE_RING_RECORDS; i++) {
+        CHECK(args[i] == (first + i));
+    }
+    CHECK(download_all(DTRACE_CH_CONTROL, &first, args, DTRACE_RING_RECORDS) == 0);
+    // Past the end, and a channel that doesn't exist
+    CHECK(DTRACE_Download(DTRACE_CH_HALL, 0xFFFFFF00u, data) == DTRACE_DOWNLOAD_HEADER_BYTES);
+    CHECK(DTRACE_Download(DTRACE_NUM_CHANNELS, 0, data) == DTRACE_DOWNLOAD_HEADER_BYTES);
+}
+
+static void test_mask(void) {
+    uint32_t args[4], first;
+    reset();
+    CHECK(DTRACE_SetMask(1u << DTRACE_CH_CONTROL) == RETVAL_OK);
+    DTRACE_RECORD(DTRACE_CH_HALL, DTRACE_HALL_EDGE, 1, 1);
+    DTRACE_RECORD(DTRACE_CH_CONTROL, DTRACE_CTRL_TO_FOC, 2, 2);
+    CHECK(download_all(DTRACE_CH_HALL, &first, args, 4) == 0);
+    CHECK(download_all(DTRACE_CH_CONTROL, &first, args, 4) == 1);
+    CHECK(args[0] == 2);
+    // Channels that don't exist can't be turned on
+    CHECK(DTRACE_SetMask(1u << DTRACE_NUM_CHANNELS) == RETVAL_FAIL);
+    CHECK(DTRACE_GetMask() == (1u << DTRACE_CH_CONTROL));
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief  Time for a Hall edge trace point. With tracing compiled out
+ *         DTRACE_RECORD is an empty statement, which is the loop with no
+ *         trace point at all.
+ */
+static double bench(uint8_t mode) {
+    volatile uint32_t capture = 0;
+    double start = now();
+    for(uint32_t i = 0; i < BENCH_RECORDS; i++) {
+        capture = capture + 1;
+        if(mode != 0) {
+            DTRACE_RECORD(DTRACE_CH_HALL, DTRACE_HALL_EDGE, (uint16_t)capture, i);
+        }
+    }
+    return (now() - start) * 1e9 / (double)BENCH_RECORDS;
+}
+
+static void test_cost(void) {
+    double none, on, off;
+    uint32_t ring_bytes = sizeof(dtrace_ring) + sizeof(dtrace_head) + sizeof(DTrace_Mask);
+    reset();
+    none = bench(0);
+    on = bench(1);
+    DTRACE_SetMask(0);
+    off = bench(1);
+    CHECK(dtrace_head[DTRACE_CH_HALL] == BENCH_RECORDS);
+    // Two rings of 64 twelve byte records, the heads and the mask
+    CHECK(ring_bytes == ((DTRACE_NUM_CHANNELS * DTRACE_RING_RECORDS * 12) + (DTRACE_NUM_CHANNELS * 4) + 4));
+    printf("%u bytes of RAM with tracing on, none compiled out\n", ring_bytes);
+    printf("Hall edge on this PC: %.1fns traced, %.1fns masked off, %.1fns compiled out\n",
+            on, off, none);
+}
+
+int main(void) {
+    test_ring();
+    test_mask();
+    test_cost();
+    return host_summary("test_debug_trace");
+}
@@ -0,0 +1,467 @@
+/******************************************************************************
+ * Filename: test_deferred_log.c
+ * Description: Host test of the deferred logger. Records go in from the
+ *              main loop and from a writer preempted partway, come out in
+ *              download packets, and the cost of a log call is measured.
+ *              Given a directory, it also writes what the firmware would
+ *              send and what tools/dlog_format.py should print for it,
+ *              which test_dlog_format.py checks.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "../src/deferred_log.c"
+
+// Only inline in the header, this makes the linkable copies
+extern void data_packet_pack_32b(uint8_t* array, uint32_t value);
+extern uint32_t data_packet_extract_32b(uint8_t* array);
+
+#define BENCH_CALLS     (10000000u)
+#define MAX_RECORDS     (DLOG_RING_WORDS / 2)
+#define MAX_MESSAGE     (120)
+
+typedef struct {
+    uint32_t id;
+    uint8_t nargs;
+    uint32_t cycles;
+    uint32_t args[DLOG_MAX_ARGS];
+} Record_Type;
+
+static uint8_t data[DLOG_DOWNLOAD_BYTES];
+static uint16_t data_len;
+static Record_Type records[MAX_RECORDS];
+
+static void reset(void) {
+    memset(dlog_ring, 0, sizeof(dlog_ring));
+    dlog_head = 0;
+    dlog_tail = 0;
+    dlog_dropped = 0;
+}
+
+/**
+ * @brief  One download packet, split back into records the way the host
+ *         tool does it
+ * @param  n - Number of records in it
+ * @retval Dropped count from the packet
+ */
+static uint32_t download(uint32_t* n) {
+    uint16_t len = DLOG_Download(data);
+    data_len = len;
+    uint32_t place = DLOG_DOWNLOAD_HEADER_BYTES;
+    CHECK(len <= DLOG_DOWNLOAD_BYTES);
+    CHECK((len % 4) == 0);
+    *n = 0;
+    while((place + 8) <= len) {
+        uint32_t header = data_packet_extract_32b(&data[place]);
+        Record_Type* r = &records[*n % MAX_RECORDS];
+        CHECK((header & DLOG_HEADER_VALID) != 0);
+        r->id = header >> DLOG_HEADER_ID_SHIFT;
+        r->nargs = header & DLOG_HEADER_NARGS_MASK;
+        r->cycles = data_packet_extract_32b(&data[place + 4]);
+        CHECK(r->nargs <= DLOG_MAX_ARGS);
+        for(uint32_t i = 0; i < r->nargs; i++) {
+            r->args[i] = data_packet_extract_32b(&data[place + 8 + 4 * i]);
+        }
+        place += 8 + 4 * r->nargs;
+        (*n)++;
+    }
+    // Whole records only
+    CHECK(place == len);
+    return data_packet_extract_32b(&data[0]);
+}
+
+static uint8_t ring_clear(void) {
+    for(uint32_t i = 0; i < DLOG_RING_WORDS; i++) {
+        if(dlog_ring[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief  Each number of arguments, and the cycle count and string ID
+ *         that go with them
+ */
+static void test_records(void) {
+    uint32_t n;
+    const uint32_t too_many[6] = { 1, 2, 3, 4, 5, 6 };
+    reset();
+    for(uint32_t i = 0; i < 2; i++) {
+        host_dwt.CYCCNT = 1000 + i;
+        DLOG("No arguments");
+    }
+    DLOG("One %u", 11u);
+    DLOG("Two %u %d", 21u, (uint32_t)-22);
+    DLOG("Three %u %u %f", 31u, 32u, DLOG_Float(3.3f));
+    DLOG("Four %u %u %u %c", 41u, 42u, 43u, (uint32_t)'d');
+    DLOG_Write(0x123456u, too_many, 6);
+    CHECK(download(&n) == 0);
+    CHECK(n == 7);
+    CHECK(records[0].cycles == 1000);
+    CHECK(records[1].cycles == 1001);
+    // Same call, same string
+    CHECK(records[0].id == records[1].id);
+    for(uint32_t i = 0; i < 5; i++) {
+        CHECK(records[i + 1].nargs == i);
+        if(i >= 1) {
+            CHECK(records[i + 1].id != records[i].id);
+            CHECK(records[i + 1].args[0] == ((10 * i) + 1));
+        }
+    }
+    CHECK(records[3].args[1] == (uint32_t)-22);
+    CHECK(records[4].args[2] == DLOG_Float(3.3f));
+    CHECK(records[5].args[3] == 'd');
+    // Anything past four arguments is left off
+    CHECK(records[6].id == 0x123456u);
+    CHECK(records[6].nargs == DLOG_MAX_ARGS);
+    CHECK(records[6].args[3] == 4);
+    CHECK(ring_clear());
+    // Nothing more to send, just the dropped count
+    CHECK(DLOG_Download(data) == DLOG_DOWNLOAD_HEADER_BYTES);
+}
+
+/**
+ * @brief  Fills the ring, then runs records across its end many times.
+ *         Records that don't fit are counted and reported once.
+ */
+static void test_full(void) {
+    uint32_t n, total = 0, dropped = 0, next = 0;
+    reset();
+    for(uint32_t i = 0; i < (MAX_RECORDS + 5); i++) {
+        DLOG("Fill %u", i);
+    }
+    // Three words a record
+    CHECK(dlog_dropped == (MAX_RECORDS + 5 - (DLOG_RING_WORDS / 3)));
+    do {
+        dropped += download(&n);
+        for(uint32_t i = 0; i < n; i++) {
+            CHECK(records[i].args[0] == (total + i));
+        }
+        total += n;
+    } while(n > 0);
+    CHECK(total == (DLOG_RING_WORDS / 3));
+    CHECK(dropped == (MAX_RECORDS + 5 - total));
+    CHECK(ring_clear());
+
+    // Five words a record, so they land all over the ring
+    for(uint32_t round = 0; round < 50; round++) {
+        for(uint32_t i = 0; i < 37; i++) {
+            DLOG("Wrap %u %u %u", round, i, ~i);
+        }
+        do {
+            CHECK(download(&n) == 0);
+            for(uint32_t i = 0; i < n; i++) {
+                CHECK(records[i].args[0] == round);
+                CHECK(records[i].args[1] == (next % 37));
+                CHECK(records[i].args[2] == ~(next % 37));
+                next++;
+            }
+        } while(n > 0);
+    }
+    CHECK(next == (50 * 37));
+    CHECK(ring_clear());
+}
+
+/**
+ * @brief  A packet takes as many whole records as fit, and the next one
+ *         carries on from there
+ */
+static void test_paging(void) {
+    uint32_t n, packets = 0, total = 0;
+    reset();
+    for(uint32_t i = 0; i < 80; i++) {
+        DLOG("Page %u %u %u %u", i, 0u, 0u, 0u);
+    }
+    do {
+        download(&n);
+        if(n > 0) {
+            // Six words a record
+            CHECK(n == ((total + (DLOG_DOWNLOAD_WORDS / 6)) <= 80 ? (DLOG_DOWNLOAD_WORDS / 6) : (80 - total)));
+            CHECK(records[0].args[0] == total);
+            packets++;
+        }
+        total += n;
+    } while(n > 0);
+    CHECK(total == 80);
+    CHECK(packets == ((80 + (DLOG_DOWNLOAD_WORDS / 6) - 1) / (DLOG_DOWNLOAD_WORDS / 6)));
+}
+
+/**
+ * @brief  The writer is preempted between reserving its space and putting
+ *         the header in, which is the only barrier it has. The interrupt
+ *         logs a record of its own and then the main loop downloads: the
+ *         reader has to stop at the unfinished record, and pick it up, and
+ *         the one after it, on the next download.
+ */
+static uint32_t preempted_n;
+
+static void preempt_isr(void) {
+    // The barriers in the interrupt's own calls don't count
+    host_barrier_hook = NULL;
+    DLOG("Interrupt %u", 2u);
+    CHECK(download(&preempted_n) == 0);
+}
+
+static void test_preempted(void) {
+    uint32_t n;
+    reset();
+    DLOG("Before %u", 0u);
+    host_barrier_hook = preempt_isr;
+    DLOG("Preempted %u", 1u);
+    CHECK(host_barrier_hook == NULL);
+    CHECK(preempted_n == 1);
+    download(&n);
+    CHECK(n == 2);
+    CHECK(records[0].args[0] == 1);
+    CHECK(records[1].args[0] == 2);
+    CHECK(records[0].id != records[1].id);
+    CHECK(ring_clear());
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief  Time for one log call with each number of arguments. The reader
+ *         is skipped forward without looking, so the ring never fills.
+ */
+static double bench(uint8_t nargs) {
+    volatile uint32_t value = 0;
+    double start;
+    reset();
+    start = now();
+    for(uint32_t i = 0; i < BENCH_CALLS; i++) {
+        switch(nargs) {
+        case 0:
+            DLOG("Bench");
+            break;
+        case 1:
+            DLOG("Bench %u", value);
+            break;
+        case 2:
+            DLOG("Bench %u %u", value, i);
+            break;
+        case 3:
+            DLOG("Bench %u %u %u", value, i, value);
+            break;
+        default:
+            DLOG("Bench %u %u %u %u", value, i, value, i);
+            break;
+        }
+        if((i & 31) == 31) {
+            dlog_tail = dlog_head;
+        }
+    }
+    return (now() - start) * 1e9 / (double)BENCH_CALLS;
+}
+
+static void test_cost(void) {
+    double ns[DLOG_MAX_ARGS + 1], full, drain;
+    uint32_t n, total = 0, ring_bytes = sizeof(dlog_ring) + sizeof(dlog_head) + sizeof(dlog_tail)
+            + sizeof(dlog_dropped);
+    double start;
+    for(uint8_t i = 0; i <= DLOG_MAX_ARGS; i++) {
+        ns[i] = bench(i);
+    }
+    // A call that finds the ring full only counts itself
+    reset();
+    dlog_head = DLOG_RING_WORDS;
+    start = now();
+    for(uint32_t i = 0; i < BENCH_CALLS; i++) {
+        DLOG("Bench %u", i);
+    }
+    full = (now() - start) * 1e9 / (double)BENCH_CALLS;
+    CHECK(dlog_dropped == BENCH_CALLS);
+    // Writing and downloading, as fast as the main loop could empty it
+    reset();
+    start = now();
+    while(total < BENCH_CALLS) {
+        for(uint32_t i = 0; i < (DLOG_DOWNLOAD_WORDS / 3); i++) {
+            DLOG("Bench %u", i);
+        }
+        download(&n);
+        total += n;
+    }
+    drain = (now() - start) / (double)total;
+    CHECK(dlog_dropped == 0);
+    CHECK(ring_bytes == ((DLOG_RING_WORDS * 4) + 12));
+    printf("%u bytes of RAM, records of 8 bytes plus 4 an argument\n", ring_bytes);
+    printf("Log call on this PC: %.1f/%.1f/%.1f/%.1f/%.1fns with 0 to 4 arguments, %.1fns dropped\n",
+            ns[0], ns[1], ns[2], ns[3], ns[4], full);
+    printf("Logged and downloaded: %.1f million one argument records a second\n", 1e-6 / drain);
+}
+
+/**
+ * @brief  What the host tool should print for each record, kept in the
+ *         order they were logged. The tool prints the time since the
+ *         first record and the message.
+ */
+static char messages[MAX_RECORDS][MAX_MESSAGE];
+static uint32_t logged;
+static uint32_t expect_head;
+static FILE* strings_file;
+
+static void expect(const char* fmt, ...) {
+    va_list args;
+    uint32_t header = dlog_ring[expect_head & (DLOG_RING_WORDS - 1)];
+    static uint32_t ids[MAX_RECORDS];
+    static uint32_t num_ids;
+    uint32_t id = header >> DLOG_HEADER_ID_SHIFT;
+    uint32_t i;
+    CHECK((header & DLOG_HEADER_VALID) != 0);
+    expect_head += 2 + (header & DLOG_HEADER_NARGS_MASK);
+    va_start(args, fmt);
+    vsnprintf(messages[logged % MAX_RECORDS], MAX_MESSAGE, fmt, args);
+    va_end(args);
+    logged++;
+    // Each string once, what the tool reads out of the ELF file
+    for(i = 0; (i < num_ids) && (ids[i] != id); i++) {
+    }
+    if(i == num_ids) {
+        ids[num_ids++] = id;
+        fprintf(strings_file, "%06x\t%s\n", id, fmt);
+    }
+}
+
+/**
+ * @brief  Downloads everything. Each packet is written the way the
+ *         firmware sends it, and the lines the tool should print for it
+ *         go alongside.
+ */
+static uint32_t shown, last_cycles;
+static uint64_t elapsed;
+
+static void download_to(FILE* log, FILE* expected) {
+    uint32_t n, dropped;
+    for(;;) {
+        dropped = download(&n);
+        if((n == 0) && (dropped == 0)) {
+            break;
+        }
+        for(uint32_t i = 0; i < data_len; i++) {
+            fprintf(log, "%02x", data[i]);
+        }
+        fprintf(log, "\n");
+        if(dropped != 0) {
+            fprintf(expected, "%14s  %u records dropped, the ring was full\n", "", dropped);
+        }
+        for(uint32_t i = 0; i < n; i++) {
+            if(shown != 0) {
+                elapsed += records[i].cycles - last_cycles;
+            }
+            last_cycles = records[i].cycles;
+            fprintf(expected, "%12.6fs  %s\n", (double)elapsed / (double)SYS_CLK,
+                    messages[shown % MAX_RECORDS]);
+            shown++;
+        }
+    }
+}
+
+/**
+ * @brief  Conversions the firmware uses, the cycle counter wrapping, more
+ *         than a packet's worth, and records dropped. The host printf
+ *         formats each message from the real values here, and the tool
+ *         has to match it from the raw words.
+ * @param  dir - Where to write strings.txt (ID and string, as the tool
+ *         would read them from the ELF file), log.txt (packets, as hex)
+ *         and expected.txt (what the tool should print)
+ */
+static void test_roundtrip(const char* dir) {
+    char path[256];
+    FILE *log, *expected;
+    uint32_t i;
+    snprintf(path, sizeof(path), "%s/strings.txt", dir);
+    strings_file = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s/log.txt", dir);
+    log = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s/expected.txt", dir);
+    expected = fopen(path, "w");
+    CHECK((strings_file != NULL) && (log != NULL) && (expected != NULL));
+    if((strings_file == NULL) || (log == NULL) || (expected == NULL)) {
+        return;
+    }
+    reset();
+    expect_head = 0;
+    // Wraps a second in
+    host_dwt.CYCCNT = 0xFFFFFFFFu - SYS_CLK;
+    DLOG("Motor ID failed in state %lu, error %lu", 3u, 0x10u);
+    expect("Motor ID failed in state %lu, error %lu", 3ul, 0x10ul);
+    host_dwt.CYCCNT += SYS_CLK / 2;
+    DLOG("Motor ID: R %f ohm, Ld %f H, Lq %f H, flux %f Wb", DLOG_Float(0.095f),
+            DLOG_Float(190e-6f), DLOG_Float(210e-6f), DLOG_Float(0.0123f));
+    expect("Motor ID: R %f ohm, Ld %f H, Lq %f H, flux %f Wb", (double)0.095f,
+            (double)190e-6f, (double)210e-6f, (double)0.0123f);
+    host_dwt.CYCCNT += SYS_CLK;
+    DLOG("Fault 0x%08x at %d rpm, %.2fV", 0x40u, (uint32_t)-1250, DLOG_Float(-3.5f));
+    expect("Fault 0x%08x at %d rpm, %.2fV", 0x40u, -1250, (double)-3.5f);
+    host_dwt.CYCCNT += 12345;
+    DLOG("Hall %c%c%c, %5u", (uint32_t)'1', (uint32_t)'0', (uint32_t)'1', 42u);
+    expect("Hall %c%c%c, %5u", '1', '0', '1', 42u);
+    DLOG("|%-5d|%+d|%#x|", (uint32_t)-7, 7u, 255u);
+    expect("|%-5d|%+d|%#x|", -7, 7, 255u);
+    DLOG("Speed %.1e eHz, %g%% duty, %X %o", DLOG_Float(1234.5f), DLOG_Float(0.25f), 0xBEEFu, 8u);
+    expect("Speed %.1e eHz, %g%% duty, %X %o", (double)1234.5f, (double)0.25f, 0xBEEFu, 8u);
+    DLOG("Startup done");
+    expect("Startup done");
+    // More than a packet
+    for(i = 0; i < 60; i++) {
+        host_dwt.CYCCNT += 1700 * i;
+        DLOG("Step %u of %u", i, 60u);
+        expect("Step %u of %u", i, 60u);
+    }
+    download_to(log, expected);
+    // Then fill the ring, the rest are dropped
+    for(i = 0; i < (DLOG_RING_WORDS / 3); i++) {
+        host_dwt.CYCCNT += 170;
+        DLOG("Fill %u", i);
+        expect("Fill %u", i);
+    }
+    for(i = 0; i < 9; i++) {
+        DLOG("Dropped %u", i);
+    }
+    download_to(log, expected);
+    CHECK(shown == logged);
+    fclose(strings_file);
+    fclose(log);
+    fclose(expected);
+}
+
+int main(int argc, char* argv[]) {
+    test_records();
+    test_full();
+    test_paging();
+    test_preempted();
+    if(argc > 1) {
+        test_roundtrip(argv[1]);
+    } else {
+        test_cost();
+    }
+    return host_summary("test_deferred_log");
+}
@@ -0,0 +1,319 @@
+/******************************************************************************
+ * Filename: test_derating.c
+ * Description: Host test of the derating engine. Bus voltage, temperatures
+ *              and currents are driven through ramps at the speed loop
+ *              rate, and the limit scale and reason code are checked
+ *              against the soft and hard limits.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <math.h>
+#include <time.h>
+#include "../src/foc_lib.c"
+#include "../src/derating.c"
+
+void CORDIC_CalcSinCos(Angle_Type theta, float* sin, float* cos) {
+    *sin = sinf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+    *cos = cosf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+}
+
+#define RATE            (2000) // Speed loop calls per second
+#define STEP_UP         (DERATE_RECOVERY_RATE / RATE) // Fastest recovery per call
+#define NORMAL_VBUS     (12.0f) // Bench supply, the soft cap is 10V
+#define NORMAL_TEMP     (30.0f)
+
+static Config_Main cfg;
+
+// Present inputs, held between calls
+static float vbus;
+static float fet_temp;
+static float motor_temp;
+static float phase_current;
+static float batt_current;
+
+static float step(void) {
+    return DERATE_Process(&cfg, vbus, fet_temp, motor_temp, phase_current, batt_current);
+}
+
+static void run_ms(uint32_t ms) {
+    for(uint32_t i = 0; i < ms * RATE / 1000; i++) {
+        step();
+    }
+}
+
+/**
+ * @brief  Moves one input linearly to a new value over a time, checking
+ *         the recovery rate limit on every call
+ */
+static void ramp(float* input, float to, uint32_t ms) {
+    uint32_t n = ms * RATE / 1000;
+    float from = *input;
+    float last = DERATE_GetScale();
+    for(uint32_t i = 1; i <= n; i++) {
+        *input = from + (to - from) * (float)i / (float)n;
+        float scale = step();
+        CHECK(scale - last <= STEP_UP * 1.001f);
+        CHECK((scale >= 0.0f) && (scale <= 1.0f));
+        last = scale;
+    }
+}
+
+static void setup(void) {
+    cfg.VoltageSoftCap = DFLT_LMT_VOLT_SOFTCAP;
+    cfg.VoltageHardCap = DFLT_LMT_VOLT_HARDCAP;
+    cfg.FetTempSoftCap = DFLT_LMT_FET_TEMP_SOFTCAP;
+    cfg.FetTempHardCap = DFLT_LMT_FET_TEMP_HARDCAP;
+    cfg.MotorTempSoftCap = DFLT_LMT_MOTOR_TEMP_SOFTCAP;
+    cfg.MotorTempHardCap = DFLT_LMT_MOTOR_TEMP_HARDCAP;
+    cfg.MaxPhaseCurrent = DFLT_LMT_PHASE_CUR_MAX;
+    cfg.CurrentFault = DFLT_LMT_CUR_FAULT_MAX;
+    cfg.MaxBatteryCurrent = DFLT_LMT_BATT_CUR_MAX;
+    cfg.throttle_limit_scale = -1.0f;
+    cfg.regen_limit_scale = -1.0f;
+    vbus = NORMAL_VBUS;
+    fet_temp = NORMAL_TEMP;
+    motor_temp = NORMAL_TEMP;
+    phase_current = 0.0f;
+    batt_current = 0.0f;
+    DERATE_Init();
+}
+
+static void test_startup(void) {
+    setup();
+    CHECK(DERATE_GetScale() == 0.0f);
+    // The filters start at the first readings, so nothing reads as a
+    // dead battery or a frozen FET while they settle. Float rounding of
+    // the coefficients leaves the DC gain a little off one.
+    step();
+    CHECK(fabsf(Derate_Filt.Y[DERATE_FILT_VBUS] - NORMAL_VBUS) < 0.01f);
+    CHECK(fabsf(Derate_Filt.Y[DERATE_FILT_FET_TEMP] - NORMAL_TEMP) < 0.01f);
+    CHECK(fabsf(Derate_Filt.Y[DERATE_FILT_MOTOR_TEMP] - NORMAL_TEMP) < 0.01f);
+    CHECK(DERATE_GetReason() == Main_Limit_None);
+    CHECK(cfg.throttle_limit_scale == DERATE_GetScale());
+    CHECK(cfg.regen_limit_scale == DERATE_GetRegenScale());
+
+    // Current comes in at 0.5 per second
+    ramp(&vbus, NORMAL_VBUS, 999);
+    CHECK(fabsf(DERATE_GetScale() - 0.5f) < 0.001f);
+    CHECK(DERATE_GetReason() == Main_Limit_None);
+    ramp(&vbus, NORMAL_VBUS, 1001);
+    CHECK(DERATE_GetScale() == 1.0f);
+    for(uint8_t ch = 0; ch < DERATE_FILT_CHANNELS; ch++) {
+        CHECK(fabsf(Derate_Filt.Y[ch] - Derate_Filt.X[ch]) < 0.01f);
+    }
+}
+
+static void test_thermal(void) {
+    setup();
+    run_ms(2000);
+    // A slow climb past the soft cap, a minute from 30 to 95 degC. The
+    // scale follows the ramp down from 75 to 90 degC without delay.
+    uint32_t n = 60 * RATE;
+    float from = fet_temp;
+    for(uint32_t i = 1; i <= n; i++) {
+        fet_temp = from + (95.0f - from) * (float)i / (float)n;
+        float scale = step();
+        float expect = (DFLT_LMT_FET_TEMP_HARDCAP - fet_temp)
+                / (DFLT_LMT_FET_TEMP_HARDCAP - DFLT_LMT_FET_TEMP_SOFTCAP);
+        expect = fminf(fmaxf(expect, 0.0f), 1.0f);
+        // The 5Hz filter lags about 0.05 degC behind this ramp
+        CHECK(fabsf(scale - expect) < 0.01f);
+        // Regen is derated for temperature too
+        CHECK(cfg.regen_limit_scale == scale);
+        if(fet_temp < 74.9f) {
+            CHECK(DERATE_GetReason() == Main_Limit_None);
+        } else if((fet_temp > 75.1f) && (fet_temp < 89.9f)) {
+            CHECK(DERATE_GetReason() == Main_Limit_SoftFetTemp);
+        } else if(fet_temp > 90.1f) {
+            CHECK(DERATE_GetReason() == Main_Limit_HardFetTemp);
+        }
+    }
+    CHECK(DERATE_GetScale() == 0.0f);
+
+    // Cooling quickly back to normal. The recovery is rate limited and
+    // the hard cap stays the reason until the scale is back to one.
+    ramp(&fet_temp, 60.0f, 200);
+    CHECK(DERATE_GetScale() <= 0.1f + 1e-4f);
+    CHECK(DERATE_GetReason() == Main_Limit_HardFetTemp);
+    ramp(&fet_temp, 60.0f, 1700);
+    CHECK(DERATE_GetScale() < 1.0f);
+    CHECK(DERATE_GetReason() == Main_Limit_HardFetTemp);
+    ramp(&fet_temp, 60.0f, 200);
+    CHECK(DERATE_GetScale() == 1.0f);
+    CHECK(DERATE_GetReason() == Main_Limit_None);
+}
+
+static void test_temperature_noise(void) {
+    setup();
+    fet_temp = 85.0f;
+    run_ms(3000);
+    float settled = DERATE_GetScale();
+    CHECK(fabsf(settled - (1.0f / 3.0f)) < 0.001f);
+    // A single bad conversion far past the hard cap doesn't cut the
+    // current. Without the filter this would be zero.
+    fet_temp = 150.0f;
+    step();
+    fet_temp = 85.0f;
+    float scale = step();
+    CHECK(scale > 0.25f);
+    run_ms(500);
+    CHECK(DERATE_GetReason() == Main_Limit_SoftFetTemp);
+}
+
+static void test_battery_sag(void) {
+    setup();
+    run_ms(2000);
+    // The battery sags to halfway between the caps under load. The limit
+    // follows the 20Hz voltage filter straight down, including its small
+    // undershoot, and then recovers from that at the limited rate.
+    vbus = 9.0f;
+    run_ms(50);
+    CHECK(DERATE_GetScale() < 0.5f);
+    CHECK(DERATE_GetReason() == Main_Limit_SoftVoltage);
+    run_ms(450);
+    CHECK(fabsf(DERATE_GetScale() - 0.5f) < 0.01f);
+    CHECK(DERATE_GetReason() == Main_Limit_SoftVoltage);
+    // Braking charges the battery, so a low one doesn't limit regen
+    CHECK(cfg.regen_limit_scale == 1.0f);
+
+    // The motor heats up far enough to take over as the lowest limit
+    ramp(&motor_temp, 85.0f, 1000);
+    run_ms(200);
+    CHECK(fabsf(DERATE_GetScale() - (1.0f / 3.0f)) < 0.01f);
+    CHECK(DERATE_GetReason() == Main_Limit_SoftMotorTemp);
+    CHECK(cfg.regen_limit_scale == DERATE_GetScale());
+
+    // When it cools, the scale climbs back to the voltage limit. The motor
+    // keeps the blame until then, and then hands it back.
+    ramp(&motor_temp, NORMAL_TEMP, 100);
+    CHECK(DERATE_GetReason() == Main_Limit_SoftMotorTemp);
+    run_ms(300);
+    CHECK(fabsf(DERATE_GetScale() - 0.5f) < 0.01f);
+    CHECK(DERATE_GetReason() == Main_Limit_SoftVoltage);
+    // Regen keeps climbing past that, at the same rate
+    run_ms(1500);
+    CHECK(cfg.regen_limit_scale == 1.0f);
+
+    // A deep sag past the hard cap
+    ramp(&vbus, 7.5f, 100);
+    run_ms(100);
+    CHECK(DERATE_GetScale() == 0.0f);
+    CHECK(DERATE_GetReason() == Main_Limit_HardVoltage);
+    CHECK(cfg.regen_limit_scale == 1.0f);
+
+    // The load comes off and the battery recovers
+    ramp(&vbus, NORMAL_VBUS, 100);
+    ramp(&vbus, NORMAL_VBUS, 1900);
+    CHECK(DERATE_GetScale() < 1.0f);
+    CHECK(DERATE_GetReason() == Main_Limit_HardVoltage);
+    ramp(&vbus, NORMAL_VBUS, 200);
+    CHECK(DERATE_GetScale() == 1.0f);
+    CHECK(DERATE_GetReason() == Main_Limit_None);
+}
+
+static void test_currents(void) {
+    setup();
+    run_ms(2000);
+    // Battery current is a backup to the fast limiter, from the limit to
+    // 25% over it
+    batt_current = DFLT_LMT_BATT_CUR_MAX;
+    CHECK(step() == 1.0f);
+    batt_current = DFLT_LMT_BATT_CUR_MAX * 1.125f;
+    CHECK(fabsf(step() - 0.5f) < 1e-4f);
+    CHECK(DERATE_GetReason() == Main_Limit_BattCurrent);
+    batt_current = DFLT_LMT_BATT_CUR_MAX * 1.5f;
+    CHECK(step() == 0.0f);
+    CHECK(DERATE_GetReason() == Main_Limit_BattCurrent);
+    CHECK(cfg.regen_limit_scale == 1.0f);
+    batt_current = 0.0f;
+
+    // Phase current isn't filtered, from the max to the fault level
+    phase_current = (DFLT_LMT_PHASE_CUR_MAX + DFLT_LMT_CUR_FAULT_MAX) / 2.0f;
+    CHECK(step() <= STEP_UP * 1.001f); // Still recovering from zero
+    run_ms(2000);
+    CHECK(fabsf(DERATE_GetScale() - 0.5f) < 1e-4f);
+    CHECK(DERATE_GetReason() == Main_Limit_PhaseCurrent);
+    phase_current = DFLT_LMT_CUR_FAULT_MAX;
+    CHECK(step() == 0.0f);
+    CHECK(DERATE_GetReason() == Main_Limit_CurrentFault);
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief  Time a call with the inputs changing, so nothing is folded away
+ * @param  input - Input moved by a small amount on every call
+ * @retval Seconds a call
+ */
+static double time_calls(float* input) {
+    uint32_t n = 2000000;
+    float base = *input;
+    volatile float sink = 0.0f;
+    double start = now();
+    for(uint32_t i = 0; i < n; i++) {
+        *input = base + (float)(i & 0xF) * 0.01f;
+        sink += step();
+    }
+    double t = (now() - start) / n;
+    *input = base;
+    (void)sink;
+    return t;
+}
+
+/**
+ * @brief  Cost of the update in the 2kHz group, with nothing limiting and
+ *         with every soft limit active at once so each source's ramp and
+ *         reason check run
+ */
+static void test_cost(void) {
+    setup();
+    run_ms(2000);
+    double idle = time_calls(&vbus);
+    vbus = 9.0f;
+    fet_temp = 80.0f;
+    motor_temp = 85.0f;
+    phase_current = DFLT_LMT_PHASE_CUR_MAX + 1.0f;
+    batt_current = DFLT_LMT_BATT_CUR_MAX * 1.1f;
+    run_ms(2000);
+    CHECK(DERATE_GetScale() < 1.0f);
+    double limiting = time_calls(&fet_temp);
+    CHECK(DERATE_GetScale() < 1.0f);
+    printf("On this PC a derating update takes %.1fns, %.1fns while limiting, "
+            "%.3f%% of the 2kHz period\n", idle * 1e9, limiting * 1e9,
+            100.0 * limiting * RATE);
+}
+
+int main(void) {
+    test_startup();
+    test_thermal();
+    test_temperature_noise();
+    test_battery_sag();
+    test_currents();
+    test_cost();
+    return host_summary("test_derating");
+}
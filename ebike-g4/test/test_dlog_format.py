@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+###############################################################################
+# Filename: test_dlog_format.py
+# Description: Round trip of the deferred logger. test_deferred_log writes
+#              the records the firmware would send and the strings they
+#              point to. Those strings go into the .dlog_fmt section of a
+#              32-bit ELF file, tools/dlog_format.py decodes the packets
+#              with it, and what it prints has to match what the host
+#              printf made of the same values.
+###############################################################################
+#
+# Copyright (c) 2020 David Miller
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+TOOL = os.path.join(HERE, '..', 'tools', 'dlog_format.py')
+
+
+def write_elf(path, strings):
+    """Writes an ELF file holding just a .dlog_fmt section, with each string
+    at its ID, the way the firmware's linker script places them."""
+    base = min(strings)
+    size = max(i + len(s) + 1 for i, s in strings.items()) - base
+    section = bytearray(size)
+    for i, s in strings.items():
+        section[i - base:i - base + len(s)] = s.encode('ascii')
+    names = b'\0.dlog_fmt\0.shstrtab\0'
+    data_offset = 52
+    names_offset = data_offset + len(section)
+    sh_offset = (names_offset + len(names) + 3) & ~3
+    # ELF32, little endian, EM_ARM, three sections: null, strings, names
+    header = b'\x7fELF\x01\x01\x01' + bytes(9) + struct.pack(
+        '<HHIIIIIHHHHHH', 2, 40, 1, 0, 0, sh_offset, 0, 52, 0, 0, 40, 3, 2)
+    sections = bytes(40) + struct.pack(
+        '<IIIIIIIIII', 1, 1, 0, base, data_offset, len(section), 0, 0, 1, 0) + struct.pack(
+        '<IIIIIIIIII', 11, 3, 0, 0, names_offset, len(names), 0, 0, 1, 0)
+    with open(path, 'wb') as f:
+        f.write(header + section + names + bytes(sh_offset - names_offset - len(names)) + sections)
+
+
+def main():
+    failures = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        if subprocess.call([os.path.join(HERE, 'test_deferred_log'), tmp],
+                           stdout=subprocess.DEVNULL) != 0:
+            print('test_dlog_format: test_deferred_log failed')
+            return 1
+        strings = {}
+        with open(os.path.join(tmp, 'strings.txt')) as f:
+            for line in f:
+                string_id, fmt = line.rstrip('\n').split('\t', 1)
+                strings[int(string_id, 16)] = fmt
+        elf = os.path.join(tmp, 'dlog.elf')
+        write_elf(elf, strings)
+
+        # The strings as the tool reads them out of the ELF file
+        listed = subprocess.check_output([sys.executable, TOOL, elf], text=True).splitlines()
+        expected = ['0x%06x  %s' % (i, strings[i]) for i in sorted(strings)]
+        if listed != expected:
+            print('test_dlog_format: strings listed differ from the ones logged')
+            failures += 1
+
+        output = subprocess.check_output([sys.executable, TOOL, elf, os.path.join(tmp, 'log.txt')],
+                                         text=True).splitlines()
+        with open(os.path.join(tmp, 'expected.txt')) as f:
+            expected = f.read().splitlines()
+        for line, (got, want) in enumerate(zip(output, expected)):
+            if got != want:
+                print('test_dlog_format: line %d is "%s", should be "%s"' % (line + 1, got, want))
+                failures += 1
+        if len(output) != len(expected):
+            print('test_dlog_format: %d lines, should be %d' % (len(output), len(expected)))
+            failures += 1
+        checks = len(expected) + 2
+    print('test_dlog_format: %d checks, %d failed' % (checks, failures))
+    return 0 if failures == 0 else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
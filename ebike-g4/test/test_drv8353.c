@@ -0,0 +1,458 @@
+/******************************************************************************
+ * Filename: test_drv8353.c
+ * Description: Host test of the DRV8353 SPI job queue. A model of the chip
+ *              sits behind SPI1 and answers each frame the way the real one
+ *              does, with the 11 data bits the register held before the
+ *              frame. It can drop writes, hold bits stuck, latch faults,
+ *              or go quiet as if unplugged. Checks the queue limits, the
+ *              read back and retry of writes, and the fault status polling.
+ *              Then the SPI is given a clock, so a frame takes as long as
+ *              it does on the wire, and the CPU time of the interrupt
+ *              driven queue is compared with the old waiting transfers.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <string.h>
+
+static SPI_TypeDef* host_spi(void);
+static DWT_Type* host_clock(void);
+static GPIO_TypeDef host_gpiob;
+#undef SPI1
+#define SPI1        (host_spi())
+#undef DWT
+#define DWT         (host_clock())
+#undef GPIOB
+#define GPIOB       (&host_gpiob)
+
+#include "../src/drv8353.c"
+
+// Answers are tagged above the 16 frame bits, so a new frame written by the
+// driver can be told apart from the last answer
+#define CHIP_ANSWERED       (0x10000u)
+#define CS_BIT              (1u << SPI_CS_PIN)
+// For the timed runs. A register access costs the CPU a few cycles on the
+// peripheral bus, and everything else the driver does is left out.
+#define ACCESS_CYCLES       (4)
+#define IRQ_CYCLES          (24) // Interrupt entry and exit
+#define FRAME_CYCLES        (16u * SPI_CLKDIV)
+
+static SPI_TypeDef host_spi_regs;
+static uint32_t tick;
+
+// The chip
+static uint16_t chip_reg[DRV_NUM_REGS];
+static uint16_t chip_stuck[DRV_NUM_REGS]; // Bits that won't set
+static uint8_t chip_drop[DRV_NUM_REGS]; // Writes to ignore
+static uint32_t chip_writes[DRV_NUM_REGS];
+static uint32_t chip_reads[DRV_NUM_REGS];
+static uint8_t chip_unplugged;
+static uint32_t frames;
+
+// The clock, only running for the timed runs
+static uint8_t timed;
+static uint64_t clk;
+static uint64_t frame_start;
+static uint8_t frame_started;
+
+static uint32_t elog_drv_faults;
+static uint32_t elog_code;
+
+// Only used by DRV8353_PowerUp, which the test doesn't need
+void GPIO_Clk(GPIO_TypeDef* gpio) {}
+void GPIO_Output(GPIO_TypeDef* gpio, uint8_t pin) {}
+void GPIO_AF(GPIO_TypeDef* gpio, uint8_t pin, uint8_t af) {}
+
+uint32_t GetTick(void) {
+    return tick++;
+}
+
+void ELOG_Record(uint8_t type, uint32_t code) {
+    if(type == ELOG_EVENT_DRV_FAULT) {
+        elog_drv_faults++;
+        elog_code = code;
+    }
+}
+
+/**
+ * @brief  One 16 bit frame through the chip
+ * @retval What the chip clocks back out
+ */
+static uint16_t chip_frame(uint16_t frame) {
+    uint8_t reg = (frame & DRV_ADDR) >> DRV_ADDR_SHIFT;
+    uint16_t out;
+    CHECK((frame & 0x0700u) == 0 || (frame & DRV_RW) == 0); // Reads send zeros
+    CHECK(reg < DRV_NUM_REGS);
+    if(chip_unplugged != 0) {
+        // MISO floats high
+        return 0xFFFFu;
+    }
+    out = chip_reg[reg];
+    if((frame & DRV_RW) != 0) {
+        chip_reads[reg]++;
+        return out;
+    }
+    chip_writes[reg]++;
+    if((reg == DRVREG_FAULT1) || (reg == DRVREG_FAULT2)) {
+        return out; // Read only
+    }
+    if(chip_drop[reg] > 0) {
+        chip_drop[reg]--;
+        return out;
+    }
+    chip_reg[reg] = frame & DRV_DATA & ~(chip_stuck[reg]);
+    if((reg == DRVREG_CTRL) && ((frame & DRVBIT_CTRL_CLRFLT) != 0)) {
+        // Clears the latched faults, and doesn't stay set
+        chip_reg[DRVREG_FAULT1] = 0;
+        chip_reg[DRVREG_FAULT2] = 0;
+        chip_reg[DRVREG_CTRL] &= ~(DRVBIT_CTRL_CLRFLT);
+    }
+    return out;
+}
+
+static DWT_Type* host_clock(void) {
+    if(timed != 0) {
+        clk += ACCESS_CYCLES;
+    }
+    host_dwt.CYCCNT = (uint32_t)clk;
+    return &host_dwt;
+}
+
+/**
+ * @brief  Notes the start of a frame the driver has just written to DR.
+ *         The driver read the last answer before writing it, which
+ *         cleared RXNE.
+ */
+static void frame_sync(void) {
+    if((timed != 0) && (host_spi_regs.DR < CHIP_ANSWERED) && (frame_started == 0)) {
+        frame_started = 1;
+        frame_start = clk;
+        host_spi_regs.SR &= ~(SPI_SR_RXNE);
+    }
+}
+
+/**
+ * @brief  Stands in for SPI1. A frame written to DR is clocked through
+ *         the chip the next time the driver looks at the SPI. In the
+ *         timed runs, not until it's had time to go over the wire.
+ */
+static SPI_TypeDef* host_spi(void) {
+    SPI_TypeDef* regs = &host_spi_regs;
+    if(timed != 0) {
+        clk += ACCESS_CYCLES;
+        frame_sync();
+        if((frame_started != 0) && (clk < (frame_start + FRAME_CYCLES))) {
+            return regs;
+        }
+        frame_started = 0;
+    }
+    if(regs->DR < CHIP_ANSWERED) {
+        // Chip select went high after the last frame, and low for this one
+        CHECK((host_gpiob.BSRR & CS_BIT) != 0);
+        CHECK((host_gpiob.BRR & CS_BIT) != 0);
+        host_gpiob.BSRR &= ~CS_BIT;
+        host_gpiob.BRR &= ~CS_BIT;
+        regs->DR = CHIP_ANSWERED | chip_frame((uint16_t)regs->DR);
+        regs->SR |= SPI_SR_RXNE;
+        frames++;
+    }
+    return regs;
+}
+
+/**
+ * @brief  Runs the SPI interrupt until the queue is empty
+ */
+static void bus(void) {
+    while(drv_busy != 0) {
+        DRV8353_IRQ();
+        host_spi_regs.SR &= ~(SPI_SR_RXNE);
+    }
+    CHECK(drv_job_count == 0);
+}
+
+static void setup(void) {
+    memset(&host_spi_regs, 0, sizeof(host_spi_regs));
+    memset(&host_gpiob, 0, sizeof(host_gpiob));
+    host_spi_regs.DR = CHIP_ANSWERED;
+    host_gpiob.BSRR = CS_BIT;
+    // Datasheet reset values
+    chip_reg[DRVREG_FAULT1] = 0;
+    chip_reg[DRVREG_FAULT2] = 0;
+    chip_reg[DRVREG_CTRL] = 0;
+    chip_reg[DRVREG_GATEH] = 0x3FF;
+    chip_reg[DRVREG_GATEL] = 0x7FF;
+    chip_reg[DRVREG_OCP] = 0x159;
+    chip_reg[DRVREG_CSA] = 0x283;
+    chip_reg[DRVREG_CAL] = 0;
+    memset(chip_stuck, 0, sizeof(chip_stuck));
+    memset(chip_drop, 0, sizeof(chip_drop));
+    chip_unplugged = 0;
+    elog_drv_faults = 0;
+    DRV8353_Init();
+    host_spi_regs.SR &= ~(SPI_SR_RXNE);
+    memset(chip_writes, 0, sizeof(chip_writes));
+    memset(chip_reads, 0, sizeof(chip_reads));
+    frames = 0;
+}
+
+static void test_init(void) {
+    setup();
+    // Set up with waiting transfers, and the shadow matches the chip
+    for(uint8_t reg = 0; reg < DRV_NUM_REGS; reg++) {
+        CHECK(DRV8353_GetRegister(reg) == chip_reg[reg]);
+    }
+    CHECK(chip_reg[DRVREG_CTRL] == DRVBIT_CTRL_OCPACT);
+    CHECK(DRV8353_GetGain() == DRV_Gain_10);
+    CHECK(drv_busy == 0);
+}
+
+static void test_queue_full(void) {
+    setup();
+    // The bus is stuck on the first frame, so nothing leaves the queue
+    for(uint8_t i = 0; i < DRV_MAX_JOBS; i++) {
+        CHECK(DRV8353_QueueRead(DRVREG_FAULT1) == RETVAL_OK);
+    }
+    CHECK(DRV8353_QueueRead(DRVREG_FAULT2) == RETVAL_FAIL);
+    CHECK(Drv_Status.QueueFull == 1);
+    // A write that doesn't fit leaves the shadow as it was
+    CHECK(DRV8353_SetGain(DRV_Gain_40) == RETVAL_FAIL);
+    CHECK(DRV8353_GetGain() == DRV_Gain_10);
+    CHECK(Drv_Status.QueueFull == 2);
+    bus();
+    CHECK(Drv_Status.Transfers == DRV_MAX_JOBS);
+    CHECK(chip_reads[DRVREG_FAULT1] == DRV_MAX_JOBS);
+    CHECK(chip_reads[DRVREG_FAULT2] == 0);
+    CHECK(chip_writes[DRVREG_CSA] == 0);
+
+    // A write never goes in without room for its read back
+    for(uint8_t i = 0; i < DRV_MAX_JOBS - 1; i++) {
+        CHECK(DRV8353_QueueRead(DRVREG_CAL) == RETVAL_OK);
+    }
+    CHECK(DRV8353_QueueWrite(DRVREG_CAL, 0x155) == RETVAL_FAIL);
+    CHECK(DRV8353_GetRegister(DRVREG_CAL) == 0);
+    bus();
+    CHECK(chip_writes[DRVREG_CAL] == 0);
+
+    // Writes back to back, as many as fit, all land and check out
+    for(uint8_t i = 0; i < DRV_MAX_JOBS / 2; i++) {
+        CHECK(DRV8353_QueueWrite(DRVREG_CAL, i) == RETVAL_OK);
+    }
+    CHECK(DRV8353_QueueWrite(DRVREG_CAL, 0x7F) == RETVAL_FAIL);
+    CHECK(DRV8353_GetRegister(DRVREG_CAL) == (DRV_MAX_JOBS / 2) - 1);
+    bus();
+    CHECK(chip_writes[DRVREG_CAL] == DRV_MAX_JOBS / 2);
+    CHECK(chip_reg[DRVREG_CAL] == (DRV_MAX_JOBS / 2) - 1);
+    CHECK(Drv_Status.VerifyFailures == 0);
+}
+
+static void test_verify(void) {
+    setup();
+    // One write lost on the wire. The read back catches it and it's sent
+    // again.
+    chip_drop[DRVREG_OCP] = 1;
+    CHECK(DRV8353_SetVDSLimit(DRV_VDS_0p06) == RETVAL_OK);
+    CHECK(DRV8353_GetVDSLimit() == DRV_VDS_0p06);
+    bus();
+    CHECK(Drv_Status.VerifyFailures == 1);
+    CHECK(chip_writes[DRVREG_OCP] == 2);
+    CHECK((chip_reg[DRVREG_OCP] & DRVBIT_OCP_VDSLVL) == DRV_VDS_0p06);
+    CHECK(DRV8353_GetRegister(DRVREG_OCP) == chip_reg[DRVREG_OCP]);
+
+    // A bit that won't set. It gives up after the retries, and the shadow
+    // shows what the chip really has.
+    chip_stuck[DRVREG_CSA] = DRVBIT_CSA_GAIN_1;
+    CHECK(DRV8353_SetGain(DRV_Gain_40) == RETVAL_OK);
+    bus();
+    CHECK(chip_writes[DRVREG_CSA] == 1 + DRV_WRITE_RETRIES);
+    CHECK(Drv_Status.VerifyFailures == 1 + 1 + DRV_WRITE_RETRIES);
+    CHECK(DRV8353_GetRegister(DRVREG_CSA) == chip_reg[DRVREG_CSA]);
+    CHECK(DRV8353_GetGain() == DRV_Gain_10);
+
+    // A newer write to the same register takes over from a failed one,
+    // rather than the old value being tried again on top of it
+    chip_drop[DRVREG_GATEL] = 1;
+    CHECK(DRV8353_QueueWrite(DRVREG_GATEL, 0x123) == RETVAL_OK);
+    CHECK(DRV8353_QueueWrite(DRVREG_GATEL, 0x321) == RETVAL_OK);
+    bus();
+    CHECK(chip_writes[DRVREG_GATEL] == 2);
+    CHECK(chip_reg[DRVREG_GATEL] == 0x321);
+    CHECK(DRV8353_GetRegister(DRVREG_GATEL) == 0x321);
+
+    // The fault clear bit never reads back, and that's not a failure
+    uint32_t failures = Drv_Status.VerifyFailures;
+    CHECK(DRV8353_QueueWrite(DRVREG_CTRL, DRVBIT_CTRL_OCPACT | DRVBIT_CTRL_CLRFLT) == RETVAL_OK);
+    bus();
+    CHECK(Drv_Status.VerifyFailures == failures);
+    CHECK(chip_writes[DRVREG_CTRL] == 1);
+
+    // A poll of the register is already on the wire when a write to it is
+    // queued. The poll brings back the old value, and the read back of the
+    // write leaves the shadow with what the chip has now.
+    CHECK(DRV8353_QueueRead(DRVREG_CSA) == RETVAL_OK);
+    CHECK(DRV8353_SetGain(DRV_Gain_5) == RETVAL_OK);
+    bus();
+    CHECK(chip_reads[DRVREG_CSA] == 1 + DRV_WRITE_RETRIES + 2);
+    CHECK(DRV8353_GetRegister(DRVREG_CSA) == chip_reg[DRVREG_CSA]);
+    CHECK(DRV8353_GetGain() == DRV_Gain_5);
+    CHECK(Drv_Status.VerifyFailures == failures);
+    for(uint8_t reg = 0; reg < DRV_NUM_REGS; reg++) {
+        CHECK(DRV8353_GetRegister(reg) == chip_reg[reg]);
+    }
+}
+
+static void test_fault_poll(void) {
+    setup();
+    // Each poll reads both fault registers, and the control register
+    // every so often
+    for(uint32_t i = 0; i < 10 * DRV_POLL_CTRL_DIVIDER; i++) {
+        DRV8353_Poll();
+        bus();
+    }
+    CHECK(chip_reads[DRVREG_FAULT1] == 10 * DRV_POLL_CTRL_DIVIDER);
+    CHECK(chip_reads[DRVREG_FAULT2] == 10 * DRV_POLL_CTRL_DIVIDER);
+    CHECK(chip_reads[DRVREG_CTRL] == 10);
+    CHECK(frames == 21 * DRV_POLL_CTRL_DIVIDER);
+    CHECK(elog_drv_faults == 0);
+
+    // A gate drive fault. It's logged once, with both registers in the
+    // shadow by the end of the poll.
+    chip_reg[DRVREG_FAULT1] = DRVBIT_FAULT1_FAULT | DRVBIT_FAULT1_GDF;
+    chip_reg[DRVREG_FAULT2] = DRVBIT_FAULT2_VGSHA;
+    for(uint32_t i = 0; i < 5; i++) {
+        DRV8353_Poll();
+        bus();
+    }
+    CHECK(elog_drv_faults == 1);
+    CHECK(elog_code == (DRVBIT_FAULT1_FAULT | DRVBIT_FAULT1_GDF));
+    CHECK(DRV8353_GetRegister(DRVREG_FAULT1) == chip_reg[DRVREG_FAULT1]);
+    CHECK(DRV8353_GetRegister(DRVREG_FAULT2) == DRVBIT_FAULT2_VGSHA);
+
+    // Cleared, then it happens again. That's a new one.
+    DRV8353_QueueWrite(DRVREG_CTRL, DRVBIT_CTRL_OCPACT | DRVBIT_CTRL_CLRFLT);
+    DRV8353_Poll();
+    bus();
+    CHECK(DRV8353_GetRegister(DRVREG_FAULT1) == 0);
+    CHECK(elog_drv_faults == 1);
+    chip_reg[DRVREG_FAULT1] = DRVBIT_FAULT1_FAULT | DRVBIT_FAULT1_VDSHA;
+    DRV8353_Poll();
+    bus();
+    CHECK(elog_drv_faults == 2);
+
+    // Unplugged. Reads come back all ones, and the control register check
+    // notices within one round of polls.
+    chip_unplugged = 1;
+    CHECK(DRV8353_GetGain() != DRV_Gain_Unknown);
+    for(uint32_t i = 0; i < DRV_POLL_CTRL_DIVIDER; i++) {
+        DRV8353_Poll();
+        bus();
+    }
+    CHECK(DRV8353_GetGain() == DRV_Gain_Unknown);
+    CHECK(DRV8353_GetVDSLimit() == DRV_VDS_Unknown);
+}
+
+/**
+ * @brief  The SPI interrupt for each frame as it finishes, until the queue
+ *         is empty. Only the time in the interrupt is the CPU's.
+ * @retval CPU cycles
+ */
+static uint64_t timed_bus(void) {
+    uint64_t cpu = 0;
+    frame_sync();
+    while(drv_busy != 0) {
+        // Off doing something else until the frame is done
+        if(clk < (frame_start + FRAME_CYCLES)) {
+            clk = frame_start + FRAME_CYCLES;
+        }
+        uint64_t start = clk;
+        DRV8353_IRQ();
+        host_spi_regs.SR &= ~(SPI_SR_RXNE);
+        cpu += (clk - start) + IRQ_CYCLES;
+        frame_sync();
+    }
+    return cpu;
+}
+
+/**
+ * @brief  One poll of the fault and control registers and one verified
+ *         write, first with the waiting transfers that were used for
+ *         everything before the queue, then through the queue
+ */
+static void test_cpu(void) {
+    const uint32_t rounds = 100;
+    const uint32_t frames_each = 5;
+    uint64_t blocking = 0, queued = 0, start;
+    setup();
+    timed = 1;
+    host_dwt.CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    drv_cs_gap_cycles = (SYS_CLK / 1000000u) * DRV_CS_HIGH_NS / 1000u;
+    for(uint32_t i = 0; i < rounds; i++) {
+        start = clk;
+        DRV8353_Read(DRVREG_FAULT1);
+        DRV8353_Read(DRVREG_FAULT2);
+        DRV8353_Read(DRVREG_CTRL);
+        DRV8353_Write(DRVREG_CAL, i & DRV_DATA);
+        CHECK(DRV8353_Read(DRVREG_CAL) == (i & DRV_DATA));
+        blocking += clk - start;
+        // Something else for a while
+        clk += 10 * FRAME_CYCLES;
+    }
+    uint32_t blocking_frames = frames;
+    frames = 0;
+    for(uint32_t i = 0; i < rounds; i++) {
+        start = clk;
+        DRV8353_QueueRead(DRVREG_FAULT1);
+        DRV8353_QueueRead(DRVREG_FAULT2);
+        DRV8353_QueueRead(DRVREG_CTRL);
+        DRV8353_QueueWrite(DRVREG_CAL, i & DRV_DATA);
+        queued += clk - start;
+        queued += timed_bus();
+        CHECK(DRV8353_GetRegister(DRVREG_CAL) == (i & DRV_DATA));
+        clk += 10 * FRAME_CYCLES;
+    }
+    timed = 0;
+    CHECK(blocking_frames == rounds * frames_each);
+    CHECK(frames == rounds * frames_each);
+    CHECK(Drv_Status.VerifyFailures == 0);
+    // Most of a waiting transfer is the wait
+    CHECK(blocking > (uint64_t)rounds * frames_each * FRAME_CYCLES);
+    CHECK((queued * 2) < blocking);
+    double each_blocking = (double)blocking / (rounds * frames_each);
+    double each_queued = (double)queued / (rounds * frames_each);
+    // Two fault registers every poll, the control register every tenth
+    double poll_frames = 2.0 + 1.0 / DRV_POLL_CTRL_DIVIDER;
+    double polls = 1e6 / DRV_POLL_PERIOD_US;
+    printf("A frame takes %.0f CPU cycles waiting, %.0f from the queue, %u on the wire\n",
+            each_blocking, each_queued, (unsigned)FRAME_CYCLES);
+    printf("The fault poll at %.0fHz would take %.3f%% of the CPU waiting, %.3f%% from the queue\n",
+            polls, 100.0 * each_blocking * poll_frames * polls / SYS_CLK,
+            100.0 * each_queued * poll_frames * polls / SYS_CLK);
+}
+
+int main(void) {
+    test_init();
+    test_queue_full();
+    test_verify();
+    test_fault_poll();
+    test_cpu();
+    return host_summary("test_drv8353");
+}
@@ -0,0 +1,384 @@
+/******************************************************************************
+ * Filename: test_event_log.c
+ * Description: Host test of the event log. The log pages are mapped at
+ *              their real address and the flash routines are replaced by a
+ *              simulator that can lose power at any erase or double word
+ *              program. Power is cut at every step of a run of records that
+ *              crosses from the last log page back into the first, and the
+ *              log has to come back with every finished record, nothing
+ *              half written, and the sequence carrying on. The cost of a
+ *              record and of a drain pass are timed at the end.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+static FLASH_TypeDef host_flash_regs;
+#undef FLASH
+#define FLASH       (&host_flash_regs)
+
+#include "../src/crc.c"
+#include "../src/event_log.c"
+
+// Only inline in the header, this makes the linkable copies
+extern void data_packet_pack_8b(uint8_t* array, uint8_t value);
+extern void data_packet_pack_16b(uint8_t* array, uint16_t value);
+extern void data_packet_pack_32b(uint8_t* array, uint32_t value);
+extern void data_packet_pack_float(uint8_t* array, float value);
+extern uint16_t data_packet_extract_16b(uint8_t* array);
+extern uint32_t data_packet_extract_32b(uint8_t* array);
+
+#define TEST_FLASH_SIZE     ((uint32_t)0x100000) // Past the end of bank 2
+#define TEST_NEVER          (0xFFFFFFFFu)
+#define TEST_CODE_MASK      (0xA5A5A5A5u) // Test records have code = sequence ^ this
+#define TEST_EVENT          (0x40)
+#define TEST_RESET_FLAGS    (RCC_CSR_PINRSTF)
+
+static uint32_t flash_ops; // Erases and programs so far
+static uint32_t flash_cut; // Power goes at this operation
+static uint8_t erase_pending;
+
+uint16_t DRV8353_GetRegister(uint8_t address) {
+    return 0x0400u | address;
+}
+
+/**
+ * @brief  Counts an erase or program, and loses power if it's the one
+ * @retval 1 if the power went
+ */
+static uint8_t flash_operation(void) {
+    return (flash_ops++ == flash_cut) ? 1 : 0;
+}
+
+FLASH_Status FLASH_StartErasePage(uint32_t FLASH_Page, uint8_t FLASH_Bank) {
+    uint32_t size = ((FLASH->OPTR & FLASH_OPTR_DBANK) != 0) ? PAGE_SIZE_DUAL : PAGE_SIZE_SINGLE;
+    uint32_t address = FLASH_START_ADDRESS + (FLASH_Page * size);
+    if(FLASH_Bank == 1) {
+        address += BANK2_START_ADDRESS - FLASH_START_ADDRESS;
+    }
+    if(flash_operation() != 0) {
+        // Only gets part way
+        memset((void*)(uintptr_t)address, 0xFF, size / 2);
+        host_reset(HOST_POWER_LOSS);
+    }
+    memset((void*)(uintptr_t)address, 0xFF, size);
+    erase_pending = 1;
+    return FLASH_COMPLETE;
+}
+
+FLASH_Status FLASH_FinishErase(void) {
+    erase_pending = 0;
+    return FLASH_COMPLETE;
+}
+
+FLASH_Status FLASH_ProgramDoubleWord(uint32_t Address, uint32_t Data1, uint32_t Data2) {
+    volatile uint32_t* words = (volatile uint32_t*)(uintptr_t)Address;
+    // Programming can only clear bits
+    CHECK((words[0] & Data1) == Data1);
+    CHECK((words[1] & Data2) == Data2);
+    CHECK(erase_pending == 0);
+    if(flash_operation() != 0) {
+        // The first word made it, only some bits of the second did
+        words[0] &= Data1;
+        words[1] &= Data2 | 0xFFFF0000u;
+        host_reset(HOST_POWER_LOSS);
+    }
+    words[0] &= Data1;
+    words[1] &= Data2;
+    return FLASH_COMPLETE;
+}
+
+static void power_on(void) {
+    flash_ops = 0;
+    erase_pending = 0;
+    host_tim1.BDTR = 0;
+    host_rcc.CSR = TEST_RESET_FLAGS;
+    ELOG_Init();
+}
+
+static void setup(uint8_t dual_bank) {
+    memset((void*)(uintptr_t)FLASH_START_ADDRESS, 0xFF, TEST_FLASH_SIZE);
+    memset(&host_flash_regs, 0, sizeof(host_flash_regs));
+    host_flash_regs.OPTR = dual_bank ? FLASH_OPTR_DBANK : 0;
+    flash_cut = TEST_NEVER;
+    power_on();
+}
+
+static void drain(void) {
+    while((ELOG_GetStatistic(CONFIG_ELOG_STATUS_PENDING) != 0) || (elog_erasing != 0)
+            || (elog_clear_pages != 0) || (elog_clear_request != 0)) {
+        ELOG_Drain();
+    }
+}
+
+/**
+ * @brief  Records test events, draining each batch before the RAM buffer
+ *         fills up
+ */
+static void record(uint32_t count) {
+    for(uint32_t i = 0; i < count; i++) {
+        ELOG_Record(TEST_EVENT, elog_next_sequence ^ TEST_CODE_MASK);
+        if(elog_ram_count >= (ELOG_RAM_RECORDS / 2)) {
+            drain();
+        }
+    }
+    drain();
+}
+
+// Everything in the log, oldest first, from the bulk download
+static uint32_t log_seq[1024];
+static uint8_t log_type[1024];
+static uint32_t log_count;
+
+static void download(void) {
+    uint8_t data[ELOG_DOWNLOAD_BYTES];
+    uint32_t index = 0;
+    uint32_t end;
+    log_count = 0;
+    do {
+        uint16_t length = ELOG_Download(index, data);
+        index = data_packet_extract_32b(&(data[0]));
+        end = data_packet_extract_32b(&(data[4]));
+        for(uint16_t place = ELOG_DOWNLOAD_HEADER_BYTES; place < length; place += ELOG_DOWNLOAD_RECORD_BYTES) {
+            uint32_t seq = data_packet_extract_32b(&(data[place]));
+            uint32_t code = data_packet_extract_32b(&(data[place + 8]));
+            uint8_t type = data[place + 26];
+            if(type == TEST_EVENT) {
+                CHECK(code == (seq ^ TEST_CODE_MASK));
+            } else if(type == ELOG_EVENT_RESET) {
+                CHECK(code == TEST_RESET_FLAGS);
+            } else {
+                CHECK(type == ELOG_EVENT_LOG_CLEARED);
+            }
+            log_seq[log_count] = seq;
+            log_type[log_count] = type;
+            log_count++;
+        }
+    } while(index < end);
+}
+
+static uint8_t has(uint32_t seq) {
+    for(uint32_t i = 0; i < log_count; i++) {
+        if(log_seq[i] == seq) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void test_wrap(uint8_t dual_bank) {
+    setup(dual_bank);
+    // Reset record and a few more, in order with nothing missing
+    record(20);
+    CHECK(ELog_Stats.Written == 21);
+    download();
+    CHECK(log_count == 21);
+    for(uint32_t i = 0; i < log_count; i++) {
+        CHECK(log_seq[i] == i + 1);
+    }
+
+    // Around the ring of pages 122 to 125 three and a bit times. The page
+    // being written and the three before it are all there, oldest first.
+    record((3 * elog_num_slots) + elog_slots_per_page + 5);
+    CHECK(ELog_Stats.FlashErrors == 0);
+    download();
+    CHECK(log_count == (uint32_t)((3 * elog_slots_per_page) + (elog_write_slot % elog_slots_per_page)));
+    CHECK(log_seq[log_count - 1] == ELog_Stats.Sequence);
+    for(uint32_t i = 1; i < log_count; i++) {
+        CHECK(log_seq[i] == log_seq[i - 1] + 1);
+    }
+    // In the flash pages the log owns, and nowhere else
+    CHECK(elog_base_address == (dual_bank ? ELOG_START_ADDRESS_DUAL : ELOG_START_ADDRESS_SINGLE));
+    CHECK(ELOG_IsBlank(elog_base_address - elog_page_size, elog_page_size));
+    CHECK(ELOG_IsBlank(elog_base_address + (ELOG_NUM_PAGES * elog_page_size), elog_page_size));
+
+    // Power cycled, it carries on in the next slot with the next number
+    uint32_t newest = ELog_Stats.Sequence;
+    uint16_t slot = elog_write_slot;
+    power_on();
+    CHECK(elog_write_slot == slot);
+    drain();
+    download();
+    CHECK(log_seq[log_count - 1] == newest + 1);
+    CHECK(log_seq[log_count - 2] == newest);
+}
+
+/**
+ * @brief  Fills the log until the next record goes in the last few slots
+ *         of page 125, then writes a batch that wraps into page 122 with
+ *         the power cut at one erase or program.
+ * @param  cut - Flash operation, counted from the start of the batch
+ * @retval 1 if the power went, 0 if the batch finished first
+ */
+static uint8_t cut_at(uint32_t cut) {
+    uint32_t newest;
+    volatile uint8_t lost = 0;
+
+    setup(1);
+    // Once around already, so page 122 is full of old records
+    record(elog_num_slots - 1);
+    record(elog_num_slots - 4 - elog_write_slot);
+    CHECK(elog_write_slot == elog_num_slots - 4);
+
+    flash_ops = 0;
+    flash_cut = cut;
+    if(setjmp(host_reset_jmp) == 0) {
+        record(12);
+    } else {
+        CHECK(host_reset_cause == HOST_POWER_LOSS);
+        lost = 1;
+    }
+    // Everything that had finished before the power went
+    newest = ELog_Stats.Sequence;
+    flash_cut = TEST_NEVER;
+
+    power_on();
+    drain();
+    download();
+    // Oldest first, every record whole, numbers never reused
+    for(uint32_t i = 1; i < log_count; i++) {
+        CHECK(log_seq[i] > log_seq[i - 1]);
+    }
+    // The reset record is next after the last one that finished
+    CHECK(log_seq[log_count - 1] == newest + 1);
+    CHECK(log_type[log_count - 1] == ELOG_EVENT_RESET);
+    // Nothing finished went missing. Only the page the wrap erases
+    // is given up, and that's the oldest one.
+    for(uint32_t seq = newest - (2 * elog_slots_per_page); seq <= newest; seq++) {
+        CHECK(has(seq));
+    }
+    // The record cut short is gone, and so are the ones still in RAM
+    CHECK(!has(newest + 2));
+
+    // And it keeps going from there
+    record(10);
+    download();
+    CHECK(log_seq[log_count - 1] == newest + 11);
+    for(uint32_t seq = newest + 1; seq <= newest + 11; seq++) {
+        CHECK(has(seq));
+    }
+    return lost;
+}
+
+static void test_power_loss(void) {
+    uint32_t cut = 0;
+    while(cut_at(cut) != 0) {
+        cut++;
+    }
+    // 12 records of 4 double words, and the erase of page 122
+    CHECK(cut == (12 * ELOG_RECORD_DOUBLE_WORDS) + 1);
+}
+
+static void test_clear(void) {
+    setup(1);
+    record(100);
+    ELOG_Clear();
+    drain();
+    download();
+    // Just the note that it was cleared, numbered on from before
+    CHECK(log_count == 1);
+    CHECK(log_seq[0] == 102);
+    CHECK(log_type[0] == ELOG_EVENT_LOG_CLEARED);
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief  Cost of a record from an interrupt, kept and dropped, and of one
+ *         drain pass. The drain time is the CPU's part only, the flash
+ *         simulator's stores included. On the chip each program then runs
+ *         for about 85us in the background, in bank 2 when dual bank.
+ */
+static void test_cost(void) {
+    uint32_t n = 1000000;
+    uint32_t passes = 0;
+    setup(1);
+    drain();
+    // Kept, emptying the RAM buffer by hand between batches
+    double start = now();
+    for(uint32_t i = 0; i < n; i += ELOG_RAM_RECORDS) {
+        for(uint32_t j = 0; j < ELOG_RAM_RECORDS; j++) {
+            ELOG_Record(TEST_EVENT, j);
+        }
+        elog_ram_tail = elog_ram_head;
+        elog_ram_count = 0;
+    }
+    double kept = (now() - start) / n;
+    CHECK(ELog_Stats.Dropped == 0);
+    // Dropped with the buffer full
+    for(uint32_t j = 0; j < ELOG_RAM_RECORDS; j++) {
+        ELOG_Record(TEST_EVENT, j);
+    }
+    start = now();
+    for(uint32_t i = 0; i < n; i++) {
+        ELOG_Record(TEST_EVENT, i);
+    }
+    double dropped = (now() - start) / n;
+    CHECK(ELog_Stats.Dropped == n);
+
+    // Draining around the ring a few times, erases and all
+    setup(1);
+    drain();
+    uint32_t written = ELog_Stats.Written;
+    uint32_t records = 4 * elog_num_slots;
+    start = now();
+    for(uint32_t i = 0; i < records; i += ELOG_RAM_RECORDS) {
+        for(uint32_t j = 0; j < ELOG_RAM_RECORDS; j++) {
+            ELOG_Record(TEST_EVENT, elog_next_sequence ^ TEST_CODE_MASK);
+        }
+        while((elog_ram_count != 0) || (elog_staged_valid != 0) || (elog_erasing != 0)) {
+            ELOG_Drain();
+            passes++;
+        }
+    }
+    double drained = now() - start;
+    CHECK(ELog_Stats.Written - written == records);
+    CHECK(ELog_Stats.FlashErrors == 0);
+    printf("On this PC a record takes %.1fns, %.1fns dropped when the buffer is full\n",
+            kept * 1e9, dropped * 1e9);
+    printf("A drain pass takes %.1fns, %.2f passes a record with the erases, %.0fns of CPU a record\n",
+            drained / passes * 1e9, (double)passes / records, drained / records * 1e9);
+}
+
+int main(void) {
+    void* flash = mmap((void*)(uintptr_t)FLASH_START_ADDRESS, TEST_FLASH_SIZE,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if(flash != (void*)(uintptr_t)FLASH_START_ADDRESS) {
+        printf("test_event_log: can't map the flash at 0x%08x\n", (unsigned int)FLASH_START_ADDRESS);
+        return 1;
+    }
+
+    test_wrap(1);
+    test_wrap(0);
+    test_power_loss();
+    test_clear();
+    test_cost();
+    return host_summary("test_event_log");
+}
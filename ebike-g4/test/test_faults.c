@@ -0,0 +1,310 @@
+/******************************************************************************
+ * Filename: test_faults.c
+ * Description: Host test of the fault manager and of who owns MOE. Faults
+ *              are injected at every point of the motor interrupt, from the
+ *              ADC data and from higher priority interrupts, including in
+ *              the middle of its critical sections. The outputs have to go
+ *              off in the cycle the fault happens and never come back on
+ *              while it's latched.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include "../src/faults.c"
+
+static uint32_t elog_faults;
+
+void ELOG_Record(uint8_t type, uint32_t code) {
+    if(type == ELOG_EVENT_FAULT) {
+        elog_faults |= code;
+    }
+}
+
+// Where a fault comes from
+#define SRC_OVERCURRENT     (0) // Seen in the ADC data by FAULT_Check
+#define SRC_BREAK           (1) // Gate driver pulls the break input
+#define SRC_SOFTWARE        (2) // FAULT_Set from a higher priority interrupt
+
+// Where in the motor interrupt it lands
+#define AT_BEFORE_CHECK     (0)
+#define AT_AFTER_CHECK      (1) // Between FAULT_Check and the MOE write
+#define AT_AFTER_ON         (2)
+#define AT_MASKED           (3) // First critical section, from AT_MASKED on
+
+static Config_Main cfg;
+static Motor_Observations obv;
+static uint32_t timestamp;
+static uint8_t pwm_enable;
+
+// Interrupts raised while masked, run when unmasked
+static uint8_t pend_break;
+static uint8_t pend_software;
+static uint8_t in_handler;
+// Raise this source at the nth mask, zero for never
+static uint32_t inject_at_mask;
+static uint8_t inject_src;
+static uint32_t masks;
+
+static uint8_t moe(void) {
+    return ((PWM_TIM->BDTR & TIM_BDTR_MOE) != 0) ? 1 : 0;
+}
+
+// Same as TIM1_BRK_TIM15_IRQHandler
+static void break_isr(void) {
+    if((TIM1->SR & TIM_SR_BIF) != 0) {
+        TIM1->SR &= ~(TIM_SR_BIF);
+        FAULT_Set(FAULT_HW_BREAK);
+    }
+}
+
+static void software_isr(void) {
+    FAULT_Set(FAULT_MOTOR_OVERTEMP);
+}
+
+static void run_pending(void) {
+    in_handler = 1;
+    if(pend_break != 0) {
+        pend_break = 0;
+        break_isr();
+    }
+    if(pend_software != 0) {
+        pend_software = 0;
+        software_isr();
+    }
+    in_handler = 0;
+}
+
+/**
+ * @brief  Raises a fault. The break clears MOE in hardware straight
+ *         away. The interrupt runs now, or when the critical section ends.
+ */
+static void raise(uint8_t src) {
+    if(src == SRC_OVERCURRENT) {
+        obv.iA = cfg.CurrentFault + 1.0f;
+        return;
+    }
+    if(src == SRC_BREAK) {
+        PWM_TIM->BDTR &= ~(TIM_BDTR_MOE);
+        PWM_TIM->SR |= TIM_SR_BIF;
+        pend_break = 1;
+    } else {
+        pend_software = 1;
+    }
+    if((host_irq_masked == 0) && (in_handler == 0)) {
+        run_pending();
+    }
+}
+
+static void irq_hook(uint8_t masked) {
+    if(in_handler != 0) {
+        return;
+    }
+    if(masked != 0) {
+        masks++;
+        if(masks == inject_at_mask) {
+            raise(inject_src);
+        }
+    } else {
+        run_pending();
+    }
+}
+
+// Same order as MAIN_MotorISR
+static void motor_isr(uint8_t inject, uint8_t src) {
+    timestamp++;
+    if(inject == AT_BEFORE_CHECK) {
+        raise(src);
+    }
+    FAULT_Check(&cfg, &obv, 48.0f, timestamp);
+    if(inject == AT_AFTER_CHECK) {
+        raise(src);
+    }
+    if(pwm_enable != 0) {
+        FAULT_MotorON();
+    } else {
+        PWM_MotorOFF();
+    }
+    if(inject == AT_AFTER_ON) {
+        raise(src);
+    }
+}
+
+static void setup(void) {
+    cfg.CurrentFault = 60.0f;
+    cfg.MinVoltFault = 20.0f;
+    cfg.MaxVoltFault = 60.0f;
+    cfg.FetTempHardCap = 100.0f;
+    cfg.MotorTempHardCap = 120.0f;
+    obv.iA = 0.0f;
+    obv.iB = 0.0f;
+    obv.iC = 0.0f;
+    obv.FetTempDegC = 25.0f;
+    obv.MotorTempDegC = 25.0f;
+    timestamp = 0;
+    pwm_enable = 1;
+    pend_break = 0;
+    pend_software = 0;
+    in_handler = 0;
+    inject_at_mask = 0;
+    masks = 0;
+    elog_faults = 0;
+    PWM_TIM->BDTR = 0;
+    PWM_TIM->SR = 0;
+    host_irq_hook = irq_hook;
+    FAULT_Init();
+}
+
+/**
+ * @brief  Injects one fault and measures how many PWM cycles the outputs
+ *         stay on afterwards.
+ * @param  src - SRC_xxx
+ * @param  at - AT_xxx, or AT_MASKED + n to land in the nth critical
+ *              section of the faulted cycle
+ */
+static void inject(uint8_t src, uint8_t at) {
+    uint32_t latency = 0;
+    uint32_t at_fault;
+    setup();
+    // Running normally
+    for(uint32_t i = 0; i < 10; i++) {
+        motor_isr(0xFF, src);
+        CHECK(moe() == 1);
+    }
+    if(at >= AT_MASKED) {
+        inject_src = src;
+        inject_at_mask = masks + 1 + (at - AT_MASKED);
+        motor_isr(0xFF, src);
+        if(masks < inject_at_mask) {
+            // Fewer critical sections than that, not a real case
+            inject_at_mask = 0;
+            return;
+        }
+    } else {
+        motor_isr(at, src);
+    }
+    at_fault = timestamp;
+    // The overcurrent is gone again by the next cycle, since the
+    // outputs are off
+    obv.iA = 0.0f;
+    // Still asking for output the whole time
+    for(uint32_t i = 0; i < 100; i++) {
+        if(moe() != 0) {
+            latency = timestamp - at_fault + 1;
+        }
+        motor_isr(0xFF, src);
+    }
+    CHECK(latency == 0);
+    CHECK(moe() == 0);
+    CHECK(FAULT_GetActive() != 0);
+    CHECK(elog_faults == FAULT_GetActive());
+    if(latency != 0) {
+        printf("source %u at %u: outputs on %u cycles after the fault\n",
+                src, at, (unsigned)latency);
+    }
+
+    // Cleared, it comes back on in the next cycle
+    FAULT_Clear();
+    motor_isr(0xFF, src);
+    CHECK(moe() == 1);
+    host_irq_hook = NULL;
+}
+
+static void test_injection(void) {
+    for(uint8_t src = SRC_OVERCURRENT; src <= SRC_SOFTWARE; src++) {
+        for(uint8_t at = AT_BEFORE_CHECK; at <= AT_MASKED + 3; at++) {
+            if((src == SRC_OVERCURRENT) && (at != AT_BEFORE_CHECK)) {
+                // Only seen in the ADC data, at the check
+                continue;
+            }
+            inject(src, at);
+        }
+    }
+}
+
+static void test_still_there(void) {
+    setup();
+    motor_isr(0xFF, 0);
+    CHECK(moe() == 1);
+    // Cleared while the overcurrent is still there. It latches again in
+    // the same cycle, before the outputs could be turned on.
+    obv.iA = cfg.CurrentFault + 1.0f;
+    motor_isr(0xFF, 0);
+    CHECK(moe() == 0);
+    for(uint32_t i = 0; i < 10; i++) {
+        FAULT_Clear();
+        motor_isr(0xFF, 0);
+        CHECK(moe() == 0);
+        CHECK(FAULT_GetActive() == FAULT_OVERCURRENT);
+    }
+    CHECK(Faults.Count == 11);
+    // A break that hasn't been handled yet keeps them off too
+    obv.iA = 0.0f;
+    FAULT_Clear();
+    host_irq_hook = NULL;
+    PWM_TIM->SR |= TIM_SR_BIF;
+    CHECK(FAULT_MotorON() == RETVAL_FAIL);
+    CHECK(moe() == 0);
+    break_isr();
+    CHECK(FAULT_GetActive() == FAULT_HW_BREAK);
+    CHECK(FAULT_MotorON() == RETVAL_FAIL);
+    FAULT_Clear();
+    CHECK(FAULT_MotorON() == RETVAL_OK);
+    CHECK(moe() == 1);
+}
+
+static void test_undervoltage(void) {
+    setup();
+    host_irq_hook = NULL;
+    motor_isr(0xFF, 0);
+    CHECK(moe() == 1);
+    // Sagging bus. Off for as long as it's low, back on by itself, and
+    // never logged.
+    timestamp++;
+    FAULT_Check(&cfg, &obv, cfg.MinVoltFault - 1.0f, timestamp);
+    FAULT_MotorON();
+    CHECK(moe() == 0);
+    CHECK(FAULT_GetActive() == FAULT_UNDERVOLTAGE);
+    motor_isr(0xFF, 0);
+    CHECK(moe() == 1);
+    CHECK(FAULT_GetActive() == 0);
+    CHECK(elog_faults == 0);
+}
+
+static void test_disable(void) {
+    setup();
+    host_irq_hook = NULL;
+    motor_isr(0xFF, 0);
+    CHECK(moe() == 1);
+    pwm_enable = 0;
+    motor_isr(0xFF, 0);
+    CHECK(moe() == 0);
+    CHECK(FAULT_GetActive() == 0);
+}
+
+int main(void) {
+    test_injection();
+    test_still_there();
+    test_undervoltage();
+    test_disable();
+    return host_summary("test_faults");
+}
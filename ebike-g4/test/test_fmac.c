@@ -0,0 +1,341 @@
+/******************************************************************************
+ * Filename: test_fmac.c
+ * Description: Host test of what the firmware's filters would do on the G4
+ *              FMAC, against FOC_BiquadCalc. A bit accurate model of the
+ *              FMAC's Q1.15 IIR runs each filter with its coefficients
+ *              rounded the way the FMAC needs them. Also tallies the CPU
+ *              cycles the FMAC could take off the FPU.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <math.h>
+#include <string.h>
+#include "../src/foc_lib.c"
+
+void CORDIC_CalcSinCos(Angle_Type theta, float* sin, float* cos) {
+    *sin = sinf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+    *cos = cosf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+}
+
+/*
+ * FMAC data path (RM0440, FMAC functional description): Q1.15 samples and
+ * coefficients, Q2.30 products cut to 22 fraction bits before they go into
+ * a 26 bit accumulator, then a gain of 2^R, and the output truncated to
+ * Q1.15 and clipped at full scale (CLIPEN). IIR feedback comes from the
+ * Q1.15 outputs, and is added, so the A terms go in negated. Coefficients
+ * of one or more are scaled down by 2^R to fit.
+ */
+#define FMAC_MAX_P          (3)
+#define FMAC_MAX_Q          (2)
+#define FMAC_MAX_GAIN_SHIFT (7)
+#define FMAC_ACC_BITS       (26)
+
+typedef struct {
+    int16_t B[FMAC_MAX_P]; // Feed forward
+    int16_t A[FMAC_MAX_Q]; // Feedback, FMAC sign
+    uint8_t P;
+    uint8_t Q;
+    uint8_t R; // Output gain shift
+    int16_t X[FMAC_MAX_P]; // Newest first
+    int16_t Y[FMAC_MAX_Q];
+} Fmac_Model;
+
+static int16_t q15(float x) {
+    x *= 32768.0f;
+    if(x >= 32767.0f) {
+        return 32767;
+    }
+    if(x <= -32768.0f) {
+        return -32768;
+    }
+    return (int16_t)lrintf(x);
+}
+
+static int32_t fmac_acc(int32_t acc, int16_t coef, int16_t sample) {
+    // Product cut from 30 to 22 fraction bits, sum wrapped to 26 bits
+    acc += ((int32_t)coef * (int32_t)sample) >> 8;
+    return (int32_t)((uint32_t)acc << (32 - FMAC_ACC_BITS)) >> (32 - FMAC_ACC_BITS);
+}
+
+static int16_t fmac_step(Fmac_Model* m, int16_t x) {
+    int32_t acc = 0;
+    int64_t out;
+    for(int i = m->P - 1; i > 0; i--) {
+        m->X[i] = m->X[i - 1];
+    }
+    m->X[0] = x;
+    for(uint8_t i = 0; i < m->P; i++) {
+        acc = fmac_acc(acc, m->B[i], m->X[i]);
+    }
+    for(uint8_t i = 0; i < m->Q; i++) {
+        acc = fmac_acc(acc, m->A[i], m->Y[i]);
+    }
+    // 22 fraction bits back to 15, rounded down, after the gain
+    out = ((int64_t)acc * (1 << m->R)) >> 7;
+    if(out > INT16_MAX) {
+        out = INT16_MAX;
+    } else if(out < INT16_MIN) {
+        out = INT16_MIN;
+    }
+    for(int i = m->Q - 1; i > 0; i--) {
+        m->Y[i] = m->Y[i - 1];
+    }
+    if(m->Q > 0) {
+        m->Y[0] = (int16_t)out;
+    }
+    return (int16_t)out;
+}
+
+/**
+ * @brief  Loads the model with float coefficients, feed forward then
+ *         feedback in the FMAC's sign, and clears its history
+ */
+static void fmac_load(Fmac_Model* m, const float* coefs, uint8_t p, uint8_t q) {
+    float largest = 0.0f;
+    memset(m, 0, sizeof(*m));
+    m->P = p;
+    m->Q = q;
+    for(uint8_t i = 0; i < p + q; i++) {
+        largest = fmaxf(largest, fabsf(coefs[i]));
+    }
+    while((largest >= 1.0f) && (m->R < FMAC_MAX_GAIN_SHIFT)) {
+        largest *= 0.5f;
+        m->R++;
+    }
+    for(uint8_t i = 0; i < p; i++) {
+        m->B[i] = q15(coefs[i] / (float)(1 << m->R));
+    }
+    for(uint8_t i = 0; i < q; i++) {
+        m->A[i] = q15(coefs[p + i] / (float)(1 << m->R));
+    }
+}
+
+static float fmac_coef(const Fmac_Model* m, int16_t c) {
+    return (float)c / 32768.0f * (float)(1 << m->R);
+}
+
+/**
+ * @brief  The model's arithmetic, one step at a time
+ */
+static void test_model(void) {
+    Fmac_Model m;
+    // Half, with a gain of two, passes straight through
+    const float pass[3] = { 1.0f, 0.0f, 0.0f };
+    fmac_load(&m, pass, 1, 0);
+    CHECK(m.R == 1);
+    CHECK(m.B[0] == 16384);
+    CHECK(fmac_step(&m, 12345) == 12345);
+    CHECK(fmac_step(&m, -12345) == -12345);
+    CHECK(fmac_step(&m, INT16_MIN) == INT16_MIN);
+    // A quarter of an odd number is truncated down, both signs
+    const float quarter[1] = { 0.25f };
+    fmac_load(&m, quarter, 1, 0);
+    CHECK(fmac_step(&m, 7) == 1);
+    CHECK(fmac_step(&m, -7) == -2);
+    // Clipped rather than wrapped
+    const float twice[1] = { 2.0f };
+    fmac_load(&m, twice, 1, 0);
+    CHECK(m.R == 2);
+    CHECK(fmac_step(&m, 20000) == INT16_MAX);
+    CHECK(fmac_step(&m, -20000) == INT16_MIN);
+    // Feedback is the clipped output: an integrator of a constant input
+    const float integrate[2] = { 0.5f, 0.9990234375f };
+    fmac_load(&m, integrate, 1, 1);
+    CHECK(m.A[0] == 32736);
+    int16_t y = 0;
+    for(uint32_t i = 0; i < 100000; i++) {
+        y = fmac_step(&m, 1000);
+    }
+    CHECK(y == INT16_MAX);
+}
+
+typedef struct {
+    const char* name;
+    float fs; // Hz
+    float f0; // Hz
+    float q; // Zero for a single pole filter
+} Filter_Case;
+
+/*
+ * Every filter the firmware runs, at its real rate, and one near the PWM
+ * rate like a current sense filter would be, to compare
+ */
+static const Filter_Case filters[] = {
+    { "throttle", THROTTLE_SAMPLING_RATE, DFLT_THRT_FILT, THROTTLE_FILT_Q_DEFAULT },
+    { "derating temperature", DERATE_SAMPLING_RATE, DERATE_TEMP_FILT, DERATE_TEMP_FILT_Q },
+    { "derating bus voltage", DERATE_SAMPLING_RATE, DERATE_VBUS_FILT, DERATE_VBUS_FILT_Q },
+    { "battery current, single pole", IBATT_SAMPLING_RATE, IBATT_FILT, 0.0f },
+    { "2kHz at 20kHz, for comparison", (float)DFLT_FOC_PWM_FREQ, 2000.0f, 0.707f },
+};
+#define NUM_FILTERS     (sizeof(filters) / sizeof(filters[0]))
+
+typedef struct {
+    float coef_error; // Worst coefficient, relative to itself
+    float dc_gain; // Of the rounded coefficients
+    float settle_error; // After a half scale step, against the float filter
+    float small_step; // How much of a 1/1000 step the output follows
+} Filter_Result;
+
+/**
+ * @brief  Runs a filter case on the model and FOC_BiquadCalc together.
+ *         The single pole filter is y += k * (x - y), as battery_current.c
+ *         does it, which is b0 = k and a1 = -(1 - k).
+ */
+static Filter_Result run_case(const Filter_Case* fc) {
+    Filter_Result res = { 0.0f, 0.0f, 0.0f, 0.0f };
+    Biquad_Type biq;
+    Fmac_Model m;
+    float coefs[5];
+    uint8_t p, q;
+    float sum_b = 0.0f, sum_a = 0.0f;
+    uint32_t settle = (uint32_t)(20.0f * fc->fs / fc->f0);
+
+    memset(&biq, 0, sizeof(biq));
+    if(fc->q == 0.0f) {
+        float k = 2.0f * PI * fc->f0 / fc->fs;
+        biq.B0 = k;
+        biq.A1 = -(1.0f - k);
+        p = 1;
+        q = 1;
+        coefs[0] = biq.B0;
+        coefs[1] = -biq.A1;
+    } else {
+        FOC_BiquadDesign(&biq, Biquad_LowPass, fc->fs, fc->f0, fc->q);
+        p = 3;
+        q = 2;
+        coefs[0] = biq.B0;
+        coefs[1] = biq.B1;
+        coefs[2] = biq.B2;
+        coefs[3] = -biq.A1;
+        coefs[4] = -biq.A2;
+    }
+    fmac_load(&m, coefs, p, q);
+    for(uint8_t i = 0; i < p; i++) {
+        res.coef_error = fmaxf(res.coef_error, fabsf(fmac_coef(&m, m.B[i]) - coefs[i]) / fabsf(coefs[i]));
+        sum_b += fmac_coef(&m, m.B[i]);
+    }
+    for(uint8_t i = 0; i < q; i++) {
+        res.coef_error = fmaxf(res.coef_error, fabsf(fmac_coef(&m, m.A[i]) - coefs[p + i]) / fabsf(coefs[p + i]));
+        sum_a += fmac_coef(&m, m.A[i]);
+    }
+    res.dc_gain = sum_b / (1.0f - sum_a);
+
+    // Half scale step, settled, then up by a thousandth of full scale
+    int16_t x = q15(0.5f), y = 0;
+    for(uint32_t n = 0; n < settle; n++) {
+        y = fmac_step(&m, x);
+        biq.X = 0.5f;
+        if(fc->q == 0.0f) {
+            biq.Y += biq.B0 * (biq.X - biq.Y);
+        } else {
+            FOC_BiquadCalc(&biq);
+        }
+    }
+    CHECK(fabsf(biq.Y - 0.5f) < 1e-3f);
+    res.settle_error = ((float)y / 32768.0f - biq.Y) / 0.5f;
+    int16_t before = y;
+    int16_t small = q15(0.001f);
+    for(uint32_t n = 0; n < settle; n++) {
+        y = fmac_step(&m, x + small);
+    }
+    res.small_step = (float)(y - before) / (float)small;
+    return res;
+}
+
+/**
+ * @brief  The firmware's own filters lose their DC gain or stick, while a
+ *         filter near the PWM rate comes out close to the float one
+ */
+static void test_filters(void) {
+    Filter_Result res[NUM_FILTERS];
+    printf("On the FMAC, as Q1.15:\n");
+    for(uint32_t i = 0; i < NUM_FILTERS; i++) {
+        res[i] = run_case(&filters[i]);
+        printf("  %s, %.0fHz at %.0fHz: coefficients off by up to %.2f%%, DC gain %.4f, "
+                "settles %.2f%% off, follows %.0f%% of a 0.1%% step\n",
+                filters[i].name, (double)filters[i].f0, (double)filters[i].fs,
+                100.0 * res[i].coef_error, (double)res[i].dc_gain,
+                100.0 * res[i].settle_error, 100.0 * res[i].small_step);
+    }
+    // Throttle: the feed forward terms are under one LSB
+    CHECK(fabsf(res[0].dc_gain - 1.0f) > 0.1f);
+    // Derating: poles so close to one that the output sticks
+    CHECK(res[1].small_step == 0.0f);
+    CHECK(res[2].small_step == 0.0f);
+    CHECK(fabsf(res[2].settle_error) > 0.01f);
+    // Battery current works, a few LSB off
+    CHECK(res[3].small_step > 0.9f);
+    CHECK(fabsf(res[3].settle_error) < 0.005f);
+    // And a filter the FMAC suits is as good as the float one
+    CHECK(fabsf(res[4].settle_error) < 1e-4f);
+    CHECK(res[4].small_step > 0.9f);
+}
+
+/*
+ * Cortex-M4F cycles per sample, tallied from the instruction timings in
+ * its technical reference manual. Not measured, there is no G4 here.
+ * - FOC_BiquadCalc: 8 pipelined VLDR (9), VMUL and 2 VMLS, VMUL and 2 VMLA
+ *   (14), 3 VSTR (4), call and return (4)
+ * - A bank channel: the same loads, sums and stores, plus the loop (4)
+ * - battery_current.c's single pole, inline: 2 VLDR, VSUB, VMLA, VSTR
+ * - The FMAC, polled: scale and VCVT to Q15 (3), write WDATA (2), wait
+ *   for p+q MACs plus the FMAC's pipeline while polling SR (10), read
+ *   RDATA (2), VCVT and scale back (3), call and return (4)
+ * - Loading another filter into the FMAC: PARAM, p+q coefficients, p-1+q
+ *   history words, PARAM again, each an AHB write (2)
+ */
+#define FPU_BIQUAD_CYCLES       (31)
+#define FPU_BANK_CYCLES         (31)
+#define FPU_SINGLE_POLE_CYCLES  (8)
+#define FMAC_POLLED_CYCLES      (24)
+#define FMAC_RELOAD_CYCLES      (2 * (1 + 5 + 4 + 1))
+
+/**
+ * @brief  CPU cycles per 20kHz control cycle the firmware's filters take
+ *         on the FPU, and what moving them to the FMAC would change
+ */
+static void test_cycles(void) {
+    double per_control = 1.0 / (double)DFLT_FOC_PWM_FREQ;
+    double throttle = THROTTLE_SAMPLING_RATE * per_control;
+    double derating = DERATE_SAMPLING_RATE * per_control * DERATE_FILT_CHANNELS;
+    double fpu = (throttle * FPU_BIQUAD_CYCLES) + (derating * FPU_BANK_CYCLES)
+            + FPU_SINGLE_POLE_CYCLES;
+    // The FMAC holds one filter, the derating channels take turns
+    double fmac = (throttle * FMAC_POLLED_CYCLES)
+            + (derating * (FMAC_POLLED_CYCLES + FMAC_RELOAD_CYCLES))
+            + FMAC_POLLED_CYCLES;
+    double cycles = (double)SYS_CLK / (double)DFLT_FOC_PWM_FREQ;
+    CHECK(fpu < 0.01 * cycles);
+    printf("Filters on the FPU: %.1f cycles a control cycle, %.2f%% of the CPU. "
+            "On the FMAC, polled: %.1f cycles\n", fpu, 100.0 * fpu / cycles, fmac);
+    printf("Per sample: FPU biquad %d cycles, FMAC %d, or %d with a reload\n",
+            FPU_BIQUAD_CYCLES, FMAC_POLLED_CYCLES, FMAC_POLLED_CYCLES + FMAC_RELOAD_CYCLES);
+}
+
+int main(void) {
+    test_model();
+    test_filters();
+    test_cycles();
+    return host_summary("test_fmac");
+}
@@ -0,0 +1,346 @@
+/******************************************************************************
+ * Filename: test_foc_lib.c
+ * Description: Host test of the FOC library. Current loop gains from
+ *              FOC_PIsynth are checked against a sampled R-L plant with the
+ *              same delay as the motor interrupt: the duty is computed from
+ *              this cycle's ADC sample and goes out in the next PWM period.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <complex.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/foc_lib.c"
+
+void CORDIC_CalcSinCos(Angle_Type theta, float* sin, float* cos) {
+    *sin = sinf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+    *cos = cosf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+}
+
+#define FS              ((float)DFLT_FOC_PWM_FREQ)
+#define VBUS            (48.0f)
+#define FULL_SCALE      (VBUS * INV_SQRT3)
+#define BENCH_RUNS      (2000000u)
+
+/**
+ * @brief  Open loop gain at one frequency. The PI is
+ *         Kp * (1 + Ki * z / (z - 1)) from FOC_PIcalc, the plant is a
+ *         zero order hold of 1 / (Ls + R), and there's one sample of delay
+ *         between them.
+ */
+static double complex open_loop(const PID_Type* pid, double r, double l, double f) {
+    double complex z = cexp(I * 2.0 * M_PI * f / FS);
+    double a = exp(-r / (l * FS));
+    double complex pi = pid->Kp * FULL_SCALE * (1.0 + pid->Ki * z / (z - 1.0));
+    double complex plant = ((1.0 - a) / r) / (z - a);
+    return pi * plant / z;
+}
+
+/**
+ * @brief  Crossover, closed loop bandwidth and phase margin of
+ *         FOC_PIsynth's gains
+ * @param  r, l - Real plant
+ * @param  r_model, l_model - What the gains were tuned for
+ * @param  want - Requested bandwidth (Hz)
+ */
+static void loop(double r, double l, float r_model, float l_model, float want,
+        double* fc, double* bw, double* pm) {
+    PID_Type pid;
+    FOC_PIDdefaults(&pid);
+    FOC_PIsynth(&pid, r_model, l_model, FULL_SCALE, FS, want);
+    *fc = 0.0;
+    *bw = 0.0;
+    // Step up to Nyquist, finding where the loop gain and the closed loop
+    // gain drop through one and -3dB
+    for(double f = 1.0; f < FS / 2.0; f += 1.0) {
+        double complex g = open_loop(&pid, r, l, f);
+        if((cabs(g) < 1.0) && (*fc == 0.0)) {
+            *fc = f;
+            *pm = 180.0 + carg(g) * 180.0 / M_PI;
+        }
+        if((cabs(g / (1.0 + g)) < M_SQRT1_2) && (*bw == 0.0)) {
+            *bw = f;
+        }
+    }
+}
+
+static void test_synth(void) {
+    double fc, bw, pm;
+    // Small hub motor to big one
+    const float rs[] = { 0.05f, 0.1f, 0.3f };
+    const float ls[] = { 50e-6f, 150e-6f, 400e-6f };
+    for(uint32_t m = 0; m < 3; m++) {
+        for(float want = 100.0f; want <= MAIN_CURRENT_BW_MAX; want *= 1.25f) {
+            loop(rs[m], ls[m], rs[m], ls[m], want, &fc, &bw, &pm);
+            // Loop gain crosses over where it was asked to
+            CHECK(fabs(fc - want) < 0.05 * want);
+            CHECK(pm > 60.0);
+            // The delay makes the closed loop wider than that, more so
+            // the closer it gets to the PWM frequency
+            CHECK(bw > want);
+            CHECK(bw < 2.5 * want);
+        }
+        loop(rs[m], ls[m], rs[m], ls[m], MAIN_CURRENT_BW_DFLT, &fc, &bw, &pm);
+        printf("R %.2f L %.0fuH at %.0fHz: -3dB at %.0fHz, phase margin %.1f deg\n",
+                (double)rs[m], (double)ls[m] * 1e6, (double)MAIN_CURRENT_BW_DFLT, bw, pm);
+        loop(rs[m], ls[m], rs[m], ls[m], MAIN_CURRENT_BW_MAX, &fc, &bw, &pm);
+        printf("R %.2f L %.0fuH at %.0fHz: -3dB at %.0fHz, phase margin %.1f deg\n",
+                (double)rs[m], (double)ls[m] * 1e6, (double)MAIN_CURRENT_BW_MAX, bw, pm);
+    }
+}
+
+static void test_mismatch(void) {
+    double fc, bw, pm;
+    // Identified model off by a factor of two either way, at the default
+    // bandwidth. Crossover follows the error in L, and there's still
+    // enough phase margin not to ring.
+    for(float k = 0.5f; k <= 2.0f; k *= 2.0f) {
+        loop(0.1, 100e-6, 0.1f * k, 100e-6f * k, MAIN_CURRENT_BW_DFLT, &fc, &bw, &pm);
+        CHECK(fabs(fc - k * MAIN_CURRENT_BW_DFLT) < 0.05 * k * MAIN_CURRENT_BW_DFLT);
+        CHECK(pm > 60.0);
+    }
+}
+
+/**
+ * @brief  Step response with FOC_PIcalc itself, so the gains are checked
+ *         on the code that uses them and not just on the algebra
+ */
+static void test_step(void) {
+    PID_Type pid;
+    float r = 0.1f, l = 100e-6f;
+    float a = expf(-r / (l * FS));
+    float i = 0.0f, out = 0.0f, peak = 0.0f;
+    uint32_t rise = 0;
+    FOC_PIDdefaults(&pid);
+    FOC_PIsynth(&pid, r, l, FULL_SCALE, FS, MAIN_CURRENT_BW_MAX);
+    for(uint32_t n = 0; n < 200; n++) {
+        // Last cycle's output is on the motor now
+        i = a * i + (1.0f - a) * out * FULL_SCALE / r;
+        pid.Err = 10.0f - i;
+        FOC_PIcalc(&pid);
+        out = pid.Out;
+        peak = fmaxf(peak, i);
+        if((rise == 0) && (i > 10.0f * (1.0f - expf(-1.0f)))) {
+            rise = n;
+        }
+    }
+    // First order, one time constant is 1 / (2 pi bw)
+    CHECK(fabsf((float)rise / FS - 1.0f / (2.0f * PI * MAIN_CURRENT_BW_MAX)) < 2.0f / FS);
+    CHECK(peak < 10.5f);
+    CHECK(fabsf(i - 10.0f) < 0.01f);
+}
+
+/**
+ * @brief  One of each shape at a few frequencies, the same in a bank and
+ *         as separate filters
+ */
+static void design_all(Biquad_Bank_Type* bank, Biquad_Type* biqs, uint8_t channels) {
+    const Biquad_Shape shapes[4] = { Biquad_LowPass, Biquad_HighPass, Biquad_Notch, Biquad_BandPass };
+    FOC_BiquadBankInit(bank, channels);
+    for(uint8_t ch = 0; ch < channels; ch++) {
+        float f0 = 50.0f * (float)(ch + 1);
+        float q = 0.5f + 0.25f * (float)ch;
+        memset(&biqs[ch], 0, sizeof(Biquad_Type));
+        FOC_BiquadDesign(&biqs[ch], shapes[ch % 4], FS, f0, q);
+        FOC_BiquadBankDesign(bank, ch, shapes[ch % 4], FS, f0, q);
+    }
+}
+
+/**
+ * @brief  The bank does the same sums in the same order as FOC_BiquadCalc,
+ *         so every output matches exactly
+ */
+static void test_bank_matches(void) {
+    Biquad_Bank_Type bank;
+    Biquad_Type biqs[BIQUAD_BANK_MAX_CHANNELS];
+    uint32_t differ = 0;
+    srand(1);
+    design_all(&bank, biqs, BIQUAD_BANK_MAX_CHANNELS);
+    for(uint32_t n = 0; n < 20000; n++) {
+        for(uint8_t ch = 0; ch < BIQUAD_BANK_MAX_CHANNELS; ch++) {
+            float x = sinf(0.01f * (float)(n * (ch + 1))) + (float)rand() / (float)RAND_MAX - 0.5f;
+            biqs[ch].X = x;
+            bank.X[ch] = x;
+            FOC_BiquadCalc(&biqs[ch]);
+        }
+        FOC_BiquadBankCalc(&bank);
+        for(uint8_t ch = 0; ch < BIQUAD_BANK_MAX_CHANNELS; ch++) {
+            differ += (bank.Y[ch] != biqs[ch].Y) ? 1 : 0;
+        }
+    }
+    CHECK(differ == 0);
+    // Channels past the ones in use aren't touched, or designed
+    FOC_BiquadBankInit(&bank, 2);
+    bank.X[2] = 1.0f;
+    FOC_BiquadBankDesign(&bank, 2, Biquad_LowPass, FS, 100.0f, 0.7f);
+    FOC_BiquadBankCalc(&bank);
+    CHECK(bank.Y[2] == 0.0f);
+    CHECK(bank.B0[2] == 1.0f);
+    // Undesigned channels pass their input straight through
+    bank.X[1] = 3.0f;
+    FOC_BiquadBankCalc(&bank);
+    CHECK(bank.Y[1] == 3.0f);
+}
+
+/**
+ * @brief  A primed channel starts at its steady state for that input and
+ *         stays there. That's the input times the DC gain of the rounded
+ *         coefficients, which is only close to the design's. One that
+ *         isn't primed starts from zero.
+ */
+static void test_bank_prime(void) {
+    Biquad_Bank_Type bank;
+    Biquad_Type biqs[BIQUAD_BANK_MAX_CHANNELS];
+    // Low pass and notch pass DC, high pass and band pass block it
+    const float dc_gain[4] = { 1.0f, 0.0f, 1.0f, 0.0f };
+    double steady[BIQUAD_BANK_MAX_CHANNELS];
+    const float x = 36.5f;
+    double worst = 0.0, worst_gain = 0.0;
+    design_all(&bank, biqs, BIQUAD_BANK_MAX_CHANNELS);
+    for(uint8_t ch = 0; ch < BIQUAD_BANK_MAX_CHANNELS; ch++) {
+        steady[ch] = x * ((double)bank.B0[ch] + bank.B1[ch] + bank.B2[ch])
+                / (1.0 + bank.A1[ch] + bank.A2[ch]);
+        worst_gain = fmax(worst_gain, fabs(steady[ch] / x - dc_gain[ch % 4]));
+        FOC_BiquadBankPrime(&bank, ch, x);
+        bank.X[ch] = x;
+    }
+    for(uint32_t n = 0; n < 10000; n++) {
+        FOC_BiquadBankCalc(&bank);
+        for(uint8_t ch = 0; ch < BIQUAD_BANK_MAX_CHANNELS; ch++) {
+            worst = fmax(worst, fabs(bank.Y[ch] - steady[ch]));
+        }
+    }
+    CHECK(worst < 5e-5 * x);
+    CHECK(worst_gain < 1e-3);
+    printf("primed bank: %.1e of the input from the steady state, DC gain off by up to %.1e\n",
+            worst / x, worst_gain);
+    // Without priming, the low pass ramps up from zero
+    design_all(&bank, biqs, 1);
+    bank.X[0] = x;
+    FOC_BiquadBankCalc(&bank);
+    CHECK(bank.Y[0] < 0.01f * x);
+    // Out of range channels are left alone
+    FOC_BiquadBankPrime(&bank, 1, x);
+    CHECK(bank.U1[1] == 0.0f);
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+/*
+ * FOC_BiquadBankCalc as the compiler builds it without vectorizing, to time
+ * against. This test is built at -O3, where GCC runs four channels at once
+ * in SSE registers (make vec-report shows it).
+ */
+__attribute__((optimize("no-tree-vectorize")))
+static void bank_calc_scalar(Biquad_Bank_Type* bank) {
+    const float* restrict a1 = bank->A1;
+    const float* restrict a2 = bank->A2;
+    const float* restrict b0 = bank->B0;
+    const float* restrict b1 = bank->B1;
+    const float* restrict b2 = bank->B2;
+    const float* restrict x = bank->X;
+    float* restrict u1 = bank->U1;
+    float* restrict u2 = bank->U2;
+    float* restrict y = bank->Y;
+    uint32_t channels = bank->Channels;
+    float intermed;
+    for(uint32_t i = 0; i < channels; i++) {
+        intermed = (x[i]) - (u1[i] * a1[i]) - (u2[i] * a2[i]);
+        y[i] = (intermed * b0[i]) + (u1[i] * b1[i]) + (u2[i] * b2[i]);
+        u2[i] = u1[i];
+        u1[i] = intermed;
+    }
+}
+
+/**
+ * @brief  Runs a bank for the benchmark, and returns ns per channel
+ */
+static double time_bank(void (*volatile calc)(Biquad_Bank_Type*), Biquad_Bank_Type* bank,
+        volatile float* in) {
+    double start = now();
+    for(uint32_t n = 0; n < BENCH_RUNS; n++) {
+        for(uint8_t ch = 0; ch < bank->Channels; ch++) {
+            bank->X[ch] = *in;
+        }
+        calc(bank);
+    }
+    return (now() - start) * 1e9 / ((double)BENCH_RUNS * bank->Channels);
+}
+
+/**
+ * @brief  Time per channel, the bank against a call to FOC_BiquadCalc for
+ *         each filter, and the bank with and without vectorizing. The
+ *         derating filters are three channels. All are called through a
+ *         pointer, since the firmware calls them from other files and they
+ *         aren't inlined there either.
+ */
+static void test_bank_cost(void) {
+    Biquad_Bank_Type bank;
+    Biquad_Type biqs[BIQUAD_BANK_MAX_CHANNELS];
+    const uint8_t counts[3] = { 1, 3, BIQUAD_BANK_MAX_CHANNELS };
+    volatile float in = 1.0f;
+    void (*volatile scalar_calc)(Biquad_Type*) = FOC_BiquadCalc;
+    Biquad_Bank_Type unvectorized;
+    for(uint32_t c = 0; c < 3; c++) {
+        uint8_t channels = counts[c];
+        double start, scalar, banked, banked_scalar;
+        float sum = 0.0f;
+        design_all(&bank, biqs, channels);
+        unvectorized = bank;
+        start = now();
+        for(uint32_t n = 0; n < BENCH_RUNS; n++) {
+            for(uint8_t ch = 0; ch < channels; ch++) {
+                biqs[ch].X = in;
+                scalar_calc(&biqs[ch]);
+            }
+        }
+        scalar = (now() - start) * 1e9 / ((double)BENCH_RUNS * channels);
+        banked = time_bank(FOC_BiquadBankCalc, &bank, &in);
+        banked_scalar = time_bank(bank_calc_scalar, &unvectorized, &in);
+        for(uint8_t ch = 0; ch < channels; ch++) {
+            sum += fabsf(bank.Y[ch] - biqs[ch].Y);
+            sum += fabsf(unvectorized.Y[ch] - biqs[ch].Y);
+        }
+        CHECK(sum == 0.0f);
+        printf("%u channels on this PC: %.2fns a channel with FOC_BiquadCalc, "
+                "%.2fns in a bank, %.2fns in a bank not vectorized\n",
+                channels, scalar, banked, banked_scalar);
+    }
+}
+
+int main(void) {
+    test_synth();
+    test_mismatch();
+    test_step();
+    test_bank_matches();
+    test_bank_prime();
+    test_bank_cost();
+    return host_summary("test_foc_lib");
+}
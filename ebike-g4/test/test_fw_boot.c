@@ -0,0 +1,285 @@
+/******************************************************************************
+ * Filename: test_fw_boot.c
+ * Description: Host test of the firmware update boot stage. The flash is
+ *              mapped at its real address and programmed directly, and
+ *              erases happen when the boot stage next looks at the flash
+ *              registers. Power is cut at every flash operation in turn,
+ *              to check the journal always finishes the swap, and the
+ *              swap back, with both images intact.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <string.h>
+#include <sys/mman.h>
+
+static FLASH_TypeDef* host_flash(void);
+#undef FLASH
+#define FLASH       (host_flash())
+
+#include "../src/fw_boot.c"
+
+#define TEST_FLASH_SIZE     ((uint32_t)0x80000)
+#define TEST_SECTORS        (3)
+#define TEST_IMAGE_SIZE     ((2 * FWUP_SECTOR_SIZE) + 0x400) // Last sector partly used
+#define TEST_OLD_IMAGE      (0x10000000u)
+#define TEST_NEW_IMAGE      (0x20000000u)
+#define TEST_NEVER          (0xFFFFFFFFu)
+#define TEST_MAX_RESETS     (20)
+
+static FLASH_TypeDef host_flash_regs;
+static uint32_t flash_ops; // Erases and programs so far
+static uint32_t flash_cut; // Power goes at this operation
+static uint32_t flash_fail; // This operation reports an error
+static uint8_t flash_fail_all;
+static uint8_t flash_pg; // Programming was on at the last register access
+
+static void flash_operation(uint32_t address, uint32_t size) {
+    if(flash_ops++ == flash_cut) {
+        // An erase that loses power only gets part way
+        if(size != 0) {
+            memset((void*)(uintptr_t)address, 0xFF, size / 2);
+        }
+        host_reset(HOST_POWER_LOSS);
+    }
+    if(flash_fail_all || (flash_ops - 1 == flash_fail)) {
+        host_flash_regs.SR |= FLASH_SR_PROGERR;
+        return;
+    }
+    if(size != 0) {
+        memset((void*)(uintptr_t)address, 0xFF, size);
+    }
+}
+
+/**
+ * @brief  Stands in for FLASH. Carries out whatever the last register
+ *         write started. Programming is done by the writes themselves,
+ *         this only counts them.
+ */
+static FLASH_TypeDef* host_flash(void) {
+    FLASH_TypeDef* regs = &host_flash_regs;
+    // Errors are cleared by writing ones. The boot stage always clears
+    // all of them at once, and only ever sees one at a time from here.
+    if((regs->SR & FWBOOT_FLASH_ERRORS) == FWBOOT_FLASH_ERRORS) {
+        regs->SR &= ~FWBOOT_FLASH_ERRORS;
+    }
+    if((regs->CR & FLASH_CR_STRT) != 0) {
+        uint32_t size = ((regs->OPTR & FLASH_OPTR_DBANK) != 0) ? PAGE_SIZE_DUAL : PAGE_SIZE_SINGLE;
+        uint32_t page = (regs->CR & FLASH_CR_PNB) >> FLASH_CR_PNB_Pos;
+        uint32_t address = FLASH_START_ADDRESS + (page * size);
+        if((regs->CR & FLASH_CR_BKER) != 0) {
+            address += BANK2_START_ADDRESS - FLASH_START_ADDRESS;
+        }
+        regs->CR &= ~FLASH_CR_STRT;
+        flash_operation(address, size);
+    } else if(((regs->CR & FLASH_CR_PG) != 0) && (flash_pg == 0)) {
+        flash_pg = 1;
+        flash_operation(0, 0);
+    }
+    flash_pg = ((regs->CR & FLASH_CR_PG) != 0) ? 1 : 0;
+    return regs;
+}
+
+static const Fwup_Record_Type* record(void) {
+    return (const Fwup_Record_Type*)(uintptr_t)FWUP_RECORD_ADDRESS;
+}
+
+static uint32_t image_word(uint32_t seed, uint32_t i) {
+    // Mostly erased, the boot stage skips those
+    return ((i % 64) < 2) ? (seed + i) : FLASH_ERASED;
+}
+
+static void write_image(uint32_t address, uint32_t seed) {
+    uint32_t* words = (uint32_t*)(uintptr_t)address;
+    for(uint32_t i = 0; i < (TEST_SECTORS * FWUP_SECTOR_SIZE / 4); i++) {
+        words[i] = image_word(seed, i);
+    }
+}
+
+static uint8_t image_is(uint32_t address, uint32_t seed) {
+    const uint32_t* words = (const uint32_t*)(uintptr_t)address;
+    for(uint32_t i = 0; i < (TEST_SECTORS * FWUP_SECTOR_SIZE / 4); i++) {
+        if(words[i] != image_word(seed, i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief  Erased flash with the old image running, and the new one
+ *         staged and committed
+ */
+static void setup(uint8_t dual_bank) {
+    Fwup_Record_Type* header = (Fwup_Record_Type*)(uintptr_t)FWUP_RECORD_ADDRESS;
+
+    memset((void*)(uintptr_t)FLASH_START_ADDRESS, 0xFF, TEST_FLASH_SIZE);
+    memset(&host_flash_regs, 0, sizeof(host_flash_regs));
+    host_flash_regs.OPTR = dual_bank ? FLASH_OPTR_DBANK : 0;
+    write_image(FWUP_APP_ADDRESS, TEST_OLD_IMAGE);
+    write_image(FWUP_STAGING_ADDRESS, TEST_NEW_IMAGE);
+    header->Size = TEST_IMAGE_SIZE;
+    header->Crc = 0;
+    header->Magic = FWUP_MAGIC;
+
+    flash_ops = 0;
+    flash_cut = TEST_NEVER;
+    flash_fail = TEST_NEVER;
+    flash_fail_all = 0;
+}
+
+/**
+ * @brief  One reset, running the boot stage until it starts the
+ *         application or resets again
+ * @retval HOST_xxx, how it ended
+ */
+static int boot(void) {
+    host_flash_regs.CR = FLASH_CR_LOCK;
+    host_flash_regs.SR = 0;
+    host_scb.AIRCR = 0;
+    flash_pg = 0;
+    if(setjmp(host_reset_jmp) == 0) {
+        FWUP_BootReset();
+        host_reset_cause = HOST_RETURNED;
+    }
+    return host_reset_cause;
+}
+
+static uint32_t boot_until_started(void) {
+    uint32_t resets = 0;
+    while((boot() != HOST_APP_STARTED) && (resets < TEST_MAX_RESETS)) {
+        resets++;
+    }
+    return resets;
+}
+
+static void test_no_update(void) {
+    setup(1);
+    memset((void*)(uintptr_t)FWUP_RECORD_ADDRESS, 0xFF, FWUP_SECTOR_SIZE);
+    CHECK(boot() == HOST_APP_STARTED);
+    CHECK(flash_ops == 0);
+    CHECK(image_is(FWUP_APP_ADDRESS, TEST_OLD_IMAGE));
+    CHECK(host_scb.VTOR == FWUP_APP_ADDRESS);
+}
+
+static uint32_t test_swap_and_revert(uint8_t dual_bank) {
+    uint32_t ops;
+
+    setup(dual_bank);
+    // Committed, so it gets swapped in for a trial run
+    CHECK(boot() == HOST_APP_STARTED);
+    CHECK(image_is(FWUP_APP_ADDRESS, TEST_NEW_IMAGE));
+    CHECK(image_is(FWUP_STAGING_ADDRESS, TEST_OLD_IMAGE));
+    CHECK(FWUP_BootIsMarked(&(record()->Trial)));
+    CHECK(!FWUP_BootIsMarked(&(record()->Reverted)));
+    ops = flash_ops;
+    CHECK(ops > 0);
+
+    // Reset before confirming, so the old one goes back
+    CHECK(boot() == HOST_APP_STARTED);
+    CHECK(image_is(FWUP_APP_ADDRESS, TEST_OLD_IMAGE));
+    CHECK(image_is(FWUP_STAGING_ADDRESS, TEST_NEW_IMAGE));
+    CHECK(FWUP_BootIsMarked(&(record()->Reverted)));
+    CHECK(flash_ops == 2 * ops);
+
+    // And then it's left alone
+    ops = flash_ops;
+    CHECK(boot() == HOST_APP_STARTED);
+    CHECK(flash_ops == ops);
+    CHECK(image_is(FWUP_APP_ADDRESS, TEST_OLD_IMAGE));
+    return ops;
+}
+
+static void test_confirmed(void) {
+    setup(1);
+    CHECK(boot() == HOST_APP_STARTED);
+    // The application confirms itself
+    FWUP_BootMark(&(record()->Confirmed));
+    uint32_t ops = flash_ops;
+    CHECK(boot() == HOST_APP_STARTED);
+    CHECK(flash_ops == ops);
+    CHECK(image_is(FWUP_APP_ADDRESS, TEST_NEW_IMAGE));
+    CHECK(image_is(FWUP_STAGING_ADDRESS, TEST_OLD_IMAGE));
+}
+
+static void test_power_loss(uint8_t dual_bank, uint32_t ops) {
+    for(uint32_t cut = 0; cut < ops; cut++) {
+        setup(dual_bank);
+        flash_cut = cut;
+        uint32_t resets = boot_until_started();
+        CHECK(resets <= 1);
+        if(FWUP_BootIsMarked(&(record()->Reverted))) {
+            // Power went right after the trial run was marked, which
+            // is the same as the new image resetting straight away
+            CHECK(cut == (ops / 2) - 1);
+        } else {
+            CHECK(image_is(FWUP_APP_ADDRESS, TEST_NEW_IMAGE));
+            CHECK(image_is(FWUP_STAGING_ADDRESS, TEST_OLD_IMAGE));
+            CHECK(FWUP_BootIsMarked(&(record()->Trial)));
+        }
+
+        resets += boot_until_started();
+        CHECK(resets == 1);
+        CHECK(image_is(FWUP_APP_ADDRESS, TEST_OLD_IMAGE));
+        CHECK(image_is(FWUP_STAGING_ADDRESS, TEST_NEW_IMAGE));
+        CHECK(FWUP_BootIsMarked(&(record()->Reverted)));
+    }
+}
+
+static void test_flash_errors(void) {
+    // A single error is retried
+    setup(1);
+    flash_fail = 5;
+    CHECK(boot() == HOST_APP_STARTED);
+    CHECK(image_is(FWUP_APP_ADDRESS, TEST_NEW_IMAGE));
+    CHECK(image_is(FWUP_STAGING_ADDRESS, TEST_OLD_IMAGE));
+
+    // Flash that won't erase gives up and resets, without touching either image
+    setup(1);
+    flash_fail_all = 1;
+    CHECK(boot() == HOST_RESET);
+    CHECK(flash_ops == FWBOOT_RETRIES * 2);
+    CHECK(image_is(FWUP_APP_ADDRESS, TEST_OLD_IMAGE));
+    CHECK(image_is(FWUP_STAGING_ADDRESS, TEST_NEW_IMAGE));
+    CHECK(!FWUP_BootIsMarked(&(record()->Trial)));
+    // Until it comes good
+    flash_fail_all = 0;
+    CHECK(boot() == HOST_APP_STARTED);
+    CHECK(image_is(FWUP_APP_ADDRESS, TEST_NEW_IMAGE));
+}
+
+int main(void) {
+    void* flash = mmap((void*)(uintptr_t)FLASH_START_ADDRESS, TEST_FLASH_SIZE,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if(flash != (void*)(uintptr_t)FLASH_START_ADDRESS) {
+        printf("test_fw_boot: can't map the flash at 0x%08x\n", (unsigned int)FLASH_START_ADDRESS);
+        return 1;
+    }
+
+    test_no_update();
+    test_confirmed();
+    test_flash_errors();
+    test_power_loss(1, test_swap_and_revert(1));
+    test_power_loss(0, test_swap_and_revert(0));
+    return host_summary("test_fw_boot");
+}
@@ -0,0 +1,419 @@
+/******************************************************************************
+ * Filename: test_fw_update.c
+ * Description: Host test of streaming an update into the staging slot:
+ *              chunks in, programmed from the task, CRC checked, committed.
+ *              The flash is mapped at its real address behind a simulator
+ *              of the flash driver. Programming only clears bits, an erase
+ *              takes several task runs, and the event log can hold the
+ *              flash busy. Checks chunks that come out of order or twice,
+ *              a bad CRC, power cut at every flash operation, and how fast
+ *              an image streams in.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <string.h>
+#include <sys/mman.h>
+
+static FLASH_TypeDef host_flash_regs;
+#undef FLASH
+#define FLASH       (&host_flash_regs)
+
+#include "../src/crc.c"
+#include "../src/fw_update.c"
+
+#define TEST_FLASH_SIZE     ((uint32_t)0x80000)
+#define TEST_IMAGE_SIZE     (10003) // Ends part way into a double word
+#define TEST_NEVER          (0xFFFFFFFFu)
+// Page erase takes 22ms typically, 11 runs of the task
+#define TEST_ERASE_RUNS     (22000 / FWUP_TASK_PERIOD_US)
+#define TEST_MAX_RUNS       (100000)
+
+static uint8_t image[TEST_IMAGE_SIZE];
+static uint32_t image_crc;
+
+// Flash simulator
+static uint32_t flash_ops; // Erases and programs started so far
+static uint32_t flash_cut; // Power goes at this operation
+static uint32_t flash_stuck; // Address of a bit that won't program
+static uint32_t erase_address; // Page being erased
+static uint32_t erase_size;
+static uint32_t erase_runs; // Task runs until the erase is done
+static uint32_t busy_runs; // Task runs the event log holds the flash for
+static uint32_t background; // Event log flash work on, see task_run
+static uint32_t runs;
+
+static void flash_operation(uint32_t address, uint32_t size) {
+    if(flash_ops++ == flash_cut) {
+        // Power goes part way through. Half an erase, or a program that
+        // only cleared some of the bits.
+        if(size != 0) {
+            memset((void*)(uintptr_t)address, 0xFF, size / 2);
+        } else {
+            *(uint32_t*)(uintptr_t)address &= 0x5A5A5A5Au;
+        }
+        host_reset(HOST_POWER_LOSS);
+    }
+}
+
+FLASH_Status FLASH_StartErasePage(uint32_t FLASH_Page, uint8_t FLASH_Bank) {
+    uint32_t dual = ((FLASH->OPTR & FLASH_OPTR_DBANK) != 0) ? 1 : 0;
+    if((erase_runs != 0) || ((FLASH->SR & FLASH_SR_BSY) != 0)) {
+        return FLASH_BUSY;
+    }
+    erase_size = dual ? PAGE_SIZE_DUAL : PAGE_SIZE_SINGLE;
+    erase_address = (FLASH_Bank ? BANK2_START_ADDRESS : FLASH_START_ADDRESS)
+            + (FLASH_Page * erase_size);
+    flash_operation(erase_address, erase_size);
+    erase_runs = TEST_ERASE_RUNS;
+    return FLASH_COMPLETE;
+}
+
+FLASH_Status FLASH_FinishErase(void) {
+    if(erase_runs > 1) {
+        return FLASH_BUSY;
+    }
+    if(erase_runs == 1) {
+        memset((void*)(uintptr_t)erase_address, 0xFF, erase_size);
+        erase_runs = 0;
+    }
+    return FLASH_COMPLETE;
+}
+
+FLASH_Status FLASH_ProgramDoubleWord(uint32_t Address, uint32_t Data1, uint32_t Data2) {
+    uint32_t* words = (uint32_t*)(uintptr_t)Address;
+    // Waits out an erase
+    if(erase_runs != 0) {
+        erase_runs = 1;
+        FLASH_FinishErase();
+    }
+    // Only erased flash takes a value, anything takes zero
+    if(((words[0] != FLASH_ERASED) || (words[1] != FLASH_ERASED))
+            && ((Data1 != 0) || (Data2 != 0))) {
+        return FLASH_ERROR_PROGRAM;
+    }
+    flash_operation(Address, 0);
+    words[0] = Data1;
+    words[1] = Data2;
+    if((flash_stuck & ~0x07u) == Address) {
+        // One bit that should have been cleared stays erased
+        uint32_t* word = &words[(flash_stuck & 0x04u) / 4];
+        *word |= ~(*word) & (*word + 1u);
+    }
+    return FLASH_COMPLETE;
+}
+
+void ELOG_Record(uint8_t type, uint32_t code) {
+}
+
+uint32_t GetTick(void) {
+    return runs * (FWUP_TASK_PERIOD_US / 1000);
+}
+
+static const Fwup_Record_Type* record(void) {
+    return (const Fwup_Record_Type*)(uintptr_t)FWUP_RECORD_ADDRESS;
+}
+
+static uint32_t state(void) {
+    return FWUP_GetStatistic(CONFIG_FWUP_STATUS_STATE);
+}
+
+static uint32_t received(void) {
+    return FWUP_GetStatistic(CONFIG_FWUP_STATUS_RECEIVED);
+}
+
+static uint8_t staged_ok(void) {
+    return memcmp((const void*)(uintptr_t)FWUP_STAGING_ADDRESS, image, TEST_IMAGE_SIZE) == 0;
+}
+
+/**
+ * @brief  Flash full of an old update, and a new image to send
+ */
+static void setup(uint8_t dual_bank) {
+    memset((void*)(uintptr_t)FLASH_START_ADDRESS, 0x00, TEST_FLASH_SIZE);
+    memset(&host_flash_regs, 0, sizeof(host_flash_regs));
+    host_flash_regs.OPTR = dual_bank ? FLASH_OPTR_DBANK : 0;
+    host_tim1.BDTR = 0;
+    for(uint32_t i = 0; i < TEST_IMAGE_SIZE; i++) {
+        image[i] = (uint8_t)((i * 7u) ^ (i >> 8));
+    }
+    image_crc = CRC_Software_CRC32(image, TEST_IMAGE_SIZE);
+    flash_ops = 0;
+    flash_cut = TEST_NEVER;
+    flash_stuck = TEST_NEVER;
+    erase_runs = 0;
+    busy_runs = 0;
+    background = 0;
+    runs = 0;
+    FWUP_Init();
+}
+
+/**
+ * @brief  One run of the task, every FWUP_TASK_PERIOD_US. With background
+ *         on, the event log writes a record every 10 runs (20ms) and
+ *         erases a page every 500 runs (1s), holding the flash busy.
+ */
+static void task_run(void) {
+    runs++;
+    if(background) {
+        if((runs % 500) == 0) {
+            busy_runs = TEST_ERASE_RUNS;
+        } else if(((runs % 10) == 0) && (busy_runs == 0)) {
+            busy_runs = 1;
+        }
+    }
+    if(busy_runs > 0) {
+        busy_runs--;
+        host_flash_regs.SR |= FLASH_SR_BSY;
+    } else {
+        host_flash_regs.SR &= ~FLASH_SR_BSY;
+    }
+    if(erase_runs > 1) {
+        erase_runs--;
+    }
+    FWUP_Task();
+}
+
+static uint8_t send(uint32_t offset) {
+    uint32_t length = TEST_IMAGE_SIZE - offset;
+    if(length > FWUP_CHUNK_BYTES) {
+        length = FWUP_CHUNK_BYTES;
+    }
+    return FWUP_Chunk(offset, &image[offset], (uint16_t)length);
+}
+
+/**
+ * @brief  Sends the image a chunk at a time, one try per task run, the
+ *         way the packets come in from the host
+ * @retval Task runs it took to take and program the whole image
+ */
+static uint32_t stream(void) {
+    uint32_t offset = 0, start = runs;
+    CHECK(FWUP_Begin(TEST_IMAGE_SIZE, image_crc) == RETVAL_OK);
+    while(((offset < TEST_IMAGE_SIZE) || (fwup_chunk_bytes != 0) || (fwup_jobs != 0))
+            && (runs - start < TEST_MAX_RUNS) && (state() == Fwup_Receiving)) {
+        if((offset < TEST_IMAGE_SIZE) && (send(offset) == RETVAL_OK)) {
+            offset += FWUP_CHUNK_BYTES;
+        }
+        task_run();
+    }
+    return runs - start;
+}
+
+/**
+ * @brief  Commits and runs the task until the record is written
+ */
+static uint8_t commit(void) {
+    if(FWUP_Commit() != RETVAL_OK) {
+        return RETVAL_FAIL;
+    }
+    for(uint32_t n = 0; (n < 10) && (state() == Fwup_Committing); n++) {
+        task_run();
+    }
+    return (state() == Fwup_Ready) ? RETVAL_OK : RETVAL_FAIL;
+}
+
+static void test_update(void) {
+    setup(1);
+    CHECK(state() == Fwup_Idle);
+    stream();
+    CHECK(FWUP_GetStatistic(CONFIG_FWUP_STATUS_PROGRAMMED) == ((TEST_IMAGE_SIZE + 7u) & ~7u));
+    CHECK(staged_ok());
+    CHECK(commit() == RETVAL_OK);
+    CHECK(record()->Size == TEST_IMAGE_SIZE);
+    CHECK(record()->Crc == image_crc);
+    CHECK(record()->Magic == FWUP_MAGIC);
+    CHECK(!FWUP_IsMarked(&(record()->Trial)));
+    CHECK(FWUP_GetStatistic(CONFIG_FWUP_STATUS_ERRORS) == 0);
+    // What the boot stage will find after a reset
+    FWUP_Init();
+    CHECK(state() == Fwup_Ready);
+}
+
+/**
+ * @brief  A chunk ahead of the next one, or sent before the last one is
+ *         programmed, is refused. A repeat of the last one is ACKed again
+ *         and not taken twice. The image still comes out right.
+ */
+static void test_out_of_order(void) {
+    setup(1);
+    CHECK(FWUP_Begin(TEST_IMAGE_SIZE, image_crc) == RETVAL_OK);
+    CHECK(send(FWUP_CHUNK_BYTES) == RETVAL_FAIL);
+    CHECK(send(0) == RETVAL_OK);
+    CHECK(send(0) == RETVAL_OK);
+    CHECK(received() == FWUP_CHUNK_BYTES);
+    // Still programming the first one
+    CHECK(send(FWUP_CHUNK_BYTES) == RETVAL_FAIL);
+    CHECK(received() == FWUP_CHUNK_BYTES);
+    while(fwup_chunk_bytes != 0) {
+        task_run();
+    }
+    CHECK(send(FWUP_CHUNK_BYTES) == RETVAL_OK);
+    CHECK(send(FWUP_CHUNK_BYTES) == RETVAL_OK);
+    // Too late for the first one, it's already been programmed
+    CHECK(send(0) == RETVAL_FAIL);
+    CHECK(send(3 * FWUP_CHUNK_BYTES) == RETVAL_FAIL);
+    CHECK(received() == 2 * FWUP_CHUNK_BYTES);
+    // Not all there yet
+    CHECK(FWUP_Commit() == RETVAL_FAIL);
+    for(uint32_t offset = 2 * FWUP_CHUNK_BYTES; offset < TEST_IMAGE_SIZE; ) {
+        if(send(offset) == RETVAL_OK) {
+            // And each one twice
+            CHECK(send(offset) == RETVAL_OK);
+            offset += FWUP_CHUNK_BYTES;
+        }
+        task_run();
+    }
+    while(fwup_chunk_bytes != 0) {
+        task_run();
+    }
+    CHECK(received() == TEST_IMAGE_SIZE);
+    CHECK(staged_ok());
+    CHECK(commit() == RETVAL_OK);
+}
+
+/**
+ * @brief  An image that doesn't match its CRC is never committed, whether
+ *         the host sent the wrong CRC or a bit didn't program
+ */
+static void test_bad_crc(void) {
+    setup(1);
+    image_crc ^= 1;
+    stream();
+    CHECK(staged_ok());
+    CHECK(FWUP_Commit() == RETVAL_FAIL);
+    CHECK(state() == Fwup_Failed);
+    CHECK(FWUP_GetStatistic(CONFIG_FWUP_STATUS_ERRORS) == 1);
+    task_run();
+    CHECK(record()->Magic == FLASH_ERASED);
+
+    // The running CRC is from reading the flash back, not from the packets
+    setup(1);
+    flash_stuck = FWUP_STAGING_ADDRESS + 4000;
+    stream();
+    CHECK(!staged_ok());
+    CHECK(FWUP_Commit() == RETVAL_FAIL);
+    CHECK(state() == Fwup_Failed);
+    CHECK(record()->Magic == FLASH_ERASED);
+    FWUP_Init();
+    CHECK(state() == Fwup_Idle);
+
+    // Sent again, it goes through
+    flash_stuck = TEST_NEVER;
+    image_crc = CRC_Software_CRC32(image, TEST_IMAGE_SIZE);
+    stream();
+    CHECK(staged_ok());
+    CHECK(commit() == RETVAL_OK);
+}
+
+/**
+ * @brief  Power cut at every flash operation of an update in turn: while
+ *         the old record is erased, while staging is erased and programmed,
+ *         and while the record header is written. Until the header is all
+ *         there, the reset finds no update and nothing gets swapped in.
+ *         Once it is, the reset finds the whole image staged, matching
+ *         the record's CRC. Either way the update can be sent again.
+ */
+static void test_power_loss(uint8_t dual_bank) {
+    uint32_t ops;
+    // Counted across the resets
+    volatile uint32_t idle = 0, ready = 0;
+
+    setup(dual_bank);
+    stream();
+    CHECK(commit() == RETVAL_OK);
+    ops = flash_ops;
+    for(uint32_t cut = 0; cut <= ops; cut++) {
+        setup(dual_bank);
+        flash_cut = cut;
+        if(setjmp(host_reset_jmp) == 0) {
+            stream();
+            commit();
+            // Power goes after the commit
+            host_reset(HOST_POWER_LOSS);
+        }
+        flash_cut = TEST_NEVER;
+        erase_runs = 0;
+        FWUP_Init();
+        if(state() == Fwup_Ready) {
+            ready++;
+            CHECK(cut >= ops - 1);
+            CHECK(record()->Size == TEST_IMAGE_SIZE);
+            CHECK(record()->Crc == image_crc);
+            CHECK(CRC_Software_CRC32((const uint8_t*)(uintptr_t)FWUP_STAGING_ADDRESS,
+                    record()->Size) == image_crc);
+        } else {
+            idle++;
+            CHECK(state() == Fwup_Idle);
+            CHECK(record()->Magic != FWUP_MAGIC);
+        }
+        stream();
+        CHECK(staged_ok());
+        CHECK(commit() == RETVAL_OK);
+    }
+    // Only the cut after the commit finds it ready. The one on the magic
+    // number leaves it half written.
+    CHECK(ready == 1);
+    CHECK(idle == ops);
+    printf("%s bank: power cut at each of %u flash operations, none swapped in a bad image\n",
+            dual_bank ? "Dual" : "Single", (unsigned int)ops);
+}
+
+/**
+ * @brief  How fast an image goes into staging at one double word per task
+ *         run, with the flash to itself and with the event log using it
+ */
+static void test_rate(void) {
+    const char* names[2] = { "flash to itself", "event log busy" };
+    for(uint32_t b = 0; b < 2; b++) {
+        setup(1);
+        background = b;
+        uint32_t took = stream();
+        CHECK(staged_ok());
+        double seconds = (double)took * FWUP_TASK_PERIOD_US * 1e-6;
+        // One double word per run, or 8 bytes in 2ms
+        CHECK(took > (TEST_IMAGE_SIZE / 8));
+        printf("Staging, %s: %u task runs, %.0f bytes/s (%.0f at most), "
+                "%.1fs for a %uK image\n", names[b], (unsigned int)took,
+                TEST_IMAGE_SIZE / seconds, 8.0 / (FWUP_TASK_PERIOD_US * 1e-6),
+                (double)FWUP_SLOT_SIZE / (TEST_IMAGE_SIZE / seconds),
+                (unsigned int)(FWUP_SLOT_SIZE / 1024));
+    }
+}
+
+int main(void) {
+    void* flash = mmap((void*)(uintptr_t)FLASH_START_ADDRESS, TEST_FLASH_SIZE,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if(flash != (void*)(uintptr_t)FLASH_START_ADDRESS) {
+        printf("test_fw_update: can't map the flash at 0x%08x\n", (unsigned int)FLASH_START_ADDRESS);
+        return 1;
+    }
+
+    test_update();
+    test_out_of_order();
+    test_bad_crc();
+    test_power_loss(1);
+    test_power_loss(0);
+    test_rate();
+    return host_summary("test_fw_update");
+}
@@ -0,0 +1,113 @@
+/******************************************************************************
+ * Filename: test_hall_sensor.c
+ * Description: Host test of setting the hall state angles from floats. An
+ *              angle of exactly one is a full revolution, the same as zero,
+ *              and must not overflow the conversion to Angle_Type. Nor can
+ *              an angle saved just under 360deg, which reads back as one.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <math.h>
+#include "../src/hall_sensor.c"
+
+void GPIO_Clk(GPIO_TypeDef* gpio) {
+}
+
+void GPIO_AF(GPIO_TypeDef* gpio, uint8_t pin, uint8_t af) {
+}
+
+// Saved hall angles, by state
+static float saved[7];
+
+uint16_t EE_SaveFloat(uint16_t VirtAddress, float Data) {
+    saved[VirtAddress - CONFIG_MOTOR_HALL1 + 1] = Data;
+    return 0;
+}
+
+float EE_ReadFloatWithDefault(uint16_t VirtAddress, float defalt) {
+    return saved[VirtAddress - CONFIG_MOTOR_HALL1 + 1];
+}
+
+static float table[8] = { 0.0f, 0.75f, 0.0833f, 0.9167f, 0.4167f, 0.5833f, 0.25f, 0.0f };
+
+/**
+ * @brief  One is accepted and lands on zero, past one and NaN are refused
+ */
+static void test_set_angle(void) {
+    CHECK(HALL_SetAngleTable(table) == RETVAL_OK);
+    CHECK(HALL_SetAngle(1, 1.0f) == RETVAL_OK);
+    CHECK(HALL_GetAngleFromTable(1) == U32_0_DEG);
+    CHECK(HALL_SetAngle(1, 0.99999994f) == RETVAL_OK);
+    CHECK(HALL_GetAngleFromTable(1) == 0xFFFFFF00u);
+    CHECK(HALL_SetAngle(1, 0.0f) == RETVAL_OK);
+    CHECK(HALL_GetAngleFromTable(1) == U32_0_DEG);
+
+    CHECK(HALL_SetAngle(1, 1.0000001f) == RETVAL_FAIL);
+    CHECK(HALL_SetAngle(1, -1e-9f) == RETVAL_FAIL);
+    CHECK(HALL_SetAngle(1, NAN) == RETVAL_FAIL);
+    CHECK(HALL_GetAngleFromTable(1) == U32_0_DEG);
+}
+
+/**
+ * @brief  Same for the whole table, and the order still comes out right
+ *         with the angle that wrapped to zero first
+ */
+static void test_set_table(void) {
+    table[3] = 1.0f;
+    CHECK(HALL_SetAngleTable(table) == RETVAL_OK);
+    CHECK(HALL_GetAngleFromTable(3) == U32_0_DEG);
+    CHECK(HALL_GetAngleFromTable(6) == U32_90_DEG);
+    CHECK(HallStateForwardOrder[1] == 3);
+    CHECK(HallStateForwardOrder[2] == 2);
+
+    table[3] = NAN;
+    CHECK(HALL_SetAngleTable(table) == RETVAL_FAIL);
+    table[3] = 1.5f;
+    CHECK(HALL_SetAngleTable(table) == RETVAL_FAIL);
+    // Left as it was
+    CHECK(HALL_GetAngleFromTable(3) == U32_0_DEG);
+    table[3] = 0.9167f;
+}
+
+/**
+ * @brief  An angle a few counts below 360deg is saved as 1.0f, and loads
+ *         back as zero
+ */
+static void test_save_load(void) {
+    CHECK(HALL_SetAngleTable(table) == RETVAL_OK);
+    HallStateAnglesFwd[3] = 0xFFFFFFF0u;
+    HALL_SaveVariables();
+    CHECK(saved[3] == 1.0f);
+    HALL_LoadVariables();
+    CHECK(HALL_GetAngleFromTable(3) == U32_0_DEG);
+    CHECK(HALL_GetAngleFromTable(6) == U32_90_DEG);
+    CHECK(HallStateForwardOrder[1] == 3);
+}
+
+int main(void) {
+    test_set_angle();
+    test_set_table();
+    test_save_load();
+    return host_summary("test_hall_sensor");
+}
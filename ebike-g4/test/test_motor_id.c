@@ -0,0 +1,284 @@
+/******************************************************************************
+ * Filename: test_motor_id.c
+ * Description: Host test of motor parameter identification, on a simulated
+ *              salient motor with Ld < Lq. The rotor is free to turn, or
+ *              blocked at every angle in turn. Each run checks how far the
+ *              estimates are from the motor's real parameters, and how long
+ *              the identification takes, step by step.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <math.h>
+#include <string.h>
+#include "../src/foc_lib.c"
+#include "../src/motor_id.c"
+
+void CORDIC_CalcSinCos(Angle_Type theta, float* sin, float* cos) {
+    *sin = sinf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+    *cos = cosf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+}
+
+static uint32_t events;
+
+void TASK_PostEvent(uint32_t e) {
+    events |= e;
+}
+
+void DLOG_Write(uint32_t id, const uint32_t* args, uint8_t nargs) {
+}
+
+#define SUBSTEPS        (10)
+#define DT              (1.0f / (MOTID_SAMPLING_RATE * SUBSTEPS))
+#define VBUS            (48.0f)
+#define MOTOR_R         (0.1f)
+#define MOTOR_LD        (90e-6f)
+#define MOTOR_LQ        (110e-6f)
+#define MOTOR_FLUX      (0.02f)
+// Rotor, in electrical units. Lines up with half the test current in
+// a few hundred ms, and gets well past MOTID_FLUX_SPEED when spinning.
+#define TORQUE_GAIN     (10000.0f) // rad/s^2 per N.m-ish of lambda * Iq
+#define FRICTION        (2.0f) // 1/s
+#define VALID_EHZ       (2.0f) // Hall interpolation is good above this
+
+static Config_Main cfg;
+static Motor_Controls ctrl;
+static Motor_Observations obv;
+static Motor_PWMDuties pwm;
+static PID_Type pid_id, pid_iq;
+static FOC_StateVariables foc;
+static Main_Variables mvar;
+
+// Plant state, rotor frame
+static float id, iq;
+static float theta; // Electrical angle, radians
+static float omega; // Electrical rad/s
+static uint8_t blocked;
+static float hall_offset; // Where the Hall states start, revolutions
+
+// PWM cycles spent in each step of the last run
+static uint32_t state_cycles[MotId_Failed + 1];
+
+static float wrap(float a) {
+    return a - 2.0f * (float)M_PI * floorf(a / (2.0f * (float)M_PI));
+}
+
+static uint8_t hall_state(void) {
+    float pos = theta / (2.0f * (float)M_PI) - hall_offset;
+    pos -= floorf(pos);
+    return (uint8_t)(pos * 6.0f) + 1;
+}
+
+Angle_Type HALL_GetStateMidpoint(uint8_t state) {
+    return ANGLE_FROM_FLOAT(hall_offset + ((float)state - 0.5f) / 6.0f);
+}
+
+/**
+ * @brief  The motor over one PWM cycle, with the averaged voltage vector
+ *         the identification asked for
+ */
+static void plant(void) {
+    float va = foc.Clarke_Alpha * VBUS * INV_SQRT3;
+    float vb = foc.Clarke_Beta * VBUS * INV_SQRT3;
+    for(uint32_t n = 0; n < SUBSTEPS; n++) {
+        float s = sinf(theta), c = cosf(theta);
+        float vd = va * c + vb * s;
+        float vq = vb * c - va * s;
+        float did = (vd - MOTOR_R * id + omega * MOTOR_LQ * iq) / MOTOR_LD;
+        float diq = (vq - MOTOR_R * iq - omega * (MOTOR_LD * id + MOTOR_FLUX)) / MOTOR_LQ;
+        id += did * DT;
+        iq += diq * DT;
+        if(blocked == 0) {
+            float torque = MOTOR_FLUX * iq + (MOTOR_LD - MOTOR_LQ) * id * iq;
+            omega += (TORQUE_GAIN * torque - FRICTION * omega) * DT;
+            theta = wrap(theta + omega * DT);
+        }
+    }
+}
+
+static void sense(void) {
+    float s = sinf(theta), c = cosf(theta);
+    float alpha = id * c - iq * s;
+    float beta = id * s + iq * c;
+    float speed = omega / (2.0f * (float)M_PI);
+    obv.iA = alpha;
+    obv.iB = -0.5f * alpha + SQRT3_OVER_2 * beta;
+    obv.iC = -0.5f * alpha - SQRT3_OVER_2 * beta;
+    obv.HallState = hall_state();
+    obv.RotorSpeed_eHz = speed;
+    if(fabsf(speed) < VALID_EHZ) {
+        obv.RotorAngle = HALL_GetStateMidpoint(obv.HallState);
+    } else {
+        obv.RotorAngle = ANGLE_FROM_FLOAT(theta / (2.0f * (float)M_PI));
+    }
+}
+
+/**
+ * @brief  Runs a whole identification
+ * @param  start - Rotor angle to start from, degrees
+ * @param  block - Non-zero to hold the rotor there
+ * @param  offset - Hall state 1 starts here, revolutions
+ */
+static void run(float start, uint8_t block, float offset) {
+    uint32_t cycles = 0;
+    cfg.MotorResistance = 1.0f;
+    cfg.MotorLd = 1.0f;
+    cfg.MotorLq = 1.0f;
+    cfg.MotorFluxLinkage = 1.0f;
+    ctrl.BusVoltage = VBUS;
+    FOC_PIDdefaults(&pid_id);
+    FOC_PIDdefaults(&pid_iq);
+    FOC_PIsynth(&pid_id, MOTOR_R, MOTOR_LD, INV_SQRT3 * VBUS, MOTID_SAMPLING_RATE, 1000.0f);
+    FOC_PIsynth(&pid_iq, MOTOR_R, MOTOR_LQ, INV_SQRT3 * VBUS, MOTID_SAMPLING_RATE, 1000.0f);
+    foc.Id_PID = &pid_id;
+    foc.Iq_PID = &pid_iq;
+    foc.Clarke_Alpha = 0.0f;
+    foc.Clarke_Beta = 0.0f;
+    mvar.Ctrl = &ctrl;
+    mvar.Obv = &obv;
+    mvar.Pwm = &pwm;
+    mvar.Foc = &foc;
+    id = 0.0f;
+    iq = 0.0f;
+    theta = wrap(start * (float)M_PI / 180.0f);
+    omega = 0.0f;
+    blocked = block;
+    hall_offset = offset;
+    events = 0;
+    memset(state_cycles, 0, sizeof(state_cycles));
+    MOTID_Init();
+    CHECK(MOTID_Start(0.0f) == RETVAL_OK);
+    while((MOTID_IsRunning() != 0) && (cycles < 20 * DFLT_FOC_PWM_FREQ)) {
+        state_cycles[Motid.State]++;
+        sense();
+        MOTID_Process(&mvar, &cfg, 1);
+        plant();
+        cycles++;
+    }
+    CHECK(Motid.State == MotId_Done);
+    CHECK(events == TASK_EVENT_MOTOR_ID);
+}
+
+static float error(float estimate, float real) {
+    return fabsf(estimate - real) / real;
+}
+
+static float seconds(MotId_State state) {
+    return (float)state_cycles[state] / (float)DFLT_FOC_PWM_FREQ;
+}
+
+static float total_seconds(void) {
+    float t = 0.0f;
+    for(uint32_t s = 0; s <= MotId_Failed; s++) {
+        t += seconds((MotId_State)s);
+    }
+    return t;
+}
+
+/**
+ * @brief  Keeps the shortest and longest identification so far
+ */
+static void track_time(float* fastest, float* slowest) {
+    float t = total_seconds();
+    *fastest = fminf(*fastest, t);
+    *slowest = fmaxf(*slowest, t);
+}
+
+static void print_steps(const char* name) {
+    printf("%s: align %.2fs, resistance %.2fs, Ld %.2fs, Lq %.2fs, spin %.2fs\n", name,
+            (double)seconds(MotId_Align),
+            (double)(seconds(MotId_Resistance1) + seconds(MotId_Resistance2)),
+            (double)seconds(MotId_InductanceD), (double)seconds(MotId_InductanceQ),
+            (double)seconds(MotId_Spin));
+}
+
+static void test_free(void) {
+    float fastest = 1e9f, slowest = 0.0f;
+    float worst_l = 0.0f;
+    uint32_t aligned = 0;
+    // Anywhere but right on the unstable point opposite phase A. Hall edges
+    // between the aligned position and its neighbours, and on it.
+    for(float start = -170.0f; start < 180.0f; start += 20.0f) {
+        for(uint32_t k = 0; k < 2; k++) {
+            run(start, 0, (k == 0) ? 0.0f : (1.0f / 12.0f));
+            CHECK(error(cfg.MotorResistance, MOTOR_R) < 0.01f);
+            CHECK(error(cfg.MotorFluxLinkage, MOTOR_FLUX) < 0.03f);
+            CHECK(Motid.FluxValid == 1);
+            CHECK(cfg.MotorLd < cfg.MotorLq);
+            track_time(&fastest, &slowest);
+            // Lined up, unless it started in the Hall state it lines up in.
+            // Then it's the same as blocked.
+            if(Motid.Aligned != 0) {
+                aligned++;
+                worst_l = fmaxf(worst_l, error(cfg.MotorLd, MOTOR_LD));
+                worst_l = fmaxf(worst_l, error(cfg.MotorLq, MOTOR_LQ));
+            }
+        }
+    }
+    CHECK(aligned >= 30);
+    CHECK(worst_l < 0.01f);
+    printf("free rotor: Ld, Lq within %.1f%%\n", (double)(100.0f * worst_l));
+    // Spinning up for the flux linkage is what varies
+    CHECK(slowest < 5.0f);
+    printf("free rotor: identification takes %.2fs to %.2fs\n", (double)fastest, (double)slowest);
+    print_steps("free rotor, last run");
+}
+
+/**
+ * @brief  Wheel held still. The d axis is only known to the Hall state, so
+ *         Ld and Lq mix, at most a quarter of the way towards each other.
+ *         They must never swap.
+ */
+static void test_blocked(void) {
+    float fastest = 1e9f, slowest = 0.0f;
+    float worst_ld = 0.0f, worst_lq = 0.0f;
+    // Admittances mix as cos^2 and sin^2 of the axis error
+    float ld_30 = 1.0f / (0.75f / MOTOR_LD + 0.25f / MOTOR_LQ);
+    float lq_30 = 1.0f / (0.25f / MOTOR_LD + 0.75f / MOTOR_LQ);
+    for(float start = 0.0f; start < 360.0f; start += 5.0f) {
+        run(start + 0.1f, 1, 0.0f);
+        CHECK(Motid.Aligned == 0);
+        CHECK(error(cfg.MotorResistance, MOTOR_R) < 0.01f);
+        CHECK(cfg.MotorLd < cfg.MotorLq);
+        CHECK(cfg.MotorLd < ld_30 * 1.02f);
+        CHECK(cfg.MotorLq > lq_30 * 0.98f);
+        // Never turned, so the old flux linkage stays
+        CHECK(Motid.FluxValid == 0);
+        CHECK(cfg.MotorFluxLinkage == 1.0f);
+        worst_ld = fmaxf(worst_ld, error(cfg.MotorLd, MOTOR_LD));
+        worst_lq = fmaxf(worst_lq, error(cfg.MotorLq, MOTOR_LQ));
+        track_time(&fastest, &slowest);
+    }
+    printf("blocked rotor: Ld within %.1f%%, Lq within %.1f%%\n",
+            (double)(100.0f * worst_ld), (double)(100.0f * worst_lq));
+    // Waits out the spin timeout before deciding the wheel is blocked
+    CHECK(slowest < 10.0f);
+    printf("blocked rotor: identification takes %.2fs to %.2fs\n", (double)fastest, (double)slowest);
+    print_steps("blocked rotor, last run");
+}
+
+int main(void) {
+    test_free();
+    test_blocked();
+    return host_summary("test_motor_id");
+}
@@ -0,0 +1,299 @@
+/******************************************************************************
+ * Filename: test_pas.c
+ * Description: Host test of pedal assist. A simulated crank sensor drives a
+ *              model of the PAS timer in PWM input mode, one timer tick at
+ *              a time, and PAS_Process runs every millisecond like it does
+ *              in the main loop. Checks cadence, how long assist takes to
+ *              start and stop, and that backpedaling never assists.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <math.h>
+
+static TIM_TypeDef host_tim5;
+#undef TIM5
+#define TIM5        (&host_tim5)
+
+#include "../src/pas.c"
+
+void GPIO_Analog(GPIO_TypeDef* gpio, uint8_t pin) {
+}
+
+void GPIO_AF(GPIO_TypeDef* gpio, uint8_t pin, uint8_t af) {
+}
+
+uint16_t EE_SaveInt16(uint16_t VirtAddress, int16_t Data) {
+    return 0;
+}
+
+uint16_t EE_SaveFloat(uint16_t VirtAddress, float Data) {
+    return 0;
+}
+
+int16_t EE_ReadInt16WithDefault(uint16_t VirtAddress, int16_t defalt) {
+    return defalt;
+}
+
+float EE_ReadFloatWithDefault(uint16_t VirtAddress, float defalt) {
+    return defalt;
+}
+
+static float torque_volts;
+
+float ADC_GetThrottle(void) {
+    return torque_volts;
+}
+
+float THROTTLE_GetRatio(void) {
+    return 1.0f;
+}
+
+#define TICKS_PER_MS    (PAS_TICK_HZ / 1000u)
+#define PULSES          (DFLT_PAS_PULSES)
+
+// Crank sensor
+static float rpm;
+static float duty; // High time of each pulse, fraction of the period
+static float pulse_pos; // Pulses so far, the fraction is where in this one
+static uint8_t level;
+static uint32_t edges; // Rising edges so far
+static uint32_t ms; // Time since the test started
+static float peak; // Highest command since the test last cleared it
+
+/**
+ * @brief  One tick of the PAS timer. Counts up, rolls over at ARR, and on
+ *         a rising edge captures the period into CCR1 and resets. A
+ *         falling edge captures the high time into CCR2. Interrupts are
+ *         handled the same as TIM5_IRQHandler.
+ */
+static void tick(void) {
+    uint8_t now;
+    pulse_pos += rpm * (float)PULSES / (60.0f * (float)PAS_TICK_HZ);
+    pulse_pos -= floorf(pulse_pos);
+    now = (pulse_pos < duty) ? 1 : 0;
+    if(host_tim5.CNT >= host_tim5.ARR) {
+        host_tim5.CNT = 0;
+        PAS_TimeoutCallback();
+    } else {
+        host_tim5.CNT++;
+    }
+    if((now != 0) && (level == 0)) {
+        host_tim5.CCR1 = host_tim5.CNT;
+        host_tim5.CNT = 0;
+        edges++;
+        PAS_CaptureCallback();
+    } else if((now == 0) && (level != 0)) {
+        host_tim5.CCR2 = host_tim5.CNT;
+    }
+    level = now;
+}
+
+static void run_ms(uint32_t n) {
+    for(uint32_t i = 0; i < n; i++) {
+        for(uint32_t t = 0; t < TICKS_PER_MS; t++) {
+            tick();
+        }
+        PAS_Process();
+        peak = fmaxf(peak, PAS_GetCommand());
+        ms++;
+    }
+}
+
+/**
+ * @brief  Runs until the command gets to a fraction of where it's going
+ * @retval Milliseconds it took, or the limit if it never got there
+ */
+static uint32_t run_until(float fraction, float target, uint32_t limit) {
+    uint32_t start = ms;
+    while((ms - start) < limit) {
+        run_ms(1);
+        if((target > 0.0f) ? (PAS_GetCommand() >= fraction * target) : (PAS_GetCommand() <= fraction)) {
+            break;
+        }
+    }
+    return ms - start;
+}
+
+/**
+ * @brief  Changes the direction the cranks turn at the start of a pulse,
+ *         so the duty cycle of each pulse is one way or the other
+ */
+static void turn(float new_duty) {
+    uint32_t last = edges;
+    while(edges == last) {
+        run_ms(1);
+    }
+    duty = new_duty;
+}
+
+static void setup(uint16_t mode, uint16_t direction) {
+    PAS_Init();
+    CHECK(PAS_SetInputMode(mode) == RETVAL_OK);
+    CHECK(PAS_SetDirection(direction) == RETVAL_OK);
+    rpm = 0.0f;
+    duty = 0.5f;
+    pulse_pos = 0.5f; // Half a pulse from the next rising edge
+    level = 0;
+    ms = 0;
+    torque_volts = DFLT_PAS_TORQUE_ZERO;
+    host_tim5.CNT = 0;
+    // Settle with the cranks still, long enough to time out
+    run_ms(1000);
+}
+
+static float assist(float cadence) {
+    return DFLT_PAS_LEVEL2 * fminf(1.0f, cadence / DFLT_PAS_CADENCE_FULL);
+}
+
+/**
+ * @brief  Steady pedaling from a standstill. Assist waits for a start
+ *         edge and PAS_START_PULSES periods, then ramps at PAS_RISE.
+ */
+static void test_cadence(void) {
+    const float cadences[] = { 15.0f, 30.0f, 60.0f, 90.0f, 120.0f };
+    for(uint32_t i = 0; i < 5; i++) {
+        float pulse_ms = 60000.0f / (cadences[i] * (float)PULSES);
+        float target = assist(cadences[i]);
+        uint32_t start, full;
+        setup(PAS_INPUT_CADENCE, PAS_DIR_NONE);
+        CHECK(PAS_GetCommand() == 0.0f);
+        CHECK(PAS_GetPedaling() == PAS_PEDAL_STOPPED);
+        rpm = cadences[i];
+        start = run_until(1.0f, 1e-6f, 5000);
+        full = run_until(0.9f, target, 5000) + start;
+        // The first edge is half a period in, and doesn't count
+        CHECK(fabsf((float)start - (((float)PAS_START_PULSES + 0.5f) * pulse_ms)) < 2.0f);
+        CHECK((float)(full - start) <= (0.9f * target / PAS_RISE) + 2.0f);
+        run_ms(1000);
+        CHECK(PAS_GetPedaling() == PAS_PEDAL_FORWARD);
+        CHECK(fabsf(PAS_GetCadence() - cadences[i]) < 0.01f * cadences[i]);
+        CHECK(fabsf(PAS_GetCommand() - target) < 0.01f * target);
+        printf("%3.0f rpm: assist starts after %ums, 90%% after %ums\n", (double)cadences[i], start, full);
+    }
+    // Slower than the timeout allows is the same as not pedaling
+    setup(PAS_INPUT_CADENCE, PAS_DIR_NONE);
+    rpm = 0.8f * 60.0f / (DFLT_PAS_TIMEOUT * (float)PULSES);
+    run_ms(5000);
+    CHECK(PAS_GetCommand() == 0.0f);
+}
+
+/**
+ * @brief  Cranks stop dead. The cadence falls off with the time since the
+ *         last edge, and the timeout ends pedaling altogether.
+ */
+static void test_stop(void) {
+    float pulse_ms = 60000.0f / (60.0f * (float)PULSES);
+    float target = assist(60.0f);
+    uint32_t half, zero;
+    setup(PAS_INPUT_CADENCE, PAS_DIR_NONE);
+    rpm = 60.0f;
+    run_ms(2000);
+    CHECK(fabsf(PAS_GetCommand() - target) < 0.01f * target);
+    // Stop just after a rising edge, the worst place
+    while(level == 0) {
+        run_ms(1);
+    }
+    rpm = 0.0f;
+    half = run_until(0.5f * target, 0.0f, 5000);
+    // Halves once twice the period has gone by
+    CHECK((float)half <= (2.0f * pulse_ms) + 2.0f);
+    zero = half + run_until(0.0f, 0.0f, 5000);
+    CHECK((float)zero <= (1000.0f * DFLT_PAS_TIMEOUT) + 2.0f);
+    CHECK(PAS_GetPedaling() == PAS_PEDAL_STOPPED);
+    CHECK(PAS_GetCadence() == 0.0f);
+    printf("stop from 60 rpm: half assist after %ums, none after %ums\n", half, zero);
+    // Starting again goes through the start pulses again
+    rpm = 60.0f;
+    CHECK((float)run_until(1.0f, 1e-6f, 5000) >= ((float)PAS_START_PULSES * pulse_ms));
+}
+
+/**
+ * @brief  Dual Hall crank sensor, where the duty cycle gives the direction.
+ *         Backpedaling must never assist, whichever way round it's wired.
+ */
+static void test_backpedal(void) {
+    float pulse_ms = 60000.0f / (60.0f * (float)PULSES);
+    for(uint16_t dir = PAS_DIR_HIGH_FORWARD; dir <= PAS_DIR_LOW_FORWARD; dir++) {
+        float forward = (dir == PAS_DIR_HIGH_FORWARD) ? 0.7f : 0.3f;
+        uint32_t drop;
+        setup(PAS_INPUT_CADENCE, dir);
+        // Backwards from a standstill
+        rpm = 60.0f;
+        duty = 1.0f - forward;
+        peak = 0.0f;
+        run_ms(3000);
+        CHECK(peak == 0.0f);
+        CHECK(PAS_GetPedaling() == PAS_PEDAL_BACKWARD);
+        CHECK(PAS_GetCadence() == 0.0f);
+        // Forwards, then back again. Assist ends on the first backward pulse.
+        duty = forward;
+        run_ms(2000);
+        CHECK(PAS_GetCommand() > 0.9f * assist(60.0f));
+        turn(1.0f - forward);
+        drop = run_until(0.0f, 0.0f, 5000);
+        CHECK((float)drop <= pulse_ms + 2.0f);
+        CHECK(PAS_GetPedaling() == PAS_PEDAL_BACKWARD);
+        // Rocking the cranks back and forth, one pulse each way
+        peak = 0.0f;
+        for(uint32_t i = 0; i < 40; i++) {
+            turn(((i & 1) != 0) ? forward : (1.0f - forward));
+        }
+        CHECK(peak == 0.0f);
+        printf("backpedal, %s duty forward: assist ends after %ums\n",
+                (dir == PAS_DIR_HIGH_FORWARD) ? "high" : "low", drop);
+    }
+}
+
+/**
+ * @brief  Torque sensor step, through the filter and the rise limit
+ */
+static void test_torque(void) {
+    float target = DFLT_PAS_LEVEL2 * 0.5f;
+    uint32_t full;
+    setup(PAS_INPUT_TORQUE, PAS_DIR_NONE);
+    // Half the torque for full assist
+    torque_volts = DFLT_PAS_TORQUE_ZERO + (0.5f * DFLT_PAS_TORQUE_FULL / DFLT_PAS_TORQUE_SCALE);
+    full = run_until(0.9f, target, 5000);
+    CHECK(full < 200);
+    run_ms(1000);
+    CHECK(fabsf(PAS_GetTorque() - 0.5f * DFLT_PAS_TORQUE_FULL) < 0.01f * DFLT_PAS_TORQUE_FULL);
+    CHECK(fabsf(PAS_GetCommand() - target) < 0.01f * target);
+    // Feet resting on the pedals
+    torque_volts = DFLT_PAS_TORQUE_ZERO + (0.5f * PAS_TORQUE_DEADBAND / DFLT_PAS_TORQUE_SCALE);
+    run_ms(1000);
+    CHECK(PAS_GetCommand() == 0.0f);
+    // Broken wire
+    torque_volts = 0.0f;
+    run_ms(1);
+    CHECK(PAS_GetCommand() == 0.0f);
+    printf("torque step: 90%% assist after %ums\n", full);
+}
+
+int main(void) {
+    test_cadence();
+    test_stop();
+    test_backpedal();
+    test_torque();
+    return host_summary("test_pas");
+}
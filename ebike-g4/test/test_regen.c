@@ -0,0 +1,298 @@
+/******************************************************************************
+ * Filename: test_regen.c
+ * Description: Host test of regenerative braking. A bike with a direct
+ *              drive hub motor is braked on the flat, held on a long
+ *              descent with a nearly full battery, and left rolling
+ *              backwards on a hill with the brake held. The current loop
+ *              is taken as ideal, with the battery current limiter and
+ *              estimate from the firmware in between, and a battery with
+ *              internal resistance sets the bus voltage.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <math.h>
+#include "../src/foc_lib.c"
+#include "../src/battery_current.c"
+#include "../src/regen.c"
+
+void CORDIC_CalcSinCos(Angle_Type theta, float* sin, float* cos) {
+    *sin = sinf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+    *cos = cosf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+}
+
+static uint32_t disengaged;
+
+uint8_t SPEED_Disengage(void) {
+    disengaged++;
+    return RETVAL_OK;
+}
+
+#define RATE            (2000) // Speed loop calls per second
+#define DT              (1.0f / (float)RATE)
+#define PWM_PER_STEP    (DFLT_FOC_PWM_FREQ / RATE)
+
+// Bike and rider
+#define MASS            (100.0f) // kg
+#define GRAVITY         (9.81f)
+#define ROLLING         (0.008f)
+#define DRAG            (0.35f) // Half of air density * CdA, N per (m/s)^2
+#define WHEEL_RADIUS    (DFLT_MOTOR_WHEEL_SIZE * 0.0005f) // m
+// Direct drive hub
+#define POLE_PAIRS      (DFLT_MOTOR_POLEPAIRS)
+#define MOTOR_R         (0.15f) // Ohm
+#define MOTOR_L         (100e-6f) // H
+#define MOTOR_FLUX      (0.037f) // Wb, about 1.3Nm/A
+// Battery
+#define BATT_RINT       (0.3f) // Ohm, a small pack that's getting old
+
+static Config_Main cfg;
+
+// Bike state, held between calls
+static float speed; // m/s, negative rolling backwards
+static float grade; // Rise over run
+static float batt_ocv; // Open circuit voltage
+static float vbus;
+static float ibatt; // Present battery current, negative when charging
+static float iq; // Present q axis current
+static float force; // From the motor, at the road
+static float peak_vbus;
+static float battery_wh; // Energy into the battery, from the plant side
+
+static float kmh(void) {
+    return fabsf(speed) * 3.6f;
+}
+
+static uint8_t direction(void) {
+    if(speed > 0.05f) {
+        return HALL_ROT_FORWARD;
+    } else if(speed < -0.05f) {
+        return HALL_ROT_REVERSE;
+    }
+    return HALL_ROT_UNKNOWN;
+}
+
+/**
+ * @brief  One speed loop call, then ten PWM cycles of an ideal current
+ *         loop following the command through the battery limiter
+ * @retval The regen command
+ */
+static float step(void) {
+    float regen = REGEN_Process(&cfg, vbus, kmh(), IBATT_GetFilteredCurrent(), direction());
+    CHECK((regen >= 0.0f) && (regen <= 1.0f));
+    // As in MAIN_SpeedISR, the brake overrides the throttle
+    float throttle_command = (REGEN_IsBraking() != 0) ? -regen : 0.0f;
+    float iq_ref = throttle_command * cfg.MaxPhaseRegenCurrent;
+    // Signed electrical speed. Positive Iq pushes forwards.
+    float w = speed / WHEEL_RADIUS * (float)POLE_PAIRS;
+    float full_scale = vbus * INV_SQRT3;
+    for(uint32_t n = 0; n < PWM_PER_STEP; n++) {
+        float td = (-w * MOTOR_L * iq) / full_scale;
+        float tq = (MOTOR_R * iq + w * MOTOR_FLUX) / full_scale;
+        iq = IBATT_LimitIq(&cfg, iq_ref, td, tq, 0.0f, iq);
+        ibatt = IBATT_Estimate(td, tq, 0.0f, iq);
+    }
+    vbus = batt_ocv - (BATT_RINT * ibatt);
+    peak_vbus = fmaxf(peak_vbus, vbus);
+    battery_wh -= ibatt * vbus * DT / 3600.0f;
+
+    force = 1.5f * (float)POLE_PAIRS * MOTOR_FLUX * iq / WHEEL_RADIUS;
+    float resist = MASS * GRAVITY * grade;
+    if(speed != 0.0f) {
+        resist += copysignf(MASS * GRAVITY * ROLLING + DRAG * speed * speed, speed);
+    }
+    speed += (force - resist) / MASS * DT;
+    return regen;
+}
+
+static void run_ms(uint32_t ms) {
+    for(uint32_t i = 0; i < ms * RATE / 1000; i++) {
+        step();
+    }
+}
+
+static float kinetic_wh(void) {
+    return 0.5f * MASS * speed * speed / 3600.0f;
+}
+
+static void setup(float kmh_start, float ocv) {
+    cfg.MaxVoltFault = DFLT_LMT_VOLT_FAULT_MAX;
+    cfg.MaxPhaseCurrent = DFLT_LMT_PHASE_CUR_MAX;
+    cfg.MaxPhaseRegenCurrent = 30.0f;
+    cfg.MaxBatteryCurrent = DFLT_LMT_BATT_CUR_MAX;
+    cfg.MaxBatteryRegenCurrent = 10.0f;
+    cfg.throttle_limit_scale = 1.0f;
+    cfg.regen_limit_scale = 1.0f;
+    speed = kmh_start / 3.6f;
+    grade = 0.0f;
+    batt_ocv = ocv;
+    vbus = ocv;
+    ibatt = 0.0f;
+    iq = 0.0f;
+    peak_vbus = vbus;
+    battery_wh = 0.0f;
+    disengaged = 0;
+    IBATT_Init();
+    REGEN_Init();
+}
+
+static void test_ramps(void) {
+    setup(30.0f, 52.0f);
+    REGEN_SetBrake(1);
+    CHECK(disengaged == 1);
+    CHECK(REGEN_IsBraking() != 0);
+    // Half a second to full regen
+    for(uint32_t i = 1; i <= RATE / 2; i++) {
+        float regen = step();
+        CHECK(fabsf(regen - (float)i * REGEN_RISE_RATE / RATE) < 1e-4f);
+    }
+    CHECK(REGEN_GetCommand() > 0.999f);
+    // Forward torque derating, for a flat battery say, doesn't limit regen
+    cfg.throttle_limit_scale = 0.2f;
+    CHECK(step() > 0.999f);
+    cfg.throttle_limit_scale = 1.0f;
+    // Thermal derating does, straight away. Coming back up is no faster
+    // than the brake ramp.
+    cfg.regen_limit_scale = 0.5f;
+    CHECK(step() == 0.5f);
+    cfg.regen_limit_scale = 1.0f;
+    CHECK(fabsf(step() - (0.5f + REGEN_RISE_RATE / RATE)) < 1e-4f);
+    run_ms(250);
+    CHECK(REGEN_GetCommand() > 0.999f);
+    // And let go in a tenth of a second
+    REGEN_SetBrake(0);
+    CHECK(disengaged == 1);
+    for(uint32_t i = 1; i <= RATE / 10; i++) {
+        float regen = step();
+        CHECK(fabsf(regen - (1.0f - (float)i * REGEN_FALL_RATE / RATE)) < 1e-4f);
+    }
+    CHECK(step() == 0.0f);
+}
+
+static void test_stop(void) {
+    setup(30.0f, 52.0f);
+    float start_wh = kinetic_wh();
+    float most_charge = 0.0f;
+    float stop_kmh = 0.0f;
+    REGEN_SetBrake(1);
+    for(uint32_t i = 0; i < 20 * RATE; i++) {
+        float was_kmh = kmh();
+        float regen = step();
+        most_charge = fminf(most_charge, ibatt);
+        CHECK(iq <= 0.0f);
+        if(was_kmh > REGEN_FADE_HIGH_KMH) {
+            // The charge limit comes first, well before the phase limit
+            CHECK(ibatt > -cfg.MaxBatteryRegenCurrent - 0.3f);
+        } else if(was_kmh <= REGEN_FADE_LOW_KMH) {
+            stop_kmh = was_kmh;
+            CHECK(regen == 0.0f);
+        }
+    }
+    // Slows down to the speed where regen fades out, and then rolls on
+    CHECK(stop_kmh > 0.0f);
+    CHECK(kmh() > 0.0f);
+    CHECK(kmh() < REGEN_FADE_LOW_KMH);
+    CHECK(most_charge < -cfg.MaxBatteryRegenCurrent + 0.3f);
+    // The energy count agrees with the battery, and is less than what the
+    // bike had to give
+    float recovered = REGEN_GetRecoveredWh();
+    CHECK(recovered > 0.2f * start_wh);
+    CHECK(recovered < start_wh - kinetic_wh());
+    CHECK(fabsf(recovered - battery_wh) < 0.03f * battery_wh);
+    printf("stop from 30 km/h: %.2fWh recovered of %.2fWh, peak bus %.2fV on a %.1fV battery\n",
+            (double)recovered, (double)start_wh, (double)peak_vbus, 52.0);
+}
+
+static void test_peak_vbus(void) {
+    // Nearly full, on a long 6% descent at 30 km/h. Without the fade, 10A
+    // into 0.3 Ohm would be 3V over the open circuit voltage.
+    float ocv = DFLT_LMT_VOLT_FAULT_MAX - REGEN_VBUS_MARGIN - REGEN_VBUS_FADE;
+    setup(30.0f, ocv);
+    grade = -0.06f;
+    REGEN_SetBrake(1);
+    run_ms(19000);
+    // Held steadily below the fade limit, without giving up on regen.
+    // The bus voltage follows the charge current within a cycle, so this
+    // only settles because the command comes back up slowly after a dip.
+    float lo = vbus;
+    float hi = vbus;
+    for(uint32_t i = 0; i < RATE; i++) {
+        step();
+        lo = fminf(lo, vbus);
+        hi = fmaxf(hi, vbus);
+    }
+    CHECK(hi - lo < 0.05f);
+    CHECK(peak_vbus < DFLT_LMT_VOLT_FAULT_MAX - REGEN_VBUS_MARGIN - 0.5f);
+    CHECK(REGEN_GetCommand() > 0.3f);
+    CHECK(vbus > ocv + 1.0f);
+    CHECK(REGEN_GetRecoveredWh() > 0.0f);
+    // Enough to slow the bike down, even so
+    CHECK(kmh() < 25.0f);
+    printf("20s down 6%% from 30 km/h: %.2fWh recovered, peak bus %.2fV on a %.1fV battery, "
+            "fault at %.1fV\n", (double)REGEN_GetRecoveredWh(), (double)peak_vbus,
+            (double)ocv, (double)DFLT_LMT_VOLT_FAULT_MAX);
+
+    // With a fuller battery, regen fades out completely
+    setup(30.0f, DFLT_LMT_VOLT_FAULT_MAX - REGEN_VBUS_MARGIN + 0.1f);
+    grade = -0.06f;
+    REGEN_SetBrake(1);
+    run_ms(10000);
+    CHECK(REGEN_GetCommand() == 0.0f);
+    CHECK(peak_vbus < DFLT_LMT_VOLT_FAULT_MAX);
+    printf("10s down 6%% on a full battery: %.2fWh recovered, peak bus %.2fV\n",
+            (double)REGEN_GetRecoveredWh(), (double)peak_vbus);
+}
+
+static void test_rolling_back(void) {
+    // Stopped on a 10% hill with the brake lever held. The mechanical
+    // brake isn't modelled, so the bike rolls backwards. Regen there would
+    // be negative torque, driving the wheel backwards even faster.
+    setup(0.0f, 52.0f);
+    grade = 0.10f;
+    REGEN_SetBrake(1);
+    for(uint32_t i = 0; i < 3 * RATE; i++) {
+        step();
+        CHECK(force >= 0.0f);
+        CHECK(REGEN_GetCommand() == 0.0f);
+    }
+    CHECK(speed < 0.0f);
+    CHECK(kmh() > REGEN_FADE_HIGH_KMH);
+    // Free rolling, nothing from the motor
+    CHECK(iq == 0.0f);
+    CHECK(REGEN_GetRecoveredWh() == 0.0f);
+
+    // Rolling forwards again at the same speed, regen is back
+    speed = -speed;
+    grade = 0.0f;
+    run_ms(600);
+    CHECK(REGEN_GetCommand() > 0.999f);
+    CHECK(force < 0.0f);
+}
+
+int main(void) {
+    test_ramps();
+    test_stop();
+    test_peak_vbus();
+    test_rolling_back();
+    return host_summary("test_regen");
+}
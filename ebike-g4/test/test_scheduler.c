@@ -0,0 +1,253 @@
+/******************************************************************************
+ * Filename: test_scheduler.c
+ * Description: Host test of the rate group scheduler. The PWM cycle is
+ *              stepped by hand: each tick runs the current loop, then any
+ *              slower group that SCHED_Tick pended, the way the NVIC would
+ *              once the ADC interrupt returns. Execution times are made up
+ *              by moving the cycle counter.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <string.h>
+#include "../src/scheduler.c"
+
+#define PWM_FREQ            (20000u)
+#define TICK_CYCLES         (170000000u / PWM_FREQ) // 8500
+#define CURRENT_CYCLES      (2000u) // Motor ISR, well inside its 50% budget
+#define SPEED_CYCLES        (5000u) // Speed loop, inside 20% of 85000
+#define HOUSEKEEPING_CYCLES (1000u) // Fits in the same PWM period
+
+// Set by a test to stretch one run of a group
+static uint32_t extra_speed_cycles;
+static uint32_t extra_current_cycles;
+static uint32_t speed_runs;
+static uint32_t housekeeping_runs;
+
+static uint32_t stat(Sched_Group group, uint16_t id) {
+    return SCHED_GetStatistic(id + (group * CONFIG_SCHED_GROUP_OFFSET));
+}
+
+/**
+ * @brief  The ADC interrupt: current loop, then release the slower groups
+ */
+static void current_isr(void) {
+    SCHED_Begin(Sched_Current);
+    host_dwt.CYCCNT += CURRENT_CYCLES + extra_current_cycles;
+    extra_current_cycles = 0;
+    SCHED_End(Sched_Current);
+    SCHED_Tick();
+}
+
+/**
+ * @brief  One PWM period. The current loop runs at its start, then the
+ *         pended groups run in priority order in whatever is left.
+ */
+static void pwm_cycle(void) {
+    uint32_t start = host_dwt.CYCCNT;
+    current_isr();
+    if(NVIC_GetPendingIRQ(SCHED_SPEED_IRQn) != 0) {
+        NVIC_ClearPendingIRQ(SCHED_SPEED_IRQn);
+        SCHED_Begin(Sched_Speed);
+        speed_runs++;
+        host_dwt.CYCCNT += SPEED_CYCLES;
+        // A long run is preempted by the current loop every PWM period
+        while(extra_speed_cycles > 0) {
+            uint32_t step = TICK_CYCLES - (host_dwt.CYCCNT - start);
+            if(step > extra_speed_cycles) {
+                step = extra_speed_cycles;
+            }
+            host_dwt.CYCCNT += step;
+            extra_speed_cycles -= step;
+            if(extra_speed_cycles > 0) {
+                start = host_dwt.CYCCNT;
+                current_isr();
+            }
+        }
+        SCHED_End(Sched_Speed);
+    }
+    if(NVIC_GetPendingIRQ(SCHED_HOUSEKEEPING_IRQn) != 0) {
+        NVIC_ClearPendingIRQ(SCHED_HOUSEKEEPING_IRQn);
+        SCHED_Begin(Sched_Housekeeping);
+        housekeeping_runs++;
+        host_dwt.CYCCNT += HOUSEKEEPING_CYCLES;
+        SCHED_End(Sched_Housekeeping);
+    }
+    // Idle until the next PWM period, unless something ran long
+    if((host_dwt.CYCCNT - start) < TICK_CYCLES) {
+        host_dwt.CYCCNT = start + TICK_CYCLES;
+    }
+}
+
+static void setup(void) {
+    memset(&host_nvic, 0, sizeof(host_nvic));
+    host_dwt.CYCCNT = 0xFFF00000u; // Wraps early on
+    speed_runs = 0;
+    housekeeping_runs = 0;
+    extra_speed_cycles = 0;
+    extra_current_cycles = 0;
+    SCHED_Init(PWM_FREQ);
+}
+
+static void test_rates(void) {
+    setup();
+    CHECK((host_coredebug.DEMCR & CoreDebug_DEMCR_TRCENA_Msk) != 0);
+    CHECK((host_dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk) != 0);
+    CHECK(stat(Sched_Current, CONFIG_SCHED_BUDGET_CYCLES) == TICK_CYCLES / 2);
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_BUDGET_CYCLES) == TICK_CYCLES * 10 / 5);
+    CHECK(stat(Sched_Housekeeping, CONFIG_SCHED_BUDGET_CYCLES) == TICK_CYCLES * 200 / 10);
+
+    // One second: 20kHz, 2kHz and 100Hz
+    for(uint32_t i = 0; i < PWM_FREQ; i++) {
+        pwm_cycle();
+        // Released on the tick that completes each divider
+        if(i == (SCHED_SPEED_DIVIDER - 2)) {
+            CHECK(speed_runs == 0);
+        }
+        if(i == (SCHED_SPEED_DIVIDER - 1)) {
+            CHECK(speed_runs == 1);
+        }
+        if(i == (SCHED_HOUSEKEEPING_DIVIDER - 1)) {
+            CHECK(housekeeping_runs == 1);
+            CHECK(speed_runs == (SCHED_HOUSEKEEPING_DIVIDER / SCHED_SPEED_DIVIDER));
+        }
+    }
+    CHECK(stat(Sched_Current, CONFIG_SCHED_RUNS) == 20000);
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_RUNS) == 2000);
+    CHECK(stat(Sched_Housekeeping, CONFIG_SCHED_RUNS) == 100);
+    CHECK(speed_runs == 2000);
+    CHECK(housekeeping_runs == 100);
+    // Nothing late or long, even across the cycle counter wrap
+    for(uint8_t g = 0; g < Sched_Background; g++) {
+        CHECK(stat(g, CONFIG_SCHED_OVERRUNS) == 0);
+        CHECK(stat(g, CONFIG_SCHED_BUDGET_OVERRUNS) == 0);
+    }
+    CHECK(stat(Sched_Current, CONFIG_SCHED_LAST_CYCLES) == CURRENT_CYCLES);
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_MAX_CYCLES) == SPEED_CYCLES);
+    CHECK(stat(Sched_Housekeeping, CONFIG_SCHED_MAX_CYCLES) == HOUSEKEEPING_CYCLES);
+    // Out of range statistics read as zero
+    CHECK(SCHED_GetStatistic(CONFIG_SCHED_RUNS + (Sched_NumGroups * CONFIG_SCHED_GROUP_OFFSET)) == 0);
+}
+
+static void test_speed_overrun(void) {
+    setup();
+    for(uint32_t i = 0; i < 100; i++) {
+        pwm_cycle();
+    }
+    // The next speed loop run spans two and a half of its periods. The
+    // current loop keeps preempting it, and that time isn't charged to it.
+    for(uint32_t i = 0; i < SCHED_SPEED_DIVIDER - 1; i++) {
+        pwm_cycle();
+    }
+    uint32_t runs = stat(Sched_Speed, CONFIG_SCHED_RUNS);
+    uint32_t own = ((TICK_CYCLES - CURRENT_CYCLES) * SCHED_SPEED_DIVIDER * 5) / 2;
+    extra_speed_cycles = own - SPEED_CYCLES;
+    pwm_cycle();
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_RUNS) == runs + 1);
+    // Released twice while it was still running, and both were skipped
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_OVERRUNS) == 2);
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_BUDGET_OVERRUNS) == 1);
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_LAST_CYCLES) == own);
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_MAX_CYCLES) == own);
+    // The current loop never missed a tick
+    CHECK(stat(Sched_Current, CONFIG_SCHED_OVERRUNS) == 0);
+
+    // Back on schedule, without the skipped runs piling up
+    runs = stat(Sched_Speed, CONFIG_SCHED_RUNS);
+    for(uint32_t i = 0; i < 10 * SCHED_SPEED_DIVIDER; i++) {
+        pwm_cycle();
+    }
+    CHECK((stat(Sched_Speed, CONFIG_SCHED_RUNS) - runs) == 10);
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_OVERRUNS) == 2);
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_LAST_CYCLES) == SPEED_CYCLES);
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_MAX_CYCLES) == own);
+}
+
+static void test_pending_skip(void) {
+    setup();
+    // A release that is still pending, because the group is masked or a
+    // higher priority group is hogging the CPU, isn't pended again
+    for(uint32_t i = 0; i < SCHED_SPEED_DIVIDER; i++) {
+        current_isr();
+        host_dwt.CYCCNT += TICK_CYCLES - CURRENT_CYCLES;
+    }
+    CHECK(NVIC_GetPendingIRQ(SCHED_SPEED_IRQn) != 0);
+    for(uint32_t i = 0; i < SCHED_SPEED_DIVIDER; i++) {
+        current_isr();
+        host_dwt.CYCCNT += TICK_CYCLES - CURRENT_CYCLES;
+    }
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_OVERRUNS) == 1);
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_RUNS) == 0);
+}
+
+static void test_current_late(void) {
+    setup();
+    for(uint32_t i = 0; i < 50; i++) {
+        pwm_cycle();
+    }
+    // One current loop run over its 50% budget, but still finished in time
+    extra_current_cycles = TICK_CYCLES / 2;
+    pwm_cycle();
+    CHECK(stat(Sched_Current, CONFIG_SCHED_BUDGET_OVERRUNS) == 1);
+    CHECK(stat(Sched_Current, CONFIG_SCHED_OVERRUNS) == 0);
+    CHECK(stat(Sched_Current, CONFIG_SCHED_MAX_CYCLES) == CURRENT_CYCLES + (TICK_CYCLES / 2));
+
+    // A missed ADC trigger makes the next start two periods late
+    host_dwt.CYCCNT += TICK_CYCLES;
+    pwm_cycle();
+    CHECK(stat(Sched_Current, CONFIG_SCHED_OVERRUNS) == 1);
+    // One period plus a bit of jitter is fine
+    host_dwt.CYCCNT += TICK_CYCLES / 4;
+    pwm_cycle();
+    CHECK(stat(Sched_Current, CONFIG_SCHED_OVERRUNS) == 1);
+}
+
+static void test_reset_stats(void) {
+    setup();
+    for(uint32_t i = 0; i < 400; i++) {
+        pwm_cycle();
+    }
+    SCHED_ResetStats();
+    CHECK(host_irq_masked == 0);
+    for(uint8_t g = 0; g < Sched_NumGroups; g++) {
+        CHECK(stat(g, CONFIG_SCHED_RUNS) == 0);
+        CHECK(stat(g, CONFIG_SCHED_MAX_CYCLES) == 0);
+    }
+    // The budgets are configuration, not statistics
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_BUDGET_CYCLES) != 0);
+    // Counting carries on from the same point in the dividers
+    for(uint32_t i = 0; i < 200; i++) {
+        pwm_cycle();
+    }
+    CHECK(stat(Sched_Speed, CONFIG_SCHED_RUNS) == 20);
+    CHECK(stat(Sched_Housekeeping, CONFIG_SCHED_RUNS) == 1);
+}
+
+int main(void) {
+    test_rates();
+    test_speed_overrun();
+    test_pending_skip();
+    test_current_late();
+    test_reset_stats();
+    return host_summary("test_scheduler");
+}
@@ -0,0 +1,224 @@
+/******************************************************************************
+ * Filename: test_snapshot.c
+ * Description: Host test of the motor state snapshot. The motor interrupt
+ *              is played by a signal handler, which preempts the reader at
+ *              any instruction the same way the interrupt does on the one
+ *              core, and by the barrier hook, which preempts it at exactly
+ *              the seqlock's barriers. Every copy the reader gets has to
+ *              come from a single publish.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "../src/snapshot.c"
+
+#define INTERRUPT_US    (20) // Signal period standing in for the PWM period
+#define RUN_SECONDS     (1.0)
+
+static Motor_Controls ctrl;
+static Motor_Observations obv;
+static Motor_PWMDuties pwm;
+static FOC_StateVariables foc;
+static Main_Variables mvar = { 0, &ctrl, &obv, &pwm, &foc };
+static volatile uint32_t publishes;
+
+/**
+ * @brief  One motor interrupt. Every field gets the cycle count, so a copy
+ *         that mixes two cycles shows up.
+ */
+static void motor_isr(void) {
+    uint32_t n = ++publishes;
+    float f = (float)n;
+    mvar.Timestamp = n;
+    ctrl.ThrottleCommand = f;
+    ctrl.BusVoltage = f;
+    obv.iA = f;
+    obv.iB = f;
+    obv.iC = f;
+    obv.RotorAngle = n;
+    obv.RotorSpeed_eHz = f;
+    obv.HallState = (uint8_t)n;
+    obv.FetTempDegC = f;
+    obv.MotorTempDegC = f;
+    obv.FaultCode = n;
+    pwm.tA = f;
+    pwm.tB = f;
+    pwm.tC = f;
+    foc.Park_D = f;
+    foc.Park_Q = f;
+    foc.Vd = f;
+    foc.Vq = f;
+    SNAP_Publish(&mvar);
+}
+
+/**
+ * @brief  Count of the fields that aren't from the same cycle as the timestamp
+ */
+static uint32_t torn(const Main_Snapshot* s) {
+    uint32_t n = s->Timestamp;
+    float f = (float)n;
+    const float fields[] = { s->Ctrl.ThrottleCommand, s->Ctrl.BusVoltage,
+            s->Obv.iA, s->Obv.iB, s->Obv.iC, s->Obv.RotorSpeed_eHz,
+            s->Obv.FetTempDegC, s->Obv.MotorTempDegC,
+            s->Pwm.tA, s->Pwm.tB, s->Pwm.tC, s->Park_D, s->Park_Q, s->Vd, s->Vq };
+    uint32_t bad = 0;
+    for(uint32_t i = 0; i < (sizeof(fields) / sizeof(fields[0])); i++) {
+        bad += (fields[i] != f) ? 1 : 0;
+    }
+    bad += (s->Obv.RotorAngle != n) ? 1 : 0;
+    bad += (s->Obv.HallState != (uint8_t)n) ? 1 : 0;
+    bad += (s->Obv.FaultCode != n) ? 1 : 0;
+    return bad;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    motor_isr();
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief  The motor interrupt at each barrier in turn. Publishing between
+ *         reading the sequence and copying, or between copying and checking
+ *         it again, makes the reader go round again and get the new one.
+ */
+static uint32_t preempt_at;
+static uint32_t barriers;
+
+static void barrier_isr(void) {
+    barriers++;
+    if(barriers == preempt_at) {
+        // The interrupt's own barriers don't count
+        host_barrier_hook = NULL;
+        motor_isr();
+        host_barrier_hook = barrier_isr;
+    }
+}
+
+static void test_barriers(void) {
+    Main_Snapshot s;
+    motor_isr();
+    for(preempt_at = 1; preempt_at <= 2; preempt_at++) {
+        uint32_t before = publishes;
+        barriers = 0;
+        host_barrier_hook = barrier_isr;
+        CHECK(SNAP_Get(&s) == (before + 1));
+        host_barrier_hook = NULL;
+        CHECK(s.Timestamp == (before + 1));
+        CHECK(torn(&s) == 0);
+        // Two barriers a try, the first try was wasted
+        CHECK(barriers == 4);
+    }
+    // Not preempted, one try
+    barriers = 0;
+    preempt_at = 0;
+    host_barrier_hook = barrier_isr;
+    CHECK(SNAP_Get(&s) == publishes);
+    host_barrier_hook = NULL;
+    CHECK(barriers == 2);
+}
+
+/**
+ * @brief  Reads as fast as it can while the interrupt publishes. A plain
+ *         copy of the same memory alongside shows how often the reader is
+ *         caught partway, so the test can see a torn copy when there is one.
+ */
+static void test_preempted(void) {
+    struct sigaction sa;
+    struct itimerval timer;
+    Main_Snapshot s, plain;
+    uint32_t reads = 0, bad = 0, plain_bad = 0, last = 0, backwards = 0;
+    uint32_t first = publishes;
+    double end;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGALRM, &sa, NULL);
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = INTERRUPT_US;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+    end = now() + RUN_SECONDS;
+    while(now() < end) {
+        for(uint32_t i = 0; i < 1000; i++) {
+            uint32_t count = SNAP_Get(&s);
+            bad += (torn(&s) != 0) ? 1 : 0;
+            // The count it returns is the publish it copied
+            bad += (count != s.Timestamp) ? 1 : 0;
+            backwards += (count < last) ? 1 : 0;
+            last = count;
+            __asm__ volatile("" ::: "memory");
+            memcpy(&plain, &Msnap, sizeof(plain));
+            plain_bad += (torn(&plain) != 0) ? 1 : 0;
+            reads++;
+        }
+    }
+    timer.it_value.tv_usec = 0;
+    timer.it_interval.tv_usec = 0;
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+    CHECK((publishes - first) > 1000);
+    CHECK(bad == 0);
+    CHECK(backwards == 0);
+    // Otherwise the test proves nothing
+    CHECK(plain_bad > 0);
+    printf("%u reads across %u publishes: %u torn, %u torn without the sequence check\n",
+            reads, publishes - first, bad, plain_bad);
+}
+
+static void test_cost(void) {
+    Main_Snapshot s;
+    uint32_t n = 1000000;
+    double start = now();
+    for(uint32_t i = 0; i < n; i++) {
+        motor_isr();
+    }
+    double publish = (now() - start) / n;
+    start = now();
+    for(uint32_t i = 0; i < n; i++) {
+        SNAP_Get(&s);
+        __asm__ volatile("" ::: "memory");
+    }
+    double get = (now() - start) / n;
+    CHECK(torn(&s) == 0);
+    printf("%u bytes a snapshot, on this PC %.0fns to fill and publish, %.0fns to read\n",
+            (unsigned)sizeof(Main_Snapshot), publish * 1e9, get * 1e9);
+}
+
+int main(void) {
+    test_barriers();
+    test_preempted();
+    test_cost();
+    return host_summary("test_snapshot");
+}
@@ -0,0 +1,400 @@
+/******************************************************************************
+ * Filename: test_speed_control.c
+ * Description: Host test of cruise control and walk assist. The speed loop
+ *              drives a simple bike: mass, rolling resistance, air drag and
+ *              a road grade, with the motor force capped by the battery
+ *              power the way the battery current limiter caps Iq. The
+ *              speed loop is then timed where the scheduler dispatches it,
+ *              next to the current loop's share of the scheduler.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include "../src/foc_lib.c"
+#include "../src/scheduler.c"
+#include "../src/speed_control.c"
+
+void CORDIC_CalcSinCos(Angle_Type theta, float* sin, float* cos) {
+    *sin = sinf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+    *cos = cosf(ANGLE_TO_FLOAT(theta) * 2.0f * (float)M_PI);
+}
+
+#define RATE            (2000) // Speed loop calls per second
+#define DT              (1.0f / (float)RATE)
+
+// Bike and rider
+#define RIDDEN_MASS     (100.0f) // kg, bike and rider
+#define PUSHED_MASS     (30.0f) // kg, just the bike for walk assist
+#define GRAVITY         (9.81f)
+#define ROLLING         (0.008f)
+#define DRAG            (0.35f) // Half of air density * CdA, N per (m/s)^2
+#define FULL_FORCE      (150.0f) // N at the wheel for a torque command of one
+#define BATT_POWER      (600.0f) // W at the wheel the battery limit allows
+
+static Config_Main cfg;
+
+// Bike state, held between calls
+static float mass;
+static float speed; // m/s
+static float grade; // Rise over run
+static float throttle;
+static float command;
+static uint8_t limiting;
+
+static float kmh(void) {
+    return speed * 3.6f;
+}
+
+/**
+ * @brief  One speed loop call and 0.5ms of riding
+ */
+static void step(void) {
+    float ehz = kmh() / (3.6f * PI * cfg.WheelSizeMM * 0.001f
+            / (cfg.GearRatio * (float)cfg.MotorPolePairs));
+    command = SPEED_Process(&cfg, throttle, ehz, limiting);
+    CHECK((command >= 0.0f) && (command <= cfg.throttle_limit_scale));
+    float force = command * FULL_FORCE;
+    // The battery limiter clips the torque, and tells the speed loop so
+    float force_max = BATT_POWER / fmaxf(speed, 1.0f);
+    limiting = (force > force_max) ? 1 : 0;
+    if(limiting != 0) {
+        force = force_max;
+    }
+    float resist = mass * GRAVITY * (ROLLING + grade) + DRAG * speed * speed;
+    speed += (force - resist) / mass * DT;
+    if(speed < 0.0f) {
+        speed = 0.0f; // Rider holds it on the brakes
+    }
+}
+
+static void run_ms(uint32_t ms) {
+    for(uint32_t i = 0; i < ms * RATE / 1000; i++) {
+        step();
+    }
+}
+
+/**
+ * @brief  Runs and tracks the speed range
+ */
+static void run_range(uint32_t ms, float* lo, float* hi) {
+    *lo = kmh();
+    *hi = kmh();
+    for(uint32_t i = 0; i < ms * RATE / 1000; i++) {
+        step();
+        *lo = fminf(*lo, kmh());
+        *hi = fmaxf(*hi, kmh());
+    }
+}
+
+static void setup(void) {
+    cfg.MotorPolePairs = 10;
+    cfg.WheelSizeMM = 660.0f;
+    cfg.GearRatio = 5.0f;
+    cfg.throttle_limit_scale = 1.0f;
+    mass = RIDDEN_MASS;
+    speed = 0.0f;
+    grade = 0.0f;
+    throttle = 0.0f;
+    command = 0.0f;
+    limiting = 0;
+    SPEED_Init();
+}
+
+/**
+ * @brief  Rides up to about 25 km/h on the flat on the throttle and lets
+ *         cruise control take over
+ */
+static void cruise_at_25(void) {
+    setup();
+    throttle = 0.5f;
+    while(kmh() < 25.0f) {
+        step();
+    }
+    // Just enough to hold the speed
+    throttle = 0.165f;
+    run_ms(5000);
+    CHECK(SPEED_EngageCruise() == RETVAL_OK);
+    CHECK(SPEED_GetMode() == Speed_Cruise);
+    CHECK(fabsf(Speed.SetpointKmh - kmh()) < 0.01f);
+    step();
+    // Takes over from the throttle without a jump in torque
+    CHECK(fabsf(command - 0.165f) < 0.01f);
+    throttle = 0.0f;
+}
+
+static void test_conversion(void) {
+    setup();
+    // 660mm wheel, 10 pole pairs, 5:1 gears. 2.073m per wheel turn and
+    // 50 electrical turns per wheel turn.
+    SPEED_Process(&cfg, 0.0f, 100.0f, 0);
+    CHECK(fabsf(SPEED_GetSpeedKmh() - 100.0f / 50.0f * 2.0735f * 3.6f) < 0.01f);
+    CHECK(fabsf(SPEED_KmhPerEHz(&cfg) * 100.0f - SPEED_GetSpeedKmh()) < 1e-4f);
+    // Direct drive hub, 23 pole pairs. 100 electrical Hz is 4.35 wheel
+    // turns a second.
+    cfg.MotorPolePairs = 23;
+    cfg.GearRatio = 1.0f;
+    CHECK(fabsf(SPEED_KmhPerEHz(&cfg) * 100.0f - 100.0f / 23.0f * 2.0735f * 3.6f) < 0.01f);
+    // 700C road wheel, 2.1m around
+    cfg.WheelSizeMM = 668.5f;
+    CHECK(fabsf(SPEED_KmhPerEHz(&cfg) * 100.0f - 100.0f / 23.0f * 2.1002f * 3.6f) < 0.01f);
+    // No gear ratio or pole pairs set yet, no speed
+    cfg.MotorPolePairs = 0;
+    CHECK(SPEED_KmhPerEHz(&cfg) == 0.0f);
+    cfg.MotorPolePairs = 10;
+    cfg.GearRatio = 0.0f;
+    CHECK(SPEED_KmhPerEHz(&cfg) == 0.0f);
+    SPEED_Process(&cfg, 0.0f, 100.0f, 0);
+    CHECK(SPEED_GetSpeedKmh() == 0.0f);
+}
+
+static void test_cruise_engage(void) {
+    setup();
+    // Too slow for cruise
+    throttle = 0.5f;
+    while(kmh() < 7.0f) {
+        step();
+    }
+    CHECK(SPEED_EngageCruise() == RETVAL_FAIL);
+    CHECK(SPEED_GetMode() == Speed_Off);
+
+    cruise_at_25();
+    float lo, hi;
+    run_range(10000, &lo, &hi);
+    CHECK(fabsf(kmh() - Speed.SetpointKmh) < 0.05f);
+    CHECK((hi - lo) < 0.05f);
+
+    // The rider can go faster with the throttle. The loop is pushing the
+    // other way all the while, so its integral runs down to nothing
+    // instead of winding up.
+    throttle = 0.9f;
+    run_ms(5000);
+    CHECK(kmh() > Speed.SetpointKmh + 5.0f);
+    CHECK(command == 0.9f);
+    CHECK(Speed.Loop.Ui < 0.01f);
+    // Letting go, it coasts back down and holds the speed again
+    throttle = 0.0f;
+    run_range(20000, &lo, &hi);
+    CHECK(Speed.SetpointKmh - lo < 1.0f);
+    CHECK(fabsf(kmh() - Speed.SetpointKmh) < 0.05f);
+
+    // Disengaged, the throttle is back in charge
+    SPEED_Disengage();
+    step();
+    CHECK(command == 0.0f);
+}
+
+static void test_cruise_grade(void) {
+    float lo, hi;
+    cruise_at_25();
+    run_ms(5000);
+    float flat = command;
+    // Onto a 4% climb, about 39N more, 0.26 more torque. The speed dips
+    // while the integral catches up, and then it's held.
+    grade = 0.04f;
+    run_range(20000, &lo, &hi);
+    CHECK(Speed.SetpointKmh - lo < 1.5f);
+    CHECK(hi - Speed.SetpointKmh < 0.5f);
+    CHECK(fabsf(kmh() - Speed.SetpointKmh) < 0.05f);
+    CHECK(fabsf(command - flat - (RIDDEN_MASS * GRAVITY * grade / FULL_FORCE)) < 0.01f);
+    // Down a 4% slope cruise can only coast, since braking is left to
+    // the rider. The integral stays at zero rather than going negative.
+    grade = -0.04f;
+    run_range(15000, &lo, &hi);
+    CHECK(command == 0.0f);
+    CHECK(hi > Speed.SetpointKmh + 5.0f);
+    CHECK(fabsf(Speed.Loop.Ui) < 0.001f);
+    // Back on the flat, it picks up as soon as the speed is back down,
+    // without first unwinding all that coasting
+    grade = 0.0f;
+    run_range(25000, &lo, &hi);
+    CHECK(Speed.SetpointKmh - lo < 1.0f);
+    CHECK(fabsf(kmh() - Speed.SetpointKmh) < 0.05f);
+}
+
+static void test_cruise_windup(void) {
+    float lo, hi;
+    cruise_at_25();
+    run_ms(5000);
+    // A climb too steep for the battery. The speed drops off and the
+    // battery limiter clips the torque, and the integral stops growing
+    // from then on.
+    grade = 0.10f;
+    for(uint32_t i = 0; i < 20 * RATE; i++) {
+        float ui = Speed.Loop.Ui;
+        uint8_t was_limiting = limiting;
+        step();
+        if(was_limiting != 0) {
+            CHECK(Speed.Loop.Ui <= ui);
+        }
+    }
+    CHECK(limiting != 0);
+    CHECK(kmh() < Speed.SetpointKmh - 5.0f);
+    CHECK(Speed.Loop.Ui < 0.4f);
+    // Over the top, it comes back to the setpoint with a small overshoot
+    grade = 0.0f;
+    run_range(30000, &lo, &hi);
+    CHECK(hi - Speed.SetpointKmh < 2.0f);
+    CHECK(fabsf(kmh() - Speed.SetpointKmh) < 0.05f);
+
+    // Derated hard. The back calculation keeps the integral at the cap
+    // instead of running off while the output is saturated.
+    cfg.throttle_limit_scale = 0.3f;
+    grade = 0.04f;
+    run_ms(20000);
+    CHECK(command == 0.3f);
+    CHECK(kmh() < Speed.SetpointKmh - 5.0f);
+    CHECK(Speed.Loop.Ui < 0.3f + 0.001f);
+    cfg.throttle_limit_scale = 1.0f;
+    grade = 0.0f;
+    run_range(30000, &lo, &hi);
+    CHECK(hi - Speed.SetpointKmh < 2.0f);
+    CHECK(fabsf(kmh() - Speed.SetpointKmh) < 0.05f);
+}
+
+static void test_walk(void) {
+    float hi = 0.0f;
+    float most = 0.0f;
+    setup();
+    // Pushing the bike up an 8% ramp from standstill, holding the button
+    // down. The assist is refreshed every 100ms.
+    mass = PUSHED_MASS;
+    grade = 0.08f;
+    for(uint32_t t = 0; t < 200; t++) {
+        SPEED_EngageWalk();
+        CHECK(SPEED_GetMode() == Speed_Walk);
+        for(uint32_t i = 0; i < RATE / 10; i++) {
+            step();
+            most = fmaxf(most, command);
+            hi = fmaxf(hi, kmh());
+        }
+    }
+    // Never more than the walk torque, even starting off
+    CHECK(most == SPEED_WALK_MAX_TORQUE);
+    CHECK(hi < SPEED_WALK_KMH + 0.5f);
+    CHECK(fabsf(kmh() - SPEED_WALK_KMH) < 0.05f);
+
+    // Let go of the button. It stops pushing after the timeout.
+    SPEED_EngageWalk();
+    run_ms(499);
+    CHECK(SPEED_GetMode() == Speed_Walk);
+    CHECK(command > 0.0f);
+    run_ms(2);
+    CHECK(SPEED_GetMode() == Speed_Off);
+    CHECK(command == 0.0f);
+
+    // On the flat it won't run away either. The integral only starts to
+    // build once the output comes off the cap, and the little that does
+    // is worth about half a km/h of overshoot.
+    setup();
+    mass = PUSHED_MASS;
+    hi = 0.0f;
+    for(uint32_t t = 0; t < 200; t++) {
+        SPEED_EngageWalk();
+        run_range(100, &most, &hi);
+        CHECK(hi < SPEED_WALK_KMH + 0.6f);
+    }
+    CHECK(fabsf(kmh() - SPEED_WALK_KMH) < 0.05f);
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief  PWM cycles the way the ADC interrupt and the pended speed group
+ *         run them, with the scheduler's own bookkeeping
+ * @param  n - PWM cycles to run
+ * @param  dispatch - Non-zero to run the speed loop when it's released
+ * @param  runs - Speed loop runs
+ * @retval Seconds taken
+ */
+static double run_ticks(uint32_t n, uint8_t dispatch, uint32_t* runs) {
+    float ehz = 0.0f;
+    volatile float sink = 0.0f;
+    *runs = 0;
+    double start = now();
+    for(uint32_t i = 0; i < n; i++) {
+        // The current loop's part. MAIN_MotorISR is the same either way.
+        SCHED_Begin(Sched_Current);
+        SCHED_End(Sched_Current);
+        SCHED_Tick();
+        if(NVIC_GetPendingIRQ(SCHED_SPEED_IRQn) != 0) {
+            NVIC_ClearPendingIRQ(SCHED_SPEED_IRQn);
+            if(dispatch != 0) {
+                SCHED_Begin(Sched_Speed);
+                // Speed moving a little about the setpoint
+                ehz = 80.0f + (float)(i & 0x70) * 0.01f;
+                sink += SPEED_Process(&cfg, 0.0f, ehz, 0);
+                SCHED_End(Sched_Speed);
+                (*runs)++;
+            }
+        }
+        NVIC_ClearPendingIRQ(SCHED_HOUSEKEEPING_IRQn);
+    }
+    (void)sink;
+    return now() - start;
+}
+
+/**
+ * @brief  The speed loop runs in the 2kHz group and nothing of it is in the
+ *         20kHz path. The current loop's scheduler cost is the same with
+ *         cruise running as with the speed loop off.
+ */
+static void test_cost(void) {
+    uint32_t n = 20000000;
+    uint32_t runs;
+    cruise_at_25();
+    memset(&host_nvic, 0, sizeof(host_nvic));
+    SCHED_Init(DFLT_FOC_PWM_FREQ);
+    double tick_only = run_ticks(n, 0, &runs);
+    CHECK(runs == 0);
+    double with_speed = run_ticks(n, 1, &runs);
+    // Once every ten PWM cycles, from the speed group
+    CHECK(runs == (n / SCHED_SPEED_DIVIDER));
+    CHECK(SPEED_GetMode() == Speed_Cruise);
+    CHECK(Sched_Stats[Sched_Current].Runs == (2 * n));
+    CHECK(Sched_Stats[Sched_Speed].Runs == runs);
+    SPEED_Disengage();
+    double tick_off = run_ticks(n, 0, &runs);
+    double speed_run = (with_speed - tick_only) / (double)(n / SCHED_SPEED_DIVIDER);
+    printf("On this PC the 20kHz scheduler path takes %.1fns a PWM cycle with "
+            "cruise on, %.1fns with it off\n", tick_only / n * 1e9, tick_off / n * 1e9);
+    printf("The speed loop in its 2kHz group takes %.1fns a run, %.1fns spread "
+            "over each PWM cycle and none inside the current loop\n",
+            speed_run * 1e9, speed_run / SCHED_SPEED_DIVIDER * 1e9);
+}
+
+int main(void) {
+    test_conversion();
+    test_cruise_engage();
+    test_cruise_grade();
+    test_cruise_windup();
+    test_walk();
+    test_cost();
+    return host_summary("test_speed_control");
+}
@@ -0,0 +1,253 @@
+/******************************************************************************
+ * Filename: test_tasks.c
+ * Description: Host test of the cooperative task executor. Events are
+ *              posted from several sources, some of them from inside a
+ *              running task the way an interrupt would, and time is moved
+ *              on with the cycle counter.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <string.h>
+
+void ELOG_Record(uint8_t type, uint32_t code) {
+}
+
+#include "../src/wdt.c"
+#include "../src/tasks.c"
+
+#define CYCLES_PER_US       (170u)
+#define RUN_CYCLES          (1000u) // Every task takes this long
+#define MAX_ORDER           (64)
+
+// Which task ran, in order
+static uint8_t order[MAX_ORDER];
+static uint8_t order_count;
+// Events a task posts while it runs, like an interrupt arriving mid-pass
+static uint32_t post_during[TASK_MAX_TASKS];
+
+static void record(uint8_t t) {
+    if(order_count < MAX_ORDER) {
+        order[order_count++] = t;
+    }
+    host_dwt.CYCCNT += RUN_CYCLES;
+    if(post_during[t] != 0) {
+        TASK_PostEvent(post_during[t]);
+    }
+}
+
+static void task1(void) { record(1); }
+static void task2(void) { record(2); }
+static void task3(void) { record(3); }
+static void task4(void) { record(4); }
+static void task5(void) { record(5); }
+static void task6(void) { record(6); }
+
+static uint32_t runs(uint8_t t) {
+    return TASK_GetStatistic(CONFIG_TASK_RUNS + (t * CONFIG_TASK_OFFSET));
+}
+
+static uint32_t stat(uint8_t t, uint16_t id) {
+    return TASK_GetStatistic(id + (t * CONFIG_TASK_OFFSET));
+}
+
+static void run(void) {
+    order_count = 0;
+    TASK_Run();
+}
+
+/**
+ * @brief  The executor with the supervisor (task 0) and six tasks:
+ *         one per event, one on two events, and one periodic.
+ */
+static void setup(void) {
+    host_dwt.CYCCNT = 0xFFFF0000u; // Wraps early on
+    memset(post_during, 0, sizeof(post_during));
+    TASK_Init();
+    CHECK(TASK_Register(task1, TASK_EVENT_USB_RX, 0) == 1);
+    CHECK(TASK_Register(task2, TASK_EVENT_FLASH_DONE, 0) == 2);
+    CHECK(TASK_Register(task3, TASK_EVENT_LIVE_READY, 0) == 3);
+    CHECK(TASK_Register(task4, TASK_EVENT_MOTOR_ID, 0) == 4);
+    CHECK(TASK_Register(task5, TASK_EVENT_USB_RX | TASK_EVENT_FLASH_DONE, 0) == 5);
+    CHECK(TASK_Register(task6, 0, 1000) == 6);
+}
+
+static void test_one_pass(void) {
+    setup();
+    // Nothing ready, nothing runs
+    run();
+    CHECK(order_count == 0);
+
+    // Every source posts before the pass. Each ready task runs exactly
+    // once, in registration order.
+    TASK_PostEvent(TASK_EVENT_MOTOR_ID);
+    TASK_PostEvent(TASK_EVENT_LIVE_READY);
+    TASK_PostEvent(TASK_EVENT_FLASH_DONE);
+    TASK_PostEvent(TASK_EVENT_USB_RX);
+    TASK_PostEvent(TASK_EVENT_USB_RX);
+    host_dwt.CYCCNT += 1000 * CYCLES_PER_US;
+    run();
+    CHECK(order_count == 6);
+    for(uint8_t i = 0; i < 6; i++) {
+        CHECK(order[i] == i + 1);
+    }
+    // All taken, so the next pass is empty
+    run();
+    CHECK(order_count == 0);
+    CHECK(runs(5) == 1);
+}
+
+static void test_posted_mid_pass(void) {
+    setup();
+    // The USB task sends a packet and the live data task frees the buffer
+    // again while running. Neither is lost, and neither task gets a second
+    // run in the same pass, so nothing can hog the loop.
+    post_during[1] = TASK_EVENT_USB_RX;
+    post_during[3] = TASK_EVENT_FLASH_DONE;
+    TASK_PostEvent(TASK_EVENT_USB_RX | TASK_EVENT_LIVE_READY);
+    run();
+    CHECK(order_count == 3);
+    CHECK(order[0] == 1);
+    CHECK(order[1] == 3);
+    CHECK(order[2] == 5);
+    post_during[1] = 0;
+    post_during[3] = 0;
+    run();
+    CHECK(order_count == 3);
+    CHECK(order[0] == 1);
+    CHECK(order[1] == 2);
+    CHECK(order[2] == 5);
+    run();
+    CHECK(order_count == 0);
+}
+
+static void test_busy_source(void) {
+    setup();
+    // One source posting on every pass doesn't hold the others off
+    post_during[1] = TASK_EVENT_USB_RX;
+    TASK_PostEvent(TASK_EVENT_USB_RX);
+    run();
+    for(uint32_t pass = 0; pass < 20; pass++) {
+        TASK_PostEvent(TASK_EVENT_MOTOR_ID);
+        run();
+        CHECK(order_count == 3);
+        CHECK(order[1] == 4);
+    }
+    CHECK(runs(1) == 21);
+    CHECK(runs(4) == 20);
+}
+
+static void test_latency(void) {
+    setup();
+    // Measured from the first post, not the latest
+    TASK_PostEvent(TASK_EVENT_FLASH_DONE);
+    host_dwt.CYCCNT += 300 * CYCLES_PER_US;
+    TASK_PostEvent(TASK_EVENT_FLASH_DONE);
+    host_dwt.CYCCNT += 200 * CYCLES_PER_US;
+    run();
+    CHECK(stat(2, CONFIG_TASK_LAST_LATENCY) == 500 * CYCLES_PER_US);
+    // The task behind it waited for the one in front as well
+    CHECK(stat(5, CONFIG_TASK_LAST_LATENCY) == (500 * CYCLES_PER_US) + RUN_CYCLES);
+    CHECK(stat(2, CONFIG_TASK_MAX_RUN_CYCLES) == RUN_CYCLES);
+
+    // A task on two events counts from the older one
+    TASK_PostEvent(TASK_EVENT_USB_RX);
+    host_dwt.CYCCNT += 100 * CYCLES_PER_US;
+    TASK_PostEvent(TASK_EVENT_FLASH_DONE);
+    run();
+    CHECK(stat(1, CONFIG_TASK_LAST_LATENCY) == 100 * CYCLES_PER_US);
+    CHECK(stat(5, CONFIG_TASK_LAST_LATENCY) == (100 * CYCLES_PER_US) + (2 * RUN_CYCLES));
+    // The worst case is kept
+    CHECK(stat(2, CONFIG_TASK_MAX_LATENCY) == 500 * CYCLES_PER_US);
+    CHECK(stat(2, CONFIG_TASK_LAST_LATENCY) == RUN_CYCLES);
+
+    // A waiting event past the deadline makes the task late for this
+    // supervisor pass, so it doesn't echo the token
+    TASK_PostEvent(TASK_EVENT_MOTOR_ID);
+    host_dwt.CYCCNT += (TASK_EVENT_DEADLINE_US + 1) * CYCLES_PER_US;
+    run();
+    CHECK(Tasks[4].Echo != Wdt_Token);
+    CHECK(Tasks[1].Echo == Wdt_Token);
+
+    TASK_ResetStats();
+    CHECK(stat(2, CONFIG_TASK_MAX_LATENCY) == 0);
+    CHECK(runs(1) == 0);
+}
+
+static void test_periodic(void) {
+    setup();
+    host_dwt.CYCCNT += 999 * CYCLES_PER_US;
+    run();
+    CHECK(runs(6) == 0);
+    host_dwt.CYCCNT += 1 * CYCLES_PER_US;
+    run();
+    CHECK(runs(6) == 1);
+    CHECK(stat(6, CONFIG_TASK_LAST_LATENCY) == 0);
+    // Half a period late is a latency, not a missed run
+    host_dwt.CYCCNT += 1500 * CYCLES_PER_US - RUN_CYCLES;
+    run();
+    CHECK(runs(6) == 2);
+    CHECK(stat(6, CONFIG_TASK_LAST_LATENCY) == 500 * CYCLES_PER_US);
+    // Held up for several periods, it runs once and doesn't try to catch up
+    host_dwt.CYCCNT += 5000 * CYCLES_PER_US;
+    run();
+    run();
+    run();
+    CHECK(runs(6) == 3);
+    host_dwt.CYCCNT += 1000 * CYCLES_PER_US;
+    run();
+    CHECK(runs(6) == 4);
+}
+
+static void test_registration(void) {
+    setup();
+    // The supervisor and six tasks so far. Fill the rest of the table.
+    for(uint8_t t = 7; t < TASK_MAX_TASKS; t++) {
+        CHECK(TASK_Register(task1, TASK_EVENT_USB_RX, 0) == t);
+    }
+    CHECK(TASK_Register(task2, TASK_EVENT_FLASH_DONE, 0) == TASK_INVALID);
+    CHECK(TASK_Register(task2, 0, 1000) == TASK_INVALID);
+    CHECK(Task_Count == TASK_MAX_TASKS);
+    // The lost task never runs
+    TASK_PostEvent(TASK_EVENT_FLASH_DONE);
+    run();
+    CHECK(order_count == 2);
+
+    // No function is as bad as no room
+    setup();
+    CHECK(TASK_Register(0, TASK_EVENT_USB_RX, 0) == TASK_INVALID);
+    CHECK(Task_Count == 7);
+    // Statistics for a task that doesn't exist read as zero
+    CHECK(runs(7) == 0);
+    CHECK(runs(TASK_INVALID) == 0);
+}
+
+int main(void) {
+    test_one_pass();
+    test_posted_mid_pass();
+    test_busy_source();
+    test_latency();
+    test_periodic();
+    test_registration();
+    return host_summary("test_tasks");
+}
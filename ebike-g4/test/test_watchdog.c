@@ -0,0 +1,255 @@
+/******************************************************************************
+ * Filename: test_watchdog.c
+ * Description: Host test of the watchdog supervisor. Runs the task
+ *              executor against a fake cycle counter, with the interrupts
+ *              checking in (or not) each millisecond, and counts the
+ *              feeds. Then checks what gets blamed after a reset.
+ ******************************************************************************
+
+ Copyright (c) 2020 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "host.h"
+#include <string.h>
+
+static uint32_t elog_type;
+static uint32_t elog_code;
+static uint32_t elog_count;
+
+void ELOG_Record(uint8_t type, uint32_t code) {
+    elog_type = type;
+    elog_code = code;
+    elog_count++;
+}
+
+#include "../src/wdt.c"
+#include "../src/tasks.c"
+
+#define CYCLES_PER_MS       (170000u)
+#define MOTOR_PER_MS        (20) // 20kHz
+#define HOUSEKEEPING_MS     (10) // 100Hz
+#define RUN_MOTOR           (1u << Wdt_MotorISR)
+#define RUN_SPEED           (1u << Wdt_SpeedISR)
+#define RUN_HOUSEKEEPING    (1u << Wdt_HousekeepingISR)
+#define RUN_ALL             (RUN_MOTOR | RUN_SPEED | RUN_HOUSEKEEPING)
+#define TASK_EVENTS         (1) // Task numbers, after the supervisor
+#define TASK_PERIODIC       (2)
+
+static uint32_t now_ms;
+static uint32_t feeds;
+static uint32_t runs[3];
+
+static void event_task(void) {
+    runs[TASK_EVENTS]++;
+}
+
+static void periodic_task(void) {
+    runs[TASK_PERIODIC]++;
+}
+
+static void elapse(uint32_t ms) {
+    host_dwt.CYCCNT += ms * CYCLES_PER_MS;
+    now_ms += ms;
+}
+
+/**
+ * @brief  Runs the main loop once a millisecond, with the interrupts in
+ *         sources checking in first
+ */
+static void run_for(uint32_t ms, uint32_t sources) {
+    for(uint32_t i = 0; i < ms; i++) {
+        elapse(1);
+        if((sources & RUN_MOTOR) != 0) {
+            for(uint8_t n = 0; n < MOTOR_PER_MS; n++) {
+                WDT_CheckIn(Wdt_MotorISR);
+                WDT_CheckOut(Wdt_MotorISR);
+            }
+        }
+        if((sources & RUN_SPEED) != 0) {
+            WDT_CheckIn(Wdt_SpeedISR);
+            WDT_CheckOut(Wdt_SpeedISR);
+        }
+        if(((sources & RUN_HOUSEKEEPING) != 0) && ((now_ms % HOUSEKEEPING_MS) == 0)) {
+            WDT_CheckIn(Wdt_HousekeepingISR);
+            WDT_RefreshWindow();
+            WDT_CheckOut(Wdt_HousekeepingISR);
+        }
+        TASK_Run();
+        if(host_iwdg.KR == IWDG_RELOAD) {
+            feeds++;
+            host_iwdg.KR = 0;
+        }
+    }
+}
+
+/**
+ * @brief  A power on reset, then startup in the same order as main
+ */
+static void setup(void) {
+    memset((void*)&Wdt_Crumbs, 0, sizeof(Wdt_Crumbs));
+    host_rcc.CSR = 0;
+    elog_count = 0;
+    WDT_CheckLastReset();
+    TASK_Init();
+    CHECK(TASK_Register(event_task, TASK_EVENT_USB_RX, 0) == TASK_EVENTS);
+    CHECK(TASK_Register(periodic_task, 0, 1000) == TASK_PERIODIC);
+    WDT_Init();
+    CHECK(elog_count == 0);
+    now_ms = 0;
+    feeds = 0;
+    memset(runs, 0, sizeof(runs));
+}
+
+/**
+ * @brief  A watchdog reset, then the startup checks again
+ */
+static void watchdog_reset(void) {
+    host_rcc.CSR = RCC_CSR_IWDGRSTF;
+    elog_count = 0;
+    WDT_CheckLastReset();
+    WDT_Init();
+}
+
+static void test_healthy(void) {
+    setup();
+    run_for(100, RUN_ALL);
+    CHECK(feeds == 10);
+    CHECK(runs[TASK_PERIODIC] == 100);
+    CHECK(runs[TASK_EVENTS] == 0);
+    CHECK(WDT_GetStatistic(CONFIG_WDT_STATUS_MISSES) == 0);
+    CHECK(Wdt_Crumbs.Miss == WDT_MISS_NONE);
+    CHECK(host_wwdg.CR == (WWDG_CR_WDGA | WWDG_RELOAD));
+
+    TASK_PostEvent(TASK_EVENT_USB_RX);
+    run_for(1, RUN_ALL);
+    CHECK(runs[TASK_EVENTS] == 1);
+    run_for(1, RUN_ALL);
+    CHECK(runs[TASK_EVENTS] == 1);
+}
+
+static void test_motor_stops(void) {
+    setup();
+    run_for(20, RUN_ALL);
+    feeds = 0;
+    uint32_t misses = WDT_GetStatistic(CONFIG_WDT_STATUS_MISSES);
+    // Missed on the very next pass
+    run_for(30, RUN_ALL & ~RUN_MOTOR);
+    CHECK(feeds == 0);
+    CHECK(WDT_GetStatistic(CONFIG_WDT_STATUS_MISSES) == (misses + 3));
+    CHECK(Wdt_Crumbs.Miss == (WDT_MISS_SOURCE + Wdt_MotorISR));
+    // And back once it's running again
+    run_for(20, RUN_ALL);
+    CHECK(feeds == 2);
+    CHECK(Wdt_Crumbs.Miss == WDT_MISS_NONE);
+
+    // The supervisor recorded it, so that's what gets the blame
+    run_for(10, RUN_ALL & ~RUN_MOTOR);
+    watchdog_reset();
+    CHECK(WDT_GetStatistic(CONFIG_WDT_STATUS_LAST_RESET) == (WDT_MISS_SOURCE + Wdt_MotorISR));
+    CHECK(elog_count == 1);
+    CHECK(elog_type == ELOG_EVENT_WATCHDOG);
+    CHECK(elog_code == (WDT_MISS_SOURCE + Wdt_MotorISR));
+}
+
+static void test_housekeeping_deadline(void) {
+    setup();
+    run_for(20, RUN_ALL);
+    feeds = 0;
+    // Housekeeping gets three passes
+    run_for(50, RUN_ALL & ~RUN_HOUSEKEEPING);
+    CHECK(feeds == 2);
+    CHECK(Wdt_Crumbs.Miss == (WDT_MISS_SOURCE + Wdt_HousekeepingISR));
+}
+
+static void test_late_task(void) {
+    setup();
+    run_for(25, RUN_ALL);
+    feeds = 0;
+    uint32_t misses = WDT_GetStatistic(CONFIG_WDT_STATUS_MISSES);
+    // The loop is held up for a few periods, after the periodic task
+    // already checked in this pass
+    elapse(3);
+    run_for(45, RUN_ALL);
+    // Only the one feed is held back, out of five passes
+    CHECK(feeds == 4);
+    CHECK(WDT_GetStatistic(CONFIG_WDT_STATUS_MISSES) == (misses + 1));
+    CHECK(TASK_GetStatistic(CONFIG_TASK_MISSED_CHECKINS
+            + (TASK_PERIODIC * CONFIG_TASK_OFFSET)) == 1);
+    CHECK(TASK_GetStatistic(CONFIG_TASK_MISSED_CHECKINS
+            + (TASK_EVENTS * CONFIG_TASK_OFFSET)) == 0);
+}
+
+static void test_reset_blame(void) {
+    // Nothing to blame after a power on reset
+    setup();
+    CHECK(WDT_GetStatistic(CONFIG_WDT_STATUS_LAST_RESET) == WDT_MISS_NONE);
+    // Or with RAM that was never set up
+    Wdt_Crumbs.Magic = 0;
+    Wdt_Crumbs.Miss = WDT_MISS_SOURCE;
+    watchdog_reset();
+    CHECK(WDT_GetStatistic(CONFIG_WDT_STATUS_LAST_RESET) == WDT_MISS_NONE);
+    CHECK(elog_count == 0);
+
+    // A task that never finished, with the motor interrupt still going
+    setup();
+    run_for(20, RUN_ALL);
+    WDT_TaskStart(TASK_PERIODIC);
+    for(uint32_t n = 0; n <= WDT_STUCK_TASK; n++) {
+        WDT_CheckIn(Wdt_MotorISR);
+        WDT_CheckOut(Wdt_MotorISR);
+    }
+    watchdog_reset();
+    CHECK(WDT_GetStatistic(CONFIG_WDT_STATUS_LAST_RESET) == (WDT_MISS_TASK + TASK_PERIODIC));
+    CHECK(elog_code == (WDT_MISS_TASK + TASK_PERIODIC));
+
+    // The speed loop interrupt stuck, which blocks the task too
+    setup();
+    run_for(20, RUN_ALL);
+    WDT_TaskStart(TASK_PERIODIC);
+    WDT_CheckIn(Wdt_SpeedISR);
+    for(uint32_t n = 0; n <= WDT_STUCK_TASK; n++) {
+        WDT_CheckIn(Wdt_MotorISR);
+        WDT_CheckOut(Wdt_MotorISR);
+    }
+    watchdog_reset();
+    CHECK(WDT_GetStatistic(CONFIG_WDT_STATUS_LAST_RESET) == (WDT_MISS_SOURCE + Wdt_SpeedISR));
+
+    // The motor interrupt stuck, so the tick stops too
+    setup();
+    run_for(20, RUN_ALL);
+    WDT_CheckIn(Wdt_MotorISR);
+    watchdog_reset();
+    CHECK(WDT_GetStatistic(CONFIG_WDT_STATUS_LAST_RESET) == (WDT_MISS_SOURCE + Wdt_MotorISR));
+
+    // The breadcrumbs start over after every reset
+    CHECK(Wdt_Crumbs.Magic == WDT_MISS_MAGIC);
+    CHECK(Wdt_Crumbs.Task == WDT_MISS_NONE);
+    CHECK(Wdt_Crumbs.Entered[Wdt_MotorISR] == WDT_NOT_RUNNING);
+}
+
+int main(void) {
+    test_healthy();
+    test_motor_stops();
+    test_housekeeping_deadline();
+    test_late_task();
+    test_reset_blame();
+    return host_summary("test_watchdog");
+}
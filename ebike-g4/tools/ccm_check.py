@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+###############################################################################
+# Filename: ccm_check.py
+# Description: Checks the CCMRAM code in a linked image. Prints how much of
+#              the code budget is used, and every call from CCMRAM code
+#              back out to Flash, which goes through a linker veneer and
+#              pays the Flash wait states the move was meant to avoid.
+#              Exits with an error if there are any, or if the budget is
+#              blown, so it can run as a post-build step:
+#                  python3 ../tools/ccm_check.py ebike-g4.elf
+###############################################################################
+#
+# Copyright (c) 2020 David Miller
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import re
+import subprocess
+import sys
+
+CCMRAM_START = 0x10000000
+CCMRAM_END = 0x10008000
+CODE_BUDGET = 16 * 1024 # Same as the ASSERT in sections.ld
+SECTION = '.ramfunc_CCMRAM'
+
+# Functions that are allowed to stay in Flash. They're only called on the
+# way out of a fault, while the motor isn't being driven, or never in
+# practice.
+ALLOWED = {
+    'ELOG_Record', # Logging a new fault, after the outputs are off
+    'MOTID_Process', # Only while identifying the motor
+    'sqrtf', # vsqrt is inline, the call only sets errno for a negative input
+}
+
+# Function start: "10000120 <MAIN_MotorISR>:"
+FUNC_RE = re.compile(r'^([0-9a-f]+) <([^>]+)>:$')
+# Branch with link, or a tail call: "bl 10000abc <FOO_veneer>"
+CALL_RE = re.compile(r'\s(bl|blx|b\.w|b)\s+([0-9a-f]+)\s+<([^>+]+)(\+0x[0-9a-f]+)?>')
+
+
+def section_size(elf, tool_prefix):
+    out = subprocess.run([tool_prefix + 'size', '-A', elf], check=True,
+                         capture_output=True, text=True).stdout
+    for line in out.splitlines():
+        fields = line.split()
+        if (len(fields) >= 2) and (fields[0] == SECTION):
+            return int(fields[1])
+    return 0
+
+
+def flash_calls(elf, tool_prefix):
+    out = subprocess.run([tool_prefix + 'objdump', '-d', '-j', SECTION, elf],
+                         check=True, capture_output=True, text=True).stdout
+    calls = []
+    caller = None
+    for line in out.splitlines():
+        m = FUNC_RE.match(line)
+        if m:
+            caller = m.group(2)
+            continue
+        m = CALL_RE.search(line)
+        if (m is None) or (caller is None) or caller.endswith('_veneer'):
+            continue
+        target = int(m.group(2), 16)
+        name = m.group(3)
+        # Long calls out of CCMRAM land on a veneer next to the caller
+        if name.endswith('_veneer'):
+            name = name[:-len('_veneer')].lstrip('_')
+        elif CCMRAM_START <= target < CCMRAM_END:
+            continue
+        if name not in ALLOWED:
+            calls.append((caller, name))
+    return sorted(set(calls))
+
+
+def main():
+    if len(sys.argv) < 2:
+        print('Usage: ccm_check.py <elf> [tool prefix, default arm-none-eabi-]')
+        return 2
+    elf = sys.argv[1]
+    tool_prefix = sys.argv[2] if len(sys.argv) > 2 else 'arm-none-eabi-'
+
+    size = section_size(elf, tool_prefix)
+    print('CCMRAM code: %d of %d bytes (%d%%)' % (size, CODE_BUDGET, (100 * size) // CODE_BUDGET))
+    calls = flash_calls(elf, tool_prefix)
+    for caller, callee in calls:
+        print('  %s calls %s in Flash' % (caller, callee))
+
+    if size > CODE_BUDGET:
+        print('Over budget')
+        return 1
+    if calls:
+        print('%d calls from CCMRAM to Flash' % len(calls))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
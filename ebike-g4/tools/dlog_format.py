@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+###############################################################################
+# Filename: dlog_format.py
+# Description: Host side of the deferred logger (deferred_log.c). Reads the
+#              format strings out of the .dlog_fmt section of the ELF file,
+#              then decodes downloaded records and prints the messages.
+#
+#              The input is the data from LOG_RESULT packets, one packet
+#              per line as hex, the dropped count first:
+#                  python3 tools/dlog_format.py ebike-g4.elf log.txt
+#              With no log file, it lists the strings and their IDs.
+###############################################################################
+#
+# Copyright (c) 2020 David Miller
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import re
+import struct
+import sys
+
+CPU_CLOCK_HZ = 170000000 # DWT cycle counter rate
+
+# Same as deferred_log.h
+DLOG_HEADER_VALID = 0x80
+DLOG_HEADER_NARGS_MASK = 0x0F
+DLOG_HEADER_ID_SHIFT = 8
+DLOG_DOWNLOAD_HEADER_BYTES = 4
+
+# printf conversions, and what each argument word has to be turned into
+SPEC_RE = re.compile(r'%[-+ #0]*\d*(?:\.\d+)?(?:hh|h|ll|l|z|j|t)?([diouxXeEfgGcp%])')
+
+
+def read_strings(elf_path):
+    """Returns {ID: format string} from the .dlog_fmt section."""
+    with open(elf_path, 'rb') as f:
+        elf = f.read()
+    if elf[:4] != b'\x7fELF' or elf[4] != 1 or elf[5] != 1:
+        raise ValueError('%s is not a little endian 32-bit ELF file' % elf_path)
+    shoff, = struct.unpack_from('<I', elf, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from('<HHH', elf, 0x2E)
+
+    def section(i):
+        # name, type, flags, addr, offset, size
+        return struct.unpack_from('<IIIIII', elf, shoff + i * shentsize)
+
+    names_offset = section(shstrndx)[4]
+    for i in range(shnum):
+        name, _, _, addr, offset, size = section(i)
+        end = elf.index(b'\0', names_offset + name)
+        if elf[names_offset + name:end] != b'.dlog_fmt':
+            continue
+        # The section is linked at address 0, so an ID is an offset into it
+        strings = {}
+        data = elf[offset:offset + size]
+        pos = 0
+        while pos < len(data):
+            end = data.find(b'\0', pos)
+            if end < 0:
+                end = len(data)
+            if end > pos:
+                strings[addr + pos] = data[pos:end].decode('ascii', 'replace')
+            pos = end + 1
+        return strings
+    raise ValueError('%s has no .dlog_fmt section' % elf_path)
+
+
+def format_message(fmt, args):
+    """Formats one message, converting each raw word for its conversion."""
+    values = []
+    specs = [m.group(1) for m in SPEC_RE.finditer(fmt) if m.group(1) != '%']
+    for spec, word in zip(specs, args):
+        if spec in 'eEfgG':
+            values.append(struct.unpack('<f', struct.pack('<I', word))[0])
+        elif spec in 'di':
+            values.append(word - (1 << 32) if word & 0x80000000 else word)
+        elif spec == 'c':
+            values.append(chr(word & 0xFF))
+        else:
+            values.append(word)
+    if len(values) != len(specs):
+        return fmt + ' (missing arguments)'
+    # Python takes the same conversions, but not the C length modifiers
+    py_fmt = SPEC_RE.sub(lambda m: re.sub(r'(hh|h|ll|l|z|j|t)(?=.$)', '', m.group(0))
+                         .replace('p', 'x'), fmt)
+    return py_fmt % tuple(values)
+
+
+def decode_packet(payload, strings):
+    """Yields (cycles, message) for each record in one download packet."""
+    if len(payload) < DLOG_DOWNLOAD_HEADER_BYTES:
+        return
+    # Packed big endian, like everything else on the data interface
+    dropped, = struct.unpack_from('>I', payload, 0)
+    if dropped != 0:
+        yield None, '%d records dropped, the ring was full' % dropped
+    words = [struct.unpack_from('>I', payload, i)[0]
+             for i in range(DLOG_DOWNLOAD_HEADER_BYTES, len(payload) - 3, 4)]
+    i = 0
+    while i + 1 < len(words):
+        header = words[i]
+        if (header & DLOG_HEADER_VALID) == 0:
+            yield None, 'Bad record header 0x%08x, skipping the rest of the packet' % header
+            return
+        nargs = header & DLOG_HEADER_NARGS_MASK
+        string_id = header >> DLOG_HEADER_ID_SHIFT
+        cycles = words[i + 1]
+        args = words[i + 2:i + 2 + nargs]
+        fmt = strings.get(string_id)
+        if fmt is None:
+            yield cycles, 'Unknown string ID 0x%06x, args %s' % (
+                string_id, ' '.join('0x%08x' % a for a in args))
+        else:
+            yield cycles, format_message(fmt, args)
+        i += 2 + nargs
+
+
+def main():
+    if len(sys.argv) < 2:
+        print('Usage: dlog_format.py <elf> [log file, hex, one packet per line]')
+        return 2
+    strings = read_strings(sys.argv[1])
+    if len(sys.argv) < 3:
+        for string_id in sorted(strings):
+            print('0x%06x  %s' % (string_id, strings[string_id]))
+        return 0
+
+    last = None
+    elapsed = 0
+    with open(sys.argv[2]) as f:
+        for line in f:
+            line = line.strip().replace(' ', '')
+            if not line:
+                continue
+            for cycles, message in decode_packet(bytes.fromhex(line), strings):
+                if cycles is None:
+                    print('%14s  %s' % ('', message))
+                    continue
+                # The cycle counter wraps every 25 seconds
+                if last is not None:
+                    elapsed += (cycles - last) & 0xFFFFFFFF
+                last = cycles
+                print('%12.6fs  %s' % (elapsed / CPU_CLOCK_HZ, message))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())